@@ -0,0 +1,318 @@
+/**
+ * rtd_analytics.c - Incremental per-symbol analytics
+ *
+ * Rolling windows keep a running sum beside a ring of its terms: each new
+ * term replaces the oldest in O(1). Subtracting old terms lets rounding
+ * error creep in, so the sum is recomputed from the ring each time the
+ * ring wraps, which is O(1) amortized.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtd_analytics.h"
+
+// Dirty symbols whose state is prefetched ahead of the one being updated
+#define ANALYTICS_PREFETCH 8
+
+#define ANALYTIC_NAME(name) #name,
+static const char *fieldNames[ANALYTIC_FIELD_COUNT] = {
+    ANALYTIC_FIELDS(ANALYTIC_NAME)
+};
+#undef ANALYTIC_NAME
+
+static const ULONG fieldInputs[ANALYTIC_FIELD_COUNT] = {
+    (1u << QF_LAST) | (1u << QF_VOLUME),    // VWAP
+    1u << QF_LAST,                          // EMA_FAST
+    1u << QF_LAST,                          // EMA_SLOW
+    (1u << QF_BID) | (1u << QF_ASK),        // MID
+    (1u << QF_BID) | (1u << QF_ASK),        // SPREAD
+    1u << QF_LAST,                          // RVOL
+    (1u << QF_LAST) | (1u << QF_VOLUME),    // TRADE_SIZE
+};
+
+BOOL Analytics_Init(Analytics *a, const AnalyticsConfig *cfg, const QuoteStore *quotes)
+{
+    memset(a, 0, sizeof *a);
+    a->cfg = *cfg;
+    if (a->cfg.vwapWindow < 0) a->cfg.vwapWindow = 0;
+    if (a->cfg.emaFast <= 0) a->cfg.emaFast = ANALYTICS_DEFAULT_EMA_FAST;
+    if (a->cfg.emaSlow <= 0) a->cfg.emaSlow = ANALYTICS_DEFAULT_EMA_SLOW;
+    if (a->cfg.volWindow <= 0) a->cfg.volWindow = ANALYTICS_DEFAULT_VOL_WINDOW;
+    a->alphaFast = 2.0 / (a->cfg.emaFast + 1);
+    a->alphaSlow = 2.0 / (a->cfg.emaSlow + 1);
+    a->quotes = quotes;
+    return TRUE;
+}
+
+void Analytics_Free(Analytics *a)
+{
+    for (long i = 0; i < a->symbolCap; i++) free(a->symbols[i]);
+    free(a->symbols);
+    free(a->flags);
+    free(a->dirty);
+    memset(a, 0, sizeof *a);
+}
+
+int AnalyticField_FromName(const WCHAR *topic)
+{
+    for (int f = 0; f < ANALYTIC_FIELD_COUNT; f++) {
+        const char *name = fieldNames[f];
+        const WCHAR *t = topic;
+        while (*name && (WCHAR)*name == *t) {
+            name++;
+            t++;
+        }
+        if (!*name && !*t) return f;
+    }
+    return AF_NONE;
+}
+
+const char* AnalyticField_Name(int field)
+{
+    return field >= 0 && field < ANALYTIC_FIELD_COUNT ? fieldNames[field] : "?";
+}
+
+ULONG AnalyticField_Inputs(int field)
+{
+    return field >= 0 && field < ANALYTIC_FIELD_COUNT ? fieldInputs[field] : 0;
+}
+
+BOOL AnalyticField_IsDerived(const WCHAR *topic)
+{
+    return AnalyticField_FromName(topic) != AF_NONE;
+}
+
+static BOOL GrowSymbols(Analytics *a, long minCap)
+{
+    long newCap = a->symbolCap ? a->symbolCap * 2 : 1024;
+    while (newCap < minCap) newCap *= 2;
+
+    AnalyticsSymbol **symbols = (AnalyticsSymbol**)realloc(a->symbols, newCap * sizeof *symbols);
+    if (!symbols) return FALSE;
+    memset(symbols + a->symbolCap, 0, (newCap - a->symbolCap) * sizeof *symbols);
+    a->symbols = symbols;
+
+    BYTE *flags = (BYTE*)realloc(a->flags, newCap);
+    if (!flags) return FALSE;
+    memset(flags + a->symbolCap, 0, newCap - a->symbolCap);
+    a->flags = flags;
+
+    // Each symbol is queued at most once per batch
+    long *dirty = (long*)realloc(a->dirty, newCap * sizeof *dirty);
+    if (!dirty) return FALSE;
+    a->dirty = dirty;
+    a->symbolCap = newCap;
+    return TRUE;
+}
+
+/**
+ * Symbol state with its ring buffers in the same block
+ */
+static AnalyticsSymbol* NewSymbol(const Analytics *a)
+{
+    size_t ringDoubles = 2 * (size_t)a->cfg.vwapWindow + (size_t)a->cfg.volWindow;
+    AnalyticsSymbol *s = (AnalyticsSymbol*)calloc(1, sizeof *s + ringDoubles * sizeof(double));
+    if (!s) return NULL;
+    double *ring = (double*)(s + 1);
+    if (a->cfg.vwapWindow > 0) {
+        s->pv = ring;
+        s->v = ring + a->cfg.vwapWindow;
+    }
+    s->r2 = ring + 2 * a->cfg.vwapWindow;
+    return s;
+}
+
+BOOL Analytics_Track(Analytics *a, const TopicSubscription *sub)
+{
+    int field = AnalyticField_FromName(sub->topic);
+    if (field == AF_NONE) return TRUE;
+    if (sub->symbolID >= a->symbolCap && !GrowSymbols(a, sub->symbolID + 1)) return FALSE;
+
+    AnalyticsSymbol *s = a->symbols[sub->symbolID];
+    if (!s) {
+        s = NewSymbol(a);
+        if (!s) return FALSE;
+        a->symbols[sub->symbolID] = s;
+        a->flags[sub->symbolID] = ANALYTICS_TRACKED;
+    }
+    s->topicID[field] = sub->topicID;
+    s->hasOut[field] = FALSE;
+    return TRUE;
+}
+
+void Analytics_Untrack(Analytics *a, const TopicSubscription *sub)
+{
+    int field = AnalyticField_FromName(sub->topic);
+    if (field == AF_NONE || sub->symbolID >= a->symbolCap) return;
+    AnalyticsSymbol *s = a->symbols[sub->symbolID];
+    if (!s || s->topicID[field] != sub->topicID) return;
+
+    s->topicID[field] = 0;
+    for (int f = 0; f < ANALYTIC_FIELD_COUNT; f++) {
+        if (s->topicID[f]) return;
+    }
+    // A stale entry may remain in the dirty list; EndBatch skips it
+    free(s);
+    a->symbols[sub->symbolID] = NULL;
+    a->flags[sub->symbolID] = 0;
+}
+
+/**
+ * Add a trade to the VWAP, dropping the oldest once the window is full
+ */
+static void AddTrade(const Analytics *a, AnalyticsSymbol *s, double price, double size)
+{
+    long window = a->cfg.vwapWindow;
+    double pv = price * size;
+    if (window == 0) {
+        s->pvSum += pv;
+        s->vSum += size;
+        return;
+    }
+
+    if (s->vwapCount == window) {
+        s->pvSum -= s->pv[s->vwapPos];
+        s->vSum -= s->v[s->vwapPos];
+    } else {
+        s->vwapCount++;
+    }
+    s->pv[s->vwapPos] = pv;
+    s->v[s->vwapPos] = size;
+    s->pvSum += pv;
+    s->vSum += size;
+    if (++s->vwapPos == window) {
+        s->vwapPos = 0;
+        s->pvSum = s->vSum = 0;
+        for (long i = 0; i < window; i++) {
+            s->pvSum += s->pv[i];
+            s->vSum += s->v[i];
+        }
+    }
+}
+
+static void AddReturn(const Analytics *a, AnalyticsSymbol *s, double r)
+{
+    long window = a->cfg.volWindow;
+    double r2 = r * r;
+    if (s->volCount == window) s->r2Sum -= s->r2[s->volPos];
+    else s->volCount++;
+    s->r2[s->volPos] = r2;
+    s->r2Sum += r2;
+    if (++s->volPos == window) {
+        s->volPos = 0;
+        s->r2Sum = 0;
+        for (long i = 0; i < window; i++) s->r2Sum += s->r2[i];
+    }
+}
+
+/**
+ * VOLUME went down: a new session started, so the VWAP starts over
+ */
+static void ResetSession(AnalyticsSymbol *s)
+{
+    s->pvSum = s->vSum = 0;
+    s->vwapPos = s->vwapCount = 0;
+    s->tradeSize = 0;
+}
+
+/**
+ * Fold the symbol's latest quote into its state and emit changed outputs
+ */
+static void UpdateSymbol(Analytics *a, long sym, AnalyticsSymbol *s, ULONGLONG recvNs,
+                         AnalyticsEmitFn emit, void *ctx)
+{
+    const QuoteStore *q = a->quotes;
+    ULONG present = q->present[sym];
+    double last = q->dbl[QF_LAST][sym];
+    BOOL hasLast = (present & (1u << QF_LAST)) && last > 0;
+
+    BOOL traded = FALSE;
+    if (present & (1u << QF_VOLUME)) {
+        LONGLONG volume = q->i64[QF_VOLUME - QUOTE_FIRST_INT][sym];
+        if (s->hasVolume && volume > s->volume && hasLast) {
+            s->tradeSize = volume - s->volume;
+            AddTrade(a, s, last, (double)s->tradeSize);
+            a->trades++;
+            traded = TRUE;
+        } else if (s->hasVolume && volume < s->volume) {
+            ResetSession(s);
+        }
+        s->volume = volume;
+        s->hasVolume = TRUE;
+    }
+
+    if (hasLast && (traded || last != s->price)) {
+        if (s->price > 0) AddReturn(a, s, log(last / s->price));
+        if (s->hasEma) {
+            s->emaFast += a->alphaFast * (last - s->emaFast);
+            s->emaSlow += a->alphaSlow * (last - s->emaSlow);
+        } else {
+            s->emaFast = s->emaSlow = last;
+            s->hasEma = TRUE;
+        }
+        s->price = last;
+    }
+
+    double out[ANALYTIC_FIELD_COUNT];
+    BOOL valid[ANALYTIC_FIELD_COUNT];
+    double bid = q->dbl[QF_BID][sym], ask = q->dbl[QF_ASK][sym];
+    BOOL hasQuote = (present & (1u << QF_BID)) && (present & (1u << QF_ASK)) && bid > 0 && ask > 0;
+
+    valid[AF_VWAP] = s->vSum > 0;
+    out[AF_VWAP] = valid[AF_VWAP] ? s->pvSum / s->vSum : 0;
+    valid[AF_EMA_FAST] = valid[AF_EMA_SLOW] = s->hasEma;
+    out[AF_EMA_FAST] = s->emaFast;
+    out[AF_EMA_SLOW] = s->emaSlow;
+    valid[AF_MID] = valid[AF_SPREAD] = hasQuote;
+    out[AF_MID] = (bid + ask) * 0.5;
+    out[AF_SPREAD] = ask - bid;
+    valid[AF_RVOL] = s->volCount > 0;
+    out[AF_RVOL] = sqrt(s->r2Sum > 0 ? s->r2Sum : 0) * 100.0;
+    valid[AF_TRADE_SIZE] = traded;      // Every trade, even the same size again
+    out[AF_TRADE_SIZE] = (double)s->tradeSize;
+
+    for (int f = 0; f < ANALYTIC_FIELD_COUNT; f++) {
+        if (!s->topicID[f] || !valid[f]) continue;
+        if (f != AF_TRADE_SIZE && s->hasOut[f] && out[f] == s->lastOut[f]) continue;
+        s->lastOut[f] = out[f];
+        s->hasOut[f] = TRUE;
+
+        RtdUpdate u;
+        u.recvNs = recvNs;
+        u.topicID = s->topicID[f];
+        if (f == AF_TRADE_SIZE) {
+            u.vt = VT_I8;
+            u.llVal = s->tradeSize;
+        } else {
+            u.vt = VT_R8;
+            u.dblVal = out[f];
+        }
+        a->emitted++;
+        emit(ctx, &u);
+    }
+}
+
+void Analytics_EndBatch(Analytics *a, ULONGLONG recvNs, AnalyticsEmitFn emit, void *ctx)
+{
+    const QuoteStore *q = a->quotes;
+    for (long i = 0; i < a->dirtyCount; i++) {
+        // Symbols are scattered; start loading a few ahead
+        if (i + ANALYTICS_PREFETCH < a->dirtyCount) {
+            long ahead = a->dirty[i + ANALYTICS_PREFETCH];
+            RtdPrefetch(a->symbols[ahead]);
+            RtdPrefetch((char*)a->symbols[ahead] + 64);
+            RtdPrefetch((char*)a->symbols[ahead] + 128);
+            RtdPrefetch(&q->present[ahead]);
+            RtdPrefetch(&q->dbl[QF_LAST][ahead]);
+            RtdPrefetch(&q->dbl[QF_BID][ahead]);
+            RtdPrefetch(&q->dbl[QF_ASK][ahead]);
+            RtdPrefetch(&q->i64[QF_VOLUME - QUOTE_FIRST_INT][ahead]);
+        }
+        long sym = a->dirty[i];
+        if (a->flags[sym] != ANALYTICS_QUEUED) continue;
+        a->flags[sym] = ANALYTICS_TRACKED;
+        if (sym < a->quotes->symbolCap) UpdateSymbol(a, sym, a->symbols[sym], recvNs, emit, ctx);
+    }
+    a->dirtyCount = 0;
+}
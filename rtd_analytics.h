@@ -0,0 +1,125 @@
+// rtd_analytics.h - Incremental per-symbol analytics
+// Derived topics computed on the RTD thread from the decoded RefreshData
+// rows, with O(1) work per tick:
+//
+//   VWAP        volume-weighted average trade price, since the session
+//               start or over the last N trades
+//   EMA_FAST    exponential moving averages of the trade price
+//   EMA_SLOW
+//   MID, SPREAD midpoint and width of the BID/ASK quote
+//   RVOL        realized volatility: sqrt of the summed squared log
+//               returns over the last N price changes, in percent
+//   TRADE_SIZE  size of the last trade, from the increase in VOLUME
+//
+// Inputs are read from the QuoteStore after the batch has been applied,
+// so a batch carrying LAST, VOLUME, BID and ASK together is seen as one
+// consistent event. Derived values come out as ordinary updates for the
+// subscription's topic ID, only when they change.
+
+#ifndef __RTD_ANALYTICS_H__
+#define __RTD_ANALYTICS_H__
+
+#include "rtd_quotes.h"
+#include "rtd_ring.h"
+
+#define ANALYTIC_FIELDS(X) \
+    X(VWAP) X(EMA_FAST) X(EMA_SLOW) X(MID) X(SPREAD) X(RVOL) X(TRADE_SIZE)
+
+#define ANALYTIC_ENUM(name) AF_##name,
+typedef enum {
+    ANALYTIC_FIELDS(ANALYTIC_ENUM)
+    ANALYTIC_FIELD_COUNT
+} AnalyticField;
+#undef ANALYTIC_ENUM
+
+#define AF_NONE (-1)
+
+// Analytics.flags values; kept apart from the symbol state so marking a
+// symbol touched costs one byte, not a cache miss on its state
+#define ANALYTICS_TRACKED 1
+#define ANALYTICS_QUEUED  2
+
+typedef struct AnalyticsConfig {
+    long vwapWindow;    // Trades in the VWAP, 0 = whole session
+    long emaFast;       // EMA periods, in trades
+    long emaSlow;
+    long volWindow;     // Log returns in RVOL
+} AnalyticsConfig;
+
+#define ANALYTICS_DEFAULT_EMA_FAST   12
+#define ANALYTICS_DEFAULT_EMA_SLOW   26
+#define ANALYTICS_DEFAULT_VOL_WINDOW 60
+
+// Per-symbol state, allocated when the symbol gets its first derived
+// topic. Rolling sums live next to ring buffers of their terms.
+typedef struct AnalyticsSymbol {
+    long      topicID[ANALYTIC_FIELD_COUNT];    // 0 = not subscribed
+    double    lastOut[ANALYTIC_FIELD_COUNT];
+    BOOL      hasOut[ANALYTIC_FIELD_COUNT];
+
+    LONGLONG  volume;           // Cumulative VOLUME at the last batch
+    BOOL      hasVolume;
+    double    price;            // LAST at the last batch
+    LONGLONG  tradeSize;
+
+    double    pvSum, vSum;      // VWAP numerator and denominator
+    long      vwapPos, vwapCount;
+    double    emaFast, emaSlow;
+    BOOL      hasEma;
+    double    r2Sum;            // Sum of squared log returns in the window
+    long      volPos, volCount;
+
+    double   *pv, *v;           // vwapWindow entries each (NULL for session VWAP)
+    double   *r2;               // volWindow entries
+} AnalyticsSymbol;
+
+// Receives every derived value that changed (VT_R8, or VT_I8 for TRADE_SIZE)
+typedef void (*AnalyticsEmitFn)(void *ctx, RtdUpdate *u);
+
+typedef struct Analytics {
+    AnalyticsConfig   cfg;
+    double            alphaFast, alphaSlow;
+    const QuoteStore *quotes;
+    AnalyticsSymbol **symbols;  // Indexed by symbol ID, NULL when untracked
+    BYTE             *flags;    // ANALYTICS_TRACKED/QUEUED per symbol ID
+    long              symbolCap;
+    long             *dirty;    // Symbols touched in the current batch
+    long              dirtyCount;
+
+    ULONGLONG         trades;   // Volume increases seen
+    ULONGLONG         emitted;  // Derived updates produced
+} Analytics;
+
+// cfg fields <= 0 take their defaults (vwapWindow 0 stays session-wide)
+BOOL Analytics_Init(Analytics *a, const AnalyticsConfig *cfg, const QuoteStore *quotes);
+void Analytics_Free(Analytics *a);
+
+// AnalyticField for a topic name, or AF_NONE
+int AnalyticField_FromName(const WCHAR *topic);
+const char* AnalyticField_Name(int field);
+
+// QuoteField bits (1u << QF_x) a derived field is computed from
+ULONG AnalyticField_Inputs(int field);
+
+// LocalTopicFn for SubscriptionTable.isLocalTopic
+BOOL AnalyticField_IsDerived(const WCHAR *topic);
+
+// Start or stop computing sub's topic (ignored unless it names an AnalyticField)
+BOOL Analytics_Track(Analytics *a, const TopicSubscription *sub);
+void Analytics_Untrack(Analytics *a, const TopicSubscription *sub);
+
+/**
+ * Note that a row for sub's symbol arrived; call after QuoteStore_Apply
+ */
+static inline void Analytics_Apply(Analytics *a, const TopicSubscription *sub)
+{
+    long sym = sub->symbolID;
+    if (sym >= a->symbolCap || a->flags[sym] != ANALYTICS_TRACKED) return;
+    a->flags[sym] = ANALYTICS_QUEUED;
+    a->dirty[a->dirtyCount++] = sym;
+}
+
+// Recompute every symbol touched since the last call and emit what changed
+void Analytics_EndBatch(Analytics *a, ULONGLONG recvNs, AnalyticsEmitFn emit, void *ctx);
+
+#endif /* __RTD_ANALYTICS_H__ */
@@ -0,0 +1,977 @@
+/**
+ * rtd_archive.c - Compressed columnar tick archive
+ *
+ * Columns are packed least significant bit first, so the decoder loads
+ * eight bytes at the current byte and shifts. Nothing in the file is
+ * closer than eight bytes to its end (the footer is last), so those loads
+ * never need a bounds check.
+ *
+ * Column layouts, with z the zigzag of a signed value:
+ *   batch steps        varint z(min) | width byte | count - 1 x width bits
+ *   DECIMAL, INT       varint z(first) | then as batch steps, for the deltas
+ *   XOR                first double | lead byte | width byte | per value
+ *                      0 if unchanged, else 1 + width bits of the XOR
+ * Packed values are offsets from min, width bits being enough for the
+ * largest. The writer stages each open block as varints and repacks it
+ * when it closes, once min and width are known. Time chunks are
+ * byte-oriented: a varint of the zigzag delta-of-delta per batch.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtd_archive.h"
+
+static const double kPow10[ARCHIVE_MAX_SCALE + 1] = { 1, 10, 100, 1e3, 1e4, 1e5, 1e6 };
+static const int64_t kPow10i[ARCHIVE_MAX_SCALE + 1] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+
+static inline uint64_t ZigZag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t UnZigZag(uint64_t z)
+{
+    return (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+}
+
+static inline BOOL GetVarint(const BYTE *p, size_t size, size_t *pos, uint64_t *v)
+{
+    uint64_t x = 0;
+    for (int shift = 0; shift < 64 && *pos < size; shift += 7) {
+        BYTE c = p[(*pos)++];
+        x |= (uint64_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            *v = x;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// ---- Writer ----
+
+static BOOL Bits_Reserve(ArchiveBits *b, size_t more)
+{
+    if (b->len + more <= b->cap) return TRUE;
+    size_t cap = b->cap ? b->cap * 2 : 256;
+    while (cap < b->len + more) cap *= 2;
+    BYTE *grown = (BYTE*)realloc(b->buf, cap);
+    if (!grown) return FALSE;
+    b->buf = grown;
+    b->cap = cap;
+    return TRUE;
+}
+
+/**
+ * Append the low n bits of v (1 <= n <= 64); room must be reserved
+ */
+static inline void PutBits(ArchiveBits *b, uint64_t v, int n)
+{
+    if (n < 64) v &= (1ULL << n) - 1;
+    b->acc |= v << b->fill;
+    if (b->fill + n < 64) {
+        b->fill += n;
+        return;
+    }
+    memcpy(b->buf + b->len, &b->acc, 8);
+    b->len += 8;
+    int used = 64 - b->fill;
+    b->acc = used < 64 ? v >> used : 0;
+    b->fill += n - 64;
+}
+
+static void FinishBits(ArchiveBits *b)
+{
+    size_t n = (size_t)(b->fill + 7) / 8;
+    memcpy(b->buf + b->len, &b->acc, n);
+    b->len += n;
+    b->acc = 0;
+    b->fill = 0;
+}
+
+static inline void PutVarint(ArchiveBits *b, uint64_t v)
+{
+    while (v >= 0x80) {
+        b->buf[b->len++] = (BYTE)(v | 0x80);
+        v >>= 7;
+    }
+    b->buf[b->len++] = (BYTE)v;
+}
+
+/**
+ * Bit-pack count staged zigzag varints from *at as offsets from min, the
+ * smallest of them: varint zigzag min, a width byte, then width bits each
+ */
+static void PackDeltas(ArchiveBits *out, const BYTE *staged, size_t size, size_t *at, uint32_t count,
+                       int64_t min, int64_t max)
+{
+    if (count == 0) min = max = 0;
+    uint64_t range = (uint64_t)max - (uint64_t)min;
+    int width = range ? RtdMsb64(range) + 1 : 0;
+    PutVarint(out, ZigZag(min));
+    out->buf[out->len++] = (BYTE)width;
+    for (uint32_t i = 0; width && i < count; i++) {
+        uint64_t z = 0;
+        GetVarint(staged, size, at, &z);
+        PutBits(out, (uint64_t)UnZigZag(z) - (uint64_t)min, width);
+    }
+    FinishBits(out);
+}
+
+/**
+ * Pack count staged doubles: the first as is, then a lead and width byte
+ * for the window every XOR fits in, then a bit per value, followed by the
+ * window's bits when it changed
+ */
+static void PackXor(ArchiveBits *out, const BYTE *staged, uint32_t count, uint64_t any)
+{
+    int lead = any ? 63 - RtdMsb64(any) : 0;
+    int trail = any ? RtdMsb64(any & (~any + 1)) : 0;
+    int width = any ? 64 - lead - trail : 0;
+    uint64_t prev;
+    memcpy(&prev, staged, 8);
+    memcpy(out->buf + out->len, &prev, 8);
+    out->len += 8;
+    out->buf[out->len++] = (BYTE)lead;
+    out->buf[out->len++] = (BYTE)width;
+    for (uint32_t i = 1; width && i < count; i++) {
+        uint64_t bits;
+        memcpy(&bits, staged + i * 8, 8);
+        uint64_t x = bits ^ prev;
+        prev = bits;
+        PutBits(out, x != 0, 1);
+        if (x) PutBits(out, x >> trail, width);
+    }
+    FinishBits(out);
+}
+
+/**
+ * Whether v is exactly n / 10^scale for an integer n
+ */
+static BOOL ScaleFits(double v, int scale, int64_t *n)
+{
+    // Bounded so scaled values and their deltas stay inside int64
+    if (!(v > -1e12 && v < 1e12)) return FALSE;
+    double s = v * kPow10[scale];
+    int64_t r = (int64_t)(s < 0 ? s - 0.5 : s + 0.5);
+    if ((double)r / kPow10[scale] != v) return FALSE;
+    if (r == 0 && signbit(v)) return FALSE;     // -0.0 keeps its sign through XOR
+    *n = r;
+    return TRUE;
+}
+
+static int DecimalScale(double v, int minScale, int64_t *n)
+{
+    for (int scale = minScale; scale <= ARCHIVE_MAX_SCALE; scale++) {
+        if (ScaleFits(v, scale, n)) return scale;
+    }
+    return -1;
+}
+
+/**
+ * Most trailing decimal zeros of v, up to maxZeros
+ */
+static int TrailingZeros(int64_t v, int maxZeros)
+{
+    int zeros = maxZeros;
+    while (zeros > 0 && v % kPow10i[zeros] != 0) zeros--;
+    return zeros;
+}
+
+/**
+ * Codec for a VARTYPE; doubles start as ARCHIVE_DECIMAL and fall back to
+ * ARCHIVE_XOR per block
+ */
+static int CodecFor(VARTYPE vt)
+{
+    switch (vt) {
+        case VT_R8:
+        case VT_R4:
+        case VT_DATE:  return ARCHIVE_DECIMAL;
+        case VT_BSTR:  return ARCHIVE_STRING;
+        case VT_EMPTY:
+        case VT_NULL:  return ARCHIVE_EMPTY;
+        default:       return ARCHIVE_INT;     // Integers, and types decoded as 0
+    }
+}
+
+static BOOL WriteBytes(ArchiveWriter *a, const void *p, size_t n)
+{
+    if (n && fwrite(p, 1, n, a->file) != n) {
+        a->errors++;
+        return FALSE;
+    }
+    a->offset += n;
+    return TRUE;
+}
+
+/**
+ * Zero-fill to a multiple of 8 so the table that follows can be mapped
+ * in place
+ */
+static BOOL Align8(ArchiveWriter *a)
+{
+    static const BYTE zeros[8];
+    return WriteBytes(a, zeros, (size_t)(-(int64_t)a->offset & 7));
+}
+
+BOOL ArchiveWriter_Open(ArchiveWriter *a, const char *path)
+{
+    memset(a, 0, sizeof *a);
+    a->file = fopen(path, "wb");
+    if (!a->file) return FALSE;
+    setvbuf(a->file, NULL, _IOFBF, 1 << 16);
+    a->wallOffsetNs = (LONGLONG)RtdWallNs() - (LONGLONG)RtdNowNs();
+
+    ArchiveHeader hdr;
+    memset(&hdr, 0, sizeof hdr);
+    memcpy(hdr.magic, ARCHIVE_MAGIC, 8);
+    hdr.version = ARCHIVE_VERSION;
+    hdr.blockValues = ARCHIVE_BLOCK_VALUES;
+    hdr.createdWallNs = RtdWallNs();
+    if (!WriteBytes(a, &hdr, sizeof hdr)) {
+        fclose(a->file);
+        a->file = NULL;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static uint32_t HashNames(const char *symbol, const char *topic)
+{
+    uint32_t h = 2166136261u;
+    for (const char *p = symbol; *p; p++) h = (h ^ (BYTE)*p) * 16777619u;
+    h = (h ^ 0xFF) * 16777619u;
+    for (const char *p = topic; *p; p++) h = (h ^ (BYTE)*p) * 16777619u;
+    return h;
+}
+
+static BOOL GrowHash(ArchiveWriter *a)
+{
+    long cap = a->hashCap ? a->hashCap * 2 : 1024;
+    long *hash = (long*)calloc(cap, sizeof *hash);
+    if (!hash) return FALSE;
+    for (long i = 0; i < a->streamCount; i++) {
+        const ArchiveStream *s = &a->streams[i];
+        long slot = (long)(HashNames(a->names + s->symbol, a->names + s->topic) & (cap - 1));
+        while (hash[slot]) slot = (slot + 1) & (cap - 1);
+        hash[slot] = i + 1;
+    }
+    free(a->hash);
+    a->hash = hash;
+    a->hashCap = cap;
+    return TRUE;
+}
+
+static BOOL AppendName(ArchiveWriter *a, const char *name, uint32_t *offset)
+{
+    size_t len = strlen(name) + 1;
+    if (a->namesLen + len > a->namesCap) {
+        size_t cap = a->namesCap ? a->namesCap * 2 : 4096;
+        while (cap < a->namesLen + len) cap *= 2;
+        char *grown = (char*)realloc(a->names, cap);
+        if (!grown) return FALSE;
+        a->names = grown;
+        a->namesCap = cap;
+    }
+    *offset = (uint32_t)a->namesLen;
+    memcpy(a->names + a->namesLen, name, len);
+    a->namesLen += len;
+    return TRUE;
+}
+
+/**
+ * Series for a symbol and topic, added the first time they are seen
+ */
+static long StreamFor(ArchiveWriter *a, const char *symbol, const char *topic)
+{
+    if ((a->streamCount + 1) * 2 > a->hashCap && !GrowHash(a)) return -1;
+    long slot = (long)(HashNames(symbol, topic) & (a->hashCap - 1));
+    for (; a->hash[slot]; slot = (slot + 1) & (a->hashCap - 1)) {
+        const ArchiveStream *s = &a->streams[a->hash[slot] - 1];
+        if (strcmp(a->names + s->symbol, symbol) == 0 && strcmp(a->names + s->topic, topic) == 0) {
+            return a->hash[slot] - 1;
+        }
+    }
+
+    if (a->streamCount == a->streamCap) {
+        long cap = a->streamCap ? a->streamCap * 2 : 256;
+        ArchiveStream *grown = (ArchiveStream*)realloc(a->streams, cap * sizeof *grown);
+        if (!grown) return -1;
+        a->streams = grown;
+        a->streamCap = cap;
+    }
+    ArchiveStream *s = &a->streams[a->streamCount];
+    memset(s, 0, sizeof *s);
+    s->maxZeros = ARCHIVE_MAX_SCALE;
+    if (!AppendName(a, symbol, &s->symbol) || !AppendName(a, topic, &s->topic)) return -1;
+    a->hash[slot] = ++a->streamCount;
+    return a->streamCount - 1;
+}
+
+static BOOL DefineUtf8(ArchiveWriter *a, long topicID, const char *symbol, const char *topic)
+{
+    if (topicID < 0) return FALSE;
+    if (topicID >= a->topicCap) {
+        long cap = a->topicCap ? a->topicCap : 1024;
+        while (cap <= topicID) cap *= 2;
+        long *grown = (long*)realloc(a->topicStream, cap * sizeof *grown);
+        if (!grown) return FALSE;
+        memset(grown + a->topicCap, 0, (cap - a->topicCap) * sizeof *grown);
+        a->topicStream = grown;
+        a->topicCap = cap;
+    }
+    long index = StreamFor(a, symbol, topic);
+    if (index < 0) return FALSE;
+    a->topicStream[topicID] = index + 1;
+    return TRUE;
+}
+
+BOOL ArchiveWriter_Define(ArchiveWriter *a, long topicID, const WCHAR *symbol, const WCHAR *topic)
+{
+    char sym[256], top[256];
+    sym[RtdWideToUtf8(symbol, wcslen(symbol), sym, sizeof sym - 1)] = 0;
+    top[RtdWideToUtf8(topic, wcslen(topic), top, sizeof top - 1)] = 0;
+    return DefineUtf8(a, topicID, sym, top);
+}
+
+/**
+ * Write the open time chunk
+ */
+static BOOL FlushChunk(ArchiveWriter *a)
+{
+    ArchiveTimeChunk *c = &a->chunks[a->chunkCount - 1];
+    c->offset = a->offset;
+    c->bytes = (uint32_t)a->times.len;
+    BOOL ok = WriteBytes(a, a->times.buf, a->times.len);
+    a->times.len = 0;
+    a->chunkBatches = 0;
+    return ok;
+}
+
+/**
+ * Number a new receive time
+ */
+static BOOL NextBatch(ArchiveWriter *a, int64_t ns)
+{
+    if (a->chunkBatches == ARCHIVE_TIME_CHUNK && !FlushChunk(a)) return FALSE;
+    if (a->chunkBatches == 0) {
+        if (a->chunkCount == a->chunkCap) {
+            long cap = a->chunkCap ? a->chunkCap * 2 : 64;
+            ArchiveTimeChunk *grown = (ArchiveTimeChunk*)realloc(a->chunks, cap * sizeof *grown);
+            if (!grown) return FALSE;
+            a->chunks = grown;
+            a->chunkCap = cap;
+        }
+        ArchiveTimeChunk *c = &a->chunks[a->chunkCount++];
+        memset(c, 0, sizeof *c);
+        c->firstNs = ns;
+        a->lastTimeDelta = 0;
+    } else {
+        if (!Bits_Reserve(&a->times, 10)) return FALSE;
+        int64_t delta = ns - a->batchNs;
+        PutVarint(&a->times, ZigZag(delta - a->lastTimeDelta));
+        a->lastTimeDelta = delta;
+    }
+    a->chunks[a->chunkCount - 1].count++;
+    a->chunkBatches++;
+    a->batchNs = ns;
+    a->batches++;
+    return TRUE;
+}
+
+/**
+ * Write a series' open block and add it to the index
+ */
+static BOOL FlushBlock(ArchiveWriter *a, long index)
+{
+    ArchiveStream *s = &a->streams[index];
+    if (s->count == 0) return TRUE;
+    if (a->blockCount == a->blockCap) {
+        long cap = a->blockCap ? a->blockCap * 2 : 1024;
+        ArchiveBlock *grown = (ArchiveBlock*)realloc(a->blocks, cap * sizeof *grown);
+        if (!grown) return FALSE;
+        a->blocks = grown;
+        a->blockCap = cap;
+    }
+    // Staged varints and doubles are repacked: batch steps, then values
+    ArchiveBits *out = &a->packed;
+    out->len = 0;
+    if (!Bits_Reserve(out, 64 + (size_t)s->count * 20 + s->column.len)) {
+        a->errors++;
+        return FALSE;
+    }
+    size_t at = 0;
+    PackDeltas(out, s->batches.buf, s->batches.len, &at, s->count - 1, s->batchMin, s->batchMax);
+    size_t batchBytes = out->len;
+    switch (s->codec) {
+        case ARCHIVE_DECIMAL:
+        case ARCHIVE_INT: {
+            uint64_t first = 0;
+            at = 0;
+            GetVarint(s->column.buf, s->column.len, &at, &first);
+            PutVarint(out, first);
+            PackDeltas(out, s->column.buf, s->column.len, &at, s->count - 1, s->deltaMin, s->deltaMax);
+            break;
+        }
+        case ARCHIVE_XOR:
+            PackXor(out, s->column.buf, s->count, s->xorAny);
+            break;
+        case ARCHIVE_STRING:
+            memcpy(out->buf + out->len, s->column.buf, s->column.len);
+            out->len += s->column.len;
+            break;
+    }
+
+    ArchiveBlock *b = &a->blocks[a->blockCount++];
+    memset(b, 0, sizeof *b);
+    b->offset = a->offset;
+    b->firstNs = s->firstNs;
+    b->lastNs = s->lastNs;
+    b->firstBatch = s->firstBatch;
+    b->series = (uint32_t)index;
+    b->count = s->count;
+    b->batchBytes = (uint32_t)batchBytes;
+    b->valueBytes = (uint32_t)(out->len - batchBytes);
+    b->vt = s->vt;
+    b->codec = s->codec;
+    b->scale = s->scale;
+
+    BOOL ok = WriteBytes(a, out->buf, out->len);
+    s->count = 0;
+    s->batches.len = 0;
+    s->column.len = 0;
+    return ok;
+}
+
+/**
+ * Append one value to its series' open block, starting a new block when
+ * the codec changes or the block is full. raw holds the double's bits or
+ * the integer.
+ */
+static BOOL AppendValue(ArchiveWriter *a, long topicID, int64_t ns, VARTYPE vt, int64_t raw,
+                        const char *str, uint32_t strLen)
+{
+    if (topicID < 0 || topicID >= a->topicCap || !a->topicStream[topicID]) {
+        a->undefined++;
+        return FALSE;
+    }
+    long index = a->topicStream[topicID] - 1;
+    ArchiveStream *s = &a->streams[index];
+    if ((a->batches == 0 || ns != a->batchNs) && !NextBatch(a, ns)) {
+        a->errors++;
+        return FALSE;
+    }
+    uint64_t batch = a->batches - 1;
+
+    if (s->count > 0 && (s->vt != vt || s->count == ARCHIVE_BLOCK_VALUES || s->column.len >= ARCHIVE_BLOCK_BYTES)) {
+        if (!FlushBlock(a, index)) return FALSE;
+    }
+
+    int codec = CodecFor(vt), scale = 0;
+    int64_t scaled = 0;
+    if (codec == ARCHIVE_DECIMAL) {
+        double d;
+        memcpy(&d, &raw, sizeof d);
+        if (s->count > 0 && s->codec == ARCHIVE_XOR) {
+            codec = ARCHIVE_XOR;
+        } else if (s->count > 0 && ScaleFits(d, s->scale, &scaled)) {
+            scale = s->scale;
+        } else {
+            // First value of a block, or one with more decimals than it uses
+            scale = DecimalScale(d, s->minScale, &scaled);
+            if (scale < 0) {
+                codec = ARCHIVE_XOR;
+                scale = 0;
+            } else if (scale > s->minScale) {
+                s->minScale = (uint8_t)scale;
+            }
+            if (s->count > 0 && !FlushBlock(a, index)) return FALSE;
+        }
+    } else if (codec == ARCHIVE_INT) {
+        if (s->count > 0 && raw % kPow10i[s->scale] == 0) {
+            scale = s->scale;
+        } else {
+            // Fewer zeros than the open block divides out; the series keeps the lower count
+            scale = TrailingZeros(raw, s->maxZeros);
+            s->maxZeros = (uint8_t)scale;
+            if (s->count > 0 && !FlushBlock(a, index)) return FALSE;
+        }
+        scaled = raw / kPow10i[scale];
+    }
+
+    size_t room = codec == ARCHIVE_STRING ? strLen + 16 : 16;
+    if (!Bits_Reserve(&s->batches, 16) || !Bits_Reserve(&s->column, room)) {
+        a->errors++;
+        return FALSE;
+    }
+
+    if (s->count == 0) {
+        s->vt = vt;
+        s->codec = (uint8_t)codec;
+        s->scale = (uint8_t)scale;
+        s->firstNs = s->lastNs = ns;
+        s->firstBatch = s->lastBatch = batch;
+        s->batchMin = s->deltaMin = INT64_MAX;
+        s->batchMax = s->deltaMax = INT64_MIN;
+        s->lastInt = 0;
+        s->xorAny = 0;
+        s->lastStr = (size_t)-1;
+    } else {
+        int64_t step = (int64_t)(batch - s->lastBatch);
+        PutVarint(&s->batches, ZigZag(step));
+        if (step < s->batchMin) s->batchMin = step;
+        if (step > s->batchMax) s->batchMax = step;
+        s->lastBatch = batch;
+        if (ns < s->firstNs) s->firstNs = ns;
+        if (ns > s->lastNs) s->lastNs = ns;
+    }
+
+    switch (codec) {
+        case ARCHIVE_DECIMAL:
+        case ARCHIVE_INT: {
+            // The first value is a delta from 0. INT wraps; the decoder wraps back.
+            int64_t delta = (int64_t)((uint64_t)scaled - (uint64_t)s->lastInt);
+            PutVarint(&s->column, ZigZag(delta));
+            if (s->count > 0 && delta < s->deltaMin) s->deltaMin = delta;
+            if (s->count > 0 && delta > s->deltaMax) s->deltaMax = delta;
+            s->lastInt = scaled;
+            break;
+        }
+        case ARCHIVE_XOR:
+            memcpy(s->column.buf + s->column.len, &raw, 8);
+            s->column.len += 8;
+            if (s->count > 0) s->xorAny |= (uint64_t)raw ^ s->lastBits;
+            s->lastBits = (uint64_t)raw;
+            break;
+        case ARCHIVE_STRING:
+            if (s->lastStr != (size_t)-1 && strLen == s->lastStrLen &&
+                memcmp(s->column.buf + s->lastStr, str, strLen) == 0) {
+                PutVarint(&s->column, 0);
+            } else {
+                PutVarint(&s->column, (uint64_t)strLen + 1);
+                s->lastStr = s->column.len;
+                s->lastStrLen = strLen;
+                memcpy(s->column.buf + s->column.len, str, strLen);
+                s->column.len += strLen;
+            }
+            break;
+    }
+    s->count++;
+    s->values++;
+    a->values++;
+    return TRUE;
+}
+
+BOOL ArchiveWriter_Append(ArchiveWriter *a, const RtdUpdate *u)
+{
+    int64_t ns = (int64_t)u->recvNs + a->wallOffsetNs;
+    if (u->vt != VT_BSTR) return AppendValue(a, u->topicID, ns, u->vt, u->llVal, NULL, 0);
+
+    // Four bytes per unit covers UTF-16 and UTF-32 WCHARs
+    size_t len = SysStringLen(u->bstrVal);
+    if (len * 4 > a->scratchCap) {
+        char *grown = (char*)realloc(a->scratch, len * 4);
+        if (!grown) {
+            a->errors++;
+            return FALSE;
+        }
+        a->scratch = grown;
+        a->scratchCap = len * 4;
+    }
+    size_t n = RtdWideToUtf8(u->bstrVal, len, a->scratch, a->scratchCap);
+    return AppendValue(a, u->topicID, ns, VT_BSTR, 0, a->scratch, (uint32_t)n);
+}
+
+BOOL ArchiveWriter_AppendJournal(ArchiveWriter *a, const char *prefix)
+{
+    char path[300];
+    JournalReader r;
+    uint32_t files = 0;
+
+    for (uint32_t index = 1; ; index++) {
+        Journal_FilePath(path, sizeof path, prefix, index, "rtj");
+        if (!JournalReader_Open(&r, path)) break;
+        files++;
+
+        // Records carry the journal's monotonic clock; the header pins it to the wall clock
+        int64_t toWall = (int64_t)r.hdr->baseWallNs - (int64_t)r.hdr->baseNs;
+        for (uint64_t i = 0; i < r.count; i++) {
+            const JournalRecord *rec = &r.records[i];
+            if (rec->kind == JOURNAL_DEFINE) {
+                const char *symbol, *topic;
+                if (JournalReader_Definition(&r, rec, &symbol, &topic)) DefineUtf8(a, rec->topicID, symbol, topic);
+            } else if (rec->kind == JOURNAL_UPDATE) {
+                int64_t ns = (int64_t)rec->tsNs + toWall;
+                if (rec->vt == VT_BSTR) {
+                    uint32_t len;
+                    const char *str = JournalReader_String(&r, rec->value.str, &len);
+                    if (str) AppendValue(a, rec->topicID, ns, VT_BSTR, 0, str, len);
+                } else {
+                    AppendValue(a, rec->topicID, ns, rec->vt, rec->value.i64, NULL, 0);
+                }
+            }
+        }
+        JournalReader_Close(&r);
+    }
+    return files > 0 && a->errors == 0;
+}
+
+BOOL ArchiveWriter_Close(ArchiveWriter *a)
+{
+    if (!a->file) return FALSE;
+    BOOL ok = TRUE;
+    for (long i = 0; i < a->streamCount; i++) ok = FlushBlock(a, i) && ok;
+    if (a->chunkBatches > 0) ok = FlushChunk(a) && ok;
+
+    // Index: blocks grouped by series, each series' blocks in the order written
+    ArchiveSeries *series = (ArchiveSeries*)calloc(a->streamCount + 1, sizeof *series);
+    ArchiveBlock *sorted = (ArchiveBlock*)malloc((a->blockCount + 1) * sizeof *sorted);
+    if (!series || !sorted) ok = FALSE;
+    if (ok) {
+        for (long i = 0; i < a->blockCount; i++) series[a->blocks[i].series].blockCount++;
+        uint32_t next = 0;
+        for (long i = 0; i < a->streamCount; i++) {
+            series[i].symbol = a->streams[i].symbol;
+            series[i].topic = a->streams[i].topic;
+            series[i].values = a->streams[i].values;
+            series[i].firstBlock = next;
+            next += series[i].blockCount;
+            series[i].blockCount = 0;
+        }
+        for (long i = 0; i < a->blockCount; i++) {
+            ArchiveSeries *s = &series[a->blocks[i].series];
+            sorted[s->firstBlock + s->blockCount++] = a->blocks[i];
+        }
+
+        ArchiveFooter f;
+        memset(&f, 0, sizeof f);
+        f.values = a->values;
+        f.batches = a->batches;
+        f.seriesCount = (uint32_t)a->streamCount;
+        f.blockCount = (uint32_t)a->blockCount;
+        f.chunkCount = (uint32_t)a->chunkCount;
+        memcpy(f.magic, ARCHIVE_END_MAGIC, 8);
+
+        ok = Align8(a);
+        f.seriesOffset = a->offset;
+        ok = ok && WriteBytes(a, series, a->streamCount * sizeof *series);
+        f.blockOffset = a->offset;
+        ok = ok && WriteBytes(a, sorted, a->blockCount * sizeof *sorted);
+        f.chunkOffset = a->offset;
+        ok = ok && WriteBytes(a, a->chunks, a->chunkCount * sizeof *a->chunks);
+        f.namesOffset = a->offset;
+        f.namesBytes = a->namesLen;
+        ok = ok && WriteBytes(a, a->names, a->namesLen) && Align8(a) && WriteBytes(a, &f, sizeof f);
+    }
+    free(series);
+    free(sorted);
+    if (fclose(a->file) != 0) ok = FALSE;
+    a->file = NULL;
+
+    for (long i = 0; i < a->streamCount; i++) {
+        free(a->streams[i].batches.buf);
+        free(a->streams[i].column.buf);
+    }
+    free(a->streams);
+    free(a->topicStream);
+    free(a->hash);
+    free(a->names);
+    free(a->scratch);
+    free(a->blocks);
+    free(a->chunks);
+    free(a->times.buf);
+    free(a->packed.buf);
+    a->streams = NULL;
+    a->topicStream = NULL;
+    a->hash = NULL;
+    a->names = NULL;
+    a->scratch = NULL;
+    a->blocks = NULL;
+    a->chunks = NULL;
+    a->times.buf = NULL;
+    a->packed.buf = NULL;
+    return ok && a->errors == 0;
+}
+
+// ---- Reader ----
+
+static inline uint64_t Peek(const BYTE *p, uint64_t pos)
+{
+    uint64_t w;
+    memcpy(&w, p + (pos >> 3), 8);
+    return w >> (pos & 7);
+}
+
+// Up to 64 bits, in two loads when more than 56 are asked for
+static inline uint64_t GetBits(const BYTE *p, uint64_t *pos, int n)
+{
+    uint64_t v;
+    if (n <= 56) {
+        v = Peek(p, *pos) & ((1ULL << n) - 1);
+    } else {
+        v = Peek(p, *pos) & 0xFFFFFFFFULL;
+        uint64_t hi = Peek(p, *pos + 32);
+        if (n < 64) hi &= (1ULL << (n - 32)) - 1;
+        v |= hi << 32;
+    }
+    *pos += (uint64_t)n;
+    return v;
+}
+
+/**
+ * Read a packed column's header at *at: its minimum and width. FALSE if
+ * count values of that width would run past size bytes.
+ */
+static BOOL PackedHeader(const BYTE *p, size_t size, size_t *at, uint32_t count, uint64_t *min, int *width)
+{
+    uint64_t z;
+    if (!GetVarint(p, size, at, &z) || *at >= size) return FALSE;
+    *min = (uint64_t)UnZigZag(z);
+    *width = p[(*at)++];
+    return *width <= 64 && ((uint64_t)count * (uint64_t)*width + 7) / 8 <= size - *at;
+}
+
+/**
+ * Running sums of packed values from bit pos: out[0] = x, then each out[i]
+ * is out[i - 1] + min + the next width bits
+ */
+static void UnpackSums(const BYTE *p, uint64_t pos, int width, uint64_t min, uint64_t x,
+                       uint32_t count, uint64_t *out)
+{
+    out[0] = x;
+    if (width <= 56) {
+        // One unaligned load per value
+        uint64_t mask = (1ULL << width) - 1;
+        for (uint32_t i = 1; i < count; i++) {
+            x += min + (Peek(p, pos) & mask);
+            pos += (uint64_t)width;
+            out[i] = x;
+        }
+    } else {
+        for (uint32_t i = 1; i < count; i++) {
+            x += min + GetBits(p, &pos, width);
+            out[i] = x;
+        }
+    }
+}
+
+BOOL ArchiveReader_Open(ArchiveReader *r, const char *path)
+{
+    memset(r, 0, sizeof *r);
+    if (!MappedFile_Open(&r->map, path, 0, FALSE)) return FALSE;
+
+    const BYTE *base = (const BYTE*)r->map.base;
+    size_t size = r->map.size;
+    if (size < sizeof(ArchiveHeader) + sizeof(ArchiveFooter) || (size & 7) ||
+        memcmp(base, ARCHIVE_MAGIC, 8) != 0) {
+        MappedFile_Close(&r->map);
+        return FALSE;
+    }
+    const ArchiveFooter *f = (const ArchiveFooter*)(base + size - sizeof *f);
+    uint64_t end = size - sizeof *f;
+    if (memcmp(f->magic, ARCHIVE_END_MAGIC, 8) != 0 ||
+        f->seriesOffset + (uint64_t)f->seriesCount * sizeof(ArchiveSeries) > end ||
+        f->blockOffset + (uint64_t)f->blockCount * sizeof(ArchiveBlock) > end ||
+        f->chunkOffset + (uint64_t)f->chunkCount * sizeof(ArchiveTimeChunk) > end ||
+        f->namesOffset + f->namesBytes > end || (f->seriesOffset | f->blockOffset | f->chunkOffset) & 7) {
+        MappedFile_Close(&r->map);
+        return FALSE;
+    }
+    r->footer = f;
+    r->series = (const ArchiveSeries*)(base + f->seriesOffset);
+    r->blocks = (const ArchiveBlock*)(base + f->blockOffset);
+    r->chunks = (const ArchiveTimeChunk*)(base + f->chunkOffset);
+    r->names = (const char*)(base + f->namesOffset);
+    r->times = (int64_t**)calloc(f->chunkCount + 1, sizeof *r->times);
+    if (!r->times) {
+        MappedFile_Close(&r->map);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void ArchiveReader_Close(ArchiveReader *r)
+{
+    for (uint32_t i = 0; r->times && i < r->footer->chunkCount; i++) free(r->times[i]);
+    free(r->times);
+    MappedFile_Close(&r->map);
+    memset(r, 0, sizeof *r);
+}
+
+long ArchiveReader_Find(const ArchiveReader *r, const char *symbol, const char *topic)
+{
+    for (uint32_t i = 0; i < r->footer->seriesCount; i++) {
+        if (strcmp(r->names + r->series[i].symbol, symbol) == 0 &&
+            strcmp(r->names + r->series[i].topic, topic) == 0) {
+            return (long)i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Batch times of one chunk, decoded the first time a block needs them
+ */
+static const int64_t* ChunkTimes(ArchiveReader *r, uint32_t chunk)
+{
+    if (chunk >= r->footer->chunkCount) return NULL;
+    if (r->times[chunk]) return r->times[chunk];
+
+    const ArchiveTimeChunk *c = &r->chunks[chunk];
+    if (c->count == 0 || c->count > ARCHIVE_TIME_CHUNK || c->offset + c->bytes > r->footer->seriesOffset) return NULL;
+    int64_t *t = (int64_t*)malloc(c->count * sizeof *t);
+    if (!t) return NULL;
+
+    const BYTE *p = (const BYTE*)r->map.base + c->offset;
+    size_t pos = 0;
+    int64_t delta = 0;
+    t[0] = c->firstNs;
+    for (uint32_t i = 1; i < c->count; i++) {
+        uint64_t z;
+        if (!GetVarint(p, c->bytes, &pos, &z)) {
+            free(t);
+            return NULL;
+        }
+        delta += UnZigZag(z);
+        t[i] = t[i - 1] + delta;
+    }
+    r->times[chunk] = t;
+    r->chunksDecoded++;
+    return t;
+}
+
+BOOL ArchiveReader_Decode(ArchiveReader *r, uint32_t block, ArchiveColumn *col)
+{
+    if (block >= r->footer->blockCount) return FALSE;
+    const ArchiveBlock *b = &r->blocks[block];
+    uint32_t n = b->count;
+    if (n == 0 || n > ARCHIVE_BLOCK_VALUES || b->scale > ARCHIVE_MAX_SCALE ||
+        b->offset + b->batchBytes + b->valueBytes > r->footer->seriesOffset) {
+        return FALSE;
+    }
+    const BYTE *p = (const BYTE*)r->map.base + b->offset;
+    const BYTE *v = p + b->batchBytes;
+    col->series = b->series;
+    col->count = n;
+    col->vt = b->vt;
+
+    // Batch numbers, then their times
+    uint64_t min;
+    int width;
+    size_t at = 0;
+    if (!PackedHeader(p, b->batchBytes, &at, n - 1, &min, &width)) return FALSE;
+    UnpackSums(p, (uint64_t)at * 8, width, min, b->firstBatch, n, col->batch);
+    // A run of batches in one chunk at a time
+    uint64_t chunk = ~0ULL;
+    for (uint32_t i = 0; i < n; ) {
+        uint64_t c = col->batch[i] / ARCHIVE_TIME_CHUNK;
+        const int64_t *times = c < r->footer->chunkCount && c != chunk ? ChunkTimes(r, (uint32_t)c) : NULL;
+        if (!times) return FALSE;
+        uint64_t base = c * ARCHIVE_TIME_CHUNK, count = r->chunks[c].count, slot;
+        for (; i < n && (slot = col->batch[i] - base) < count; i++) col->timeNs[i] = times[slot];
+        chunk = c;
+    }
+
+    at = 0;
+    switch (b->codec) {
+        case ARCHIVE_DECIMAL:
+        case ARCHIVE_INT: {
+            uint64_t first;
+            if (!GetVarint(v, b->valueBytes, &at, &first) ||
+                !PackedHeader(v, b->valueBytes, &at, n - 1, &min, &width)) {
+                return FALSE;
+            }
+            UnpackSums(v, (uint64_t)at * 8, width, min, (uint64_t)UnZigZag(first), n, (uint64_t*)col->i64);
+            if (b->codec == ARCHIVE_DECIMAL) {
+                double scale = kPow10[b->scale];
+                for (uint32_t i = 0; i < n; i++) col->dbl[i] = (double)col->i64[i] / scale;
+            } else if (b->scale > 0) {
+                uint64_t scale = (uint64_t)kPow10i[b->scale];
+                for (uint32_t i = 0; i < n; i++) col->i64[i] = (int64_t)((uint64_t)col->i64[i] * scale);
+            }
+            break;
+        }
+        case ARCHIVE_XOR: {
+            if (b->valueBytes < 10 || v[8] + v[9] > 64) return FALSE;
+            uint64_t bits, pos = 80;
+            int trail = 64 - v[8] - v[9];
+            width = v[9];
+            memcpy(&bits, v, 8);
+            memcpy(&col->dbl[0], &bits, 8);
+            if (width == 0) {
+                for (uint32_t i = 1; i < n; i++) col->dbl[i] = col->dbl[0];
+            } else if (width <= 55) {
+                // A changed value adds its window; an unchanged one adds nothing
+                uint64_t mask = (1ULL << width) - 1;
+                for (uint32_t i = 1; i < n; i++) {
+                    uint64_t w = Peek(v, pos), changed = 0 - (w & 1);
+                    bits ^= (((w >> 1) & mask) << trail) & changed;
+                    pos += 1 + ((uint64_t)width & changed);
+                    memcpy(&col->dbl[i], &bits, 8);
+                }
+            } else {
+                for (uint32_t i = 1; i < n; i++) {
+                    if (GetBits(v, &pos, 1)) bits ^= GetBits(v, &pos, width) << trail;
+                    memcpy(&col->dbl[i], &bits, 8);
+                }
+            }
+            if (pos > (uint64_t)b->valueBytes * 8) return FALSE;
+            break;
+        }
+        case ARCHIVE_STRING: {
+            for (uint32_t i = 0; i < n; i++) {
+                uint64_t len;
+                if (!GetVarint(v, b->valueBytes, &at, &len)) return FALSE;
+                if (len == 0) {
+                    if (i == 0) return FALSE;
+                    col->str[i] = col->str[i - 1];
+                    col->strLen[i] = col->strLen[i - 1];
+                    continue;
+                }
+                if (--len > b->valueBytes - at) return FALSE;
+                col->str[i] = (const char*)v + at;
+                col->strLen[i] = (uint32_t)len;
+                at += len;
+            }
+            break;
+        }
+        case ARCHIVE_EMPTY:
+            memset(col->i64, 0, n * sizeof col->i64[0]);
+            break;
+        default:
+            return FALSE;
+    }
+    r->blocksDecoded++;
+    return TRUE;
+}
+
+ULONGLONG ArchiveReader_Query(ArchiveReader *r, long series, int64_t fromNs, int64_t toNs,
+                              ArchiveColumn *col, ArchiveRangeFn fn, void *ctx)
+{
+    if (series < 0 || (uint32_t)series >= r->footer->seriesCount) return 0;
+    const ArchiveSeries *s = &r->series[series];
+    uint32_t lo = s->firstBlock, end = s->firstBlock + s->blockCount;
+    if (end > r->footer->blockCount) return 0;
+
+    // Blocks are in time order: find the first that ends at or after fromNs
+    uint32_t hi = end;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (r->blocks[mid].lastNs < fromNs) lo = mid + 1;
+        else hi = mid;
+    }
+
+    ULONGLONG handed = 0;
+    for (uint32_t i = lo; i < end && r->blocks[i].firstNs <= toNs; i++) {
+        if (!ArchiveReader_Decode(r, i, col)) break;
+        uint32_t first = 0, last = col->count;
+        while (first < last && col->timeNs[first] < fromNs) first++;
+        while (last > first && col->timeNs[last - 1] > toNs) last--;
+        if (first == last) continue;
+        handed += last - first;
+        if (!fn(ctx, col, first, last)) break;
+    }
+    return handed;
+}
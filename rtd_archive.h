@@ -0,0 +1,253 @@
+// rtd_archive.h - Compressed columnar tick archive
+// One file holds a whole capture of the decoded update stream, split into
+// a series per symbol x topic and compressed in blocks of up to
+// ARCHIVE_BLOCK_VALUES values:
+//
+//   header | blocks and time chunks | series table | block index |
+//   time chunk index | names | footer
+//
+// Every row of a RefreshData batch has the same receive time, so times
+// are kept once per batch: wall-clock nanoseconds, delta-of-delta coded in
+// chunks of ARCHIVE_TIME_CHUNK batches. A block stores the batch number
+// of each of its values as steps from the previous one. Steps and value
+// deltas are bit-packed: the block stores their smallest value and the
+// width of the largest offset from it, then that many bits each, so a
+// topic that moves every batch costs no bits per timestamp and a block
+// decodes without a branch per value. Values are coded by type:
+//   - doubles that are exact decimals with up to 6 places (prices) as
+//     the first scaled integer, then packed deltas; other doubles XORed
+//     with the previous value, as in Gorilla, but with one bit window for
+//     the whole block: a bit per unchanged value, else one plus the width
+//   - integers as packed deltas, after dividing out the power of ten
+//     every value shares (sizes in round lots)
+//   - strings as UTF-8, a repeat of the previous string in one byte
+// A value of another VARTYPE, a double with more decimal places than the
+// block uses, or an integer with fewer trailing zeros, starts a new block.
+//
+// The block index gives each block's series, time range and file offset,
+// so a query by symbol, topic and time decodes only the blocks it
+// overlaps. The index is written by ArchiveWriter_Close; until then the
+// file cannot be read, and the tick journal remains the crash-safe record
+// (ArchiveWriter_AppendJournal converts one afterwards).
+
+#ifndef __RTD_ARCHIVE_H__
+#define __RTD_ARCHIVE_H__
+
+#include <stdio.h>
+#include "rtd_compat.h"
+#include "rtd_journal.h"
+
+#define ARCHIVE_MAGIC        "RTDARCH1"
+#define ARCHIVE_END_MAGIC    "RTDAEND1"
+#define ARCHIVE_VERSION      1
+#define ARCHIVE_BLOCK_VALUES 1024
+#define ARCHIVE_BLOCK_BYTES  8192       // Value column size that also closes a block
+#define ARCHIVE_TIME_CHUNK   4096       // Batches per time chunk
+#define ARCHIVE_MAX_SCALE    6          // Decimal places tried for doubles, zeros for integers
+
+// ArchiveBlock.codec
+#define ARCHIVE_EMPTY    0  // No value column (VT_EMPTY, VT_NULL)
+#define ARCHIVE_DECIMAL  1  // double = integer / 10^scale
+#define ARCHIVE_XOR      2  // double XORed with the previous one
+#define ARCHIVE_INT      3  // Integer types: integer = n * 10^scale
+#define ARCHIVE_STRING   4  // VT_BSTR as UTF-8
+
+#pragma pack(push, 8)
+typedef struct ArchiveHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t blockValues;
+    uint64_t createdWallNs;
+    uint64_t reserved;
+} ArchiveHeader;            // 32 bytes
+
+typedef struct ArchiveBlock {
+    uint64_t offset;        // Batch column; the value column follows it
+    int64_t  firstNs;       // Wall-clock times of its first and last values
+    int64_t  lastNs;
+    uint64_t firstBatch;    // Batch number of its first value
+    uint32_t series;
+    uint32_t count;
+    uint32_t batchBytes;
+    uint32_t valueBytes;
+    uint16_t vt;            // VARTYPE of every value in the block
+    uint8_t  codec;
+    uint8_t  scale;         // DECIMAL: decimal places; INT: trailing zeros
+    uint32_t reserved;
+} ArchiveBlock;             // 56 bytes
+
+typedef struct ArchiveTimeChunk {
+    uint64_t offset;
+    int64_t  firstNs;       // Time of its first batch, which is not in the chunk
+    uint32_t count;         // Batches, including the first
+    uint32_t bytes;
+} ArchiveTimeChunk;         // 24 bytes
+
+typedef struct ArchiveSeries {
+    uint32_t symbol;        // Offsets into the name table
+    uint32_t topic;
+    uint32_t firstBlock;    // Its blocks are contiguous in the index, oldest first
+    uint32_t blockCount;
+    uint64_t values;
+} ArchiveSeries;            // 24 bytes
+
+typedef struct ArchiveFooter {
+    uint64_t values;
+    uint64_t batches;
+    uint64_t seriesOffset;
+    uint64_t blockOffset;
+    uint64_t chunkOffset;
+    uint64_t namesOffset;
+    uint64_t namesBytes;
+    uint32_t seriesCount;
+    uint32_t blockCount;
+    uint32_t chunkCount;
+    uint32_t reserved;
+    char     magic[8];
+} ArchiveFooter;            // 80 bytes, last in the file
+#pragma pack(pop)
+
+// Growable column buffer, written a bit or a byte at a time
+typedef struct ArchiveBits {
+    BYTE    *buf;
+    size_t   len;           // Whole bytes stored
+    size_t   cap;
+    uint64_t acc;           // Bits not stored yet, the oldest lowest
+    int      fill;
+} ArchiveBits;
+
+// One series being written: its open block and coding state
+typedef struct ArchiveStream {
+    uint32_t    symbol;     // Offsets into the name table
+    uint32_t    topic;
+    uint64_t    values;
+
+    uint32_t    count;      // Values in the open block
+    uint16_t    vt;
+    uint8_t     codec;
+    uint8_t     scale;
+    uint8_t     minScale;   // Most decimal places the series has needed
+    uint8_t     maxZeros;   // Fewest trailing zeros its integers have had
+    int64_t     firstNs;
+    int64_t     lastNs;
+    uint64_t    firstBatch;
+    uint64_t    lastBatch;
+    int64_t     batchMin;   // Smallest and largest batch number step
+    int64_t     batchMax;
+    int64_t     lastInt;    // DECIMAL and INT
+    int64_t     deltaMin;   // Smallest and largest value delta
+    int64_t     deltaMax;
+    uint64_t    lastBits;   // XOR
+    uint64_t    xorAny;     // XOR: every bit any value changed
+    size_t      lastStr;    // STRING: offset and length of the previous value
+    uint32_t    lastStrLen;
+    ArchiveBits batches;    // Staged as zigzag varints until the block is written
+    ArchiveBits column;
+} ArchiveStream;
+
+typedef struct ArchiveWriter {
+    FILE             *file;
+    uint64_t          offset;           // Bytes written so far
+    LONGLONG          wallOffsetNs;     // RtdWallNs() - RtdNowNs()
+
+    long             *topicStream;      // Stream index + 1 per topic ID, 0 = not defined
+    long              topicCap;
+    ArchiveStream    *streams;
+    long              streamCount;
+    long              streamCap;
+    long             *hash;             // Stream index + 1 by symbol/topic name
+    long              hashCap;
+    char             *names;            // symbol NUL topic NUL ...
+    size_t            namesLen;
+    size_t            namesCap;
+    char             *scratch;          // UTF-8 of the string value being appended
+    size_t            scratchCap;
+
+    ArchiveBlock     *blocks;
+    long              blockCount;
+    long              blockCap;
+    ArchiveTimeChunk *chunks;
+    long              chunkCount;
+    long              chunkCap;
+    ArchiveBits       times;            // Open time chunk
+    ArchiveBits       packed;           // Block being written, bit-packed
+    uint32_t          chunkBatches;
+    int64_t           batchNs;          // Time of the newest batch
+    int64_t           lastTimeDelta;
+    uint64_t          batches;
+
+    ULONGLONG         values;
+    ULONGLONG         undefined;        // Updates for topic IDs never defined
+    ULONGLONG         errors;
+} ArchiveWriter;
+
+BOOL ArchiveWriter_Open(ArchiveWriter *a, const char *path);
+
+// Name a topic ID; updates for it go to the symbol x topic series
+BOOL ArchiveWriter_Define(ArchiveWriter *a, long topicID, const WCHAR *symbol, const WCHAR *topic);
+
+// Append one decoded update, timed by its receive time
+BOOL ArchiveWriter_Append(ArchiveWriter *a, const RtdUpdate *u);
+
+// Append every update of a tick journal (all of prefix's files), timed
+// by the wall clock the journal recorded
+BOOL ArchiveWriter_AppendJournal(ArchiveWriter *a, const char *prefix);
+
+// Write the open blocks and the index, then close the file
+BOOL ArchiveWriter_Close(ArchiveWriter *a);
+
+// One block decoded: count values of one series, oldest first
+typedef struct ArchiveColumn {
+    uint32_t    series;
+    uint32_t    count;
+    VARTYPE     vt;
+    int64_t     timeNs[ARCHIVE_BLOCK_VALUES];       // Wall clock, ns since the epoch
+    union {
+        double  dbl[ARCHIVE_BLOCK_VALUES];
+        int64_t i64[ARCHIVE_BLOCK_VALUES];
+    };
+    const char *str[ARCHIVE_BLOCK_VALUES];          // Into the mapping, not NUL terminated
+    uint32_t    strLen[ARCHIVE_BLOCK_VALUES];
+    uint64_t    batch[ARCHIVE_BLOCK_VALUES];
+} ArchiveColumn;
+
+typedef struct ArchiveReader {
+    MappedFile              map;
+    const ArchiveFooter    *footer;
+    const ArchiveSeries    *series;
+    const ArchiveBlock     *blocks;
+    const ArchiveTimeChunk *chunks;
+    const char             *names;
+    int64_t               **times;          // Batch times per chunk, decoded on first use
+    ULONGLONG               blocksDecoded;
+    ULONGLONG               chunksDecoded;
+} ArchiveReader;
+
+// Values [first, end) of col fall in the range asked for; return FALSE to stop
+typedef BOOL (*ArchiveRangeFn)(void *ctx, const ArchiveColumn *col, uint32_t first, uint32_t end);
+
+BOOL ArchiveReader_Open(ArchiveReader *r, const char *path);
+void ArchiveReader_Close(ArchiveReader *r);
+
+// Series index for a symbol and topic, or -1
+long ArchiveReader_Find(const ArchiveReader *r, const char *symbol, const char *topic);
+
+static inline const char* ArchiveReader_Symbol(const ArchiveReader *r, long series)
+{
+    return r->names + r->series[series].symbol;
+}
+
+static inline const char* ArchiveReader_Topic(const ArchiveReader *r, long series)
+{
+    return r->names + r->series[series].topic;
+}
+
+// Decode block index (0 .. footer->blockCount - 1) into col
+BOOL ArchiveReader_Decode(ArchiveReader *r, uint32_t block, ArchiveColumn *col);
+
+// Hand fn every value of a series with fromNs <= time <= toNs, decoding
+// only the blocks that overlap the range. Returns the values handed over.
+ULONGLONG ArchiveReader_Query(ArchiveReader *r, long series, int64_t fromNs, int64_t toNs,
+                              ArchiveColumn *col, ArchiveRangeFn fn, void *ctx);
+
+#endif /* __RTD_ARCHIVE_H__ */
@@ -0,0 +1,317 @@
+/**
+ * rtd_bars.c - Real-time OHLCV bars
+ *
+ * A slot's timer is always set for the oldest bar it still holds: the
+ * previous bar while it waits out the grace period, otherwise the bar
+ * being built. Rows never scan other symbols; the wheel hands back only
+ * the slots whose bars are due.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtd_bars.h"
+
+BOOL BarBuilder_Init(BarBuilder *b, const QuoteStore *quotes, const ULONG *intervalsMs, int count,
+                     DWORD graceMs, ULONGLONG nowNs, BarEmitFn emit, void *ctx)
+{
+    memset(b, 0, sizeof *b);
+    if (count < 1 || count > BAR_MAX_INTERVALS) return FALSE;
+    for (int i = 0; i < count; i++) {
+        if (intervalsMs[i] == 0 || intervalsMs[i] > BAR_MAX_INTERVAL_MS) return FALSE;
+        b->intervalMs[i] = intervalsMs[i];
+        b->intervalNs[i] = (ULONGLONG)intervalsMs[i] * 1000000ULL;
+    }
+    b->intervalCount = count;
+    b->quotes = quotes;
+    b->graceNs = (ULONGLONG)graceMs * 1000000ULL;
+    b->wallOffsetNs = (LONGLONG)RtdWallNs() - (LONGLONG)RtdNowNs();
+    b->emit = emit;
+    b->ctx = ctx;
+    b->nowNs = nowNs;
+    return TimerWheel_Init(&b->wheel, BAR_TICK_NS, nowNs);
+}
+
+void BarBuilder_Free(BarBuilder *b)
+{
+    free(b->flags);
+    free(b->symbols);
+    free(b->slots);
+    free(b->dirty);
+    TimerWheel_Free(&b->wheel);
+    memset(b, 0, sizeof *b);
+}
+
+BOOL BarBuilder_ParseIntervals(const char *list, ULONG *intervalsMs, int *count)
+{
+    *count = 0;
+    const char *p = list;
+    while (*p) {
+        char *end;
+        unsigned long n = strtoul(p, &end, 10);
+        ULONGLONG ms;
+        if (end == p || n == 0) return FALSE;
+        if (strncmp(end, "ms", 2) == 0) { ms = n; end += 2; }
+        else if (*end == 's') { ms = n * 1000ULL; end++; }
+        else if (*end == 'm') { ms = n * 60000ULL; end++; }
+        else if (*end == 'h') { ms = n * 3600000ULL; end++; }
+        else return FALSE;
+        if (ms > BAR_MAX_INTERVAL_MS || *count == BAR_MAX_INTERVALS || (*end && *end != ',')) return FALSE;
+
+        // Insert in order
+        int i = *count;
+        while (i > 0 && intervalsMs[i - 1] > ms) {
+            intervalsMs[i] = intervalsMs[i - 1];
+            i--;
+        }
+        if (i > 0 && intervalsMs[i - 1] == ms) return FALSE;
+        intervalsMs[i] = (ULONG)ms;
+        (*count)++;
+        p = *end ? end + 1 : end;
+    }
+    return *count > 0;
+}
+
+int BarInterval_Format(ULONG intervalMs, char *out, size_t outSize)
+{
+    if (intervalMs % 3600000 == 0) return snprintf(out, outSize, "%luh", (unsigned long)(intervalMs / 3600000));
+    if (intervalMs % 60000 == 0) return snprintf(out, outSize, "%lum", (unsigned long)(intervalMs / 60000));
+    if (intervalMs % 1000 == 0) return snprintf(out, outSize, "%lus", (unsigned long)(intervalMs / 1000));
+    return snprintf(out, outSize, "%lums", (unsigned long)intervalMs);
+}
+
+static BOOL GrowSymbols(BarBuilder *b, long minCap)
+{
+    long newCap = b->symbolCap ? b->symbolCap * 2 : 1024;
+    while (newCap < minCap) newCap *= 2;
+    long added = newCap - b->symbolCap;
+    int k = b->intervalCount;
+
+    BYTE *flags = (BYTE*)realloc(b->flags, newCap);
+    if (!flags) return FALSE;
+    memset(flags + b->symbolCap, 0, added);
+    b->flags = flags;
+
+    BarSymbol *symbols = (BarSymbol*)realloc(b->symbols, newCap * sizeof *symbols);
+    if (!symbols) return FALSE;
+    memset(symbols + b->symbolCap, 0, added * sizeof *symbols);
+    b->symbols = symbols;
+
+    BarSlot *slots = (BarSlot*)realloc(b->slots, (size_t)newCap * k * sizeof *slots);
+    if (!slots) return FALSE;
+    memset(slots + (size_t)b->symbolCap * k, 0, (size_t)added * k * sizeof *slots);
+    b->slots = slots;
+
+    // Each symbol is queued at most once per batch
+    long *dirty = (long*)realloc(b->dirty, newCap * sizeof *dirty);
+    if (!dirty) return FALSE;
+    b->dirty = dirty;
+    b->symbolCap = newCap;
+    return TRUE;
+}
+
+BOOL BarBuilder_Track(BarBuilder *b, const TopicSubscription *sub)
+{
+    const QuoteStore *q = b->quotes;
+    int col = sub->fieldID < q->fieldCap ? q->column[sub->fieldID] : QF_NONE;
+    if (col != QF_LAST && col != QF_VOLUME) return TRUE;
+    if (sub->symbolID >= b->symbolCap && !GrowSymbols(b, sub->symbolID + 1)) return FALSE;
+    if (!b->flags[sub->symbolID]) b->flags[sub->symbolID] = BAR_TRACKED;
+    b->symbols[sub->symbolID].inputs++;
+    return TRUE;
+}
+
+void BarBuilder_Untrack(BarBuilder *b, const TopicSubscription *sub)
+{
+    const QuoteStore *q = b->quotes;
+    long sym = sub->symbolID;
+    int col = sub->fieldID < q->fieldCap ? q->column[sub->fieldID] : QF_NONE;
+    if ((col != QF_LAST && col != QF_VOLUME) || sym <= 0 || sym >= b->symbolCap) return;
+    if (b->symbols[sym].inputs && --b->symbols[sym].inputs == 0) BarBuilder_ClearSymbol(b, sym);
+}
+
+static ULONGLONG BarDeadline(const BarBuilder *b, int k, ULONGLONG startWallNs)
+{
+    return (ULONGLONG)((LONGLONG)(startWallNs + b->intervalNs[k]) - b->wallOffsetNs) + b->graceNs;
+}
+
+/**
+ * Set a slot's timer for the oldest bar it holds
+ */
+static void Arm(BarBuilder *b, BarSlot *s, ULONG id, int k)
+{
+    if (s->closing) TimerWheel_Schedule(&b->wheel, id, BarDeadline(b, k, s->prev.startWallNs));
+    else if (s->open) TimerWheel_Schedule(&b->wheel, id, BarDeadline(b, k, s->bar.startWallNs));
+    else TimerWheel_Cancel(&b->wheel, id);
+}
+
+static void Emit(BarBuilder *b, Bar *bar, ULONGLONG closeNs, ULONGLONG deadline)
+{
+    bar->seq = ++b->seq;
+    bar->closeNs = closeNs;
+    if (closeNs > deadline && closeNs - deadline > b->maxCloseLagNs) b->maxCloseLagNs = closeNs - deadline;
+    b->bars++;
+    b->emit(b->ctx, bar);
+}
+
+static void Fold(Bar *bar, ULONGLONG t, BOOL priced, double price, LONGLONG volume)
+{
+    if (priced) {
+        if (price > bar->high) bar->high = price;
+        if (price < bar->low) bar->low = price;
+        if (t >= bar->lastNs) bar->close = price;
+        if (t < bar->firstNs) bar->open = price;
+    }
+    if (t > bar->lastNs) bar->lastNs = t;
+    if (t < bar->firstNs) bar->firstNs = t;
+    bar->volume += volume;
+    bar->ticks++;
+}
+
+/**
+ * Fold one symbol's rows at receive time t into one interval's bars
+ */
+static void ApplyTick(BarBuilder *b, long sym, int k, ULONGLONG t, BOOL priced, double price, LONGLONG volume)
+{
+    ULONG id = (ULONG)sym * b->intervalCount + k;
+    BarSlot *s = &b->slots[id];
+    LONGLONG bucket = ((LONGLONG)t + b->wallOffsetNs) / (LONGLONG)b->intervalNs[k];
+
+    if (bucket > s->bucket) {
+        if (s->open) {
+            if (s->closing) {
+                // A third bar began before the first's grace period ran out
+                s->prev.flags |= BAR_EARLY;
+                b->early++;
+                Emit(b, &s->prev, t, BarDeadline(b, k, s->prev.startWallNs));
+            }
+            s->prev = s->bar;
+            s->closing = TRUE;
+        }
+        Bar *bar = &s->bar;
+        memset(bar, 0, sizeof *bar);
+        bar->symbolID = sym;
+        bar->intervalMs = b->intervalMs[k];
+        bar->startWallNs = (ULONGLONG)bucket * b->intervalNs[k];
+        bar->open = bar->high = bar->low = bar->close = price;
+        bar->volume = volume + s->carry;
+        bar->ticks = 1;
+        bar->firstNs = bar->lastNs = t;
+        s->carry = 0;
+        s->bucket = bucket;
+        s->open = TRUE;
+        Arm(b, s, id, k);
+        return;
+    }
+
+    if (bucket == s->bucket && s->open) {
+        Fold(&s->bar, t, priced, price, volume);
+    } else if (s->closing && (ULONGLONG)bucket * b->intervalNs[k] == s->prev.startWallNs) {
+        Fold(&s->prev, t, priced, price, volume);
+        s->prev.flags |= BAR_LATE;
+        b->late++;
+    } else {
+        // Its bar is closed: keep the volume for the open or next bar
+        b->dropped++;
+        if (s->open) s->bar.volume += volume;
+        else s->carry += volume;
+    }
+}
+
+void BarBuilder_FlushSymbol(BarBuilder *b, long symbolID)
+{
+    BarSymbol *s = &b->symbols[symbolID];
+    ULONG fields = s->pendingFields;
+    if (!fields) return;
+    s->pendingFields = 0;
+
+    LONGLONG volume = 0;
+    if (fields & (1u << QF_VOLUME)) {
+        if (s->hasVolume) {
+            volume = s->pendingVolume - s->volume;
+            if (volume < 0) {
+                // A new session or a correction: start counting again
+                b->volumeResets++;
+                volume = 0;
+            }
+        }
+        s->volume = s->pendingVolume;
+        s->hasVolume = TRUE;
+    }
+    BOOL priced = (fields & (1u << QF_LAST)) != 0;
+    if (priced) {
+        s->price = s->pendingPrice;
+        s->hasPrice = TRUE;
+    }
+    if (!priced && volume == 0) return;
+    if (!s->hasPrice) {
+        s->carry += volume;
+        return;
+    }
+    volume += s->carry;
+    s->carry = 0;
+
+    for (int k = 0; k < b->intervalCount; k++) {
+        ApplyTick(b, symbolID, k, s->pendingNs, priced, s->price, volume);
+    }
+}
+
+void BarBuilder_EndBatch(BarBuilder *b)
+{
+    for (long i = 0; i < b->dirtyCount; i++) {
+        long sym = b->dirty[i];
+        BarBuilder_FlushSymbol(b, sym);
+        if (b->flags[sym]) b->flags[sym] = BAR_TRACKED;
+    }
+    b->dirtyCount = 0;
+}
+
+void BarBuilder_ClearSymbol(BarBuilder *b, long symbolID)
+{
+    if (symbolID <= 0 || symbolID >= b->symbolCap) return;
+    BarBuilder_FlushSymbol(b, symbolID);
+
+    // Close what the symbol still holds, oldest first, before forgetting it
+    ULONG first = (ULONG)symbolID * b->intervalCount;
+    for (int k = 0; k < b->intervalCount; k++) {
+        BarSlot *s = &b->slots[first + k];
+        TimerWheel_Cancel(&b->wheel, first + k);
+        if (s->closing) Emit(b, &s->prev, b->nowNs, BarDeadline(b, k, s->prev.startWallNs));
+        if (s->open) {
+            s->bar.flags |= BAR_CLEARED;
+            Emit(b, &s->bar, b->nowNs, BarDeadline(b, k, s->bar.startWallNs));
+        }
+    }
+    memset(&b->slots[first], 0, b->intervalCount * sizeof *b->slots);
+    memset(&b->symbols[symbolID], 0, sizeof *b->symbols);
+
+    // Still on the dirty list if queued; EndBatch finds nothing pending
+    b->flags[symbolID] = 0;
+}
+
+/**
+ * WheelFireFn: close the oldest bar of a slot and set its next timer
+ */
+static void CloseSlot(void *ctx, ULONG id, ULONGLONG dueNs)
+{
+    BarBuilder *b = (BarBuilder*)ctx;
+    int k = (int)(id % b->intervalCount);
+    BarSlot *s = &b->slots[id];
+
+    if (s->closing) {
+        Emit(b, &s->prev, b->nowNs, BarDeadline(b, k, s->prev.startWallNs));
+        s->closing = FALSE;
+    } else if (s->open) {
+        Emit(b, &s->bar, b->nowNs, BarDeadline(b, k, s->bar.startWallNs));
+        s->open = FALSE;
+    }
+    Arm(b, s, id, k);
+}
+
+ULONG BarBuilder_Advance(BarBuilder *b, ULONGLONG nowNs)
+{
+    ULONGLONG before = b->bars;
+    b->nowNs = nowNs;
+    TimerWheel_Advance(&b->wheel, nowNs, CloseSlot, b);
+    return (ULONG)(b->bars - before);
+}
@@ -0,0 +1,210 @@
+// rtd_bars.h - Real-time OHLCV bars
+// Each tracked symbol builds bars at up to BAR_MAX_INTERVALS intervals at
+// once (1s, 1m and 5m, say) from its LAST and VOLUME rows. LAST sets the
+// open, high, low and close; the volume of a bar is the sum of increases
+// in the cumulative VOLUME topic, so a trade at an unchanged price still
+// counts. Bars are aligned to multiples of their interval in UTC and are
+// stamped with the receive time of the rows, the only clock RTD offers.
+//
+// Rows from one RefreshData batch share a receive time and are folded in
+// together, the price before the volume, so the trade that opens a bar
+// brings its own size. A bar stays open for graceMs past its end for
+// rows that arrive late (the sharded merge can hold rows back briefly);
+// it is then closed by a timing wheel, so closing thousands of bars at a
+// boundary costs nothing per symbol until that boundary. Rows for a bar
+// already closed are late: their price is dropped and their volume goes
+// into the symbol's open bar, so bar volumes still add up to the VOLUME
+// topic. Intervals with no trades produce no bar.
+
+#ifndef __RTD_BARS_H__
+#define __RTD_BARS_H__
+
+#include "rtd_quotes.h"
+#include "rtd_subs.h"
+#include "rtd_wheel.h"
+
+#define BAR_MAX_INTERVALS    8
+#define BAR_MAX_INTERVAL_MS  (4 * 3600 * 1000)
+#define BAR_DEFAULT_GRACE_MS 100
+#define BAR_TICK_NS          1000000     // Timing wheel resolution
+
+// Bar.flags
+#define BAR_LATE    0x01    // Took rows after its end, within the grace period
+#define BAR_EARLY   0x02    // Closed before its grace period ran out by a later bar's rows
+#define BAR_CLEARED 0x04    // Closed before its end because the symbol was cleared
+
+// BarBuilder.flags values, as in L1Assembler
+#define BAR_TRACKED 1
+#define BAR_QUEUED  2
+
+typedef struct Bar {
+    ULONGLONG seq;          // 1, 2, 3... across all symbols and intervals
+    ULONGLONG startWallNs;  // UTC, a multiple of the interval
+    ULONGLONG closeNs;      // RtdNowNs() clock: when the bar was closed
+    ULONGLONG firstNs;      // Receive times of its first and last rows
+    ULONGLONG lastNs;
+    long      symbolID;
+    ULONG     intervalMs;
+    ULONG     flags;
+    ULONG     ticks;        // Rows folded in
+    double    open;
+    double    high;
+    double    low;
+    double    close;
+    LONGLONG  volume;
+} Bar;
+
+typedef void (*BarEmitFn)(void *ctx, const Bar *bar);
+
+// One symbol x interval: the bar being built and the one before it while
+// it waits out the grace period
+typedef struct BarSlot {
+    LONGLONG  bucket;       // Interval number of the newest bar begun, 0 = none
+    BOOL      open;         // bar is still being built
+    BOOL      closing;      // prev is waiting out the grace period
+    LONGLONG  carry;        // Late volume owed to the next bar
+    Bar       bar;
+    Bar       prev;
+} BarSlot;
+
+// Rows of one batch not folded in yet, and the running cumulative volume
+typedef struct BarSymbol {
+    double    price;
+    BOOL      hasPrice;
+    LONGLONG  volume;
+    BOOL      hasVolume;
+    LONGLONG  carry;        // Volume that arrived before the first price
+    ULONG     inputs;       // LAST/VOLUME subscriptions tracked
+    ULONGLONG pendingNs;
+    double    pendingPrice;
+    LONGLONG  pendingVolume;
+    ULONG     pendingFields;    // 1u << QF_LAST / QF_VOLUME
+} BarSymbol;
+
+typedef struct BarBuilder {
+    const QuoteStore *quotes;
+    ULONG             intervalMs[BAR_MAX_INTERVALS];
+    ULONGLONG         intervalNs[BAR_MAX_INTERVALS];
+    int               intervalCount;
+    ULONGLONG         graceNs;
+    LONGLONG          wallOffsetNs;     // RtdWallNs() - RtdNowNs()
+    BarEmitFn         emit;
+    void             *ctx;
+
+    BYTE             *flags;            // BAR_TRACKED/QUEUED per symbol ID
+    BarSymbol        *symbols;
+    BarSlot          *slots;            // [symbolID * intervalCount + interval]
+    long              symbolCap;
+    long             *dirty;            // Symbols with rows pending
+    long              dirtyCount;
+    TimerWheel        wheel;            // Timer per slot: its oldest bar's end + grace
+    ULONGLONG         nowNs;            // Time of the Advance in progress
+    ULONGLONG         seq;
+
+    ULONGLONG         rows;             // LAST/VOLUME rows seen
+    ULONGLONG         bars;
+    ULONGLONG         late;             // Rows folded into a bar in its grace period
+    ULONGLONG         dropped;          // Rows whose bar had closed
+    ULONGLONG         early;
+    ULONGLONG         volumeResets;     // Cumulative VOLUME went down
+    ULONGLONG         maxCloseLagNs;    // Worst close after end + grace
+} BarBuilder;
+
+// intervalsMs must be ascending; nowNs starts the timing wheel
+BOOL BarBuilder_Init(BarBuilder *b, const QuoteStore *quotes, const ULONG *intervalsMs, int count,
+                     DWORD graceMs, ULONGLONG nowNs, BarEmitFn emit, void *ctx);
+void BarBuilder_Free(BarBuilder *b);
+
+// Parse "1s,1m,5m" (units ms, s, m, h) into ascending intervals
+BOOL BarBuilder_ParseIntervals(const char *list, ULONG *intervalsMs, int *count);
+
+// "250ms", "1s", "5m", "1h"
+int BarInterval_Format(ULONG intervalMs, char *out, size_t outSize);
+
+// Build bars for sub's symbol if sub is LAST or VOLUME; call after QuoteStore_Track
+BOOL BarBuilder_Track(BarBuilder *b, const TopicSubscription *sub);
+
+// Call when sub is removed: once the symbol has neither LAST nor VOLUME
+// left, BarBuilder_ClearSymbol. Other pairs leave its bars alone.
+void BarBuilder_Untrack(BarBuilder *b, const TopicSubscription *sub);
+
+// Stop building bars for a symbol until it is tracked again. Its pending
+// rows are folded in and the bars it still holds are closed now: one in
+// its grace period as it stands, the open one flagged BAR_CLEARED.
+void BarBuilder_ClearSymbol(BarBuilder *b, long symbolID);
+
+// Fold in the pending rows of one symbol
+void BarBuilder_FlushSymbol(BarBuilder *b, long symbolID);
+
+/**
+ * Note a LAST or VOLUME row for sub. Rows with the same receive time are
+ * held and folded in together.
+ */
+static inline void BarBuilder_Apply(BarBuilder *b, const TopicSubscription *sub, const RtdUpdate *u)
+{
+    long sym = sub->symbolID;
+    if (sym >= b->symbolCap || !b->flags[sym]) return;
+    const QuoteStore *q = b->quotes;
+    int col = sub->fieldID < q->fieldCap ? q->column[sub->fieldID] : QF_NONE;
+    if (col != QF_LAST && col != QF_VOLUME) return;
+
+    double d;
+    switch (u->vt) {
+        case VT_R8:
+        case VT_R4: d = u->dblVal; break;
+        case VT_I4:
+        case VT_I8:
+        case VT_I2: d = (double)u->llVal; break;
+        default: return;
+    }
+
+    BarSymbol *s = &b->symbols[sym];
+    if (b->flags[sym] == BAR_QUEUED && s->pendingNs != u->recvNs) BarBuilder_FlushSymbol(b, sym);
+    if (b->flags[sym] == BAR_TRACKED) {
+        b->flags[sym] = BAR_QUEUED;
+        b->dirty[b->dirtyCount++] = sym;
+    }
+    s->pendingNs = u->recvNs;
+    s->pendingFields |= 1u << col;
+    if (col == QF_LAST) s->pendingPrice = d;
+    else s->pendingVolume = u->vt == VT_R8 || u->vt == VT_R4 ? (LONGLONG)d : u->llVal;
+    b->rows++;
+}
+
+// Fold in every pending row; call at the end of each batch
+void BarBuilder_EndBatch(BarBuilder *b);
+
+// Close every bar whose end + grace is at or before nowNs. Returns the
+// bars closed.
+ULONG BarBuilder_Advance(BarBuilder *b, ULONGLONG nowNs);
+
+// When the next Advance could have a bar to close (~0 if none is open)
+static inline ULONGLONG BarBuilder_NextCloseNs(const BarBuilder *b)
+{
+    return TimerWheel_NextDueNs(&b->wheel);
+}
+
+// Closed bars handed to an output worker, like L1Ring
+typedef RecordRing BarRing;
+
+static inline BOOL BarRing_Init(BarRing *r, ULONG capacity)
+{
+    return RecordRing_Init(r, capacity, sizeof(Bar));
+}
+
+static inline void BarRing_Free(BarRing *r)
+{
+    RecordRing_Free(r);
+}
+
+static inline BOOL BarRing_Push(BarRing *r, const Bar *bar)
+{
+    return RecordRing_Push(r, bar);
+}
+
+static inline ULONG BarRing_Pop(BarRing *r, Bar *out, ULONG max)
+{
+    return RecordRing_Pop(r, out, max);
+}
+
+#endif /* __RTD_BARS_H__ */
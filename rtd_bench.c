@@ -0,0 +1,3481 @@
+/**
+ * rtd_bench.c - Benchmarks for the portable RTD client core
+ *
+ * Runs on Linux against the rtd_compat.h stand-ins so hot paths can be
+ * measured without a live ThinkOrSwim. Pass case names to run a subset.
+ *
+ *   rtd_bench [case ...]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtd_analytics.h"
+#include "rtd_archive.h"
+#include "rtd_bars.h"
+#include "rtd_chain.h"
+#include "rtd_compat.h"
+#include "rtd_conflate.h"
+#include "rtd_decode.h"
+#include "rtd_format.h"
+#include "rtd_journal.h"
+#include "rtd_l1.h"
+#include "rtd_metrics.h"
+#include "rtd_net.h"
+#include "rtd_output.h"
+#include "rtd_pool.h"
+#include "rtd_quotes.h"
+#include "rtd_session.h"
+#include "rtd_shard.h"
+#include "rtd_shm.h"
+#include "rtd_sim.h"
+#include "rtd_stale.h"
+#include "rtd_subs.h"
+#include "rtd_supervisor.h"
+#include "rtd_wake.h"
+#include "rtd_watchlist.h"
+#include "rtd_wheel.h"
+
+// Rows per batch handed to an output writer, as in rtd_client's workers
+#define WORKER_ROWS 256
+
+typedef struct BenchCase {
+    const char *name;
+    const char *description;
+    void (*run)(void);
+} BenchCase;
+
+// Checks failed by the case being run; main exits nonzero if any case failed
+static ULONGLONG g_failures;
+
+/**
+ * Count a check that did not hold, naming it in the output
+ */
+static void Expect(BOOL ok, const char *what)
+{
+    if (ok) return;
+    printf("  FAILED: %s\n", what);
+    g_failures++;
+}
+
+/**
+ * Print one result line
+ */
+static void Report(const char *name, ULONGLONG items, ULONGLONG elapsedNs)
+{
+    printf("%-28s %12llu items %10.2f ns/item %14.0f items/s\n", name, items,
+           (double)elapsedNs / (double)items, (double)items * 1e9 / (double)elapsedNs);
+}
+
+/**
+ * Journal: append 10M records (5% strings) through rotation, then scan
+ * them back through the zero-copy reader
+ */
+static void BenchJournal(void)
+{
+    const ULONGLONG total = 10000000;
+    const char *prefix = "rtd_bench_journal";
+    Journal j;
+    RtdUpdate u;
+    WCHAR text[16] = L"NASDAQ";
+
+    if (!Journal_Open(&j, prefix, 64ULL << 20)) {
+        printf("journal: cannot open %s\n", prefix);
+        return;
+    }
+    for (long id = 1; id <= 5000; id++) Journal_Define(&j, id, L"SYM", L"LAST");
+
+    BSTR str = SysAllocString(text);
+    ULONGLONG start = RtdNowNs();
+    for (ULONGLONG i = 0; i < total; i++) {
+        u.recvNs = start + i;
+        u.topicID = (long)(i % 5000) + 1;
+        if (i % 20 == 0) {
+            u.vt = VT_BSTR;
+            u.bstrVal = str;
+        } else {
+            u.vt = VT_R8;
+            u.dblVal = 100.0 + (double)(i & 1023) * 0.01;
+        }
+        Journal_Append(&j, &u);
+    }
+    ULONGLONG elapsed = RtdNowNs() - start;
+    ULONGLONG files = j.fileIndex;
+    Journal_Close(&j);
+    SysFreeString(str);
+    Report("journal append", total, elapsed);
+
+    // Read every file back without copying records
+    ULONGLONG records = 0, strings = 0;
+    double sum = 0;
+    start = RtdNowNs();
+    for (uint32_t f = 1; f <= files; f++) {
+        char path[300];
+        JournalReader r;
+        Journal_FilePath(path, sizeof path, prefix, f, "rtj");
+        if (!JournalReader_Open(&r, path)) break;
+        for (uint64_t i = 0; i < r.count; i++) {
+            const JournalRecord *rec = &r.records[i];
+            if (rec->kind != JOURNAL_UPDATE) continue;
+            if (rec->vt == VT_R8) sum += rec->value.dbl;
+            else if (rec->vt == VT_BSTR && JournalReader_String(&r, rec->value.str, NULL)) strings++;
+            records++;
+        }
+        JournalReader_Close(&r);
+    }
+    elapsed = RtdNowNs() - start;
+    Report("journal mmap scan", records, elapsed);
+    printf("  %llu files, %llu string values, checksum %.2f\n", files, strings, sum);
+
+    for (uint32_t f = 1; f <= files; f++) {
+        char path[300];
+        Journal_FilePath(path, sizeof path, prefix, f, "rtj");
+        remove(path);
+        Journal_FilePath(path, sizeof path, prefix, f, "rts");
+        remove(path);
+    }
+}
+
+/**
+ * Minimal IRTDUpdateEvent that rings an RtdWakeup
+ */
+typedef struct BenchCallback {
+    IRTDUpdateEvent iface;
+    RtdWakeup      *wakeup;
+    Supervisor     *supervisor;     // Told about Disconnect, may be NULL
+} BenchCallback;
+
+static HRESULT STDMETHODCALLTYPE BenchCB_QueryInterface(IRTDUpdateEvent *This, REFIID riid, void **ppv)
+{
+    *ppv = This;
+    return S_OK;
+}
+
+static ULONG STDMETHODCALLTYPE BenchCB_AddRef(IRTDUpdateEvent *This)  { return 1; }
+static ULONG STDMETHODCALLTYPE BenchCB_Release(IRTDUpdateEvent *This) { return 1; }
+
+static HRESULT STDMETHODCALLTYPE BenchCB_GetTypeInfoCount(IRTDUpdateEvent *This, UINT *pctinfo)
+{
+    *pctinfo = 0;
+    return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE BenchCB_GetTypeInfo(IRTDUpdateEvent *This, UINT iTInfo, LCID lcid, ITypeInfo **ppTInfo)
+{
+    return E_NOTIMPL;
+}
+
+static HRESULT STDMETHODCALLTYPE BenchCB_GetIDsOfNames(IRTDUpdateEvent *This, REFIID riid, LPOLESTR *rgszNames, UINT cNames, LCID lcid, DISPID *rgDispId)
+{
+    return E_NOTIMPL;
+}
+
+static HRESULT STDMETHODCALLTYPE BenchCB_Invoke(IRTDUpdateEvent *This, DISPID dispIdMember, REFIID riid, LCID lcid, WORD wFlags, DISPPARAMS *pDispParams, VARIANT *pVarResult, EXCEPINFO *pExcepInfo, UINT *puArgErr)
+{
+    return E_NOTIMPL;
+}
+
+static HRESULT STDMETHODCALLTYPE BenchCB_UpdateNotify(IRTDUpdateEvent *This)
+{
+    Wakeup_Signal(((BenchCallback*)This)->wakeup);
+    return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE BenchCB_GetHeartbeatInterval(IRTDUpdateEvent *This, long *plRetVal)
+{
+    *plRetVal = 100;
+    return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE BenchCB_PutHeartbeatInterval(IRTDUpdateEvent *This, long plRetVal)
+{
+    return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE BenchCB_Disconnect(IRTDUpdateEvent *This)
+{
+    BenchCallback *cb = (BenchCallback*)This;
+    if (cb->supervisor) {
+        Supervisor_SignalDisconnect(cb->supervisor);
+        Wakeup_Signal(cb->wakeup);
+    }
+    return S_OK;
+}
+
+static IRTDUpdateEventVtbl benchcb_vtbl = {
+    BenchCB_QueryInterface,
+    BenchCB_AddRef,
+    BenchCB_Release,
+    BenchCB_GetTypeInfoCount,
+    BenchCB_GetTypeInfo,
+    BenchCB_GetIDsOfNames,
+    BenchCB_Invoke,
+    BenchCB_UpdateNotify,
+    BenchCB_GetHeartbeatInterval,
+    BenchCB_PutHeartbeatInterval,
+    BenchCB_Disconnect
+};
+
+static void CountRow(void *ctx, TopicSubscription *sub, VARIANT *value)
+{
+    (*(ULONGLONG*)ctx)++;
+}
+
+/**
+ * Drive a simulated server the way rtd_client's event loop does:
+ * subscribe topicCount topics, then wait/RefreshData/dispatch for seconds
+ */
+static void RunSimClient(const char *label, const SimConfig *cfg, long topicCount, double seconds)
+{
+    SubscriptionTable subs;
+    RtdWakeup wakeup;
+    BenchCallback cb = { { &benchcb_vtbl }, &wakeup };
+    WCHAR symbol[32];
+    static const WCHAR *topics[] = { L"LAST", L"BID", L"ASK", L"VOLUME" };
+
+    Wakeup_Init(&wakeup, 0);
+    SubTable_Init(&subs, topicCount);
+    IRtdServer *srv = SimServer_Create(cfg);
+
+    ULONGLONG start = RtdNowNs();
+    for (long i = 0; i < topicCount; i++) {
+        swprintf(symbol, ARRAYSIZE(symbol), L"SYM%ld", i / 4);
+        TopicSubscription *sub = SubTable_Add(&subs, symbol, topics[i % 4]);
+        ConnectSubscription(srv, sub);
+    }
+    ULONGLONG connectNs = RtdNowNs() - start;
+    srv->lpVtbl->ServerStart(srv, &cb.iface, &(long){0});
+
+    ULONGLONG rows = 0;
+    start = RtdNowNs();
+    ULONGLONG end = start + (ULONGLONG)(seconds * 1e9);
+    while (RtdNowNs() < end) {
+        if (Wakeup_Wait(&wakeup, 100) != WAKE_SIGNALED) continue;
+        Wakeup_Consume(&wakeup);
+
+        long count = 0;
+        SAFEARRAY *out = NULL;
+        if (SUCCEEDED(srv->lpVtbl->RefreshData(srv, &count, &out)) && out) {
+            SubTable_Dispatch(&subs, out, count, CountRow, &rows);
+            SafeArrayDestroy(out);
+        }
+    }
+    ULONGLONG elapsed = RtdNowNs() - start;
+
+    SimStats st;
+    SimServer_GetStats(srv, &st);
+    srv->lpVtbl->ServerTerminate(srv);
+    srv->lpVtbl->Release(srv);
+
+    Report(label, rows, elapsed);
+    printf("  %ld topics connected in %.1f ms, %llu generated, %llu conflated\n",
+           topicCount, connectNs / 1e6, st.generated, st.conflated);
+    printf("  %llu RefreshData calls, %.0f rows/batch (max %llu)\n", st.refreshCalls,
+           st.refreshCalls ? (double)st.rowsDelivered / st.refreshCalls : 0.0, st.maxRows);
+    printf("  notify->wake avg %.1f us max %.1f us, change->RefreshData avg %.1f us max %.1f us\n",
+           wakeup.wakeCount ? wakeup.totalLatencyNs / 1e3 / wakeup.wakeCount : 0.0, wakeup.maxLatencyNs / 1e3,
+           st.rowsDelivered ? st.totalRowAgeNs / 1e3 / st.rowsDelivered : 0.0, st.maxRowAgeNs / 1e3);
+
+    SubTable_Free(&subs);
+    Wakeup_Free(&wakeup);
+}
+
+/**
+ * Simulated server: 100k topics at 1M updates/s, then unthrottled
+ */
+static void BenchSim(void)
+{
+    SimConfig cfg;
+    memset(&cfg, 0, sizeof cfg);
+    cfg.mode = SIM_SYNTHETIC;
+    cfg.seed = 42;
+
+    cfg.updatesPerSec = 1e6;
+    RunSimClient("sim 100k topics @1M/s", &cfg, 100000, 2.0);
+
+    cfg.updatesPerSec = 0;
+    RunSimClient("sim 100k topics max", &cfg, 100000, 2.0);
+}
+
+/**
+ * Build a 2 x rows RefreshData result: topic IDs 1..rows in shuffled order,
+ * values r8Percent% VT_R8 and the rest 5:3 VT_I4 to VT_BSTR
+ */
+static SAFEARRAY* MakeRefreshBatch(long rows, unsigned seed, unsigned r8Percent)
+{
+    static const WCHAR *strings[] = { L"NASDAQ", L"NYSE", L"Apple Inc. - Common Stock", L"ARCA" };
+    SAFEARRAYBOUND bounds[2] = { { 2, 0 }, { (ULONG)rows, 0 } };
+    SAFEARRAY *arr = SafeArrayCreate(VT_VARIANT, 2, bounds);
+    VARIANT *data = NULL;
+    long *ids = (long*)malloc(rows * sizeof *ids);
+
+    for (long i = 0; i < rows; i++) ids[i] = i + 1;
+    for (long i = rows - 1; i > 0; i--) {
+        seed = seed * 1103515245u + 12345u;
+        long j = (long)((seed >> 8) % (unsigned)(i + 1));
+        long t = ids[i]; ids[i] = ids[j]; ids[j] = t;
+    }
+
+    SafeArrayAccessData(arr, (void**)&data);
+    for (long i = 0; i < rows; i++) {
+        VARIANT *row = &data[i * 2];
+        row[0].vt = VT_I4;
+        row[0].lVal = ids[i];
+        seed = seed * 1103515245u + 12345u;
+        unsigned pick = (seed >> 8) % 100;
+        if (pick < r8Percent) {
+            row[1].vt = VT_R8;
+            row[1].dblVal = 100.0 + (double)((seed >> 4) % 100000) * 0.01;
+        } else if (pick < r8Percent + (100 - r8Percent) * 5 / 8) {
+            row[1].vt = VT_I4;
+            row[1].lVal = (LONG)((seed >> 4) % 10000000);
+        } else {
+            row[1].vt = VT_BSTR;
+            row[1].bstrVal = SysAllocString(strings[(seed >> 4) % ARRAYSIZE(strings)]);
+        }
+    }
+    SafeArrayUnaccessData(arr);
+    free(ids);
+    return arr;
+}
+
+/**
+ * Print one stage result line
+ */
+static void ReportStage(const char *stage, long rows, ULONGLONG batches, ULONGLONG elapsedNs, LONGLONG allocs)
+{
+    double total = (double)rows * (double)batches;
+    printf("%-13s %7ld rows %10.2f ns/row %14.0f rows/s %8.2f allocs/batch\n", stage, rows,
+           (double)elapsedNs / total, total * 1e9 / (double)elapsedNs, (double)allocs / (double)batches);
+}
+
+static void IgnoreRow(void *ctx, TopicSubscription *sub, VARIANT *value)
+{
+    (*(ULONGLONG*)ctx)++;
+}
+
+/**
+ * Format one update the way the console output worker does
+ */
+static int FormatLine(const TopicSubscription *sub, const RtdUpdate *u, WCHAR *text, size_t textSize)
+{
+    WCHAR valueStr[128];
+    Format_UpdateValue(u, FORMAT_DEFAULT_DECIMALS, valueStr, ARRAYSIZE(valueStr));
+    return swprintf(text, textSize, L"[%02d:%02d:%02d.%03d] %ls %ls = %ls\n",
+                    13, 45, 22, 124, sub->symbol, sub->topic, valueStr);
+}
+
+typedef struct DecodeFormatCtx {
+    RtdUpdate u;
+    WCHAR     text[256];
+    ULONGLONG chars;
+} DecodeFormatCtx;
+
+static void DecodeFormatRow(void *ctx, TopicSubscription *sub, VARIANT *value)
+{
+    DecodeFormatCtx *c = (DecodeFormatCtx*)ctx;
+    if (!RtdUpdate_FromVariant(&c->u, sub->topicID, value, 0)) return;
+    c->chars += FormatLine(sub, &c->u, c->text, ARRAYSIZE(c->text));
+    RtdUpdate_Clear(&c->u);
+}
+
+/**
+ * RefreshData hot path, one stage at a time, for 1 to 100k row batches:
+ *   decode   - walk the SAFEARRAY and copy each value into an RtdUpdate
+ *   dispatch - SubTable_Dispatch with an empty handler (ID check + lookup)
+ *   format   - value and console line text for already decoded updates
+ *   total    - dispatch + decode + format, as the client does per row
+ */
+static void BenchDecode(void)
+{
+    static const long sizes[] = { 1, 10, 100, 1000, 10000, 100000 };
+    static const WCHAR *topics[] = { L"LAST", L"BID", L"ASK", L"VOLUME", L"DESCRIPTION" };
+    const double rowsPerStage = 2e6;
+    SubscriptionTable subs;
+    WCHAR symbol[32];
+    WCHAR text[256];
+
+    SubTable_Init(&subs, 100000);
+    for (long i = 0; i < 100000; i++) {
+        swprintf(symbol, ARRAYSIZE(symbol), L"SYM%ld", i / 5);
+        SubTable_Add(&subs, symbol, topics[i % 5]);
+    }
+
+    for (size_t s = 0; s < ARRAYSIZE(sizes); s++) {
+        long rows = sizes[s];
+        ULONGLONG batches = (ULONGLONG)(rowsPerStage / rows);
+        ULONGLONG slowBatches = batches / 8 ? batches / 8 : 1;  // format stages are ~100x slower
+        SAFEARRAY *arr = MakeRefreshBatch(rows, 42 + (unsigned)s, 60);
+        RtdUpdate *decoded = (RtdUpdate*)calloc(rows, sizeof *decoded);
+        ULONGLONG sink = 0;
+
+        // decode
+        LONGLONG allocs = RtdOleAllocCount();
+        ULONGLONG start = RtdNowNs();
+        for (ULONGLONG b = 0; b < batches; b++) {
+            VARIANT *data = NULL;
+            SafeArrayAccessData(arr, (void**)&data);
+            for (long i = 0; i < rows; i++) {
+                VARIANT *row = &data[i * 2];
+                if (row[0].vt != VT_I4) continue;
+                RtdUpdate_FromVariant(&decoded[i], row[0].lVal, &row[1], start);
+            }
+            SafeArrayUnaccessData(arr);
+            if (b + 1 < batches) {
+                for (long i = 0; i < rows; i++) RtdUpdate_Clear(&decoded[i]);
+            }
+        }
+        ULONGLONG elapsed = RtdNowNs() - start;
+        ReportStage("decode", rows, batches, elapsed, RtdOleAllocCount() - allocs);
+
+        // dispatch
+        allocs = RtdOleAllocCount();
+        start = RtdNowNs();
+        for (ULONGLONG b = 0; b < batches; b++) {
+            SubTable_Dispatch(&subs, arr, rows, IgnoreRow, &sink);
+        }
+        elapsed = RtdNowNs() - start;
+        ReportStage("dispatch", rows, batches, elapsed, RtdOleAllocCount() - allocs);
+
+        // format, reusing the updates left over from the last decode pass
+        allocs = RtdOleAllocCount();
+        start = RtdNowNs();
+        for (ULONGLONG b = 0; b < slowBatches; b++) {
+            for (long i = 0; i < rows; i++) {
+                sink += FormatLine(SubTable_Get(&subs, decoded[i].topicID), &decoded[i], text, ARRAYSIZE(text));
+            }
+        }
+        elapsed = RtdNowNs() - start;
+        ReportStage("format", rows, slowBatches, elapsed, RtdOleAllocCount() - allocs);
+
+        // total
+        DecodeFormatCtx ctx;
+        memset(&ctx, 0, sizeof ctx);
+        allocs = RtdOleAllocCount();
+        start = RtdNowNs();
+        for (ULONGLONG b = 0; b < slowBatches; b++) {
+            SubTable_Dispatch(&subs, arr, rows, DecodeFormatRow, &ctx);
+        }
+        elapsed = RtdNowNs() - start;
+        ReportStage("total", rows, slowBatches, elapsed, RtdOleAllocCount() - allocs);
+
+        if (sink == 0 || ctx.chars == 0) printf("  (no rows processed)\n");
+        for (long i = 0; i < rows; i++) RtdUpdate_Clear(&decoded[i]);
+        free(decoded);
+        SafeArrayDestroy(arr);
+    }
+    SubTable_Free(&subs);
+}
+
+static void SumColumnRow(void *ctx, TopicSubscription *sub, const RtdBatch *batch, long row)
+{
+    RtdUpdate u;
+    if (!RtdBatch_Update(batch, row, &u, 0)) return;
+    *(double*)ctx += u.vt == VT_R8 ? u.dblVal : (double)u.topicID;
+    RtdUpdate_Clear(&u);
+}
+
+static void SumVariantRow(void *ctx, TopicSubscription *sub, VARIANT *value)
+{
+    RtdUpdate u;
+    if (!RtdUpdate_FromVariant(&u, sub->topicID, value, 0)) return;
+    *(double*)ctx += u.vt == VT_R8 ? u.dblVal : (double)u.topicID;
+    RtdUpdate_Clear(&u);
+}
+
+/**
+ * Columnar RtdBatch_Decode against the per-row VARIANT switch, for an
+ * all-VT_R8 batch and the 60% VT_R8 mix:
+ *   decode - SAFEARRAY to RtdUpdates (scalar) or to columns (columnar)
+ *   route  - decode, topic ID lookup and an RtdUpdate per row, as the
+ *            client's RTD thread does before queueing
+ */
+static void BenchColumns(void)
+{
+    static const long sizes[] = { 1000, 10000, 100000 };
+    static const unsigned mixes[] = { 100, 60 };
+    const double rowsPerStage = 2e7;
+    SubscriptionTable subs;
+    RtdBatch batch;
+    WCHAR symbol[32];
+
+    SubTable_Init(&subs, 100000);
+    for (long i = 0; i < 100000; i++) {
+        swprintf(symbol, ARRAYSIZE(symbol), L"SYM%ld", i);
+        SubTable_Add(&subs, symbol, L"LAST");
+    }
+    RtdBatch_Init(&batch, 1024);
+
+    for (size_t m = 0; m < ARRAYSIZE(mixes); m++) {
+        printf("-- %u%% VT_R8\n", mixes[m]);
+        for (size_t s = 0; s < ARRAYSIZE(sizes); s++) {
+            long rows = sizes[s];
+            ULONGLONG batches = (ULONGLONG)(rowsPerStage / rows);
+            SAFEARRAY *arr = MakeRefreshBatch(rows, 7 + (unsigned)s, mixes[m]);
+            RtdUpdate *decoded = (RtdUpdate*)calloc(rows, sizeof *decoded);
+            double sink = 0;
+
+            // Scalar decode, stopping short of string copies so both sides do the same work
+            ULONGLONG start = RtdNowNs();
+            for (ULONGLONG b = 0; b < batches; b++) {
+                VARIANT *data = NULL;
+                SafeArrayAccessData(arr, (void**)&data);
+                for (long i = 0; i < rows; i++) {
+                    VARIANT *row = &data[i * 2];
+                    RtdUpdate *u = &decoded[i];
+                    u->topicID = row[0].vt == VT_I4 ? row[0].lVal : 0;
+                    u->vt = row[1].vt;
+                    switch (row[1].vt) {
+                        case VT_R8:   u->dblVal = row[1].dblVal; break;
+                        case VT_I4:   u->llVal = row[1].lVal; break;
+                        case VT_BSTR: u->bstrVal = row[1].bstrVal; break;
+                        default:      u->llVal = 0; break;
+                    }
+                }
+                SafeArrayUnaccessData(arr);
+                sink += decoded[b % rows].dblVal;
+            }
+            ULONGLONG elapsed = RtdNowNs() - start;
+            ReportStage("scalar decode", rows, batches, elapsed, 0);
+
+            start = RtdNowNs();
+            for (ULONGLONG b = 0; b < batches; b++) {
+                RtdBatch_Decode(&batch, arr, rows);
+                sink += batch.dbl[b % rows];
+            }
+            elapsed = RtdNowNs() - start;
+            ReportStage("column decode", rows, batches, elapsed, 0);
+
+            // Both decodes of the last batch agree row for row
+            long differ = 0;
+            for (long i = 0; i < rows; i++) {
+                const RtdUpdate *u = &decoded[i];
+                BOOL same = batch.topicID[i] == u->topicID && batch.vt[i] == u->vt;
+                if (u->vt == VT_R8) same &= batch.dbl[i] == u->dblVal;
+                else if (u->vt == VT_I4) same &= batch.i64[i] == u->llVal;
+                if (!same) differ++;
+            }
+            if (differ) printf("  %ld of %ld rows decode differently\n", differ, rows);
+            Expect(differ == 0, "column decode matches the scalar decode");
+
+            ULONGLONG slowBatches = batches / 4 ? batches / 4 : 1;
+            start = RtdNowNs();
+            for (ULONGLONG b = 0; b < slowBatches; b++) {
+                SubTable_Dispatch(&subs, arr, rows, SumVariantRow, &sink);
+            }
+            elapsed = RtdNowNs() - start;
+            ReportStage("scalar route", rows, slowBatches, elapsed, 0);
+
+            start = RtdNowNs();
+            for (ULONGLONG b = 0; b < slowBatches; b++) {
+                RtdBatch_Decode(&batch, arr, rows);
+                SubTable_DispatchBatch(&subs, &batch, SumColumnRow, &sink);
+            }
+            elapsed = RtdNowNs() - start;
+            ReportStage("column route", rows, slowBatches, elapsed, 0);
+
+            if (sink == 0) printf("  (no rows processed)\n");
+            free(decoded);
+            SafeArrayDestroy(arr);
+        }
+    }
+    printf("  %llu batches took the all-VT_R8 path, %llu the mixed path\n",
+           batch.fastBatches, batch.slowBatches);
+    RtdBatch_Free(&batch);
+    SubTable_Free(&subs);
+}
+
+/**
+ * Price corpus shaped like TOS quote streams: tick-grid prices for
+ * equities, penny stocks, futures, options and FX, computed mids, and
+ * greek-sized values with full binary fractions
+ */
+static double CorpusPrice(unsigned *seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    unsigned r = *seed >> 4;
+    switch (r % 8) {
+        case 0:
+        case 1:  return (double)(100 + r / 8 % 500000) * 0.01;         // Stocks, $0.01 ticks
+        case 2:  return (double)(r / 8 % 10000) * 0.0001;              // Sub-dollar, $0.0001 ticks
+        case 3:  return 4000.0 + (double)(r / 8 % 8000) * 0.25;        // Index futures
+        case 4:  return (double)(r / 8 % 4000) * 0.05;                 // Options, $0.05 ticks
+        case 5:  return 1.0 + (double)(r / 8 % 100000) * 0.00001;      // FX pips
+        case 6:  return ((double)(r / 8 % 50000) * 0.01 + (double)(r / 8 % 50000 + 1) * 0.01) / 2;
+        default: return (double)(r / 8 % 2000000) / 2000000.0 - 0.5;   // Greeks
+    }
+}
+
+/**
+ * Number formatting: swprintf (the old FormatVariantValue path) against
+ * the hand-written formatter, after checking they agree byte for byte
+ */
+static void BenchFormat(void)
+{
+    const long count = 1000000;
+    double *prices = (double*)malloc(count * sizeof *prices);
+    LONGLONG *ints = (LONGLONG*)malloc(count * sizeof *ints);
+    unsigned seed = 7;
+    WCHAR wide[64], expected[64];
+    char narrow[FORMAT_NUMBER_MAX], narrowExpected[64];
+    ULONGLONG sink = 0;
+
+    for (long i = 0; i < count; i++) {
+        prices[i] = CorpusPrice(&seed);
+        if (i & 1) prices[i] = -prices[i] * (i % 7 == 1);  // Some changes, some -0.0
+        ints[i] = (LONGLONG)(seed >> 3) * ((i & 2) ? -1 : 1) >> (i % 40);
+    }
+
+    // Agreement on every corpus value at 2, 4 and 6 decimals
+    long mismatches = 0;
+    for (long i = 0; i < count; i++) {
+        RtdUpdate u = { 0 };
+        u.vt = VT_R8;
+        u.dblVal = prices[i];
+        Format_UpdateValue(&u, FORMAT_DEFAULT_DECIMALS, wide, ARRAYSIZE(wide));
+        swprintf(expected, ARRAYSIZE(expected), L"%.6f", prices[i]);
+        if (wcscmp(wide, expected) != 0) mismatches++;
+        for (int d = 2; d <= 4; d += 2) {
+            Format_Fixed(prices[i], d, narrow, sizeof narrow);
+            snprintf(narrowExpected, sizeof narrowExpected, "%.*f", d, prices[i]);
+            if (strcmp(narrow, narrowExpected) != 0) mismatches++;
+        }
+        Format_Int64(ints[i], narrow);
+        snprintf(narrowExpected, sizeof narrowExpected, "%lld", ints[i]);
+        if (strcmp(narrow, narrowExpected) != 0) mismatches++;
+    }
+    printf("  %ld values checked against printf, %ld mismatches\n", count, mismatches);
+    Expect(mismatches == 0, "formatted text matches printf byte for byte");
+
+    ULONGLONG start = RtdNowNs();
+    for (long i = 0; i < count; i++) sink += swprintf(wide, ARRAYSIZE(wide), L"%.6f", prices[i]);
+    ULONGLONG slow = RtdNowNs() - start;
+    Report("swprintf %.6f", count, slow);
+
+    start = RtdNowNs();
+    for (long i = 0; i < count; i++) {
+        RtdUpdate u;
+        u.vt = VT_R8;
+        u.dblVal = prices[i];
+        sink += Format_UpdateValue(&u, FORMAT_DEFAULT_DECIMALS, wide, ARRAYSIZE(wide));
+    }
+    ULONGLONG fast = RtdNowNs() - start;
+    Report("Format_UpdateValue R8", count, fast);
+    printf("  %.1fx faster\n", (double)slow / (double)fast);
+
+    start = RtdNowNs();
+    for (long i = 0; i < count; i++) sink += Format_Fixed(prices[i], 6, narrow, sizeof narrow);
+    Report("Format_Fixed (UTF-8)", count, RtdNowNs() - start);
+
+    start = RtdNowNs();
+    for (long i = 0; i < count; i++) sink += swprintf(wide, ARRAYSIZE(wide), L"%lld", ints[i]);
+    slow = RtdNowNs() - start;
+    Report("swprintf %lld", count, slow);
+
+    start = RtdNowNs();
+    for (long i = 0; i < count; i++) {
+        RtdUpdate u;
+        u.vt = VT_I8;
+        u.llVal = ints[i];
+        sink += Format_UpdateValue(&u, FORMAT_DEFAULT_DECIMALS, wide, ARRAYSIZE(wide));
+    }
+    fast = RtdNowNs() - start;
+    Report("Format_UpdateValue I8", count, fast);
+    printf("  %.1fx faster (%llu chars)\n", (double)slow / (double)fast, sink);
+
+    free(prices);
+    free(ints);
+}
+
+/**
+ * Output stage: the old per-line swprintf + fputws path against the
+ * batched writer in each layout, all writing to /dev/null
+ */
+static void BenchOutput(void)
+{
+    const long count = 1000000;
+    static const char *layouts[] = { "line", "csv", "ndjson" };
+    RtdUpdate *updates = (RtdUpdate*)calloc(WORKER_ROWS, sizeof *updates);
+    BSTR name = SysAllocString(L"Apple Inc. - \"Common\", NASDAQ");
+    unsigned seed = 11;
+
+    for (long i = 0; i < WORKER_ROWS; i++) {
+        updates[i].recvNs = RtdNowNs();
+        updates[i].topicID = i + 1;
+        if (i % 10 == 9) {
+            updates[i].vt = VT_BSTR;
+            updates[i].bstrVal = name;
+        } else if (i % 4 == 3) {
+            updates[i].vt = VT_I4;
+            updates[i].llVal = 100 * i;
+        } else {
+            updates[i].vt = VT_R8;
+            updates[i].dblVal = CorpusPrice(&seed);
+        }
+    }
+
+    // Sample of each layout; the sink bypasses stdio
+    fflush(stdout);
+    for (size_t l = 0; l < ARRAYSIZE(layouts); l++) {
+        OutputSink sink;
+        OutputWriter w;
+        OutputLayout layout;
+        OutputLayout_Parse(layouts[l], &layout);
+        OutputSink_Open(&sink, NULL, layout);
+        OutputWriter_Init(&w, &sink, 4096, 0, FORMAT_DEFAULT_DECIMALS);
+        for (long i = 7; i < 10; i++) OutputWriter_Append(&w, &updates[i], L"AAPL", L"LAST");
+        OutputWriter_Free(&w);
+        OutputSink_Close(&sink);
+    }
+
+    FILE *devnull = fopen("/dev/null", "w");
+    WCHAR line[512], value[128];
+    ULONGLONG start = RtdNowNs();
+    for (long i = 0; i < count; i++) {
+        const RtdUpdate *u = &updates[i % WORKER_ROWS];
+        Format_UpdateValue(u, FORMAT_DEFAULT_DECIMALS, value, ARRAYSIZE(value));
+        swprintf(line, ARRAYSIZE(line), L"[%02d:%02d:%02d.%03d] %ls %ls = %ls\n",
+                 13, 45, 22, 124, L"AAPL", L"LAST", value);
+        fputws(line, devnull);
+    }
+    Report("fputws per line", count, RtdNowNs() - start);
+    fclose(devnull);
+
+    for (size_t l = 0; l < ARRAYSIZE(layouts); l++) {
+        OutputSink sink;
+        OutputWriter w;
+        OutputLayout layout;
+        char label[32];
+
+        OutputLayout_Parse(layouts[l], &layout);
+        OutputSink_Open(&sink, "/dev/null", layout);
+        OutputWriter_Init(&w, &sink, 256 * 1024, 0, FORMAT_DEFAULT_DECIMALS);
+        start = RtdNowNs();
+        for (long i = 0; i < count; i += WORKER_ROWS) {
+            for (long j = 0; j < WORKER_ROWS; j++) OutputWriter_Append(&w, &updates[j], L"AAPL", L"LAST");
+            OutputWriter_EndBatch(&w, RtdNowNs());
+        }
+        ULONGLONG elapsed = RtdNowNs() - start;
+        snprintf(label, sizeof label, "writer %s", layouts[l]);
+        Report(label, count, elapsed);
+        printf("  %llu writes, %.1f bytes/line\n", sink.writes, (double)sink.bytes / count);
+        OutputWriter_Free(&w);
+        OutputSink_Close(&sink);
+    }
+
+    SysFreeString(name);
+    free(updates);
+}
+
+static void ApplyQuote(void *ctx, TopicSubscription *sub, VARIANT *value)
+{
+    QuoteStore_Apply((QuoteStore*)ctx, sub, value, 1);
+}
+
+/**
+ * Quote store: 5k symbols x every tracked field, RefreshData rows applied
+ * through dispatch, then full-watchlist snapshots by linear scan
+ */
+static void BenchQuotes(void)
+{
+    const long symbols = 5000;
+    const long rows = 10000;
+    const int rounds = 1000;
+    SubscriptionTable subs;
+    QuoteStore qs;
+    WCHAR symbol[32], topic[32];
+
+    SubTable_Init(&subs, symbols * QUOTE_FIELD_COUNT);
+    QuoteStore_Init(&qs, symbols);
+    ULONGLONG start = RtdNowNs();
+    for (long i = 0; i < symbols; i++) {
+        swprintf(symbol, ARRAYSIZE(symbol), L"SYM%ld", i);
+        for (int f = 0; f < QUOTE_FIELD_COUNT; f++) {
+            const char *name = QuoteField_Name(f);
+            size_t n = 0;
+            while ((topic[n] = (WCHAR)name[n]) != 0) n++;
+            QuoteStore_Track(&qs, SubTable_Add(&subs, symbol, topic));
+        }
+    }
+    Report("subscribe + intern", subs.count, RtdNowNs() - start);
+    printf("  %ld symbols, %ld topics interned, quote store %.0f KB\n",
+           subs.symbols.count - 1, subs.topics.count - 1, QuoteStore_Bytes(&qs) / 1024.0);
+
+    // RefreshData batch covering random topics with numeric values
+    SAFEARRAYBOUND bounds[2] = { { 2, 0 }, { (ULONG)rows, 0 } };
+    SAFEARRAY *arr = SafeArrayCreate(VT_VARIANT, 2, bounds);
+    VARIANT *data = NULL;
+    unsigned seed = 3;
+    SafeArrayAccessData(arr, (void**)&data);
+    for (long i = 0; i < rows; i++) {
+        seed = seed * 1103515245u + 12345u;
+        data[i * 2].vt = VT_I4;
+        data[i * 2].lVal = (LONG)((seed >> 4) % subs.count) + 1;
+        data[i * 2 + 1].vt = (i & 3) ? VT_R8 : VT_I4;
+        if (i & 3) data[i * 2 + 1].dblVal = 100.0 + (seed & 1023) * 0.01;
+        else data[i * 2 + 1].lVal = (LONG)(seed & 0xFFFFF);
+    }
+    SafeArrayUnaccessData(arr);
+
+    start = RtdNowNs();
+    for (int r = 0; r < rounds; r++) SubTable_Dispatch(&subs, arr, rows, ApplyQuote, &qs);
+    Report("apply via dispatch", (ULONGLONG)rows * rounds, RtdNowNs() - start);
+
+    // Snapshot: mid price and total volume across the watchlist
+    const ULONG needed = (1u << QF_BID) | (1u << QF_ASK);
+    double midSum = 0;
+    LONGLONG volume = 0;
+    start = RtdNowNs();
+    for (int r = 0; r < rounds; r++) {
+        const double *bid = qs.dbl[QF_BID], *ask = qs.dbl[QF_ASK];
+        const LONGLONG *vol = qs.i64[QF_VOLUME - QUOTE_FIRST_INT];
+        for (long sym = 1; sym <= symbols; sym++) {
+            if ((qs.present[sym] & needed) == needed) midSum += (bid[sym] + ask[sym]) * 0.5;
+            volume += vol[sym];
+        }
+    }
+    Report("snapshot scan (symbols)", (ULONGLONG)symbols * rounds, RtdNowNs() - start);
+    printf("  %.0f us per 5k-symbol snapshot, checksum %.1f %lld\n",
+           (RtdNowNs() - start) / 1e3 / rounds, midSum, volume);
+
+    SafeArrayDestroy(arr);
+    QuoteStore_Free(&qs);
+    SubTable_Free(&subs);
+}
+
+typedef struct AnalyticsBenchCtx {
+    QuoteStore *quotes;
+    Analytics  *analytics;
+    ULONGLONG   derived;
+} AnalyticsBenchCtx;
+
+static void ApplyAnalyticsRow(void *ctx, TopicSubscription *sub, VARIANT *value)
+{
+    AnalyticsBenchCtx *c = (AnalyticsBenchCtx*)ctx;
+    QuoteStore_Apply(c->quotes, sub, value, 1);
+    Analytics_Apply(c->analytics, sub);
+}
+
+static void CountDerived(void *ctx, RtdUpdate *u)
+{
+    ((AnalyticsBenchCtx*)ctx)->derived++;
+}
+
+/**
+ * Analytics: 50k symbols with every derived topic, fed 20k-row batches of
+ * LAST/BID/ASK/VOLUME ticks on one thread
+ */
+static void BenchAnalytics(void)
+{
+    static const WCHAR *inputs[] = { L"LAST", L"BID", L"ASK", L"VOLUME" };
+    const long symbols = 50000;
+    const long rows = 20000;
+    const int rounds = 500;
+    SubscriptionTable subs;
+    QuoteStore qs;
+    Analytics an;
+    AnalyticsConfig cfg = { 0, 0, 0, 0 };
+    WCHAR symbol[32], topic[32];
+
+    SubTable_Init(&subs, symbols * (4 + ANALYTIC_FIELD_COUNT));
+    subs.isLocalTopic = AnalyticField_IsDerived;
+    QuoteStore_Init(&qs, symbols);
+    Analytics_Init(&an, &cfg, &qs);
+    long *inputIDs = (long*)malloc(symbols * 4 * sizeof *inputIDs);
+    for (long i = 0; i < symbols; i++) {
+        swprintf(symbol, ARRAYSIZE(symbol), L"SYM%ld", i);
+        for (int f = 0; f < 4; f++) {
+            TopicSubscription *sub = SubTable_Add(&subs, symbol, inputs[f]);
+            QuoteStore_Track(&qs, sub);
+            inputIDs[i * 4 + f] = sub->topicID;
+        }
+        for (int f = 0; f < ANALYTIC_FIELD_COUNT; f++) {
+            swprintf(topic, ARRAYSIZE(topic), L"%hs", AnalyticField_Name(f));
+            Analytics_Track(&an, SubTable_Add(&subs, symbol, topic));
+        }
+    }
+
+    SAFEARRAYBOUND bounds[2] = { { 2, 0 }, { (ULONG)rows, 0 } };
+    SAFEARRAY *arr = SafeArrayCreate(VT_VARIANT, 2, bounds);
+    VARIANT *data = NULL;
+    LONGLONG *volume = (LONGLONG*)calloc(symbols, sizeof *volume);
+    double *price = (double*)malloc(symbols * sizeof *price);
+    for (long i = 0; i < symbols; i++) price[i] = 50.0 + (double)(i % 400);
+
+    AnalyticsBenchCtx ctx = { &qs, &an, 0 };
+    ULONGLONG elapsed = 0;
+    unsigned seed = 11;
+    for (int r = 0; r < rounds; r++) {
+        // Fresh ticks for random symbols (not timed)
+        SafeArrayAccessData(arr, (void**)&data);
+        for (long i = 0; i < rows; i++) {
+            seed = seed * 1103515245u + 12345u;
+            long sym = (long)((seed >> 4) % (unsigned)symbols);
+            int f = (int)(seed >> 28) & 3;
+            data[i * 2].vt = VT_I4;
+            data[i * 2].lVal = inputIDs[sym * 4 + f];
+            if (f == 3) {
+                volume[sym] += 100 * (seed % 7 + 1);
+                data[i * 2 + 1].vt = VT_I8;
+                data[i * 2 + 1].llVal = volume[sym];
+            } else {
+                price[sym] += ((double)(seed % 11) - 5.0) / 100.0;
+                data[i * 2 + 1].vt = VT_R8;
+                data[i * 2 + 1].dblVal = price[sym] + (f == 1 ? -0.01 : f == 2 ? 0.01 : 0.0);
+            }
+        }
+        SafeArrayUnaccessData(arr);
+
+        ULONGLONG start = RtdNowNs();
+        SubTable_Dispatch(&subs, arr, rows, ApplyAnalyticsRow, &ctx);
+        Analytics_EndBatch(&an, start, CountDerived, &ctx);
+        elapsed += RtdNowNs() - start;
+    }
+    Report("ticks (apply + analytics)", (ULONGLONG)rows * rounds, elapsed);
+    printf("  %ld symbols x %d derived topics: %llu trades, %llu derived updates (%.0f/s)\n",
+           symbols, ANALYTIC_FIELD_COUNT, an.trades, ctx.derived, ctx.derived * 1e9 / elapsed);
+
+    SafeArrayDestroy(arr);
+    free(volume);
+    free(price);
+    free(inputIDs);
+    Analytics_Free(&an);
+    QuoteStore_Free(&qs);
+    SubTable_Free(&subs);
+}
+
+typedef struct L1BenchCtx {
+    QuoteStore  *quotes;
+    L1Assembler *l1;
+    L1Ring       ring;
+    double      *bid, *ask;     // What the generator last sent per symbol
+    ULONGLONG    events;
+    ULONGLONG    torn;          // Events whose bid/ask differ from the batch's final values
+    ULONGLONG    gaps;
+    ULONGLONG    lastSeq;
+} L1BenchCtx;
+
+static void ApplyL1Row(void *ctx, TopicSubscription *sub, VARIANT *value)
+{
+    L1BenchCtx *c = (L1BenchCtx*)ctx;
+    QuoteStore_Apply(c->quotes, sub, value, 1);
+    L1Assembler_Apply(c->l1, sub);
+}
+
+static void ApplyL1QuoteOnlyRow(void *ctx, TopicSubscription *sub, VARIANT *value)
+{
+    QuoteStore_Apply(((L1BenchCtx*)ctx)->quotes, sub, value, 1);
+}
+
+static void PushL1(void *ctx, const L1Quote *q)
+{
+    L1Ring_Push(&((L1BenchCtx*)ctx)->ring, q);
+}
+
+/**
+ * Drain the ring as an output worker would, checking every event against
+ * the values the generator sent last in the batch
+ */
+static void CheckL1(L1BenchCtx *c)
+{
+    L1Quote q[WORKER_ROWS];
+    ULONG n;
+    while ((n = L1Ring_Pop(&c->ring, q, WORKER_ROWS)) > 0) {
+        for (ULONG i = 0; i < n; i++) {
+            if (q[i].seq != c->lastSeq + 1) c->gaps++;
+            c->lastSeq = q[i].seq;
+            if (q[i].bid != c->bid[q[i].symbolID] || q[i].ask != c->ask[q[i].symbolID]) c->torn++;
+        }
+        c->events += n;
+    }
+}
+
+/**
+ * Release one pair the way the client does when a network client leaves:
+ * only the pair's field goes, its bars once LAST and VOLUME are both
+ * gone, and the symbol's L1 state once no pair of it is left
+ */
+static void ReleasePair(SubscriptionTable *subs, QuoteStore *qs, L1Assembler *l1, BarBuilder *b,
+                        TopicSubscription *sub)
+{
+    long symbolID = sub->symbolID;
+    QuoteStore_ClearField(qs, sub);
+    BarBuilder_Untrack(b, sub);
+    SubTable_Remove(subs, sub->topicID);
+    if (!SubTable_SymbolPairs(subs, symbolID)) L1Assembler_ClearSymbol(l1, symbolID);
+}
+
+static void CountL1(void *ctx, const L1Quote *q)
+{
+    (*(ULONGLONG*)ctx)++;
+}
+
+static void KeepBar(void *ctx, const Bar *bar)
+{
+    *(Bar*)ctx = *bar;
+}
+
+/**
+ * Store a LAST row and fold it into the L1 event and the bars
+ */
+static void ApplyPairLast(QuoteStore *qs, L1Assembler *l1, BarBuilder *b, TopicSubscription *last,
+                          double price, ULONGLONG t, ULONGLONG *events)
+{
+    RtdUpdate u;
+    memset(&u, 0, sizeof u);
+    u.topicID = last->topicID;
+    u.vt = VT_R8;
+    u.dblVal = price;
+    u.recvNs = t;
+    QuoteStore_ApplyUpdate(qs, last, &u);
+    L1Assembler_Apply(l1, last);
+    BarBuilder_Apply(b, last, &u);
+    L1Assembler_EndBatch(l1, t, CountL1, events);
+    BarBuilder_EndBatch(b);
+}
+
+/**
+ * A symbol watched as BID and LAST loses BID: LAST keeps its value, the
+ * symbol its quote age and its 1m bar its open until LAST goes too
+ */
+static void RunPairRelease(void)
+{
+    static const ULONG interval = 60000;
+    SubscriptionTable subs;
+    QuoteStore qs;
+    L1Assembler l1;
+    BarBuilder b;
+    Bar closed;
+    ULONGLONG events = 0;
+    ULONGLONG t = 1000000000ULL;
+    memset(&closed, 0, sizeof closed);
+    SubTable_Init(&subs, 16);
+    QuoteStore_Init(&qs, 16);
+    L1Assembler_Init(&l1, &qs, L1_DEFAULT_STALE_MS);
+    BarBuilder_Init(&b, &qs, &interval, 1, BAR_DEFAULT_GRACE_MS, t, KeepBar, &closed);
+    TopicSubscription *bid = SubTable_Add(&subs, L"PAIR", L"BID");
+    QuoteStore_Track(&qs, bid);
+    L1Assembler_Track(&l1, bid);
+    BarBuilder_Track(&b, bid);
+    TopicSubscription *last = SubTable_Add(&subs, L"PAIR", L"LAST");
+    QuoteStore_Track(&qs, last);
+    L1Assembler_Track(&l1, last);
+    BarBuilder_Track(&b, last);
+    long symbolID = last->symbolID, lastID = last->topicID;
+
+    QuoteStore_Set(&qs, bid, 101.5, 101, t);
+    L1Assembler_Apply(&l1, bid);
+    ApplyPairLast(&qs, &l1, &b, last, 101.75, t, &events);
+
+    ReleasePair(&subs, &qs, &l1, &b, bid);
+    double price = 0, unused;
+    BOOL lastKept = QuoteStore_Get(&qs, symbolID, QF_LAST, &price) && price == 101.75;
+    BOOL bidGone = !QuoteStore_Get(&qs, symbolID, QF_BID, &unused);
+    BOOL ageKept = l1.quoteNs[symbolID] == t;
+
+    // The next LAST row still makes an event and goes into the same bar
+    last = SubTable_Get(&subs, lastID);
+    ApplyPairLast(&qs, &l1, &b, last, 102.0, t + 1000000, &events);
+    BOOL barKept = b.bars == 0 && b.slots[symbolID].open && b.slots[symbolID].bar.ticks == 2;
+
+    ReleasePair(&subs, &qs, &l1, &b, last);
+    BOOL ageCleared = l1.quoteNs[symbolID] == 0;
+    BOOL barClosed = b.bars == 1 && (closed.flags & BAR_CLEARED) && closed.ticks == 2 && !b.flags[symbolID];
+    printf("  released BID of BID+LAST: LAST %s, BID %s, quote age %s, %llu L1 events, bar %s; "
+           "released LAST: quote age %s, bar %s\n", lastKept ? "kept" : "lost", bidGone ? "cleared" : "kept",
+           ageKept ? "kept" : "lost", events, barKept ? "open" : "closed", ageCleared ? "cleared" : "kept",
+           barClosed ? "closed" : "open");
+    Expect(lastKept && bidGone, "releasing a pair clears only its own field");
+    Expect(ageKept && events == 2, "the symbol's L1 state outlives one of its pairs");
+    Expect(barKept, "the symbol's bars outlive a pair that is not LAST or VOLUME");
+    Expect(ageCleared, "the symbol's L1 state goes with its last pair");
+    Expect(barClosed, "the symbol's bars close and stop with its last LAST or VOLUME pair");
+
+    BarBuilder_Free(&b);
+    L1Assembler_Free(&l1);
+    QuoteStore_Free(&qs);
+    SubTable_Free(&subs);
+}
+
+/**
+ * L1 assembly: 5k symbols, 20k-row batches in which each symbol touched
+ * gets a burst of BID/ASK/size/LAST rows, as one quote change arrives
+ */
+static void BenchL1(void)
+{
+    static const WCHAR *fields[] = { L"BID", L"ASK", L"BID_SIZE", L"ASK_SIZE", L"LAST" };
+    const long symbols = 5000;
+    const long rows = 20000;
+    const int rounds = 300;
+    SubscriptionTable subs;
+    QuoteStore qs;
+    L1Assembler l1;
+    WCHAR symbol[32];
+
+    SubTable_Init(&subs, symbols * 5);
+    QuoteStore_Init(&qs, symbols);
+    L1Assembler_Init(&l1, &qs, 0);
+    long *ids = (long*)malloc(symbols * 5 * sizeof *ids);
+    for (long i = 0; i < symbols; i++) {
+        swprintf(symbol, ARRAYSIZE(symbol), L"SYM%ld", i);
+        for (int f = 0; f < 5; f++) {
+            TopicSubscription *sub = SubTable_Add(&subs, symbol, fields[f]);
+            QuoteStore_Track(&qs, sub);
+            L1Assembler_Track(&l1, sub);
+            ids[i * 5 + f] = sub->topicID;
+        }
+    }
+
+    L1BenchCtx ctx;
+    memset(&ctx, 0, sizeof ctx);
+    ctx.quotes = &qs;
+    ctx.l1 = &l1;
+    L1Ring_Init(&ctx.ring, 65536);
+    ctx.bid = (double*)calloc(symbols + 1, sizeof *ctx.bid);
+    ctx.ask = (double*)calloc(symbols + 1, sizeof *ctx.ask);
+    double *mid = (double*)malloc(symbols * sizeof *mid);
+    for (long i = 0; i < symbols; i++) mid[i] = 20.0 + (double)(i % 500);
+
+    SAFEARRAYBOUND bounds[2] = { { 2, 0 }, { (ULONG)rows, 0 } };
+    SAFEARRAY *arr = SafeArrayCreate(VT_VARIANT, 2, bounds);
+    VARIANT *data = NULL;
+    ULONGLONG assembleNs = 0, plainNs = 0;
+    unsigned seed = 19;
+    for (int r = 0; r < rounds; r++) {
+        // Bursts of 1-5 fields per symbol; about 1 quote in 200 is crossed (not timed)
+        SafeArrayAccessData(arr, (void**)&data);
+        for (long i = 0; i < rows; ) {
+            seed = seed * 1103515245u + 12345u;
+            long sym = (long)((seed >> 4) % (unsigned)symbols);
+            int burst = 1 + (int)((seed >> 24) % 5);
+            mid[sym] += ((double)(seed % 11) - 5.0) / 100.0;
+            double half = (seed >> 20) % 200 == 0 ? -0.01 : 0.01 * (1 + (seed >> 12) % 3);
+            for (int f = 0; f < burst && i < rows; f++, i++) {
+                int field = (f + (int)(seed >> 8)) % 5;
+                VARIANT *v = &data[i * 2 + 1];
+                data[i * 2].vt = VT_I4;
+                data[i * 2].lVal = ids[sym * 5 + field];
+                if (field >= 2 && field <= 3) {
+                    v->vt = VT_I4;
+                    v->lVal = 100 * (1 + (LONG)(seed % 9));
+                } else {
+                    v->vt = VT_R8;
+                    v->dblVal = field == 0 ? mid[sym] - half : field == 1 ? mid[sym] + half : mid[sym];
+                }
+            }
+        }
+        SafeArrayUnaccessData(arr);
+
+        ULONGLONG start = RtdNowNs();
+        SubTable_Dispatch(&subs, arr, rows, ApplyL1QuoteOnlyRow, &ctx);
+        plainNs += RtdNowNs() - start;
+
+        // The batch's final bid/ask per symbol, for the consistency check
+        for (long id = 1; id <= symbols; id++) {
+            ctx.bid[id] = qs.dbl[QF_BID][id];
+            ctx.ask[id] = qs.dbl[QF_ASK][id];
+        }
+
+        start = RtdNowNs();
+        SubTable_Dispatch(&subs, arr, rows, ApplyL1Row, &ctx);
+        L1Assembler_EndBatch(&l1, start, PushL1, &ctx);
+        assembleNs += RtdNowNs() - start;
+        CheckL1(&ctx);
+    }
+    Report("rows (quote store only)", (ULONGLONG)rows * rounds, plainNs);
+    Report("rows (store + L1 events)", (ULONGLONG)rows * rounds, assembleNs);
+    printf("  %llu rows became %llu events (%.2f rows/event), %llu crossed, %llu locked\n",
+           l1.rows, ctx.events, (double)l1.rows / (double)(ctx.events ? ctx.events : 1), l1.crossed, l1.locked);
+    printf("  %llu torn, %llu sequence gaps, %llu dropped\n", ctx.torn, ctx.gaps, ctx.ring.dropped);
+
+    SafeArrayDestroy(arr);
+    free(mid);
+    free(ctx.bid);
+    free(ctx.ask);
+    free(ids);
+    L1Ring_Free(&ctx.ring);
+    L1Assembler_Free(&l1);
+    QuoteStore_Free(&qs);
+    SubTable_Free(&subs);
+
+    RunPairRelease();
+}
+
+typedef struct ChainBenchCtx {
+    QuoteStore   *quotes;
+    OptionChains *chains;
+    ULONGLONG     published;
+} ChainBenchCtx;
+
+static void ApplyChainRow(void *ctx, TopicSubscription *sub, VARIANT *value)
+{
+    ChainBenchCtx *c = (ChainBenchCtx*)ctx;
+    QuoteStore_Apply(c->quotes, sub, value, 1);
+    OptionChains_Apply(c->chains, sub);
+}
+
+static void ApplyQuoteOnlyRow(void *ctx, TopicSubscription *sub, VARIANT *value)
+{
+    QuoteStore_Apply(((ChainBenchCtx*)ctx)->quotes, sub, value, 1);
+}
+
+static void CountPublished(void *ctx, RtdUpdate *u)
+{
+    ((ChainBenchCtx*)ctx)->published++;
+}
+
+static BOOL IsChainTopic(const WCHAR *topic)
+{
+    return ChainField_FromName(topic) != CF_NONE;
+}
+
+/**
+ * What the aggregator avoids: every bucket of a chain summed again from
+ * the quote store
+ */
+static void RecomputeChain(const OptionChains *oc, const OptionChain *ch, double *sums)
+{
+    const QuoteStore *q = oc->quotes;
+    memset(sums, 0, ch->bucketCount * CHAIN_FIELD_COUNT * sizeof *sums);
+    for (long i = 0; i < ch->contractCount; i++) {
+        const OptionContract *c = &oc->contracts[ch->firstContract + i];
+        long sym = c->symbolID;
+        double shares = (double)q->i64[QF_OPEN_INT - QUOTE_FIRST_INT][sym] * CHAIN_MULTIPLIER;
+        double gamma = q->dbl[QF_GAMMA][sym] * shares * (c->put ? -1.0 : 1.0);
+        double delta = q->dbl[QF_DELTA][sym] * shares;
+        long buckets[3] = { 0, c->expiryBucket, c->strikeBucket };
+        for (int b = 0; b < 3; b++) {
+            sums[buckets[b] * CHAIN_FIELD_COUNT + CF_NET_GAMMA] += gamma;
+            sums[buckets[b] * CHAIN_FIELD_COUNT + CF_NET_DELTA] += delta;
+        }
+    }
+}
+
+/**
+ * Option chain: 8 expiries x 401 strikes (6416 contracts, 20k topics)
+ * fed 250-row batches of GAMMA/DELTA/OPEN_INT ticks, against the same
+ * rows without the aggregator and against recomputing the chain after
+ * each batch
+ */
+static void BenchChain(void)
+{
+    const long rows = 250;
+    const int rounds = 20000;
+    SubscriptionTable subs;
+    QuoteStore qs;
+    OptionChains oc;
+    ChainSpec spec;
+
+    ChainSpec_Parse(&spec, "SPY:250117,250124,250131,250207,250221,250321,250620,251219:300-700:1");
+    SubTable_Init(&subs, 1024);
+    subs.isLocalTopic = IsChainTopic;
+    QuoteStore_Init(&qs, 1024);
+    OptionChains_Init(&oc, &qs, 1000);
+
+    ULONGLONG start = RtdNowNs();
+    long index = OptionChains_Add(&oc, &spec, &subs);
+    ULONGLONG elapsed = RtdNowNs() - start;
+    const OptionChain *ch = &oc.chains[index];
+    long *inputIDs = (long*)malloc(ch->contractCount * 3 * sizeof *inputIDs);
+    long inputs = 0;
+    for (long id = 1; id < subs.highWater; id++) {
+        TopicSubscription *sub = SubTable_Get(&subs, id);
+        QuoteStore_Track(&qs, sub);
+        if (!sub->local) inputIDs[inputs++] = id;
+    }
+    printf("  %ld contracts, %ld topics registered in %.2f ms\n",
+           ch->contractCount, subs.count, elapsed / 1e6);
+
+    SAFEARRAYBOUND bounds[2] = { { 2, 0 }, { (ULONG)rows, 0 } };
+    SAFEARRAY *arr = SafeArrayCreate(VT_VARIANT, 2, bounds);
+    VARIANT *data = NULL;
+    double *sums = (double*)malloc(ch->bucketCount * CHAIN_FIELD_COUNT * sizeof *sums);
+    ChainBenchCtx ctx = { &qs, &oc, 0 };
+    ULONGLONG incremental = 0, baseline = 0, recompute = 0;
+    unsigned seed = 17;
+    for (int r = 0; r < rounds; r++) {
+        SafeArrayAccessData(arr, (void**)&data);
+        for (long i = 0; i < rows; i++) {
+            seed = seed * 1103515245u + 12345u;
+            long id = inputIDs[(seed >> 4) % (unsigned)inputs];
+            const WCHAR *topic = SubTable_Get(&subs, id)->topic;
+            data[i * 2].vt = VT_I4;
+            data[i * 2].lVal = id;
+            if (topic[0] == L'O') {
+                data[i * 2 + 1].vt = VT_I4;
+                data[i * 2 + 1].lVal = (LONG)(seed % 50000);
+            } else {
+                data[i * 2 + 1].vt = VT_R8;
+                data[i * 2 + 1].dblVal = (double)(seed % 10000) / (topic[0] == L'G' ? 1e5 : 1e4);
+            }
+        }
+        SafeArrayUnaccessData(arr);
+
+        start = RtdNowNs();
+        SubTable_Dispatch(&subs, arr, rows, ApplyQuoteOnlyRow, &ctx);
+        baseline += RtdNowNs() - start;
+
+        start = RtdNowNs();
+        SubTable_Dispatch(&subs, arr, rows, ApplyChainRow, &ctx);
+        incremental += RtdNowNs() - start;
+
+        start = RtdNowNs();
+        RecomputeChain(&oc, ch, sums);
+        recompute += RtdNowNs() - start;
+    }
+    Report("ticks (quote store only)", (ULONGLONG)rows * rounds, baseline);
+    Report("ticks (apply + delta)", (ULONGLONG)rows * rounds, incremental);
+    Report("recompute after batch", (ULONGLONG)rows * rounds, recompute);
+
+    // Drift of the running sums before the periodic rebuild
+    double worst = 0;
+    for (long b = 0; b < ch->bucketCount * CHAIN_FIELD_COUNT; b++) {
+        double diff = fabs(ch->buckets[b / CHAIN_FIELD_COUNT].sum[b % CHAIN_FIELD_COUNT] - sums[b]);
+        double scale = fabs(sums[b]) > 1.0 ? fabs(sums[b]) : 1.0;
+        if (diff / scale > worst) worst = diff / scale;
+    }
+
+    start = RtdNowNs();
+    OptionChains_Publish(&oc, &subs, RtdNowNs(), CountPublished, &ctx);
+    elapsed = RtdNowNs() - start;
+    printf("  %llu contract updates, worst relative drift %.2e, publish %.1f us for %llu aggregates\n",
+           oc.applied, worst, elapsed / 1e3, ctx.published);
+
+    free(sums);
+    free(inputIDs);
+    SafeArrayDestroy(arr);
+    OptionChains_Free(&oc);
+    QuoteStore_Free(&qs);
+    SubTable_Free(&subs);
+}
+
+// Shared between the shm writer and its reader threads
+typedef struct ShmBenchCtx {
+    const char       *name;
+    long              slots;
+    LONGLONG          wallOffsetNs;
+    volatile LONG     stop;
+} ShmBenchCtx;
+
+typedef struct ShmReaderArg {
+    ShmBenchCtx *ctx;
+    unsigned     seed;
+    ULONGLONG    reads;
+    ULONGLONG    retries;
+    ULONGLONG    torn;
+} ShmReaderArg;
+
+/**
+ * Reader: random slot lookups; each value is derived from its timestamp,
+ * so a torn copy shows up as a mismatch
+ */
+static void ShmReaderThread(void *arg)
+{
+    ShmReaderArg *a = (ShmReaderArg*)arg;
+    ShmReader r;
+    if (!ShmReader_Open(&r, a->ctx->name)) return;
+    ShmQuote q;
+    unsigned seed = a->seed;
+    while (!a->ctx->stop) {
+        for (int i = 0; i < 1024; i++) {
+            seed = seed * 1103515245u + 12345u;
+            long index = (long)((seed >> 4) % (unsigned)a->ctx->slots) + 1;
+            if (!ShmReader_Read(&r, index, &q)) continue;
+            ULONGLONG recvNs = q.updateNs - (ULONGLONG)a->ctx->wallOffsetNs;
+            if (q.i64 != (LONGLONG)(recvNs * 3 + (ULONGLONG)index)) a->torn++;
+        }
+        a->reads += 1024;
+    }
+    a->retries = r.retries;
+    ShmReader_Close(&r);
+}
+
+/**
+ * Shared-memory snapshot: one writer publishing into 100k slots as fast
+ * as it can while 0, 1, 2 and 4 readers copy random slots out
+ */
+static void BenchShm(void)
+{
+    const long slots = 100000;
+    const double seconds = 1.0;
+    ShmBenchCtx ctx;
+    ShmWriter w;
+    WCHAR symbol[32];
+    char name[64];
+
+    memset(&ctx, 0, sizeof ctx);
+    snprintf(name, sizeof name, "rtd_bench_%u", (unsigned)RtdNowNs());
+    ctx.name = name;
+    ctx.slots = slots;
+    if (!ShmWriter_Create(&w, name, slots + 1)) {
+        printf("  shm_open failed, skipping\n");
+        return;
+    }
+    ctx.wallOffsetNs = w.wallOffsetNs;
+
+    ULONGLONG start = RtdNowNs();
+    for (long i = 1; i <= slots; i++) {
+        swprintf(symbol, ARRAYSIZE(symbol), L"SYM%ld", i);
+        ShmWriter_Define(&w, i, symbol, L"LAST");
+    }
+    Report("define slots", slots, RtdNowNs() - start);
+
+    ShmReader probe;
+    if (ShmReader_Open(&probe, name)) {
+        start = RtdNowNs();
+        long found = ShmReader_Find(&probe, "SYM99999", "LAST");
+        printf("  find SYM99999 LAST -> slot %ld in %.0f us (linear scan)\n",
+               found, (RtdNowNs() - start) / 1e3);
+        ShmReader_Close(&probe);
+    }
+
+    static const int readerCounts[] = { 0, 1, 2, 4 };
+    for (size_t c = 0; c < ARRAYSIZE(readerCounts); c++) {
+        int readers = readerCounts[c];
+        ShmReaderArg args[4];
+        RtdThread threads[4];
+
+        ctx.stop = 0;
+        for (int t = 0; t < readers; t++) {
+            memset(&args[t], 0, sizeof args[t]);
+            args[t].ctx = &ctx;
+            args[t].seed = 17u + (unsigned)t;
+            RtdThread_Start(&threads[t], ShmReaderThread, &args[t]);
+        }
+
+        // Writer on this thread, at full rate
+        RtdUpdate u;
+        memset(&u, 0, sizeof u);
+        u.vt = VT_I8;
+        unsigned seed = 5;
+        ULONGLONG writes = 0;
+        start = RtdNowNs();
+        ULONGLONG deadline = start + (ULONGLONG)(seconds * 1e9);
+        do {
+            for (int i = 0; i < 4096; i++) {
+                seed = seed * 1103515245u + 12345u;
+                u.topicID = (long)((seed >> 4) % (unsigned)slots) + 1;
+                u.recvNs = start + writes + (ULONGLONG)i;
+                u.llVal = (LONGLONG)(u.recvNs * 3 + (ULONGLONG)u.topicID);
+                ShmWriter_Publish(&w, &u);
+            }
+            writes += 4096;
+        } while (RtdNowNs() < deadline);
+        ULONGLONG elapsed = RtdNowNs() - start;
+        ctx.stop = 1;
+
+        ULONGLONG reads = 0, retries = 0, torn = 0;
+        for (int t = 0; t < readers; t++) {
+            RtdThread_Join(&threads[t]);
+            reads += args[t].reads;
+            retries += args[t].retries;
+            torn += args[t].torn;
+        }
+
+        char label[32];
+        snprintf(label, sizeof label, "writer, %d reader(s)", readers);
+        Report(label, writes, elapsed);
+        if (readers > 0) {
+            printf("  readers %.1f M reads/s total, %llu reads retried, %llu torn\n",
+                   reads / (elapsed / 1e9) / 1e6, retries, torn);
+        }
+    }
+
+    printf("  segment %.1f MB, %llu published, %llu skipped\n",
+           w.seg.size / 1048576.0, w.published, w.skipped);
+    ShmWriter_Destroy(&w);
+}
+
+// Shared between the fan-out hub (this thread plays the RTD thread) and
+// its loopback clients
+typedef struct FanoutBench {
+    SubscriptionTable subs;
+    NetServer         net;
+    long              topics;
+    long              perClient;
+    volatile LONG     ready;        // Clients with every subscription confirmed
+    volatile LONG     stop;
+} FanoutBench;
+
+typedef struct FanoutClientArg {
+    FanoutBench *bench;
+    long         index;
+    BOOL         slow;              // Stalls 100 ms every 64 updates
+    long         subscribed;
+    ULONGLONG    updates;
+    ULONGLONG    reordered;         // Older value after a newer one on a topic
+    LONGLONG    *lastSeen;          // Per topic ID
+    Histogram    latency;           // Publish to receive, ns
+} FanoutClientArg;
+
+/**
+ * NetConnectFn: registers the pair as connected, as ConnectData would
+ */
+static TopicSubscription* FanoutConnect(void *ctx, const WCHAR *symbol, const WCHAR *topic)
+{
+    FanoutBench *b = (FanoutBench*)ctx;
+    TopicSubscription *sub = SubTable_Add(&b->subs, symbol, topic);
+    if (sub && !sub->connected) {
+        sub->connected = TRUE;
+        NetServer_Define(&b->net, sub->topicID, symbol, topic);
+    }
+    return sub;
+}
+
+static void FanoutRelease(void *ctx, TopicSubscription *sub)
+{
+    FanoutBench *b = (FanoutBench*)ctx;
+    NetServer_Clear(&b->net, sub->topicID);
+    SubTable_Remove(&b->subs, sub->topicID);
+}
+
+/**
+ * Client: subscribe a window of topics overlapping its neighbours', then
+ * read until told to stop. Each value is the publisher's RtdNowNs().
+ */
+static void FanoutClientThread(void *arg)
+{
+    FanoutClientArg *a = (FanoutClientArg*)arg;
+    FanoutBench *b = a->bench;
+    NetSubscriber s;
+    NetFrame f;
+    char symbol[32];
+
+    if (!NetSubscriber_Connect(&s, "127.0.0.1", b->net.port)) return;
+    for (long j = 0; j < b->perClient; j++) {
+        snprintf(symbol, sizeof symbol, "SYM%ld", (a->index * b->perClient / 2 + j) % b->topics);
+        NetSubscriber_Subscribe(&s, (ULONG)j, symbol, "LAST");
+    }
+    while (!b->stop) {
+        int r = NetSubscriber_Next(&s, &f, 20);
+        if (r < 0) break;
+        if (r == 0) continue;
+        if (f.type == NET_SUBSCRIBED) {
+            if (f.topicID && ++a->subscribed == b->perClient) InterlockedIncrement(&b->ready);
+            continue;
+        }
+        if (f.type != NET_UPDATE) continue;
+        Histogram_Record(&a->latency, RtdNowNs() - (ULONGLONG)f.i64);
+        if (f.topicID < 4 * b->topics) {
+            if (f.i64 < a->lastSeen[f.topicID]) a->reordered++;
+            a->lastSeen[f.topicID] = f.i64;
+        }
+        if (++a->updates % 64 == 0 && a->slow) RtdSleepMs(100);
+    }
+    NetSubscriber_Close(&s);
+}
+
+/**
+ * One fan-out run: clients subscribe, the hub publishes to every topic at
+ * rate updates/s (0 = as fast as it can) for a second, then the clients
+ * disconnect and the hub should release every pair
+ */
+static void RunFanout(const char *label, long clients, long slowClients, double rate)
+{
+    const long topics = 1000, perClient = 100;
+    const double seconds = 1.0;
+    FanoutBench b;
+    NetConfig cfg;
+    FanoutClientArg *args = (FanoutClientArg*)calloc((size_t)clients, sizeof *args);
+    RtdThread *threads = (RtdThread*)calloc((size_t)clients, sizeof *threads);
+
+    memset(&b, 0, sizeof b);
+    memset(&cfg, 0, sizeof cfg);
+    b.topics = topics;
+    b.perClient = perClient;
+    cfg.bufferBytes = 64 * 1024;
+    SubTable_Init(&b.subs, topics + 1);
+    if (!NetServer_Start(&b.net, &cfg, &b.subs, FanoutConnect, FanoutRelease, &b, NULL, NULL)) {
+        printf("  cannot listen on loopback, skipping\n");
+        SubTable_Free(&b.subs);
+        free(args);
+        free(threads);
+        return;
+    }
+
+    for (long i = 0; i < clients; i++) {
+        args[i].bench = &b;
+        args[i].index = i;
+        args[i].slow = i < slowClients;
+        args[i].lastSeen = (LONGLONG*)calloc((size_t)(4 * topics), sizeof *args[i].lastSeen);
+        RtdThread_Start(&threads[i], FanoutClientThread, &args[i]);
+    }
+    ULONGLONG start = RtdNowNs();
+    while (b.ready < clients && RtdNowNs() - start < 5000000000ULL) {
+        if (NetServer_Poll(&b.net) == 0) RtdSleepMs(1);
+    }
+    ULONGLONG subscribeNs = RtdNowNs() - start;
+
+    // Publish in batches of WORKER_ROWS, round-robin over the topics
+    RtdUpdate u;
+    memset(&u, 0, sizeof u);
+    u.vt = VT_I8;
+    ULONGLONG published = 0, publishNs = 0;
+    long next = 0;
+    start = RtdNowNs();
+    ULONGLONG deadline = start + (ULONGLONG)(seconds * 1e9);
+    for (ULONGLONG now = start; now < deadline; now = RtdNowNs()) {
+        if (rate > 0 && published > (now - start) * rate / 1e9) {
+            RtdYield();
+            continue;
+        }
+        for (int i = 0; i < WORKER_ROWS; i++) {
+            u.topicID = (next++ % topics) + 1;
+            u.recvNs = RtdNowNs();
+            u.llVal = (LONGLONG)u.recvNs;
+            NetServer_Publish(&b.net, &u);
+        }
+        NetServer_EndBatch(&b.net);
+        NetServer_Poll(&b.net);
+        published += WORKER_ROWS;
+        publishNs += RtdNowNs() - now;
+    }
+    ULONGLONG elapsed = RtdNowNs() - start;
+    RtdSleepMs(200);
+    InterlockedExchange(&b.stop, 1);
+
+    Histogram fast;
+    memset(&fast, 0, sizeof fast);
+    ULONGLONG fastUpdates = 0, slowUpdates = 0, reordered = 0, expected = 0;
+    for (long i = 0; i < clients; i++) {
+        RtdThread_Join(&threads[i]);
+        if (args[i].slow) {
+            slowUpdates += args[i].updates;
+        } else {
+            fastUpdates += args[i].updates;
+            for (int k = 0; k < HIST_BUCKETS; k++) fast.buckets[k] += args[i].latency.buckets[k];
+            fast.count += args[i].latency.count;
+            if (args[i].latency.max > fast.max) fast.max = args[i].latency.max;
+        }
+        reordered += args[i].reordered;
+        free(args[i].lastSeen);
+    }
+    // Every topic has clients * perClient / topics subscribers on average
+    expected = published * (ULONGLONG)(clients - slowClients) * perClient / topics;
+
+    ULONGLONG waitStart = RtdNowNs();
+    while (b.net.releases < b.net.connects && RtdNowNs() - waitStart < 2000000000ULL) {
+        if (NetServer_Poll(&b.net) == 0) RtdSleepMs(1);
+    }
+    ULONGLONG connects = b.net.connects, shared = b.net.shared, releases = b.net.releases;
+    NetServer_Stop(&b.net);
+
+    Report(label, published, elapsed);
+    printf("  %ld clients subscribed %ld pairs in %.1f ms: %llu connected, %llu shared; %llu released after they left\n",
+           clients, clients * perClient, subscribeNs / 1e6, connects, shared, releases);
+    printf("  publish %.0f ns/update on the hub thread, %.1f M frames/s delivered (%.1f%% of fan-out to fast clients)\n",
+           (double)publishNs / (double)published, (fastUpdates + slowUpdates) / (elapsed / 1e9) / 1e6,
+           expected ? 100.0 * fastUpdates / expected : 0.0);
+    printf("  fast client latency p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us; %llu out of order\n",
+           Histogram_Percentile(&fast, 50) / 1e3, Histogram_Percentile(&fast, 99) / 1e3,
+           Histogram_Percentile(&fast, 99.9) / 1e3, fast.max / 1e3, reordered);
+    if (slowClients > 0) {
+        printf("  %ld slow clients got %llu updates, %llu conflated while their buffers were full\n",
+               slowClients, slowUpdates, b.net.conflated);
+    }
+    SubTable_Free(&b.subs);
+    free(args);
+    free(threads);
+}
+
+/**
+ * Network fan-out: 64 loopback clients, 100 of 1000 topics each
+ */
+static void BenchFanout(void)
+{
+    RunFanout("paced 200k/s", 64, 0, 200000);
+    RunFanout("as fast as possible", 64, 0, 0);
+    RunFanout("8 of 64 clients slow", 64, 8, 200000);
+}
+
+/**
+ * Run one conflation config over an opening-bell style stream: a few hot
+ * topics take most of the updates. Time is simulated so the result does
+ * not depend on machine speed. Afterwards every topic's last emitted
+ * value must equal its last offered one, unless epsilon absorbed it.
+ */
+static void RunConflate(const char *label, const ConflateConfig *cfg)
+{
+    const long topics = 20000;
+    const ULONGLONG updates = 10000000;
+    const ULONGLONG stepNs = 200;           // 5M updates/s of simulated time
+    Conflator c;
+    RtdUpdate out[WORKER_ROWS];
+    double *lastOffered = (double*)calloc(topics + 1, sizeof *lastOffered);
+    double *lastEmitted = (double*)calloc(topics + 1, sizeof *lastEmitted);
+
+    Conflator_Init(&c, cfg);
+    unsigned seed = 11;
+    ULONGLONG now = 1000000000ULL, printed = 0;
+    ULONGLONG start = RtdNowNs();
+    for (ULONGLONG i = 0; i < updates; i++) {
+        seed = seed * 1103515245u + 12345u;
+        unsigned r = seed >> 4;
+        long id = (r & 7) ? (long)(r % 200) + 1 : (long)(r % topics) + 1;
+        RtdUpdate u;
+        u.recvNs = now;
+        u.topicID = id;
+        u.vt = VT_R8;
+        u.dblVal = lastOffered[id] + ((r & 16) ? 0.01 : -0.01) * (1 + (r >> 20) % 4);
+        lastOffered[id] = u.dblVal;
+        if (Conflator_Offer(&c, &u, 1, now)) {
+            lastEmitted[id] = u.dblVal;
+            printed++;
+        }
+        now += stepNs;
+        if ((i & 255) == 255) {
+            ULONG n;
+            while ((n = Conflator_Drain(&c, now, out, WORKER_ROWS)) > 0) {
+                for (ULONG k = 0; k < n; k++) lastEmitted[out[k].topicID] = out[k].dblVal;
+                printed += n;
+            }
+        }
+    }
+    ULONGLONG elapsed = RtdNowNs() - start;
+
+    // Let every interval and the bucket run out
+    for (int round = 0; round < 100000 && c.held > 0; round++) {
+        now += 10000000;
+        ULONG n;
+        while ((n = Conflator_Drain(&c, now, out, WORKER_ROWS)) > 0) {
+            for (ULONG k = 0; k < n; k++) lastEmitted[out[k].topicID] = out[k].dblVal;
+            printed += n;
+        }
+    }
+    long stale = 0;
+    for (long id = 1; id <= topics; id++) {
+        if (fabs(lastEmitted[id] - lastOffered[id]) > cfg->epsilon + 1e-9) stale++;
+    }
+
+    Report(label, updates, elapsed);
+    printf("  printed %llu (%.1fx fewer), %llu coalesced, %llu within epsilon, %ld stale after drain\n",
+           printed, (double)updates / (double)printed, c.coalesced, c.absorbed, stale);
+    Conflator_Free(&c);
+    free(lastOffered);
+    free(lastEmitted);
+}
+
+/**
+ * Conflation: 10M updates over 2 s of simulated opening bell, 20k topics
+ */
+static void BenchConflate(void)
+{
+    ConflateConfig cfg;
+    memset(&cfg, 0, sizeof cfg);
+    cfg.topicIntervalNs = 100000000;
+    RunConflate("100 ms per topic", &cfg);
+
+    memset(&cfg, 0, sizeof cfg);
+    cfg.maxPerSec = 10000;
+    RunConflate("10k/s per worker", &cfg);
+
+    memset(&cfg, 0, sizeof cfg);
+    cfg.epsilon = 0.025;
+    RunConflate("epsilon 0.025", &cfg);
+
+    cfg.topicIntervalNs = 100000000;
+    cfg.maxPerSec = 10000;
+    RunConflate("all three", &cfg);
+}
+
+/**
+ * Subscribe a watchlist to a running simulated server, either one pair at
+ * a time through ConnectSubscription or in one Watchlist_Connect batch
+ */
+static void RunWatchlist(const char *label, const Watchlist *wl, BOOL bulk)
+{
+    SubscriptionTable subs;
+    RtdWakeup wakeup;
+    BenchCallback cb = { { &benchcb_vtbl }, &wakeup };
+    SimConfig cfg;
+
+    memset(&cfg, 0, sizeof cfg);
+    cfg.mode = SIM_SYNTHETIC;
+    cfg.updatesPerSec = 1e6;
+    cfg.seed = 9;
+    Wakeup_Init(&wakeup, 0);
+    SubTable_Init(&subs, 1024);
+    IRtdServer *srv = SimServer_Create(&cfg);
+    srv->lpVtbl->ServerStart(srv, &cb.iface, &(long){0});
+
+    LONGLONG allocs = RtdOleAllocCount();
+    ULONGLONG start = RtdNowNs(), maxCallNs = 0;
+    long connected = 0;
+    if (bulk) {
+        WatchConnectStats st;
+        connected = Watchlist_Connect(wl, srv, &subs, NULL, NULL, &st);
+        maxCallNs = st.maxCallNs;
+    } else {
+        for (long i = 0; i < wl->count; i++) {
+            TopicSubscription *sub = SubTable_Add(&subs, wl->pairs[i].symbol, wl->pairs[i].topic);
+            ULONGLONG callStart = RtdNowNs();
+            if (SUCCEEDED(ConnectSubscription(srv, sub))) connected++;
+            ULONGLONG callNs = RtdNowNs() - callStart;
+            if (callNs > maxCallNs) maxCallNs = callNs;
+        }
+    }
+    ULONGLONG elapsed = RtdNowNs() - start;
+    allocs = RtdOleAllocCount() - allocs;
+
+    long lowID = subs.highWater, highID = 0;
+    for (long id = 1; id < subs.highWater; id++) {
+        if (!SubTable_Get(&subs, id)) continue;
+        if (id < lowID) lowID = id;
+        highID = id;
+    }
+
+    Report(label, (ULONGLONG)connected, elapsed);
+    printf("  %ld connected in %.2f ms, max call %.1f us, %.2f OLE allocations per pair, IDs %ld..%ld\n",
+           connected, elapsed / 1e6, maxCallNs / 1e3, (double)allocs / wl->count, lowID, highID);
+
+    srv->lpVtbl->ServerTerminate(srv);
+    srv->lpVtbl->Release(srv);
+    SubTable_Free(&subs);
+    Wakeup_Free(&wakeup);
+}
+
+/**
+ * A bulk load of pairs that are mostly registered already reserves more
+ * IDs than it uses; once it ends, new pairs must take freed IDs again
+ * rather than the rest of the reservation
+ */
+static void RunReserveReuse(void)
+{
+    SubscriptionTable subs;
+    WCHAR symbol[32];
+    SubTable_Init(&subs, 64);
+    for (int i = 0; i < 100; i++) {
+        swprintf(symbol, ARRAYSIZE(symbol), L"OLD%d", i);
+        SubTable_Add(&subs, symbol, L"LAST");
+    }
+    SubTable_Reserve(&subs, 150);
+    for (int i = 0; i < 150; i++) {
+        swprintf(symbol, ARRAYSIZE(symbol), i < 100 ? L"OLD%d" : L"NEW%d", i);
+        SubTable_Add(&subs, symbol, L"LAST");
+    }
+    SubTable_EndReserve(&subs);
+
+    BYTE freed[512] = { 0 };
+    for (long id = 1; id <= 10; id++) {
+        freed[id] = 1;
+        SubTable_Remove(&subs, id);
+    }
+    long highWater = subs.highWater, reused = 0;
+    for (int i = 0; i < 10; i++) {
+        swprintf(symbol, ARRAYSIZE(symbol), L"LATE%d", i);
+        TopicSubscription *sub = SubTable_Add(&subs, symbol, L"LAST");
+        if (sub && sub->topicID < (long)sizeof freed && freed[sub->topicID]) reused++;
+    }
+    printf("  reserve then re-add: %ld of 10 new pairs took freed IDs, high water %ld -> %ld\n",
+           reused, highWater, subs.highWater);
+    Expect(reused == 10 && subs.highWater == highWater, "adds after a bulk load reuse freed topic IDs");
+    SubTable_Free(&subs);
+}
+
+/**
+ * Watchlist restore: 3000 symbols x 5 topics from a file, against a
+ * simulated server already streaming 1M updates/s; then topic ID reuse
+ * after a bulk load
+ */
+static void BenchWatchlist(void)
+{
+    const char *path = "rtd_bench_watchlist.txt";
+    FILE *f = fopen(path, "w");
+    if (!f) return;
+    fprintf(f, "# symbol topics\n");
+    for (int i = 0; i < 3000; i++) {
+        if (i == 0) fprintf(f, "SYM%d LAST,BID,ASK,VOLUME,MARK\n", i);
+        else fprintf(f, "SYM%d\n", i);
+    }
+    fclose(f);
+
+    Watchlist wl;
+    ULONGLONG start = RtdNowNs();
+    if (!Watchlist_Load(&wl, path)) {
+        remove(path);
+        return;
+    }
+    Report("load file (pairs)", (ULONGLONG)wl.count, RtdNowNs() - start);
+
+    RunWatchlist("one at a time", &wl, FALSE);
+    RunWatchlist("bulk", &wl, TRUE);
+    RunReserveReuse();
+
+    Watchlist_Free(&wl);
+    remove(path);
+}
+
+static HRESULT CreateBenchSim(void *ctx, IRtdServer **ppSrv)
+{
+    *ppSrv = SimServer_Create((const SimConfig*)ctx);
+    return *ppSrv ? S_OK : RPC_E_DISCONNECTED;
+}
+
+static void PrintSupervisorEvent(void *ctx, const Supervisor *sv, SupervisorEvent ev)
+{
+    if (ev == SUPERVISOR_RECOVERED) {
+        printf("  incident %u: lost via %s, back after %.1f ms and %u attempt(s), %ld topics replayed in %.2f ms\n",
+               sv->incidents, sv->cause, (sv->recoveredNs - sv->lostNs) / 1e6, sv->attempts,
+               sv->replayed, sv->replayNs / 1e6);
+    } else if (ev == SUPERVISOR_GAP_CLOSED) {
+        printf("  incident %u: data gap %.1f ms\n", sv->incidents, sv->gapNs / 1e6);
+    }
+}
+
+/**
+ * Supervised client loop against a simulated server that dies every
+ * dropout seconds and stays down for downtime seconds
+ */
+static void RunSupervised(const char *label, BOOL notify, DWORD heartbeatMs)
+{
+    const long topics = 5000;
+    const double seconds = 2.0;
+    SubscriptionTable subs;
+    RtdWakeup wakeup;
+    Supervisor sv;
+    BenchCallback cb = { { &benchcb_vtbl }, &wakeup, &sv };
+    SimConfig cfg;
+    static const WCHAR *fields[] = { L"LAST", L"BID", L"ASK", L"VOLUME", L"MARK" };
+    WCHAR symbol[32];
+
+    memset(&cfg, 0, sizeof cfg);
+    cfg.mode = SIM_SYNTHETIC;
+    cfg.updatesPerSec = 200000;
+    cfg.seed = 21;
+    cfg.dropoutAfterSec = 0.5;
+    cfg.downtimeSec = 0.2;
+    cfg.dropoutNotify = notify;
+
+    printf("%s\n", label);
+    Wakeup_Init(&wakeup, 0);
+    SubTable_Init(&subs, topics);
+    Supervisor_Init(&sv, CreateBenchSim, &cfg, &cb.iface, &subs, heartbeatMs);
+    sv.onEvent = PrintSupervisorEvent;
+    if (FAILED(Supervisor_Start(&sv))) {
+        printf("  simulated server did not start\n");
+        return;
+    }
+    for (long i = 0; i < topics; i++) {
+        swprintf(symbol, ARRAYSIZE(symbol), L"SYM%ld", i / 5);
+        ConnectSubscription(sv.server, SubTable_Add(&subs, symbol, fields[i % 5]));
+    }
+
+    ULONGLONG rows = 0;
+    ULONGLONG end = RtdNowNs() + (ULONGLONG)(seconds * 1e9);
+    while (RtdNowNs() < end) {
+        // Same order as the client: wait, tick, then RefreshData
+        WakeResult wr = Wakeup_Wait(&wakeup, 20);
+        Supervisor_Tick(&sv, RtdNowNs());
+        if (!sv.server || wr != WAKE_SIGNALED) continue;
+        Wakeup_Consume(&wakeup);
+
+        long count = 0;
+        SAFEARRAY *out = NULL;
+        HRESULT hr = sv.server->lpVtbl->RefreshData(sv.server, &count, &out);
+        if (SUCCEEDED(hr) && out) SubTable_Dispatch(&subs, out, count, CountRow, &rows);
+        if (out) SafeArrayDestroy(out);
+        Supervisor_OnRefresh(&sv, hr, SUCCEEDED(hr) ? count : 0, RtdNowNs());
+    }
+
+    printf("  %u incident(s), %llu heartbeats, max gap %.1f ms, avg gap %.1f ms, %llu rows\n",
+           sv.incidents, sv.heartbeats, sv.maxGapNs / 1e6,
+           sv.incidents ? sv.totalGapNs / 1e6 / sv.incidents : 0.0, rows);
+    Supervisor_Stop(&sv);
+    SubTable_Free(&subs);
+    Wakeup_Free(&wakeup);
+}
+
+/**
+ * Supervisor: recovery time and data gap when the server dies every
+ * 0.5 s, with and without a Disconnect callback
+ */
+static void BenchSupervisor(void)
+{
+    RunSupervised("server calls Disconnect, 100 ms heartbeat", TRUE, 100);
+    RunSupervised("server dies silently, 100 ms heartbeat", FALSE, 100);
+}
+
+static int CompareU64(const void *a, const void *b)
+{
+    ULONGLONG x = *(const ULONGLONG*)a, y = *(const ULONGLONG*)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Metrics: cost of one histogram record, and percentile error against
+ * an exact sort on 1M latency-like samples (long-tailed, 100 ns to 100 ms)
+ */
+static void BenchMetrics(void)
+{
+    const size_t samples = 1 << 20;
+    const ULONGLONG records = 100000000;
+    ULONGLONG *values = (ULONGLONG*)malloc(samples * sizeof *values);
+    Histogram *h = (Histogram*)calloc(1, sizeof *h);
+    if (!values || !h) {
+        free(values);
+        free(h);
+        return;
+    }
+
+    ULONGLONG x = 88172645463325252ULL;
+    for (size_t i = 0; i < samples; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        double u = (double)(x >> 11) / 9007199254740992.0;
+        values[i] = (100 + (x & 1023)) << (int)(17.0 * u * u * u);
+    }
+
+    ULONGLONG start = RtdNowNs();
+    for (ULONGLONG i = 0; i < records; i++) Histogram_Record(h, values[i & (samples - 1)]);
+    Report("record", records, RtdNowNs() - start);
+
+    memset(h, 0, sizeof *h);
+    for (size_t i = 0; i < samples; i++) Histogram_Record(h, values[i]);
+    qsort(values, samples, sizeof *values, CompareU64);
+    static const double pct[] = { 50, 90, 99, 99.9, 99.99 };
+    double worst = 0;
+    for (size_t i = 0; i < ARRAYSIZE(pct); i++) {
+        ULONGLONG exact = values[(size_t)(pct[i] / 100.0 * samples + 0.5) - 1];
+        ULONGLONG approx = Histogram_Percentile(h, pct[i]);
+        double err = fabs((double)approx - (double)exact) / (double)exact;
+        if (err > worst) worst = err;
+        printf("  p%-6g exact %10llu ns  histogram %10llu ns  error %.2f%%\n", pct[i], exact, approx, err * 100);
+    }
+    printf("  worst percentile error %.2f%%, %zu bytes per histogram\n", worst * 100, sizeof *h);
+    free(values);
+    free(h);
+}
+
+/**
+ * Connect every subscription in subs to srv, allocating arguments per call
+ * or through the table's reused ones; returns the OLE allocations made
+ */
+static LONGLONG ConnectAll(const char *label, SubscriptionTable *subs, IRtdServer *srv, BOOL reuse)
+{
+    LONGLONG allocs = RtdOleAllocCount();
+    ULONGLONG start = RtdNowNs();
+    long pairs = 0;
+    for (long id = 1; id < subs->highWater; id++) {
+        TopicSubscription *sub = SubTable_Get(subs, id);
+        if (!sub) continue;
+        if (reuse) SubTable_Connect(subs, srv, sub);
+        else ConnectSubscription(srv, sub);
+        pairs++;
+    }
+    ULONGLONG elapsed = RtdNowNs() - start;
+    allocs = RtdOleAllocCount() - allocs;
+    Report(label, (ULONGLONG)pairs, elapsed);
+    printf("  %.2f OLE allocations per pair\n", (double)allocs / pairs);
+    return allocs;
+}
+
+/**
+ * Decode, copy out and release mixed batches the way EnqueueUpdate and the
+ * output worker do, with string values copied or interned
+ */
+static void RunStringValues(const char *label, SAFEARRAY *arr, long rows, RtdStringPool *pool)
+{
+    const ULONGLONG batches = 2000;
+    RtdBatch batch;
+    RtdUpdate *u = (RtdUpdate*)calloc(rows, sizeof *u);
+    RtdBatch_Init(&batch, rows);
+    batch.strings = pool;
+
+    ULONGLONG strings = 0;
+    LONGLONG allocs = RtdOleAllocCount();
+    ULONGLONG start = RtdNowNs();
+    for (ULONGLONG b = 0; b < batches; b++) {
+        long n = RtdBatch_Decode(&batch, arr, rows);
+        for (long i = 0; i < n; i++) RtdBatch_Update(&batch, i, &u[i], start);
+        strings += batch.strCount;
+        for (long i = 0; i < n; i++) RtdUpdate_Clear(&u[i]);
+    }
+    ULONGLONG elapsed = RtdNowNs() - start;
+    allocs = RtdOleAllocCount() - allocs;
+
+    ReportStage(label, rows, batches, elapsed, allocs);
+    printf("  %llu string values, %.3f allocations each\n", strings, (double)allocs / strings);
+    RtdBatch_Free(&batch);
+    free(u);
+}
+
+/**
+ * Allocations on the two paths that repeat work: resubscribing after a
+ * reconnect, and string values arriving in every batch
+ */
+static void BenchPool(void)
+{
+    SubscriptionTable subs;
+    RtdWakeup wakeup;
+    BenchCallback cb = { { &benchcb_vtbl }, &wakeup };
+    static const WCHAR *topics[] = { L"LAST", L"BID", L"ASK", L"VOLUME", L"MARK" };
+    WCHAR symbol[32];
+    SimConfig cfg;
+
+    memset(&cfg, 0, sizeof cfg);
+    cfg.mode = SIM_SYNTHETIC;
+    cfg.updatesPerSec = 1e5;
+    cfg.seed = 5;
+    Wakeup_Init(&wakeup, 0);
+    SubTable_Init(&subs, 1024);
+    for (long i = 0; i < 15000; i++) {
+        swprintf(symbol, ARRAYSIZE(symbol), L"SYM%ld", i / 5);
+        SubTable_Add(&subs, symbol, topics[i % 5]);
+    }
+
+    // Each pass is a fresh server, as after a reconnect
+    static const struct { const char *label; BOOL reuse; } passes[] = {
+        { "connect, new args", FALSE },
+        { "connect, reused", TRUE },
+        { "reconnect, reused", TRUE },
+    };
+    for (size_t p = 0; p < ARRAYSIZE(passes); p++) {
+        IRtdServer *srv = SimServer_Create(&cfg);
+        srv->lpVtbl->ServerStart(srv, &cb.iface, &(long){0});
+        ConnectAll(passes[p].label, &subs, srv, passes[p].reuse);
+        srv->lpVtbl->ServerTerminate(srv);
+        srv->lpVtbl->Release(srv);
+    }
+    printf("  %llu argument BSTRs/arrays kept for %ld pairs\n", subs.argAllocs, subs.count);
+    SubTable_Free(&subs);
+    Wakeup_Free(&wakeup);
+
+    // 40% of rows are non-R8, 3/8 of those strings from a small set
+    const long rows = 1000;
+    SAFEARRAY *arr = MakeRefreshBatch(rows, 11, 60);
+    RtdStringPool pool;
+    RtdStringPool_Init(&pool, 0);
+    RunStringValues("copied", arr, rows, NULL);
+    RunStringValues("interned", arr, rows, &pool);
+    printf("  pool: %ld values in %zu bytes, %llu hits, %llu copies\n",
+           pool.count, pool.arena.bytes, pool.hits, pool.copies);
+    RtdStringPool_Free(&pool);
+    SafeArrayDestroy(arr);
+}
+
+typedef struct ShardBenchFactory {
+    SimConfig     cfg;
+    IRtdServer   *created[MAX_SHARDS];
+    volatile LONG count;
+} ShardBenchFactory;
+
+/**
+ * ServerFactory for the shard threads: a simulated server, kept alive
+ * past ServerTerminate so its stats can be read
+ */
+static HRESULT CreateShardSim(void *ctx, IRtdServer **ppSrv)
+{
+    ShardBenchFactory *f = (ShardBenchFactory*)ctx;
+    *ppSrv = SimServer_Create(&f->cfg);
+    if (!*ppSrv) return RPC_E_DISCONNECTED;
+    (*ppSrv)->lpVtbl->AddRef(*ppSrv);
+    f->created[InterlockedIncrement(&f->count) - 1] = *ppSrv;
+    return S_OK;
+}
+
+typedef struct ShardBenchCtx {
+    ULONGLONG rows;
+    ULONGLONG lastNs;
+    ULONGLONG outOfOrder;
+} ShardBenchCtx;
+
+static void CheckMergedRow(void *ctx, RtdUpdate *u)
+{
+    ShardBenchCtx *c = (ShardBenchCtx*)ctx;
+    if (u->recvNs < c->lastNs) c->outOfOrder++;
+    c->lastNs = u->recvNs;
+    c->rows++;
+    RtdUpdate_Clear(u);
+}
+
+static void CountBatchRow(void *ctx, TopicSubscription *sub, const RtdBatch *batch, long row)
+{
+    (*(ULONGLONG*)ctx)++;
+}
+
+/**
+ * Stream topicCount topics for seconds from one simulated server on this
+ * thread (shards == 0), or from a ShardServer of that many
+ */
+static void RunShards(const char *label, const SimConfig *cfg, int shards, long topicCount, double seconds)
+{
+    static const WCHAR *topics[] = { L"LAST", L"BID", L"ASK", L"VOLUME", L"MARK" };
+    SubscriptionTable subs;
+    RtdWakeup wakeup;
+    BenchCallback cb = { { &benchcb_vtbl }, &wakeup };
+    ShardBenchFactory factory;
+    ShardBenchCtx merged;
+    RtdBatch batch;
+    WCHAR symbol[32];
+    IRtdServer *srv;
+
+    memset(&factory, 0, sizeof factory);
+    memset(&merged, 0, sizeof merged);
+    factory.cfg = *cfg;
+    Wakeup_Init(&wakeup, 0);
+    RtdBatch_Init(&batch, 1024);
+    SubTable_Init(&subs, topicCount);
+    if (shards > 0) {
+        ShardConfig sc = { shards, 65536, NULL };
+        factory.cfg.updatesPerSec = cfg->updatesPerSec / shards;
+        srv = ShardServer_Create(CreateShardSim, &factory, &sc);
+    } else {
+        CreateShardSim(&factory, &srv);
+    }
+    srv->lpVtbl->ServerStart(srv, &cb.iface, &(long){0});
+
+    ULONGLONG start = RtdNowNs();
+    for (long i = 0; i < topicCount; i++) {
+        swprintf(symbol, ARRAYSIZE(symbol), L"SYM%ld", i / 5);
+        SubTable_Connect(&subs, srv, SubTable_Add(&subs, symbol, topics[i % 5]));
+    }
+    // Sharded connects return at once; wait for the shards to make them
+    for (ULONGLONG done = 0; shards > 0 && done < (ULONGLONG)topicCount;) {
+        RtdSleepMs(1);
+        ShardServer_Drain(srv, CheckMergedRow, &merged);
+        done = 0;
+        for (int i = 0; i < shards; i++) {
+            ShardStats st;
+            ShardServer_GetStats(srv, i, &st);
+            done += st.connects;
+        }
+    }
+    ULONGLONG connectNs = RtdNowNs() - start;
+
+    SimStats before[MAX_SHARDS], total, st;
+    for (int i = 0; i < factory.count; i++) SimServer_GetStats(factory.created[i], &before[i]);
+    memset(&merged, 0, sizeof merged);
+    ULONGLONG refreshNs = 0;
+    start = RtdNowNs();
+    ULONGLONG end = start + (ULONGLONG)(seconds * 1e9);
+    while (RtdNowNs() < end) {
+        if (Wakeup_Wait(&wakeup, 100) != WAKE_SIGNALED) continue;
+        Wakeup_Consume(&wakeup);
+        if (shards > 0) {
+            ShardServer_Drain(srv, CheckMergedRow, &merged);
+            continue;
+        }
+        long count = 0;
+        SAFEARRAY *out = NULL;
+        ULONGLONG callNs = RtdNowNs();
+        if (SUCCEEDED(srv->lpVtbl->RefreshData(srv, &count, &out)) && out) {
+            refreshNs += RtdNowNs() - callNs;
+            RtdBatch_Decode(&batch, out, count);
+            SubTable_DispatchBatch(&subs, &batch, CountBatchRow, &merged.rows);
+            SafeArrayDestroy(out);
+        }
+    }
+    ULONGLONG elapsed = RtdNowNs() - start;
+    srv->lpVtbl->ServerTerminate(srv);
+    srv->lpVtbl->Release(srv);
+
+    // Over the timed run only
+    memset(&total, 0, sizeof total);
+    for (int i = 0; i < factory.count; i++) {
+        SimServer_GetStats(factory.created[i], &st);
+        total.generated += st.generated - before[i].generated;
+        total.conflated += st.conflated - before[i].conflated;
+        total.refreshCalls += st.refreshCalls - before[i].refreshCalls;
+        total.rowsDelivered += st.rowsDelivered - before[i].rowsDelivered;
+        total.totalRowAgeNs += st.totalRowAgeNs - before[i].totalRowAgeNs;
+        factory.created[i]->lpVtbl->Release(factory.created[i]);
+    }
+
+    Report(label, merged.rows, elapsed);
+    printf("  connect %.0f ms, %llu RefreshData calls, %.0f rows/call, %.1f%% of changes conflated\n",
+           connectNs / 1e6, total.refreshCalls,
+           total.refreshCalls ? (double)total.rowsDelivered / total.refreshCalls : 0.0,
+           total.generated ? 100.0 * total.conflated / total.generated : 0.0);
+    printf("  change->RefreshData avg %.2f ms, %llu rows out of receive-time order\n",
+           total.rowsDelivered ? total.totalRowAgeNs / 1e6 / total.rowsDelivered : 0.0, merged.outOfOrder);
+    if (shards == 0) {
+        printf("  RTD thread blocked in RefreshData %.0f%% of the time\n", 100.0 * refreshNs / elapsed);
+    }
+
+    SubTable_Free(&subs);
+    RtdBatch_Free(&batch);
+    Wakeup_Free(&wakeup);
+}
+
+/**
+ * 20k topics at 1M changes/s from a server whose calls cost 50 us plus
+ * 2 us per row returned, on the RTD thread and across 1 to 8 shards
+ */
+/**
+ * RtdSessionBatchFn: note which topic IDs had a row
+ */
+static void MarkTopicRows(void *ctx, RtdSession *s, const RtdBatch *batch, ULONGLONG recvNs)
+{
+    BYTE *got = (BYTE*)ctx;
+    for (long i = 0; i < batch->rows; i++) got[batch->topicID[i]] = 1;
+}
+
+/**
+ * Next symbol "<prefix><n>" that hashes to shard, from *n on
+ */
+static void SymbolOnShard(const char *prefix, int shard, int shards, long *n, WCHAR *symbol, size_t size)
+{
+    for (;; (*n)++) {
+        swprintf(symbol, size, L"%hs%ld", prefix, *n);
+        if (ShardServer_ShardOf(symbol, shards) == shard) break;
+    }
+    (*n)++;
+}
+
+/**
+ * Release topics that never change on a shard kept busy with slow
+ * connects, so their retire markers lag, and subscribe new pairs on
+ * another shard in the freed IDs. The new pairs' ConnectData values
+ * arrive while the markers are in flight and must still be delivered.
+ */
+static void RunShardReuse(void)
+{
+    const long topics = 50;
+    const long filler = 500;            // Slow connects queued ahead of the disconnects
+    RtdSessionConfig sc;
+    RtdSession s;
+    SimConfig cfg;
+    WCHAR symbol[32];
+
+    memset(&cfg, 0, sizeof cfg);
+    cfg.mode = SIM_SYNTHETIC;
+    cfg.seed = 29;
+    cfg.updatesPerSec = 1.0;
+    cfg.callLatencyUs = 200;
+    BYTE *got = (BYTE*)calloc(topics + filler + 1, 1);
+    long *ids = (long*)malloc(topics * sizeof *ids);
+    memset(&sc, 0, sizeof sc);
+    sc.factoryCtx = &cfg;
+    sc.shards = 2;
+    sc.onBatch = MarkTopicRows;
+    sc.ctx = got;
+    if (!got || !ids || !RtdSession_Init(&s, &sc) || FAILED(RtdSession_Start(&s))) {
+        printf("  session did not start\n");
+        free(got);
+        free(ids);
+        return;
+    }
+
+    long n = 0;
+    for (long i = 0; i < topics; i++) {
+        TopicSubscription *sub;
+        SymbolOnShard("OLD", 0, 2, &n, symbol, ARRAYSIZE(symbol));
+        RtdSession_Subscribe(&s, symbol, L"DESCRIPTION", &sub);
+        ids[i] = sub ? sub->topicID : 0;
+    }
+    ULONGLONG end = RtdNowNs() + 100000000ULL;
+    while (RtdNowNs() < end) RtdSession_Poll(&s, 10);
+
+    n = 0;
+    for (long i = 0; i < filler; i++) {
+        SymbolOnShard("BUSY", 0, 2, &n, symbol, ARRAYSIZE(symbol));
+        RtdSession_Subscribe(&s, symbol, L"LAST", NULL);
+    }
+    for (long i = 0; i < topics; i++) RtdSession_Unsubscribe(&s, ids[i]);
+    memset(got, 0, topics + filler + 1);
+    n = 0;
+    long reused = 0, missing = 0;
+    for (long i = 0; i < topics; i++) {
+        TopicSubscription *sub;
+        SymbolOnShard("NEW", 1, 2, &n, symbol, ARRAYSIZE(symbol));
+        RtdSession_Subscribe(&s, symbol, L"DESCRIPTION", &sub);
+        ids[i] = sub ? sub->topicID : 0;
+    }
+    end = RtdNowNs() + 400000000ULL;
+    while (RtdNowNs() < end) RtdSession_Poll(&s, 10);
+    for (long i = 0; i < topics; i++) {
+        if (!ids[i]) continue;
+        reused++;
+        if (!got[ids[i]]) missing++;
+    }
+    printf("  topic IDs reused across shards: %ld new pairs, %ld without their ConnectData value\n",
+           reused, missing);
+    Expect(reused == topics && missing == 0, "a reused topic ID's new pair gets its value");
+
+    RtdSession_Stop(&s);
+    RtdSession_Free(&s);
+    free(got);
+    free(ids);
+}
+
+static void BenchShard(void)
+{
+    SimConfig cfg;
+    memset(&cfg, 0, sizeof cfg);
+    cfg.mode = SIM_SYNTHETIC;
+    cfg.seed = 21;
+    cfg.updatesPerSec = 1e6;
+    cfg.callLatencyUs = 50;
+    cfg.rowLatencyNs = 2000;
+
+    RunShards("RTD thread", &cfg, 0, 20000, 2.0);
+    static const int counts[] = { 1, 2, 4, 8 };
+    char label[32];
+    for (size_t i = 0; i < ARRAYSIZE(counts); i++) {
+        snprintf(label, sizeof label, "%d shard%s", counts[i], counts[i] > 1 ? "s" : "");
+        RunShards(label, &cfg, counts[i], 20000, 2.0);
+    }
+    RunShardReuse();
+}
+
+typedef struct WheelBenchCtx {
+    ULONGLONG *due;         // Time each timer was last scheduled for, 0 = not pending
+    ULONGLONG  nowNs;       // Advance in progress
+    ULONGLONG  prevNs;      // The Advance before it
+    ULONGLONG  early;
+    ULONGLONG  late;
+    ULONGLONG  fired;
+} WheelBenchCtx;
+
+static void CheckWheelFire(void *ctx, ULONG id, ULONGLONG dueNs)
+{
+    WheelBenchCtx *c = (WheelBenchCtx*)ctx;
+    ULONGLONG due = c->due[id];
+    if (due > c->nowNs) c->early++;
+    if (due + BAR_TICK_NS <= c->prevNs) c->late++;   // Could have fired an Advance earlier
+    c->due[id] = 0;
+    c->fired++;
+}
+
+/**
+ * Timing wheel: 200k timers due up to 18 hours out, a third of them
+ * rescheduled or cancelled along the way, advanced in uneven steps
+ */
+static void RunWheel(void)
+{
+    const ULONG timers = 200000;
+    TimerWheel w;
+    WheelBenchCtx c;
+    memset(&c, 0, sizeof c);
+    c.due = (ULONGLONG*)calloc(timers, sizeof *c.due);
+    TimerWheel_Init(&w, BAR_TICK_NS, 0);
+
+    unsigned seed = 29;
+    ULONGLONG ops = 0, start = RtdNowNs();
+    for (ULONG id = 0; id < timers; id++) {
+        seed = seed * 1103515245u + 12345u;
+        // Spread over every level: ms, seconds, minutes and hours out
+        ULONGLONG span = 1000000ULL << (seed % 27);
+        c.due[id] = 1 + ((ULONGLONG)seed * 2654435761ULL) % span;
+        TimerWheel_Schedule(&w, id, c.due[id]);
+        ops++;
+    }
+    ULONGLONG cancelled = 0;
+    while (w.pending > 0) {
+        seed = seed * 1103515245u + 12345u;
+        c.prevNs = c.nowNs;
+        c.nowNs += 1000000ULL * (1 + seed % 5000);
+        if (seed % 3 == 0) {
+            // Move or cancel a pending timer
+            ULONG id = (seed >> 8) % timers;
+            if (c.due[id]) {
+                if (seed & 0x10000) {
+                    TimerWheel_Cancel(&w, id);
+                    c.due[id] = 0;
+                    cancelled++;
+                } else {
+                    c.due[id] = c.nowNs + ((ULONGLONG)seed << 4) % 3600000000000ULL;
+                    TimerWheel_Schedule(&w, id, c.due[id]);
+                }
+                ops++;
+            }
+        }
+        TimerWheel_Advance(&w, c.nowNs, CheckWheelFire, &c);
+    }
+    Report("timers (schedule + fire)", ops, RtdNowNs() - start);
+    printf("  %llu fired, %llu cancelled, %llu cascaded, %llu early, %llu late, %.1f h simulated\n",
+           c.fired, cancelled, w.cascaded, c.early, c.late, c.nowNs / 3.6e12);
+    TimerWheel_Free(&w);
+    free(c.due);
+}
+
+typedef struct BarBenchCtx {
+    const BarBuilder *bars;
+    LONGLONG  volume[BAR_MAX_INTERVALS];
+    ULONGLONG count[BAR_MAX_INTERVALS];
+    ULONGLONG malformed;    // low > open/close or high < open/close
+    ULONGLONG gaps;
+    ULONGLONG lastSeq;
+    ULONGLONG cleared;      // Closed by BarBuilder_ClearSymbol
+} BarBenchCtx;
+
+static void CheckBar(void *ctx, const Bar *bar)
+{
+    BarBenchCtx *c = (BarBenchCtx*)ctx;
+    int k = 0;
+    while (c->bars->intervalMs[k] != bar->intervalMs) k++;
+    c->volume[k] += bar->volume;
+    c->count[k]++;
+    if (bar->low > bar->open || bar->low > bar->close || bar->high < bar->open || bar->high < bar->close) {
+        c->malformed++;
+    }
+    if (bar->seq != c->lastSeq + 1) c->gaps++;
+    c->lastSeq = bar->seq;
+    if (bar->flags & BAR_CLEARED) c->cleared++;
+}
+
+/**
+ * Close check the wheel replaces: look at every slot once per batch
+ */
+static ULONG ScanForDueBars(const BarBuilder *b, ULONGLONG nowNs)
+{
+    ULONG due = 0;
+    for (long sym = 0; sym < b->symbolCap; sym++) {
+        for (int k = 0; k < b->intervalCount; k++) {
+            const BarSlot *s = &b->slots[sym * b->intervalCount + k];
+            ULONGLONG startWallNs = s->closing ? s->prev.startWallNs : s->bar.startWallNs;
+            LONGLONG deadline = (LONGLONG)(startWallNs + b->intervalNs[k]) - b->wallOffsetNs + (LONGLONG)b->graceNs;
+            if ((s->open || s->closing) && deadline <= (LONGLONG)nowNs) due++;
+        }
+    }
+    return due;
+}
+
+/**
+ * OHLCV bars: 10k symbols x LAST/VOLUME at 1M rows/s of simulated time,
+ * 1s/1m/5m bars with a 100 ms grace period. One batch in 100 is stamped
+ * up to 300 ms in the past, as if held back, to exercise the late row
+ * policy.
+ */
+static void BenchBars(void)
+{
+    RunWheel();
+
+    static const ULONG intervals[] = { 1000, 60000, 300000 };
+    const int intervalCount = ARRAYSIZE(intervals);
+    const long symbols = 10000;
+    const long rows = 1000;             // Per 1 ms batch
+    const long batches = 60000;         // One minute of simulated time
+    SubscriptionTable subs;
+    QuoteStore qs;
+    BarBuilder b;
+    BarBenchCtx ctx;
+    WCHAR symbol[32];
+
+    // Start mid-bar, so the first 1s bars are partial like a live session
+    ULONGLONG t = 1000000000000ULL + 123456789ULL;
+    memset(&ctx, 0, sizeof ctx);
+    ctx.bars = &b;
+    SubTable_Init(&subs, symbols * 2);
+    QuoteStore_Init(&qs, symbols);
+    BarBuilder_Init(&b, &qs, intervals, intervalCount, BAR_DEFAULT_GRACE_MS, t, CheckBar, &ctx);
+    long *ids = (long*)malloc(symbols * 2 * sizeof *ids);
+    for (long i = 0; i < symbols; i++) {
+        swprintf(symbol, ARRAYSIZE(symbol), L"SYM%ld", i);
+        TopicSubscription *last = SubTable_Add(&subs, symbol, L"LAST");
+        TopicSubscription *vol = SubTable_Add(&subs, symbol, L"VOLUME");
+        QuoteStore_Track(&qs, last);
+        QuoteStore_Track(&qs, vol);
+        BarBuilder_Track(&b, last);
+        BarBuilder_Track(&b, vol);
+        ids[i * 2] = last->topicID;
+        ids[i * 2 + 1] = vol->topicID;
+    }
+
+    double *price = (double*)malloc(symbols * sizeof *price);
+    LONGLONG *volume = (LONGLONG*)calloc(symbols, sizeof *volume);
+    LONGLONG *base = (LONGLONG*)malloc(symbols * sizeof *base);     // VOLUME at the end of its first batch
+    long *firstBatch = (long*)malloc(symbols * sizeof *firstBatch);
+    for (long i = 0; i < symbols; i++) firstBatch[i] = -1;
+    for (long i = 0; i < symbols; i++) price[i] = 20.0 + (double)(i % 500);
+    RtdUpdate *batch = (RtdUpdate*)calloc(rows, sizeof *batch);
+    LONGLONG traded = 0;
+    ULONGLONG barNs = 0;
+    unsigned seed = 31;
+
+    for (long n = 0; n < batches; n++) {
+        t += 1000000;
+        ULONGLONG stamp = t;
+        if (n % 100 == 99) stamp -= 1000000ULL * (1 + (seed >> 8) % 300);
+
+        // A trade per symbol touched: LAST when the price moved, VOLUME always
+        long count = 0;
+        while (count < rows - 1) {
+            seed = seed * 1103515245u + 12345u;
+            long sym = (long)((seed >> 4) % (unsigned)symbols);
+            LONGLONG size = 100 * (1 + (seed >> 24) % 5);
+            volume[sym] += size;
+            if (firstBatch[sym] < 0) firstBatch[sym] = n;
+            if (firstBatch[sym] == n) base[sym] = volume[sym];
+            if (seed % 10 < 7) {
+                price[sym] += ((double)((seed >> 12) % 11) - 5.0) / 100.0;
+                batch[count].topicID = ids[sym * 2];
+                batch[count].vt = VT_R8;
+                batch[count].dblVal = price[sym];
+                batch[count++].recvNs = stamp;
+            }
+            batch[count].topicID = ids[sym * 2 + 1];
+            batch[count].vt = VT_I8;
+            batch[count].llVal = volume[sym];
+            batch[count++].recvNs = stamp;
+        }
+
+        ULONGLONG start = RtdNowNs();
+        for (long i = 0; i < count; i++) {
+            TopicSubscription *sub = SubTable_Get(&subs, batch[i].topicID);
+            QuoteStore_ApplyUpdate(&qs, sub, &batch[i]);
+            BarBuilder_Apply(&b, sub, &batch[i]);
+        }
+        BarBuilder_EndBatch(&b);
+        BarBuilder_Advance(&b, t);
+        barNs += RtdNowNs() - start;
+    }
+    ULONGLONG closedOnTime = b.bars;
+    ULONGLONG maxLag = b.maxCloseLagNs;
+
+    for (long i = 0; i < symbols; i++) traded += volume[i] - base[i];
+
+    // What finding due bars by scanning would cost per batch instead
+    ULONGLONG start = RtdNowNs();
+    ULONG due = 0;
+    for (int i = 0; i < 1000; i++) due += ScanForDueBars(&b, t + (ULONGLONG)i * 1000000);
+    ULONGLONG scanNs = (RtdNowNs() - start) / 1000;
+
+    // Unsubscribe every symbol: its bars close now, so nothing is left for the wheel
+    ULONGLONG beforeClear = b.bars;
+    for (long i = 0; i < symbols; i++) BarBuilder_ClearSymbol(&b, SubTable_Get(&subs, ids[i * 2])->symbolID);
+    ULONGLONG closedByClear = b.bars - beforeClear;
+    ULONG leftOpen = BarBuilder_Advance(&b, t + 3600000000000ULL);
+
+    Report("rows (store + bars)", b.rows, barNs);
+    printf("  %llu bars closed in the run, worst %.2f ms after end + grace; %llu rows in grace, %llu too late\n",
+           closedOnTime, maxLag / 1e6, b.late, b.dropped);
+    printf("  %.0f ns per 1 ms batch of %ld rows, closes included; scanning the %ld slots for due bars"
+           " instead costs %llu ns per batch (%lu found)\n",
+           (double)barNs / batches, rows, symbols * intervalCount, scanNs, (unsigned long)due);
+    BOOL volumesMatch = TRUE;
+    for (int k = 0; k < intervalCount; k++) {
+        char label[16];
+        BarInterval_Format(intervals[k], label, sizeof label);
+        volumesMatch &= ctx.volume[k] == traded;
+        printf("  %-4s %8llu bars, volume %lld of %lld traded%s\n", label, ctx.count[k], ctx.volume[k], traded,
+               ctx.volume[k] == traded ? "" : "  MISMATCH");
+    }
+    printf("  %llu malformed, %llu sequence gaps, %llu early closes, %llu volume resets\n",
+           ctx.malformed, ctx.gaps, b.early, b.volumeResets);
+    printf("  unsubscribing closed %llu bars (%llu still open, flagged cleared), %lu left for the wheel\n",
+           closedByClear, ctx.cleared, (unsigned long)leftOpen);
+    Expect(volumesMatch, "bar volumes add up to the volume traded");
+    Expect(ctx.malformed == 0 && ctx.gaps == 0, "bars are well formed and in sequence");
+    Expect(closedByClear > 0 && leftOpen == 0, "clearing a symbol closes the bars it holds");
+
+    free(batch);
+    free(price);
+    free(volume);
+    free(base);
+    free(firstBatch);
+    free(ids);
+    BarBuilder_Free(&b);
+    QuoteStore_Free(&qs);
+    SubTable_Free(&subs);
+}
+
+// Archive bench stream: 8 topics per symbol, topic ID = symbol * 8 + topic + 1
+#define ARCH_TOPICS     8
+#define ARCH_HOT        10      // Symbols that update every batch
+#define ARCH_MIN_RATIO  10      // Journal bytes per archive byte, at least
+#define ARCH_MIN_DECODE 100e6   // Values decoded per second, at least
+
+static const char *const kArchTopics[ARCH_TOPICS] = {
+    "LAST", "BID", "ASK", "BID_SIZE", "ASK_SIZE", "VOLUME", "EXCHANGE", "THEO"
+};
+static const WCHAR *const kArchTopicsW[ARCH_TOPICS] = {
+    L"LAST", L"BID", L"ASK", L"BID_SIZE", L"ASK_SIZE", L"VOLUME", L"EXCHANGE", L"THEO"
+};
+static const char *const kArchExchanges[4] = { "NYSE", "NASDAQ", "ARCA", "BATS" };
+
+typedef struct ArchiveGen {
+    long      symbols;
+    unsigned  seed;
+    ULONGLONG ns;
+    LONGLONG *cents;
+    LONGLONG *volume;
+    BSTR      exchanges[4];
+} ArchiveGen;
+
+static void ArchiveGen_Init(ArchiveGen *g, long symbols)
+{
+    g->symbols = symbols;
+    g->seed = 37;
+    g->ns = 1000000000000ULL;
+    g->cents = (LONGLONG*)malloc(symbols * sizeof *g->cents);
+    g->volume = (LONGLONG*)calloc(symbols, sizeof *g->volume);
+    for (long i = 0; i < symbols; i++) g->cents[i] = 1000 + (i * 7919) % 50000;
+    for (int i = 0; i < 4; i++) {
+        WCHAR w[16];
+        swprintf(w, ARRAYSIZE(w), L"%hs", kArchExchanges[i]);
+        g->exchanges[i] = SysAllocString(w);
+    }
+}
+
+static void ArchiveGen_Free(ArchiveGen *g)
+{
+    free(g->cents);
+    free(g->volume);
+    for (int i = 0; i < 4; i++) SysFreeString(g->exchanges[i]);
+}
+
+static inline unsigned ArchiveGen_Next(ArchiveGen *g)
+{
+    g->seed = g->seed * 1103515245u + 12345u;
+    return g->seed >> 8;
+}
+
+static inline void PutArchR8(RtdUpdate *u, long topicID, ULONGLONG ns, double v)
+{
+    u->recvNs = ns;
+    u->topicID = topicID;
+    u->vt = VT_R8;
+    u->dblVal = v;
+}
+
+static inline void PutArchInt(RtdUpdate *u, long topicID, ULONGLONG ns, VARTYPE vt, LONGLONG v)
+{
+    u->recvNs = ns;
+    u->topicID = topicID;
+    u->vt = vt;
+    u->llVal = v;
+}
+
+/**
+ * One batch 5 ms after the last, give or take 1 ms: trades and quotes on
+ * about 8% of symbols, every topic of the hot ones
+ */
+static long ArchiveGen_Batch(ArchiveGen *g, RtdUpdate *out)
+{
+    g->ns += 4000000 + 1000ULL * (ArchiveGen_Next(g) % 2000);
+    ULONGLONG ns = g->ns;
+    long n = 0;
+    for (long sym = 0; sym < g->symbols; sym++) {
+        BOOL hot = sym < ARCH_HOT;
+        unsigned r = ArchiveGen_Next(g);
+        if (!hot && r % 100 >= 8) continue;
+        long id = sym * ARCH_TOPICS + 1;
+        BOOL trade = hot || (r >> 7) % 10 < 4;
+        BOOL quote = hot || !trade;
+        if (trade) {
+            unsigned t = ArchiveGen_Next(g);
+            LONGLONG size = 100 * (1 + t % 20) + (t % 7 == 0 ? (t >> 5) % 100 : 0);     // Odd lots now and then
+            g->cents[sym] += (LONGLONG)((t >> 8) % 11) - 5;
+            if (g->cents[sym] < 1) g->cents[sym] = 1;
+            g->volume[sym] += size;
+            PutArchR8(&out[n++], id + 0, ns, (double)g->cents[sym] / 100.0);
+            PutArchInt(&out[n++], id + 5, ns, VT_I8, g->volume[sym]);
+            if ((t >> 12) % 100 == 0) {
+                out[n].recvNs = ns;
+                out[n].topicID = id + 6;
+                out[n].vt = VT_BSTR;
+                out[n++].bstrVal = g->exchanges[(t >> 20) % 4];
+            }
+        }
+        if (quote) {
+            unsigned q = ArchiveGen_Next(g);
+            LONGLONG spread = 1 + q % 3;
+            PutArchR8(&out[n++], id + 1, ns, (double)(g->cents[sym] - spread) / 100.0);
+            PutArchR8(&out[n++], id + 2, ns, (double)(g->cents[sym] + spread) / 100.0);
+            PutArchInt(&out[n++], id + 3, ns, VT_I4, 100 * (1 + (q >> 4) % 50));
+            PutArchInt(&out[n++], id + 4, ns, VT_I4, 100 * (1 + (q >> 10) % 50));
+        }
+        if (hot) {
+            // A model value with no short decimal form
+            PutArchR8(&out[n++], id + 7, ns, (double)g->cents[sym] / 100.0 * 1.0001234567 + (double)(r % 1000) * 1e-7);
+        }
+    }
+    return n;
+}
+
+// Per-series decoded values, laid out back to back in series order
+typedef struct ArchiveCopy {
+    int64_t     *timeNs;
+    int64_t     *bits;
+    const char **str;
+    uint32_t    *strLen;
+    uint64_t    *start;     // First value of each series
+    uint64_t    *at;        // Next value to check
+} ArchiveCopy;
+
+static BOOL MatchArchived(const ArchiveCopy *c, uint64_t i, const RtdUpdate *u)
+{
+    if (u->vt == VT_BSTR) {
+        char utf8[16];
+        size_t n = RtdWideToUtf8(u->bstrVal, SysStringLen(u->bstrVal), utf8, sizeof utf8);
+        return c->strLen[i] == n && memcmp(c->str[i], utf8, n) == 0;
+    }
+    return c->bits[i] == u->llVal;      // Doubles bit for bit
+}
+
+/**
+ * Decode a whole archive, then walk the generator again and check every
+ * value, its type and its time. Times are off the receive times by the
+ * writer's wall clock offset, which must be the same for every value.
+ */
+static void VerifyArchive(const char *label, const char *path, long symbols, long batches, ULONGLONG updates)
+{
+    ArchiveReader r;
+    if (!ArchiveReader_Open(&r, path)) {
+        printf("  %s: cannot read %s\n", label, path);
+        Expect(FALSE, "the archive reads back");
+        return;
+    }
+    const ArchiveFooter *f = r.footer;
+    ArchiveCopy c;
+    c.timeNs = (int64_t*)malloc((f->values + 1) * sizeof *c.timeNs);
+    c.bits = (int64_t*)malloc((f->values + 1) * sizeof *c.bits);
+    c.str = (const char**)malloc((f->values + 1) * sizeof *c.str);
+    c.strLen = (uint32_t*)malloc((f->values + 1) * sizeof *c.strLen);
+    c.start = (uint64_t*)malloc((f->seriesCount + 1) * sizeof *c.start);
+    c.at = (uint64_t*)malloc((f->seriesCount + 1) * sizeof *c.at);
+    ArchiveColumn *col = (ArchiveColumn*)malloc(sizeof *col);
+    uint64_t next = 0;
+    for (uint32_t s = 0; s < f->seriesCount; s++) {
+        c.start[s] = c.at[s] = next;
+        next += r.series[s].values;
+    }
+
+    // Decode every block for the rate, the best of three passes, then
+    // again into per-series order (blocks are grouped by series, oldest
+    // first) for the check
+    ULONGLONG values = 0, failed = 0, best = ~0ULL;
+    for (int pass = 0; pass < 3; pass++) {
+        values = 0;
+        ULONGLONG start = RtdNowNs();
+        for (uint32_t b = 0; b < f->blockCount; b++) {
+            if (ArchiveReader_Decode(&r, b, col)) values += col->count;
+        }
+        ULONGLONG elapsed = RtdNowNs() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    if (strcmp(label, "append") == 0) {
+        Report("archive decode", values, best);
+        Expect((double)values * 1e9 >= ARCH_MIN_DECODE * (double)best, "the archive decodes 100M values/s or more");
+    }
+
+    for (uint32_t b = 0; b < f->blockCount; b++) {
+        if (!ArchiveReader_Decode(&r, b, col)) {
+            failed++;
+            continue;
+        }
+        uint64_t at = c.at[col->series];
+        memcpy(c.timeNs + at, col->timeNs, col->count * sizeof col->timeNs[0]);
+        memcpy(c.bits + at, col->i64, col->count * sizeof col->i64[0]);
+        if (col->vt == VT_BSTR) {
+            memcpy(c.str + at, col->str, col->count * sizeof col->str[0]);
+            memcpy(c.strLen + at, col->strLen, col->count * sizeof col->strLen[0]);
+        }
+        c.at[col->series] += col->count;
+    }
+
+    long *topicSeries = (long*)malloc((symbols * ARCH_TOPICS + 1) * sizeof *topicSeries);
+    for (long sym = 0; sym < symbols; sym++) {
+        char name[32];
+        snprintf(name, sizeof name, "SYM%ld", sym);
+        for (int t = 0; t < ARCH_TOPICS; t++) {
+            topicSeries[sym * ARCH_TOPICS + t + 1] = ArchiveReader_Find(&r, name, kArchTopics[t]);
+        }
+    }
+    memcpy(c.at, c.start, f->seriesCount * sizeof *c.at);
+
+    ArchiveGen g;
+    ArchiveGen_Init(&g, symbols);
+    RtdUpdate *batch = (RtdUpdate*)malloc(symbols * ARCH_TOPICS * sizeof *batch);
+    ULONGLONG checked = 0, wrong = 0, skewed = 0;
+    int64_t offset = 0;
+    for (long n = 0; n < batches; n++) {
+        long rows = ArchiveGen_Batch(&g, batch);
+        for (long i = 0; i < rows; i++) {
+            const RtdUpdate *u = &batch[i];
+            long s = topicSeries[u->topicID];
+            uint64_t at = s < 0 ? 0 : c.at[s]++;
+            if (s < 0 || at >= c.start[s] + r.series[s].values) {
+                wrong++;
+                continue;
+            }
+            if (checked == 0) offset = c.timeNs[at] - (int64_t)u->recvNs;
+            if (c.timeNs[at] - (int64_t)u->recvNs != offset) skewed++;
+            if (!MatchArchived(&c, at, u)) wrong++;
+            checked++;
+        }
+    }
+    printf("  %s round trip: %llu of %llu values match (%llu wrong, %llu mistimed, %llu blocks failed)\n",
+           label, checked - wrong, updates, wrong, skewed, failed);
+    Expect(failed == 0, "every archive block decodes");
+    Expect(wrong == 0 && checked == updates, "every value reads back as written");
+    Expect(skewed == 0, "every value keeps its receive time");
+
+    ArchiveGen_Free(&g);
+    free(batch);
+    free(topicSeries);
+    free(col);
+    free(c.timeNs);
+    free(c.bits);
+    free(c.str);
+    free(c.strLen);
+    free(c.start);
+    free(c.at);
+    ArchiveReader_Close(&r);
+}
+
+static BOOL CountRange(void *ctx, const ArchiveColumn *col, uint32_t first, uint32_t end)
+{
+    double *sum = (double*)ctx;
+    for (uint32_t i = first; i < end; i++) *sum += col->dbl[i];
+    return TRUE;
+}
+
+static ULONGLONG FileBytes(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 0;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fclose(fp);
+    return size < 0 ? 0 : (ULONGLONG)size;
+}
+
+/**
+ * Archive: 40 s of a 1000-symbol feed (about 2.5M updates) written to the
+ * tick journal and the archive side by side; size against the journal's
+ * 24-byte records (10x smaller or more), exact round trip, decode rate
+ * (100M values/s or more), and a time-range query that decodes only the
+ * blocks it overlaps. The journal is then converted to a second archive.
+ */
+static void BenchArchive(void)
+{
+    const long symbols = 1000;
+    const long batches = 8000;
+    const char *prefix = "rtd_bench_archive";
+    const char *path = "rtd_bench_archive.rta";
+    const char *converted = "rtd_bench_archive_journal.rta";
+    ArchiveWriter a;
+    Journal j;
+    WCHAR symbol[32];
+
+    if (!ArchiveWriter_Open(&a, path) || !Journal_Open(&j, prefix, 256ULL << 20)) {
+        printf("archive: cannot open %s\n", path);
+        return;
+    }
+    for (long sym = 0; sym < symbols; sym++) {
+        swprintf(symbol, ARRAYSIZE(symbol), L"SYM%ld", sym);
+        for (int t = 0; t < ARCH_TOPICS; t++) {
+            ArchiveWriter_Define(&a, sym * ARCH_TOPICS + t + 1, symbol, kArchTopicsW[t]);
+            Journal_Define(&j, sym * ARCH_TOPICS + t + 1, symbol, kArchTopicsW[t]);
+        }
+    }
+
+    ArchiveGen g;
+    ArchiveGen_Init(&g, symbols);
+    RtdUpdate *batch = (RtdUpdate*)malloc(symbols * ARCH_TOPICS * sizeof *batch);
+    ULONGLONG updates = 0, archiveNs = 0;
+    for (long n = 0; n < batches; n++) {
+        long rows = ArchiveGen_Batch(&g, batch);
+        ULONGLONG t0 = RtdNowNs();
+        for (long i = 0; i < rows; i++) ArchiveWriter_Append(&a, &batch[i]);
+        archiveNs += RtdNowNs() - t0;
+        for (long i = 0; i < rows; i++) Journal_Append(&j, &batch[i]);
+        updates += rows;
+    }
+    ULONGLONG t0 = RtdNowNs();
+    ArchiveWriter_Close(&a);
+    archiveNs += RtdNowNs() - t0;
+    Report("archive append", updates, archiveNs);
+    ArchiveGen_Free(&g);
+    free(batch);
+
+    ULONGLONG raw = j.recordsWritten * sizeof(JournalRecord) + j.stringsSize;
+    uint32_t files = j.fileIndex;
+    Journal_Close(&j);
+    ULONGLONG size = FileBytes(path);
+    ULONGLONG index = a.blockCount * sizeof(ArchiveBlock) + a.streamCount * sizeof(ArchiveSeries) + a.namesLen;
+    printf("  %llu values in %llu bytes (%.2f bits/value), %llu of them index; journal %llu bytes, %.1fx smaller\n",
+           a.values, size, size * 8.0 / (double)a.values, index, raw, (double)raw / (double)size);
+    Expect(size > 0 && raw >= size * ARCH_MIN_RATIO, "the archive is 10x smaller than the journal or more");
+    VerifyArchive("append", path, symbols, batches, updates);
+
+    // A second of the busiest LAST series out of 40, then of every LAST series
+    ArchiveReader r;
+    ArchiveColumn *col = (ArchiveColumn*)malloc(sizeof *col);
+    if (ArchiveReader_Open(&r, path)) {
+        int64_t from = (int64_t)r.blocks[0].firstNs + 20000000000LL, to = from + 1000000000LL;
+        long s = ArchiveReader_Find(&r, "SYM0", "LAST");
+        double sum = 0;
+        ULONGLONG got = ArchiveReader_Query(&r, s, from, to, col, CountRange, &sum);
+        printf("  query 1 s of %s %s: %llu values from %llu of %u blocks\n", ArchiveReader_Symbol(&r, s),
+               ArchiveReader_Topic(&r, s), got, r.blocksDecoded, r.series[s].blockCount);
+
+        ULONGLONG decoded = r.blocksDecoded, total = 0, blocks = 0;
+        long *last = (long*)malloc(symbols * sizeof *last);
+        char name[32];
+        for (long sym = 0; sym < symbols; sym++) {
+            snprintf(name, sizeof name, "SYM%ld", sym);
+            last[sym] = ArchiveReader_Find(&r, name, "LAST");
+            blocks += r.series[last[sym]].blockCount;
+        }
+        t0 = RtdNowNs();
+        for (long sym = 0; sym < symbols; sym++) {
+            total += ArchiveReader_Query(&r, last[sym], from, to, col, CountRange, &sum);
+        }
+        Report("archive range query", symbols, RtdNowNs() - t0);
+        free(last);
+        printf("  1 s of every LAST series: %llu values from %llu of %llu blocks, checksum %.2f\n",
+               total, r.blocksDecoded - decoded, blocks, sum);
+        ArchiveReader_Close(&r);
+    }
+    free(col);
+
+    ArchiveWriter_Open(&a, converted);
+    t0 = RtdNowNs();
+    BOOL ok = ArchiveWriter_AppendJournal(&a, prefix) && ArchiveWriter_Close(&a);
+    Report("journal to archive", a.values, RtdNowNs() - t0);
+    printf("  %s, %llu bytes\n", ok ? "converted" : "conversion failed", FileBytes(converted));
+    Expect(ok, "the journal converts to an archive");
+    VerifyArchive("journal", converted, symbols, batches, updates);
+
+    remove(path);
+    remove(converted);
+    for (uint32_t f = 1; f <= files; f++) {
+        char file[300];
+        Journal_FilePath(file, sizeof file, prefix, f, "rtj");
+        remove(file);
+        Journal_FilePath(file, sizeof file, prefix, f, "rts");
+        remove(file);
+    }
+}
+
+typedef struct SessionCheck {
+    BYTE      *removed;     // Per topic ID: unsubscribed mid-run
+    ULONGLONG  unsubNs;     // When they were, 0 = not yet
+    ULONGLONG  lastNs;
+    ULONGLONG  rows;
+    ULONGLONG  strings;
+    ULONGLONG  removedRows; // Rows for removed topics more than 50 ms after
+    ULONGLONG  unknown;     // Rows for topic IDs never subscribed
+    ULONGLONG  badStrings;
+    ULONGLONG  outOfOrder;
+} SessionCheck;
+
+/**
+ * RtdSessionBatchFn: check the columns the way an embedder reads them,
+ * straight out of the batch
+ */
+static void CheckSessionBatch(void *ctx, RtdSession *s, const RtdBatch *batch, ULONGLONG recvNs)
+{
+    SessionCheck *c = (SessionCheck*)ctx;
+    if (recvNs < c->lastNs) c->outOfOrder++;
+    c->lastNs = recvNs;
+    for (long i = 0; i < batch->rows; i++) {
+        long id = batch->topicID[i];
+        if (c->removed[id]) {
+            if (recvNs > c->unsubNs + 50000000ULL) c->removedRows++;
+        } else if (!SubTable_Get(&s->subs, id)) {
+            c->unknown++;
+        }
+        if (batch->vt[i] == VT_BSTR) {
+            c->strings++;
+            if (!batch->str[batch->i64[i]]) c->badStrings++;
+        }
+    }
+    c->rows += batch->rows;
+}
+
+/**
+ * Embedded session on the simulated server: subscribe, poll, drop half
+ * the topics halfway through
+ */
+static void RunSession(const char *label, int shards, double dropoutSec)
+{
+    static const WCHAR *fields[] = { L"LAST", L"BID", L"ASK", L"VOLUME", L"DESCRIPTION" };
+    const long topics = 10000;
+    const double seconds = 1.0;
+    RtdSessionConfig sc;
+    RtdSession s;
+    SessionCheck check;
+    SimConfig cfg;
+    WCHAR symbol[32];
+
+    memset(&cfg, 0, sizeof cfg);
+    cfg.mode = SIM_SYNTHETIC;
+    cfg.seed = 21;
+    cfg.updatesPerSec = 500000.0 / shards;
+    cfg.dropoutAfterSec = dropoutSec;
+    cfg.downtimeSec = 0.1;
+    cfg.dropoutNotify = TRUE;
+    memset(&check, 0, sizeof check);
+    check.removed = (BYTE*)calloc(topics + 1, 1);
+
+    memset(&sc, 0, sizeof sc);
+    sc.factoryCtx = &cfg;
+    sc.shards = shards;
+    sc.heartbeatMs = 100;
+    sc.onBatch = CheckSessionBatch;
+    sc.onEvent = PrintSupervisorEvent;
+    sc.ctx = &check;
+    if (!check.removed || !RtdSession_Init(&s, &sc) || FAILED(RtdSession_Start(&s))) {
+        printf("  session did not start\n");
+        Expect(FALSE, "the session starts");
+        free(check.removed);
+        return;
+    }
+
+    long connected = 0;
+    ULONGLONG start = RtdNowNs();
+    for (long i = 0; i < topics; i++) {
+        swprintf(symbol, ARRAYSIZE(symbol), L"SYM%ld", i / 5);
+        if (RtdSession_Subscribe(&s, symbol, fields[i % 5], NULL) == S_OK) connected++;
+    }
+    ULONGLONG connectNs = RtdNowNs() - start;
+
+    start = RtdNowNs();
+    ULONGLONG end = start + (ULONGLONG)(seconds * 1e9);
+    ULONGLONG half = 0, removed = 0;
+    while (RtdNowNs() < end) {
+        RtdSession_Poll(&s, 20);
+        if (!check.unsubNs && RtdNowNs() - start >= (ULONGLONG)(seconds * 0.5e9)) {
+            half = check.rows;
+            for (long id = 1; id < s.subs.highWater; id += 2) {
+                if (!SubTable_Get(&s.subs, id)) continue;
+                RtdSession_Unsubscribe(&s, id);
+                check.removed[id] = 1;
+                removed++;
+            }
+            check.unsubNs = RtdNowNs();
+        }
+    }
+    ULONGLONG elapsed = RtdNowNs() - start;
+
+    Report(label, check.rows, elapsed);
+    printf("  %ld topics subscribed in %.1f ms, %llu unsubscribed halfway, %llu rows before, %llu after\n",
+           connected, connectNs / 1e6, removed, half, check.rows - half);
+    printf("  %llu batches, %llu string rows, %u incident(s)\n",
+           s.batches, check.strings, s.supervisor.incidents);
+    printf("  %llu rows for unsubscribed topics, %llu unknown topic IDs, %llu null strings, "
+           "%llu batches out of order\n", check.removedRows, check.unknown, check.badStrings, check.outOfOrder);
+    Expect(connected == topics, "every topic subscribes");
+    Expect(check.removedRows == 0, "no rows for topics 50 ms after unsubscribing them");
+    Expect(check.unknown == 0, "no rows for topic IDs never subscribed");
+    Expect(check.badStrings == 0, "every string row has its string");
+    Expect(check.outOfOrder == 0, "batches arrive in receive order");
+
+    RtdSession_Stop(&s);
+    RtdSession_Free(&s);
+    free(check.removed);
+}
+
+/**
+ * Build a batch row by row past its initial capacity, as the sharded
+ * merge does, and read every row back
+ */
+static void RunBatchAppend(void)
+{
+    const long rows = 3000;
+    RtdBatch b;
+    BSTR words[3] = { SysAllocString(L"NYSE"), SysAllocString(L"NASDAQ"), SysAllocString(L"ARCA") };
+    RtdBatch_Init(&b, 1024);
+    long capacity = b.capacity, appended = 0, wrong = 0;
+    for (long i = 0; i < rows; i++) {
+        RtdUpdate u;
+        memset(&u, 0, sizeof u);
+        u.topicID = i + 1;
+        switch (i % 3) {
+            case 0:  u.vt = VT_R8;   u.dblVal = i * 0.25; break;
+            case 1:  u.vt = VT_I8;   u.llVal = (LONGLONG)i * 1000; break;
+            default: u.vt = VT_BSTR; u.bstrVal = words[i % 9 / 3]; break;
+        }
+        if (RtdBatch_Append(&b, &u)) appended++;
+    }
+    for (long i = 0; i < b.rows; i++) {
+        BOOL ok = b.topicID[i] == i + 1;
+        switch (i % 3) {
+            case 0:  ok &= b.vt[i] == VT_R8 && b.dbl[i] == i * 0.25; break;
+            case 1:  ok &= b.vt[i] == VT_I8 && b.i64[i] == (LONGLONG)i * 1000; break;
+            default: ok &= b.vt[i] == VT_BSTR && b.str[b.i64[i]] == words[i % 9 / 3]; break;
+        }
+        if (!ok) wrong++;
+    }
+    printf("  appended %ld rows to a %ld-row batch: %ld kept, %ld wrong\n", appended, capacity, b.rows, wrong);
+    Expect(appended == rows && b.rows == rows && wrong == 0, "appended rows survive the batch growing");
+    RtdBatch_Free(&b);
+    for (int i = 0; i < 3; i++) SysFreeString(words[i]);
+}
+
+/**
+ * Session: the headless library driving the simulated server, on one
+ * thread and across 4 shards, then through a server loss
+ */
+static void BenchSession(void)
+{
+    RunBatchAppend();
+    RunSession("session, RTD thread", 1, 0);
+    RunSession("session, 4 shards", 4, 0);
+    RunSession("session, server dies at 0.3 s", 1, 0.3);
+}
+
+// Per topic ID in the stale bench
+#define STALE_LIVE    0     // Updates throughout
+#define STALE_STOPS   1     // Stops at 10 s
+#define STALE_PAUSES  2     // Stops at 10 s, back at 40 s
+#define STALE_NEVER   3     // Never updates
+
+typedef struct StaleCheck {
+    const BYTE *quiet;      // STALE_* per topic ID, NULL = any topic may go stale
+    ULONGLONG   stale;
+    ULONGLONG   recovered;
+    ULONGLONG   wrong;      // Stale while still updating
+    ULONGLONG   noData;     // Stale with no update since subscribing
+    ULONGLONG   maxLagNs;   // Worst report past last update + threshold
+} StaleCheck;
+
+/**
+ * StaleEmitFn: count events and check each against what the topic did
+ */
+static void CheckStale(void *ctx, const StaleEvent *ev)
+{
+    StaleCheck *c = (StaleCheck*)ctx;
+    if (!ev->stale) {
+        c->recovered++;
+        return;
+    }
+    c->stale++;
+    if (c->quiet && c->quiet[ev->topicID] == STALE_LIVE) c->wrong++;
+    if (!ev->lastNs) c->noData++;
+    if (ev->silentNs - ev->thresholdNs > c->maxLagNs) c->maxLagNs = ev->silentNs - ev->thresholdNs;
+}
+
+/**
+ * What checking every topic's deadline each batch would cost instead
+ */
+static ULONG ScanForStale(const StaleMonitor *m, ULONGLONG nowNs)
+{
+    ULONG due = 0;
+    for (long id = 1; id < m->topicCap; id++) {
+        const StaleTopic *t = &m->topics[id];
+        if (!t->thresholdNs || t->stale) continue;
+        due += (t->lastNs ? t->lastNs : t->sinceNs) + t->thresholdNs <= nowNs;
+    }
+    return due;
+}
+
+/**
+ * A minute of simulated time over 30k topics in 1 ms batches, with some
+ * symbols going quiet
+ */
+static void RunStaleWheel(void)
+{
+    static const WCHAR *fields[] = { L"LAST", L"BID", L"VOLUME" };
+    const long symbols = 10000;
+    const long topics = symbols * 3;
+    const long rows = 1000;             // Per 1 ms batch
+    const long batches = 60000;
+    SubscriptionTable subs;
+    StaleConfig cfg;
+    StaleMonitor m;
+    StaleCheck check;
+    WCHAR symbol[32];
+
+    ULONGLONG t = 1000000000000ULL;
+    BYTE *quiet = (BYTE*)calloc(topics + 1, 1);
+    memset(&check, 0, sizeof check);
+    check.quiet = quiet;
+    StaleConfig_Parse(&cfg, "LAST=2s,BID=1s,*=10s");
+    SubTable_Init(&subs, topics + 1);
+    StaleMonitor_Init(&m, &cfg, t, CheckStale, &check);
+    long *ids = (long*)malloc(topics * sizeof *ids);
+    for (long i = 0; i < topics; i++) {
+        long sym = i / 3;
+        swprintf(symbol, ARRAYSIZE(symbol), L"SYM%ld", sym);
+        TopicSubscription *sub = SubTable_Add(&subs, symbol, fields[i % 3]);
+        StaleMonitor_Track(&m, sub, t);
+        ids[i] = sub->topicID;
+        if (sym % 1000 == 3) quiet[sub->topicID] = STALE_NEVER;
+        else if (sym % 200 == 7) quiet[sub->topicID] = STALE_PAUSES;
+        else if (sym % 100 == 7) quiet[sub->topicID] = STALE_STOPS;
+    }
+
+    ULONGLONG touches = 0, staleNs = 0;
+    unsigned seed = 47;
+    for (long n = 0; n < batches; n++) {
+        t += 1000000;
+        BOOL stopped = n >= 10000, paused = stopped && n < 40000;
+        ULONGLONG start = RtdNowNs();
+        for (long r = 0; r < rows; r++) {
+            seed = seed * 1103515245u + 12345u;
+            long id = ids[(seed >> 4) % (unsigned)topics];
+            BYTE q = quiet[id];
+            if (q == STALE_NEVER || (q == STALE_STOPS && stopped) || (q == STALE_PAUSES && paused)) continue;
+            StaleMonitor_Touch(&m, id, t);
+            touches++;
+        }
+        StaleMonitor_Advance(&m, t);
+        staleNs += RtdNowNs() - start;
+    }
+
+    ULONGLONG start = RtdNowNs();
+    ULONG due = 0;
+    for (int i = 0; i < 1000; i++) due += ScanForStale(&m, t);
+    ULONGLONG scanNs = (RtdNowNs() - start) / 1000;
+
+    long expectStale = 0, expectRecovered = 0, expectNever = 0;
+    for (long i = 0; i < topics; i++) {
+        if (quiet[ids[i]] != STALE_LIVE) expectStale++;
+        if (quiet[ids[i]] == STALE_PAUSES) expectRecovered++;
+        if (quiet[ids[i]] == STALE_NEVER) expectNever++;
+    }
+
+    Report("touches (+ advance)", touches, staleNs);
+    printf("  %.0f ns per 1 ms batch of %ld rows over %ld topics; scanning every deadline instead costs"
+           " %llu ns per batch (%lu found)\n", (double)staleNs / batches, rows, m.tracked, scanNs,
+           (unsigned long)due);
+    printf("  %llu timers fired in %ld batches: %llu rescheduled, %llu stale (a scan checks %llu)\n",
+           m.rescheduled + m.staleEvents, batches, m.rescheduled, m.staleEvents,
+           (ULONGLONG)topics * (ULONGLONG)batches);
+    printf("  %llu stale of %ld expected, %llu recovered of %ld, %llu with no data of %ld, %ld never updated;"
+           " %llu false, worst %.1f ms past threshold\n", check.stale, expectStale, check.recovered,
+           expectRecovered, check.noData, expectNever, StaleMonitor_NeverUpdated(&m), check.wrong,
+           check.maxLagNs / 1e6);
+    Expect(check.stale == (ULONGLONG)expectStale && check.wrong == 0, "quiet topics, and only those, go stale");
+    Expect(check.recovered == (ULONGLONG)expectRecovered, "resumed topics recover");
+    Expect(check.noData == (ULONGLONG)expectNever && StaleMonitor_NeverUpdated(&m) == expectNever,
+           "topics that never updated are told apart");
+    Expect(check.maxLagNs <= STALE_TICK_NS + 1000000, "stale reported within a wheel tick of the deadline");
+
+    free(ids);
+    free(quiet);
+    StaleMonitor_Free(&m);
+    SubTable_Free(&subs);
+}
+
+/**
+ * RtdSessionBatchFn: every row is an update, ConnectData's values included
+ */
+static void TouchStaleBatch(void *ctx, RtdSession *s, const RtdBatch *batch, ULONGLONG recvNs)
+{
+    StaleMonitor *m = (StaleMonitor*)ctx;
+    for (long i = 0; i < batch->rows; i++) StaleMonitor_Touch(m, batch->topicID[i], recvNs);
+}
+
+/**
+ * Subscribe on a nearly silent simulated server: the first data for each
+ * topic is its ConnectData value, so nothing should read as never updated
+ */
+static void RunStaleSession(const char *label, int shards, BOOL dropInitial)
+{
+    static const WCHAR *fields[] = { L"LAST", L"BID", L"ASK", L"VOLUME", L"DESCRIPTION" };
+    const long topics = 2000;
+    RtdSessionConfig sc;
+    RtdSession s;
+    StaleConfig cfg;
+    StaleMonitor m;
+    StaleCheck check;
+    SimConfig sim;
+    WCHAR symbol[32];
+
+    memset(&sim, 0, sizeof sim);
+    sim.mode = SIM_SYNTHETIC;
+    sim.seed = 23;
+    sim.updatesPerSec = 1.0;
+    memset(&check, 0, sizeof check);
+    StaleConfig_Parse(&cfg, "*=100ms");
+    StaleMonitor_Init(&m, &cfg, RtdNowNs(), CheckStale, &check);
+
+    memset(&sc, 0, sizeof sc);
+    sc.factoryCtx = &sim;
+    sc.shards = shards;
+    sc.onBatch = TouchStaleBatch;
+    sc.ctx = &m;
+    if (!RtdSession_Init(&s, &sc) || FAILED(RtdSession_Start(&s))) {
+        printf("  session did not start\n");
+        StaleMonitor_Free(&m);
+        return;
+    }
+    if (dropInitial) s.subs.onConnectValue = NULL;
+
+    ULONGLONG start = RtdNowNs();
+    for (long i = 0; i < topics; i++) {
+        TopicSubscription *sub;
+        swprintf(symbol, ARRAYSIZE(symbol), L"SYM%ld", i / 5);
+        if (RtdSession_Subscribe(&s, symbol, fields[i % 5], &sub) == S_OK) StaleMonitor_Track(&m, sub, RtdNowNs());
+    }
+
+    ULONGLONG firstNs = 0, end = start + 400000000ULL;
+    while (RtdNowNs() < end) {
+        RtdSession_Poll(&s, 10);
+        StaleMonitor_Advance(&m, RtdNowNs());
+        if (!firstNs && StaleMonitor_NeverUpdated(&m) == 0) firstNs = RtdNowNs() - start;
+    }
+
+    printf("%-28s %ld topics, ", label, m.tracked);
+    if (firstNs) printf("all had data %.1f ms after the first subscribe", firstNs / 1e6);
+    else printf("%ld never updated", StaleMonitor_NeverUpdated(&m));
+    printf("; %llu stale at 100 ms, %llu with no data since subscribing\n", check.stale, check.noData);
+    if (!dropInitial) Expect(firstNs && check.noData == 0, "ConnectData's value counts as first data");
+
+    RtdSession_Stop(&s);
+    RtdSession_Free(&s);
+    StaleMonitor_Free(&m);
+}
+
+/**
+ * Stale: timing-wheel deadlines against a scan, then ConnectData's value
+ * standing in for a quiet topic's first update
+ */
+static void BenchStale(void)
+{
+    RunStaleWheel();
+    RunStaleSession("session, RTD thread", 1, FALSE);
+    RunStaleSession("session, 2 shards", 2, FALSE);
+    RunStaleSession("session, values ignored", 1, TRUE);
+}
+
+static const BenchCase cases[] = {
+    { "journal", "Binary tick journal append and mmap scan", BenchJournal },
+    { "sim",     "Simulated server end-to-end throughput and latency", BenchSim },
+    { "decode",  "RefreshData decode, dispatch and format stages per row", BenchDecode },
+    { "columns", "Columnar batch decode against the per-row VARIANT switch", BenchColumns },
+    { "format",  "Allocation-free number formatting against swprintf", BenchFormat },
+    { "output",  "Batched output writer layouts against per-line fputws", BenchOutput },
+    { "quotes",  "Interned subscriptions and struct-of-arrays quote store", BenchQuotes },
+    { "analytics", "Incremental VWAP/EMA/spread/volatility over 50k symbols", BenchAnalytics },
+    { "l1",      "Coherent L1 quote events assembled from BID/ASK/size/LAST rows", BenchL1 },
+    { "chain",   "Option-chain gamma/delta exposure by strike and expiry", BenchChain },
+    { "watchlist", "Bulk watchlist subscribe against per-pair ConnectData", BenchWatchlist },
+    { "supervisor", "Server loss detection, reconnect and resubscribe gap", BenchSupervisor },
+    { "conflate", "Per-topic conflation, rate limit and epsilon on a burst", BenchConflate },
+    { "metrics", "Latency histogram record cost and percentile accuracy", BenchMetrics },
+    { "shm",     "Shared-memory snapshot writer rate with concurrent seqlock readers", BenchShm },
+    { "fanout",  "TCP fan-out to 64 loopback clients, with slow-client conflation", BenchFanout },
+    { "pool",    "Reused ConnectData arguments and interned string values", BenchPool },
+    { "shard",   "RefreshData throughput across 1 to 8 server shards on their own threads", BenchShard },
+    { "bars",    "OHLCV bars at 1s/1m/5m for 10k symbols with timing-wheel closes", BenchBars },
+    { "archive", "Compressed columnar tick archive: size, round trip, decode and range query", BenchArchive },
+    { "session", "Headless RTD session on the simulated server: poll, unsubscribe, reconnect", BenchSession },
+    { "stale",   "Timing-wheel staleness detection over 30k topics, and ConnectData as first data", BenchStale },
+};
+
+int main(int argc, char **argv)
+{
+    int ran = 0, failed = 0;
+    for (size_t c = 0; c < ARRAYSIZE(cases); c++) {
+        BOOL selected = argc < 2;
+        for (int i = 1; i < argc; i++) {
+            if (strcmp(argv[i], cases[c].name) == 0) selected = TRUE;
+        }
+        if (!selected) continue;
+        printf("== %s: %s\n", cases[c].name, cases[c].description);
+        g_failures = 0;
+        cases[c].run();
+        ran++;
+        if (g_failures > 0) {
+            printf("== %s FAILED: %llu check(s)\n", cases[c].name, g_failures);
+            failed++;
+        }
+    }
+    if (ran == 0) {
+        printf("Usage: rtd_bench [case ...]\nCases:\n");
+        for (size_t c = 0; c < ARRAYSIZE(cases); c++) {
+            printf("  %-12s %s\n", cases[c].name, cases[c].description);
+        }
+        return 1;
+    }
+    return failed > 0 ? 1 : 0;
+}
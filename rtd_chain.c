@@ -0,0 +1,351 @@
+/**
+ * rtd_chain.c - Option-chain greek exposure
+ *
+ * Each contract remembers the term it last added to its sums, so a tick
+ * costs one subtraction and three additions per field whatever the chain
+ * size. The running sums drift by a rounding error per tick; once a chain
+ * has applied as many ticks as it has contracts, the next publish rebuilds
+ * its sums from the stored terms, which keeps the cost O(1) amortized.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include "rtd_chain.h"
+
+#define CHAIN_NAME(name) #name,
+static const char *fieldNames[CHAIN_FIELD_COUNT] = {
+    CHAIN_FIELDS(CHAIN_NAME)
+};
+#undef CHAIN_NAME
+
+// Contract inputs, in the order they are subscribed
+static const WCHAR *inputTopics[] = { L"GAMMA", L"DELTA", L"OPEN_INT" };
+
+#define CHAIN_INPUTS ((1u << QF_GAMMA) | (1u << QF_DELTA) | (1u << QF_OPEN_INT))
+
+/**
+ * Parse a strike range "LOW-HIGH"
+ */
+static BOOL ParseRange(const char *p, double *low, double *high)
+{
+    char *end;
+    *low = strtod(p, &end);
+    if (end == p || *end != '-') return FALSE;
+    p = end + 1;
+    *high = strtod(p, &end);
+    return end != p && *end == ':';
+}
+
+/**
+ * UNDERLYING:YYMMDD[,YYMMDD...]:LOW-HIGH:STEP
+ */
+BOOL ChainSpec_Parse(ChainSpec *spec, const char *text)
+{
+    memset(spec, 0, sizeof *spec);
+
+    const char *p = text;
+    size_t n = 0;
+    while (*p && *p != ':') {
+        if (n + 1 >= ARRAYSIZE(spec->underlying)) return FALSE;
+        spec->underlying[n++] = (WCHAR)*p++;
+    }
+    if (n == 0 || *p != ':') return FALSE;
+    p++;
+
+    while (*p && *p != ':') {
+        if (spec->expiryCount == CHAIN_MAX_EXPIRIES) return FALSE;
+        WCHAR *e = spec->expiries[spec->expiryCount++];
+        for (n = 0; n < 6; n++, p++) {
+            if (*p < '0' || *p > '9') return FALSE;
+            e[n] = (WCHAR)*p;
+        }
+        e[n] = 0;
+        if (*p == ',' && *++p == ':') return FALSE;
+    }
+    if (spec->expiryCount == 0 || *p != ':') return FALSE;
+    p++;
+
+    if (!ParseRange(p, &spec->strikeLow, &spec->strikeHigh)) return FALSE;
+    p = strchr(p, ':') + 1;
+    char *end;
+    spec->strikeStep = strtod(p, &end);
+    if (end == p || *end) return FALSE;
+    return spec->strikeLow > 0 && spec->strikeHigh >= spec->strikeLow && spec->strikeStep > 0;
+}
+
+BOOL OptionChains_Init(OptionChains *oc, const QuoteStore *quotes, DWORD publishMs)
+{
+    memset(oc, 0, sizeof *oc);
+    oc->quotes = quotes;
+    oc->publishNs = (ULONGLONG)(publishMs ? publishMs : CHAIN_DEFAULT_PUBLISH_MS) * 1000000ULL;
+    return TRUE;
+}
+
+void OptionChains_Free(OptionChains *oc)
+{
+    for (long i = 0; i < oc->count; i++) free(oc->chains[i].buckets);
+    free(oc->chains);
+    free(oc->contracts);
+    free(oc->contractOf);
+    memset(oc, 0, sizeof *oc);
+}
+
+int ChainField_FromName(const WCHAR *topic)
+{
+    for (int f = 0; f < CHAIN_FIELD_COUNT; f++) {
+        const char *name = fieldNames[f];
+        const WCHAR *t = topic;
+        while (*name && (WCHAR)*name == *t) {
+            name++;
+            t++;
+        }
+        if (!*name && !*t) return f;
+    }
+    return CF_NONE;
+}
+
+/**
+ * Strike as TOS writes it in option symbols: no trailing zeros (500, 502.5)
+ */
+static void FormatStrike(double strike, WCHAR *out, size_t outLen)
+{
+    swprintf(out, outLen, L"%.3f", strike);
+    size_t n = wcslen(out);
+    while (n > 0 && out[n - 1] == L'0') out[--n] = 0;
+    if (n > 0 && out[n - 1] == L'.') out[--n] = 0;
+}
+
+static BOOL GrowContractOf(OptionChains *oc, long minCap)
+{
+    long newCap = oc->symbolCap ? oc->symbolCap * 2 : 1024;
+    while (newCap < minCap) newCap *= 2;
+    long *map = (long*)realloc(oc->contractOf, newCap * sizeof *map);
+    if (!map) return FALSE;
+    memset(map + oc->symbolCap, 0, (newCap - oc->symbolCap) * sizeof *map);
+    oc->contractOf = map;
+    oc->symbolCap = newCap;
+    return TRUE;
+}
+
+/**
+ * Register one bucket's NET_GAMMA/NET_DELTA topics on symbol
+ */
+static BOOL AddBucket(ChainBucket *b, SubscriptionTable *subs, const WCHAR *symbol)
+{
+    WCHAR topic[32];
+    for (int f = 0; f < CHAIN_FIELD_COUNT; f++) {
+        swprintf(topic, ARRAYSIZE(topic), L"%hs", fieldNames[f]);
+        TopicSubscription *sub = SubTable_Add(subs, symbol, topic);
+        if (!sub) return FALSE;
+        b->topicID[f] = sub->topicID;
+        b->symbolID = sub->symbolID;
+        b->fieldID[f] = sub->fieldID;
+    }
+    return TRUE;
+}
+
+/**
+ * Register one contract's inputs and map its symbol to it
+ */
+static BOOL AddContract(OptionChains *oc, OptionContract *c, SubscriptionTable *subs, const WCHAR *symbol)
+{
+    long index = (long)(c - oc->contracts);
+    for (size_t t = 0; t < ARRAYSIZE(inputTopics); t++) {
+        TopicSubscription *sub = SubTable_Add(subs, symbol, inputTopics[t]);
+        if (!sub) return FALSE;
+        c->symbolID = sub->symbolID;
+    }
+    if (c->symbolID >= oc->symbolCap && !GrowContractOf(oc, c->symbolID + 1)) return FALSE;
+    oc->contractOf[c->symbolID] = index + 1;
+    return TRUE;
+}
+
+/**
+ * Register a new chain's aggregate topics, then its contracts' inputs
+ */
+static BOOL AddChainTopics(OptionChains *oc, long chainIndex, const ChainSpec *spec, SubscriptionTable *subs)
+{
+    OptionChain *ch = &oc->chains[chainIndex];
+    long expiries = spec->expiryCount, strikes = ch->strikeCount;
+    WCHAR symbol[64], strikeText[24];
+
+    // Aggregate topics: chain, each expiry, each strike
+    if (!AddBucket(&ch->buckets[0], subs, spec->underlying)) return FALSE;
+    for (long e = 0; e < expiries; e++) {
+        swprintf(symbol, ARRAYSIZE(symbol), L"%ls:%ls", spec->underlying, spec->expiries[e]);
+        if (!AddBucket(&ch->buckets[1 + e], subs, symbol)) return FALSE;
+    }
+    for (long k = 0; k < strikes; k++) {
+        FormatStrike(spec->strikeLow + k * spec->strikeStep, strikeText, ARRAYSIZE(strikeText));
+        swprintf(symbol, ARRAYSIZE(symbol), L"%ls@%ls", spec->underlying, strikeText);
+        if (!AddBucket(&ch->buckets[1 + expiries + k], subs, symbol)) return FALSE;
+    }
+
+    // Contracts: .SPY250117C500 and .SPY250117P500 for every expiry x strike
+    for (long e = 0; e < expiries; e++) {
+        for (long k = 0; k < strikes; k++) {
+            FormatStrike(spec->strikeLow + k * spec->strikeStep, strikeText, ARRAYSIZE(strikeText));
+            for (int put = 0; put < 2; put++) {
+                OptionContract *c = &oc->contracts[oc->contractCount];
+                memset(c, 0, sizeof *c);
+                c->chain = chainIndex;
+                c->expiryBucket = 1 + e;
+                c->strikeBucket = 1 + expiries + k;
+                c->put = put;
+                swprintf(symbol, ARRAYSIZE(symbol), L".%ls%ls%lc%ls", spec->underlying,
+                         spec->expiries[e], put ? L'P' : L'C', strikeText);
+                if (!AddContract(oc, c, subs, symbol)) return FALSE;
+                oc->contractCount++;
+                ch->contractCount++;
+            }
+        }
+    }
+    return TRUE;
+}
+
+long OptionChains_Add(OptionChains *oc, const ChainSpec *spec, SubscriptionTable *subs)
+{
+    long strikes = (long)((spec->strikeHigh - spec->strikeLow) / spec->strikeStep + 1e-9) + 1;
+    if (strikes < 1 || strikes > CHAIN_MAX_STRIKES) return -1;
+    long expiries = spec->expiryCount;
+    long contracts = expiries * strikes * 2;
+
+    OptionChain *chains = (OptionChain*)realloc(oc->chains, (oc->count + 1) * sizeof *chains);
+    if (!chains) return -1;
+    oc->chains = chains;
+    if (oc->contractCount + contracts > oc->contractCap) {
+        long cap = oc->contractCount + contracts;
+        OptionContract *grown = (OptionContract*)realloc(oc->contracts, cap * sizeof *grown);
+        if (!grown) return -1;
+        oc->contracts = grown;
+        oc->contractCap = cap;
+    }
+
+    OptionChain *ch = &oc->chains[oc->count];
+    memset(ch, 0, sizeof *ch);
+    ch->spec = *spec;
+    ch->strikeCount = strikes;
+    ch->bucketCount = 1 + expiries + strikes;
+    ch->buckets = (ChainBucket*)calloc(ch->bucketCount, sizeof *ch->buckets);
+    if (!ch->buckets) return -1;
+    ch->firstContract = oc->contractCount;
+    long chainIndex = oc->count++;
+    if (!SubTable_Reserve(subs, ch->bucketCount * CHAIN_FIELD_COUNT +
+                                contracts * (long)ARRAYSIZE(inputTopics))) {
+        return -1;
+    }
+
+    BOOL added = AddChainTopics(oc, chainIndex, spec, subs);
+    SubTable_EndReserve(subs);      // Pairs already registered leave some unused
+    return added ? chainIndex : -1;
+}
+
+/**
+ * Move a contract's terms to new values, adjusting the three sums it is in
+ */
+static void SetTerms(OptionChains *oc, OptionContract *c, const double *term)
+{
+    ChainBucket *b = oc->chains[c->chain].buckets;
+    BOOL changed = FALSE;
+    for (int f = 0; f < CHAIN_FIELD_COUNT; f++) {
+        double d = term[f] - c->term[f];
+        if (d == 0) continue;
+        b[0].sum[f] += d;
+        b[c->expiryBucket].sum[f] += d;
+        b[c->strikeBucket].sum[f] += d;
+        c->term[f] = term[f];
+        changed = TRUE;
+    }
+    if (changed) {
+        oc->applied++;
+        oc->chains[c->chain].appliedSinceResum++;
+    }
+}
+
+void OptionChains_ApplyContract(OptionChains *oc, long contract)
+{
+    OptionContract *c = &oc->contracts[contract];
+    const QuoteStore *q = oc->quotes;
+    long sym = c->symbolID;
+    double term[CHAIN_FIELD_COUNT] = { 0 };
+
+    // A contract counts once all three inputs have arrived
+    if (sym < q->symbolCap && (q->present[sym] & CHAIN_INPUTS) == CHAIN_INPUTS) {
+        double shares = (double)q->i64[QF_OPEN_INT - QUOTE_FIRST_INT][sym] * CHAIN_MULTIPLIER;
+        double gamma = q->dbl[QF_GAMMA][sym] * shares;
+        term[CF_NET_GAMMA] = c->put ? -gamma : gamma;
+        term[CF_NET_DELTA] = q->dbl[QF_DELTA][sym] * shares;
+    }
+    SetTerms(oc, c, term);
+}
+
+void OptionChains_Untrack(OptionChains *oc, const TopicSubscription *sub)
+{
+    long sym = sub->symbolID;
+    if (sym >= oc->symbolCap || !oc->contractOf[sym]) return;
+    static const double zero[CHAIN_FIELD_COUNT] = { 0 };
+    SetTerms(oc, &oc->contracts[oc->contractOf[sym] - 1], zero);
+    oc->contractOf[sym] = 0;
+}
+
+/**
+ * Recompute a chain's sums from its contracts' stored terms
+ */
+static void Resum(OptionChains *oc, OptionChain *ch)
+{
+    for (long i = 0; i < ch->bucketCount; i++) {
+        memset(ch->buckets[i].sum, 0, sizeof ch->buckets[i].sum);
+    }
+    for (long i = 0; i < ch->contractCount; i++) {
+        const OptionContract *c = &oc->contracts[ch->firstContract + i];
+        for (int f = 0; f < CHAIN_FIELD_COUNT; f++) {
+            ch->buckets[0].sum[f] += c->term[f];
+            ch->buckets[c->expiryBucket].sum[f] += c->term[f];
+            ch->buckets[c->strikeBucket].sum[f] += c->term[f];
+        }
+    }
+    ch->appliedSinceResum = 0;
+    oc->resums++;
+}
+
+long OptionChains_Publish(OptionChains *oc, SubscriptionTable *subs, ULONGLONG nowNs,
+                          ChainEmitFn emit, void *ctx)
+{
+    if (oc->count == 0 || nowNs < oc->nextPublishNs) return 0;
+    oc->nextPublishNs = nowNs + oc->publishNs;
+
+    long emitted = 0;
+    for (long i = 0; i < oc->count; i++) {
+        OptionChain *ch = &oc->chains[i];
+        if (ch->appliedSinceResum >= (ULONGLONG)ch->contractCount) Resum(oc, ch);
+
+        for (long k = 0; k < ch->bucketCount; k++) {
+            ChainBucket *b = &ch->buckets[k];
+            for (int f = 0; f < CHAIN_FIELD_COUNT; f++) {
+                if (!b->topicID[f]) continue;
+                if (b->hasOut[f] && b->sum[f] == b->lastOut[f]) continue;
+
+                // The topic may have been removed, and its ID reused
+                const TopicSubscription *sub = SubTable_Get(subs, b->topicID[f]);
+                if (!sub || sub->symbolID != b->symbolID || sub->fieldID != b->fieldID[f]) {
+                    b->topicID[f] = 0;
+                    continue;
+                }
+                b->lastOut[f] = b->sum[f];
+                b->hasOut[f] = TRUE;
+
+                RtdUpdate u;
+                u.recvNs = nowNs;
+                u.topicID = b->topicID[f];
+                u.vt = VT_R8;
+                u.dblVal = b->sum[f];
+                emit(ctx, &u);
+                emitted++;
+            }
+        }
+    }
+    oc->published += emitted;
+    return emitted;
+}
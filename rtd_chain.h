@@ -0,0 +1,127 @@
+// rtd_chain.h - Option-chain greek exposure
+// An option chain is expanded from a spec into one TOS option symbol per
+// expiry x strike x call/put (.SPY250117C500), each subscribed to GAMMA,
+// DELTA and OPEN_INT. Every contract's exposure is
+//
+//   gamma exposure = GAMMA x OPEN_INT x 100, negated for puts
+//   delta exposure = DELTA x OPEN_INT x 100 (put deltas are negative)
+//
+// and is summed into per-strike (all expiries), per-expiry and chain
+// totals. A tick replaces only its own contract's term: the difference
+// from the previous term is added to the three sums it belongs to.
+//
+// The sums are published at a fixed cadence as local topics NET_GAMMA
+// and NET_DELTA on the symbols SPY (chain), SPY:250117 (expiry) and
+// SPY@500 (strike), only when they changed.
+
+#ifndef __RTD_CHAIN_H__
+#define __RTD_CHAIN_H__
+
+#include "rtd_quotes.h"
+#include "rtd_subs.h"
+
+#define CHAIN_FIELDS(X) X(NET_GAMMA) X(NET_DELTA)
+
+#define CHAIN_ENUM(name) CF_##name,
+typedef enum {
+    CHAIN_FIELDS(CHAIN_ENUM)
+    CHAIN_FIELD_COUNT
+} ChainField;
+#undef CHAIN_ENUM
+
+#define CF_NONE (-1)
+
+#define CHAIN_MAX_EXPIRIES   32
+#define CHAIN_MAX_STRIKES    2048
+#define CHAIN_MULTIPLIER     100.0   // Shares per contract
+#define CHAIN_DEFAULT_PUBLISH_MS 1000
+
+// UNDERLYING:YYMMDD[,YYMMDD...]:LOW-HIGH:STEP, e.g. SPY:250117,250221:480-520:2.5
+typedef struct ChainSpec {
+    WCHAR  underlying[16];
+    WCHAR  expiries[CHAIN_MAX_EXPIRIES][8];
+    long   expiryCount;
+    double strikeLow, strikeHigh, strikeStep;
+} ChainSpec;
+
+// One published sum: the chain total, an expiry or a strike
+typedef struct ChainBucket {
+    double sum[CHAIN_FIELD_COUNT];
+    double lastOut[CHAIN_FIELD_COUNT];
+    BOOL   hasOut[CHAIN_FIELD_COUNT];
+    long   topicID[CHAIN_FIELD_COUNT];  // 0 = not registered
+    long   symbolID;                    // Checked at publish in case the topic was removed
+    long   fieldID[CHAIN_FIELD_COUNT];
+} ChainBucket;
+
+// Bucket 0 is the chain, then expiryCount expiries, then strikeCount strikes
+typedef struct OptionChain {
+    ChainSpec    spec;
+    long         strikeCount;
+    ChainBucket *buckets;
+    long         bucketCount;
+    long         firstContract;         // Contracts are contiguous per chain
+    long         contractCount;
+    ULONGLONG    appliedSinceResum;
+} OptionChain;
+
+typedef struct OptionContract {
+    long   chain;
+    long   expiryBucket;
+    long   strikeBucket;
+    BOOL   put;
+    long   symbolID;
+    double term[CHAIN_FIELD_COUNT];     // Current contribution to the sums
+} OptionContract;
+
+typedef struct OptionChains {
+    const QuoteStore *quotes;
+    OptionChain      *chains;
+    long              count;
+    OptionContract   *contracts;
+    long              contractCount;
+    long              contractCap;
+    long             *contractOf;       // Contract index + 1 per symbol ID, 0 = none
+    long              symbolCap;
+    ULONGLONG         publishNs;        // Cadence
+    ULONGLONG         nextPublishNs;
+
+    ULONGLONG         applied;          // Ticks that changed a contract's term
+    ULONGLONG         published;        // Aggregate updates emitted
+    ULONGLONG         resums;           // Full recomputations of the sums
+} OptionChains;
+
+// Receives every aggregate that changed since it was last published
+typedef void (*ChainEmitFn)(void *ctx, RtdUpdate *u);
+
+BOOL ChainSpec_Parse(ChainSpec *spec, const char *text);
+
+BOOL OptionChains_Init(OptionChains *oc, const QuoteStore *quotes, DWORD publishMs);
+void OptionChains_Free(OptionChains *oc);
+
+// ChainField for a topic name, or CF_NONE
+int ChainField_FromName(const WCHAR *topic);
+
+// Register every contract input and aggregate topic of spec in subs,
+// without connecting them; returns the chain index or -1
+long OptionChains_Add(OptionChains *oc, const ChainSpec *spec, SubscriptionTable *subs);
+
+// Forget a removed subscription's contract (its term leaves the sums)
+void OptionChains_Untrack(OptionChains *oc, const TopicSubscription *sub);
+
+void OptionChains_ApplyContract(OptionChains *oc, long contract);
+
+/**
+ * Fold a row for sub's symbol into the sums; call after QuoteStore_Apply
+ */
+static inline void OptionChains_Apply(OptionChains *oc, const TopicSubscription *sub)
+{
+    long sym = sub->symbolID;
+    if (sym < oc->symbolCap && oc->contractOf[sym]) OptionChains_ApplyContract(oc, oc->contractOf[sym] - 1);
+}
+
+// Emit changed aggregates if the cadence has elapsed; returns updates emitted
+long OptionChains_Publish(OptionChains *oc, SubscriptionTable *subs, ULONGLONG nowNs,
+                          ChainEmitFn emit, void *ctx);
+
+#endif /* __RTD_CHAIN_H__ */
@@ -8,194 +8,152 @@
 #include <windows.h>
 #include <oleauto.h>
 #include <stdio.h>
-#include <initguid.h>
+#include <stdlib.h>
 #include "rtd_client.h"
+#include "rtd_subs.h"
+#include "rtd_wake.h"
+#include "rtd_ring.h"
+#include "rtd_journal.h"
+#include "rtd_archive.h"
+#include "rtd_sim.h"
+#include "rtd_format.h"
+#include "rtd_output.h"
+#include "rtd_quotes.h"
+#include "rtd_shm.h"
+#include "rtd_conflate.h"
+#include "rtd_watchlist.h"
+#include "rtd_supervisor.h"
+#include "rtd_metrics.h"
+#include "rtd_analytics.h"
+#include "rtd_chain.h"
+#include "rtd_decode.h"
+#include "rtd_net.h"
+#include "rtd_l1.h"
+#include "rtd_pool.h"
+#include "rtd_shard.h"
+#include "rtd_bars.h"
+#include "rtd_session.h"
+#include "rtd_stale.h"
 
-/**
- * GUID Definitions
- */
-// Define RTDServerLib GUID (used for type library)
-DEFINE_GUID(LIBID_RTDServerLib, 
-    0xBA792DC8, 0x807E, 0x43E3, 0xB4, 0x84, 0x47, 0x46, 0x5D, 0x82, 0xC4, 0xD1);
-
-// Define IRtdServer interface GUID
-DEFINE_GUID(IID_IRtdServer,
-    0xEC0E6191, 0xDB51, 0x11D3, 0x8F, 0x3E, 0x00, 0xC0, 0x4F, 0x36, 0x51, 0xB8);
+#define MAX_WORKERS  16
+#define MAX_CHAINS   8
+#define WORKER_BATCH 256
 
-// Define IRTDUpdateEvent interface GUID
-DEFINE_GUID(IID_IRTDUpdateEvent,
-    0xA43788C1, 0xD91B, 0x11D3, 0x8F, 0x39, 0x00, 0xC0, 0x4F, 0x36, 0x51, 0xB8);
-
-// ---- callback object for IRTDUpdateEvent ----
-static volatile LONG g_update_flag = 0;
+// Server, supervisor, subscriptions and RefreshData decoding (rtd_session.h)
+static RtdSession g_session;
+static BOOL g_pollMode = FALSE;          // Legacy 100 ms polling loop
 
 // Global variables for symbol and topic handling
-static WCHAR currentSymbol[32] = L"";  // No default symbol
-static WCHAR currentTopic[32] = L"";   // No default topic
+static WCHAR currentTopics[256] = L"";  // Topics applied to every symbol
+static WCHAR pendingSymbols[256] = L""; // Symbol command from the input thread
 static CRITICAL_SECTION symbolLock;
 static BOOL shouldReconnect = FALSE;
 static BOOL shouldExit = FALSE;        // Flag for application exit
 static BOOL shouldPause = FALSE; // Add this line for pause control
 
-// Forward method declarations for our callback object
-static HRESULT STDMETHODCALLTYPE CB_QueryInterface(IRTDUpdateEvent*, REFIID, void**);
-static ULONG   STDMETHODCALLTYPE CB_AddRef(IRTDUpdateEvent*);
-static ULONG   STDMETHODCALLTYPE CB_Release(IRTDUpdateEvent*);
-static HRESULT STDMETHODCALLTYPE CB_UpdateNotify(IRTDUpdateEvent*);
-static HRESULT STDMETHODCALLTYPE CB_get_HeartbeatInterval(IRTDUpdateEvent*, long*);
-static HRESULT STDMETHODCALLTYPE CB_put_HeartbeatInterval(IRTDUpdateEvent*, long);
-static HRESULT STDMETHODCALLTYPE CB_Disconnect(IRTDUpdateEvent*);
+// Output worker draining one update ring
+typedef struct OutputWorker {
+    UpdateRing         ring;
+    SubscriptionTable *subs;
+    HANDLE             thread;
+    OutputWriter       writer;
+    Conflator          conflator;   // Used when g_conflateOn
+    L1Ring             quotes;      // L1 events, used when g_l1On
+    BarRing            bars;        // Closed bars, used when g_barsOn
+#ifndef RTD_NO_METRICS
+    Metrics            metrics;     // Queue, format and write stages
+#endif
+} OutputWorker;
 
-// IDispatch stubs
-static HRESULT STDMETHODCALLTYPE CB_GetTypeInfoCount(IRTDUpdateEvent*, UINT*);
-static HRESULT STDMETHODCALLTYPE CB_GetTypeInfo(IRTDUpdateEvent*, UINT, LCID, ITypeInfo**);
-static HRESULT STDMETHODCALLTYPE CB_GetIDsOfNames(IRTDUpdateEvent*, REFIID, LPOLESTR*, UINT, LCID, DISPID*);
-static HRESULT STDMETHODCALLTYPE CB_Invoke(IRTDUpdateEvent*, DISPID, REFIID, LCID, WORD, DISPPARAMS*, VARIANT*, EXCEPINFO*, UINT*);
+static OutputWorker g_workers[MAX_WORKERS];
+static int g_workerCount = 1;
+static OutputSink g_sink;                // Shared by every worker's writer
 
-/**
- * Define the vtable for our IRTDUpdateEvent implementation
- * This maps function pointers to our implementation methods
- */
-static IRTDUpdateEventVtbl cb_vtbl = {
-    // IUnknown
-    CB_QueryInterface,
-    CB_AddRef,
-    CB_Release,
+// Per-topic rate limits applied by each worker before formatting
+static ConflateConfig g_conflate;
+static BOOL g_conflateOn = FALSE;
 
-    // IDispatch
-    CB_GetTypeInfoCount,
-    CB_GetTypeInfo,
-    CB_GetIDsOfNames,
-    CB_Invoke,
+// Binary tick journal, written on the RTD thread when enabled
+static Journal g_journal;
+static BOOL g_journalOn = FALSE;
 
-    // IRTDUpdateEvent
-    CB_UpdateNotify,
-    CB_get_HeartbeatInterval,
-    CB_put_HeartbeatInterval,
-    CB_Disconnect
-};
+// Compressed tick archive, also written on the RTD thread; its index is
+// written at exit
+static ArchiveWriter g_archive;
+static BOOL g_archiveOn = FALSE;
 
-/**
- * Creates a COM callback object
- */
-MyCallback* CreateCallback(void)
-{
-    MyCallback *cb = (MyCallback*)CoTaskMemAlloc(sizeof *cb);
-    cb->lpVtbl   = &cb_vtbl;
-    cb->refCount = 1;
-    return cb;
-}
+// Latest value of each well-known field per symbol, updated on the RTD thread
+static QuoteStore g_quotes;
 
-/**
- * QueryInterface implementation for our COM object
- */
-static HRESULT STDMETHODCALLTYPE CB_QueryInterface(IRTDUpdateEvent *this,
-                                           REFIID riid,
-                                           void **ppv)
-{
-    if (IsEqualIID(riid, &IID_IUnknown) ||
-        IsEqualIID(riid, &IID_IDispatch) ||
-        IsEqualIID(riid, &IID_IRTDUpdateEvent))
-    {
-        *ppv = this;
-        this->lpVtbl->AddRef(this);
-        return S_OK;
-    }
-    *ppv = NULL;
-    return E_NOINTERFACE;
-}
+// String values shared by every update that carries them; lives until exit
+static RtdStringPool g_strings;
 
-/**
- * AddRef implementation for our COM object
- */
-static ULONG STDMETHODCALLTYPE CB_AddRef(IRTDUpdateEvent *this)
-{
-    MyCallback *cb = (MyCallback*)this;
-    return InterlockedIncrement(&cb->refCount);
-}
+// Server instances on their own threads (1 = call the server on this thread)
+static int g_shardCount = 1;
+static RtdStringPool g_shardStrings[MAX_SHARDS];   // One per shard, used only by its thread
 
-/**
- * Release implementation for our COM object
- */
-static ULONG STDMETHODCALLTYPE CB_Release(IRTDUpdateEvent *this)
-{
-    MyCallback *cb = (MyCallback*)this;
-    LONG c = InterlockedDecrement(&cb->refCount);
-    if (c == 0) {
-        CoTaskMemFree(cb);
-    }
-    return c;
-}
+// Derived topics (VWAP, EMA_FAST, ...) computed from g_quotes after each batch
+static Analytics g_analytics;
 
-/**
- * Called by the RTD server when data has changed
- */
-static HRESULT STDMETHODCALLTYPE CB_UpdateNotify(IRTDUpdateEvent *this)
-{
-    InterlockedExchange(&g_update_flag, 1);
-    return S_OK;
-}
+// With --l1, BID/ASK/sizes/LAST rows are printed as one event per symbol
+// and batch instead of one line each
+static L1Assembler g_l1;
+static BOOL g_l1On = FALSE;
 
-/**
- * Returns the heartbeat interval in milliseconds
- */
-static HRESULT STDMETHODCALLTYPE CB_get_HeartbeatInterval(IRTDUpdateEvent *this,
-                                                  long *plRetVal)
-{
-    *plRetVal = 100;  // 100ms for more frequent updates
-    return S_OK;
-}
+// With --bars, LAST/VOLUME rows also build OHLCV bars, printed and
+// journaled as each one closes
+static BarBuilder g_bars;
+static BOOL g_barsOn = FALSE;
 
-/**
- * Sets the heartbeat interval
- */
-static HRESULT STDMETHODCALLTYPE CB_put_HeartbeatInterval(IRTDUpdateEvent *this,
-                                                  long plRetVal)
-{
-    return S_OK;
-}
+// With --stale, a topic quiet for longer than its class's threshold is
+// reported, and again when it updates
+#define STALE_PRINT_MAX 16          // Lines per pass; the rest are counted
+static StaleMonitor g_stale;
+static BOOL g_staleOn = FALSE;
+static ULONG g_staleReported;       // Events since the last EndStaleReport
 
-/**
- * Called when the server disconnects
- */
-static HRESULT STDMETHODCALLTYPE CB_Disconnect(IRTDUpdateEvent *this)
-{
-    return S_OK;
-}
+// Option chains whose greek exposure is summed and published every --chain-ms
+static OptionChains g_chains;
 
-/**
- * IDispatch stub implementations
- */
-static HRESULT STDMETHODCALLTYPE CB_GetTypeInfoCount(IRTDUpdateEvent *this, UINT *pctinfo)
-{
-    *pctinfo = 0;
-    return S_OK;
-}
+// Latest values mirrored into shared memory for local readers
+static ShmWriter g_shm;
+static BOOL g_shmOn = FALSE;
 
-static HRESULT STDMETHODCALLTYPE CB_GetTypeInfo(IRTDUpdateEvent *this, UINT iTInfo, LCID lcid, ITypeInfo **ppTInfo)
-{
-    *ppTInfo = NULL;
-    return E_NOTIMPL;
-}
+// TCP fan-out hub for other processes, polled between batches
+static NetServer g_net;
+static BOOL g_netOn = FALSE;
 
-static HRESULT STDMETHODCALLTYPE CB_GetIDsOfNames(IRTDUpdateEvent *this, REFIID riid, LPOLESTR *rgszNames, UINT cNames, LCID lcid, DISPID *rgDispId)
-{
-    return E_NOTIMPL;
-}
+#ifndef RTD_NO_METRICS
+// RTD thread stages; workers keep their own. Dumped every g_statsIntervalNs
+// and on Ctrl+Break, and totals on exit.
+static Metrics g_metrics;
+static Metrics g_metricsLast;           // Totals at the previous dump
+static ULONGLONG g_statsIntervalNs = 0;
+static ULONGLONG g_statsStartNs;
+static ULONGLONG g_statsLastNs;
+static volatile LONG g_statsRequested = 0;
+#endif
 
-static HRESULT STDMETHODCALLTYPE CB_Invoke(IRTDUpdateEvent *this, DISPID dispIdMember, REFIID riid, LCID lcid, WORD wFlags, DISPPARAMS *pDispParams, VARIANT *pvarResult, EXCEPINFO *pExcepInfo, UINT *puArgErr)
-{
-    return E_NOTIMPL;
-}
+// Fractional digits printed for floating point values
+static int g_decimals = FORMAT_DEFAULT_DECIMALS;
 
 /**
  * Console handler for Ctrl+C/Ctrl+V
  */
 static BOOL WINAPI ConsoleHandler(DWORD dwCtrlType)
 {
+#ifndef RTD_NO_METRICS
+    // Ctrl+Break asks for a latency report instead of quitting
+    if (dwCtrlType == CTRL_BREAK_EVENT) {
+        InterlockedExchange(&g_statsRequested, 1);
+        RtdSession_Wake(&g_session);
+        return TRUE;
+    }
+#endif
     if (dwCtrlType == CTRL_C_EVENT || dwCtrlType == CTRL_BREAK_EVENT) {
         wprintf(L"\nShutting down...\n");
         shouldExit = TRUE;  // Set the global exit flag
+        RtdSession_Wake(&g_session);
         return TRUE;
     }
     return FALSE;
@@ -211,7 +169,7 @@ static DWORD WINAPI InputThreadProc(LPVOID lpParam) {
     while (!shouldExit) {
         // Only print the prompt if the stream is paused (waiting for user input)
         if (shouldPause) {
-            printf("Enter new symbol (or 'quit' to exit): ");
+            printf("Enter symbols, +SYM to add, -SYM to remove, ? for latest quotes (or 'quit' to exit): ");
             fflush(stdout);
         }
         if (fgets(input, sizeof(input), stdin) == NULL) break;
@@ -222,6 +180,7 @@ static DWORD WINAPI InputThreadProc(LPVOID lpParam) {
         if (strcmp(input, "quit") == 0) {
             wprintf(L"\nShutting down...\n");
             shouldExit = TRUE;  // Set global exit flag
+            RtdSession_Wake(&g_session);
             break;
         }
         
@@ -238,9 +197,10 @@ static DWORD WINAPI InputThreadProc(LPVOID lpParam) {
         
         // Update symbol with lock protection
         EnterCriticalSection(&symbolLock);
-        wcscpy_s(currentSymbol, 32, wideInput);
+        wcscpy_s(pendingSymbols, ARRAYSIZE(pendingSymbols), wideInput);
         shouldReconnect = TRUE;
         LeaveCriticalSection(&symbolLock);
+        RtdSession_Wake(&g_session);
         // Do not print the prompt here; let the main loop handle the next pause
     }
     
@@ -248,86 +208,891 @@ static DWORD WINAPI InputThreadProc(LPVOID lpParam) {
 }
 
 /**
- * Connect to a symbol with specified topic
+ * Copy the next comma/space separated token from *pp into out
  */
-BOOL ConnectToSymbol(IRtdServer *pSrv, WCHAR *symbol, SAFEARRAY **ppArgs, long *pTopicID) {
-    // Disconnect existing if needed
-    if (*ppArgs) {
-        pSrv->lpVtbl->DisconnectData(pSrv, *pTopicID);
-        SafeArrayDestroy(*ppArgs);
-        *ppArgs = NULL;
-    }    // Create variants for the topic and symbol
-    VARIANT vType, vSym;
-    VariantInit(&vType);
-    vType.vt = VT_BSTR;
-    vType.bstrVal = SysAllocString(currentTopic);  // Use specified topic
-
-    VariantInit(&vSym);
-    vSym.vt = VT_BSTR;
-    vSym.bstrVal = SysAllocString(symbol);
-    
-    // Create SAFEARRAY
-    SAFEARRAYBOUND sab;
-    sab.cElements = 2;
-    sab.lLbound = 0;
-    *ppArgs = SafeArrayCreate(VT_VARIANT, 1, &sab);
-    
-    // Add elements to SAFEARRAY
-    SafeArrayPutElement(*ppArgs, (LONG[]){0}, &vType);
-    SafeArrayPutElement(*ppArgs, (LONG[]){1}, &vSym);
-    
-    // Connect to data
-    VARIANT initVal; 
-    VariantInit(&initVal);
-    VARIANT_BOOL getNew = VARIANT_TRUE;
-    HRESULT hr = pSrv->lpVtbl->ConnectData(pSrv, *pTopicID, ppArgs, &getNew, &initVal);
-    
-    // Clean up variants
-    VariantClear(&vType);
-    VariantClear(&vSym);
-    
-    if (FAILED(hr)) {
-        wprintf(L"Connection failed for symbol %ls: 0x%08X\n", symbol, hr);
-        return FALSE;
+static BOOL NextToken(const WCHAR **pp, WCHAR *out, size_t outLen)
+{
+    const WCHAR *p = *pp;
+    size_t n = 0;
+    while (*p == L' ' || *p == L',' || *p == L'\t') p++;
+    if (!*p) return FALSE;
+    while (*p && *p != L' ' && *p != L',' && *p != L'\t') {
+        if (n + 1 < outLen) out[n++] = *p;
+        p++;
     }
-       
-    wprintf(L"Connected to symbol: %ls\n\n", symbol);
+    out[n] = 0;
+    *pp = p;
     return TRUE;
 }
 
+/**
+ * Start tracking a subscription ConnectData just accepted: quote store,
+ * journal and archive names and shared-memory slot
+ */
+static void TrackSubscription(void *ctx, TopicSubscription *sub)
+{
+    QuoteStore_Track(&g_quotes, sub);
+    Analytics_Track(&g_analytics, sub);
+    if (g_l1On) L1Assembler_Track(&g_l1, sub);
+    if (g_barsOn) BarBuilder_Track(&g_bars, sub);
+    if (g_staleOn && !StaleMonitor_Track(&g_stale, sub, RtdNowNs())) {
+        wprintf(L"Not watched for staleness: %ls %ls (out of memory)\n", sub->symbol, sub->topic);
+    }
+    if (g_journalOn) Journal_Define(&g_journal, sub->topicID, sub->symbol, sub->topic);
+    if (g_archiveOn) ArchiveWriter_Define(&g_archive, sub->topicID, sub->symbol, sub->topic);
+    if (g_shmOn && !ShmWriter_Define(&g_shm, sub->topicID, sub->symbol, sub->topic)) {
+        wprintf(L"Not shared: %ls %ls (name too long or out of slots)\n", sub->symbol, sub->topic);
+    }
+    if (g_netOn) NetServer_Define(&g_net, sub->topicID, sub->symbol, sub->topic);
+}
+
+/**
+ * Subscribe the quote fields a derived topic is computed from, when the
+ * symbol does not have them yet
+ */
+static void SubscribeAnalyticsInputs(const TopicSubscription *derived)
+{
+    // Adding subscriptions may move the slot array; keep only the names
+    const WCHAR *symbol = derived->symbol;
+    const WCHAR *name = derived->topic;
+    ULONG inputs = AnalyticField_Inputs(AnalyticField_FromName(name));
+    WCHAR topic[32];
+    for (int f = 0; f < QUOTE_FIELD_COUNT; f++) {
+        if (!(inputs & (1u << f))) continue;
+        swprintf(topic, ARRAYSIZE(topic), L"%hs", QuoteField_Name(f));
+        TopicSubscription *sub;
+        HRESULT hr = RtdSession_Subscribe(&g_session, symbol, topic, &sub);
+        if (FAILED(hr)) {
+            wprintf(L"Connection failed for %ls %ls (input to %ls): 0x%08X\n", symbol, topic, name, hr);
+        } else if (hr == S_OK) {
+            TrackSubscription(NULL, sub);
+        }
+    }
+}
+
+/**
+ * Subscribe one symbol to every current topic
+ */
+static void SubscribeSymbol(const WCHAR *symbol)
+{
+    const WCHAR *t = currentTopics;
+    WCHAR topic[32];
+    while (NextToken(&t, topic, ARRAYSIZE(topic))) {
+        TopicSubscription *sub;
+        HRESULT hr = RtdSession_Subscribe(&g_session, symbol, topic, &sub);
+        if (hr == S_FALSE) {
+            // Network clients may have asked first; the console now holds it too
+            if (g_netOn) NetServer_Disown(&g_net, sub->topicID);
+        } else if (FAILED(hr)) {
+            wprintf(L"Connection failed for %ls %ls: 0x%08X\n", symbol, topic, hr);
+            if (hr == E_OUTOFMEMORY) return;
+        } else {
+            wprintf(L"Connected to %ls %ls (topic %ld)\n", symbol, topic, sub->topicID);
+            TrackSubscription(NULL, sub);
+            if (sub->local) SubscribeAnalyticsInputs(sub);
+        }
+    }
+}
+
+/**
+ * Disconnect one subscription and drop it from every consumer. The
+ * symbol's other pairs may still be watched, by the console or by network
+ * clients, so only state of the whole symbol waits for its last pair.
+ */
+static void RemoveSubscription(TopicSubscription *sub)
+{
+    long id = sub->topicID;
+    long symbolID = sub->symbolID;
+    QuoteStore_ClearField(&g_quotes, sub);
+    if (g_barsOn) BarBuilder_Untrack(&g_bars, sub);
+    if (g_staleOn) StaleMonitor_Untrack(&g_stale, id);
+    Analytics_Untrack(&g_analytics, sub);
+    OptionChains_Untrack(&g_chains, sub);
+    if (g_shmOn) ShmWriter_Clear(&g_shm, id);
+    if (g_netOn) NetServer_Clear(&g_net, id);
+    RtdSession_Unsubscribe(&g_session, id);
+    if (!SubTable_SymbolPairs(&g_session.subs, symbolID)) L1Assembler_ClearSymbol(&g_l1, symbolID);
+}
+
+/**
+ * Disconnect and forget every topic of one symbol (or all symbols if NULL).
+ * Pairs network clients still hold stay until the last of them leaves.
+ */
+static void UnsubscribeSymbol(const WCHAR *symbol)
+{
+    SubscriptionTable *subs = &g_session.subs;
+    long symbolID = 0;
+    if (symbol) {
+        symbolID = Interner_Find(&subs->symbols, symbol);
+        if (!symbolID) return;
+    }
+    for (long id = 1; id < subs->highWater; id++) {
+        TopicSubscription *sub = SubTable_Get(subs, id);
+        if (!sub || (symbolID && sub->symbolID != symbolID)) continue;
+        if (g_netOn && NetServer_Retain(&g_net, sub)) continue;
+        RemoveSubscription(sub);
+    }
+}
+
+/**
+ * NetConnectFn: connect a pair a network client asked for, or hand back
+ * the subscription the console or another client already has. Runs on
+ * the RTD thread from NetServer_Poll; adding may move the slot and name
+ * arrays the workers read, so it holds symbolLock like the console does.
+ */
+static TopicSubscription* ConnectForNet(void *ctx, const WCHAR *symbol, const WCHAR *topic)
+{
+    TopicSubscription *sub;
+    EnterCriticalSection(&symbolLock);
+    HRESULT hr = RtdSession_Subscribe(&g_session, symbol, topic, &sub);
+    if (hr != S_OK) {
+        LeaveCriticalSection(&symbolLock);
+        return SUCCEEDED(hr) ? sub : NULL;
+    }
+
+    TrackSubscription(NULL, sub);
+    if (sub->local) {
+        // Adding the inputs may move the slot array
+        long id = sub->topicID;
+        SubscribeAnalyticsInputs(sub);
+        sub = SubTable_Get(&g_session.subs, id);
+    }
+    LeaveCriticalSection(&symbolLock);
+    return sub;
+}
+
+/**
+ * NetReleaseFn: the last network client left a pair the hub connected
+ */
+static void ReleaseForNet(void *ctx, TopicSubscription *sub)
+{
+    EnterCriticalSection(&symbolLock);
+    RemoveSubscription(sub);
+    LeaveCriticalSection(&symbolLock);
+}
+
+/**
+ * NetWakeFn: subscription requests arrived while the RTD thread waits
+ */
+static void WakeForNet(void *ctx)
+{
+    RtdSession_Wake(&g_session);
+}
+
+/**
+ * Print the latest value of every tracked field for every watched symbol
+ */
+static void PrintQuoteSnapshot(SubscriptionTable *subs)
+{
+    char value[FORMAT_NUMBER_MAX];
+    for (long sym = 1; sym < subs->symbols.count && sym < g_quotes.symbolCap; sym++) {
+        ULONG present = g_quotes.present[sym];
+        if (!present) continue;
+        wprintf(L"%-8ls", Interner_String(&subs->symbols, sym));
+        for (int f = 0; f < QUOTE_FIELD_COUNT; f++) {
+            if (!(present & (1u << f))) continue;
+            if (f < QUOTE_FIRST_INT) Format_Fixed(g_quotes.dbl[f][sym], g_decimals, value, sizeof value);
+            else Format_Int64(g_quotes.i64[f - QUOTE_FIRST_INT][sym], value);
+            wprintf(L" %hs=%hs", QuoteField_Name(f), value);
+        }
+        wprintf(L"\n");
+    }
+}
+
+/**
+ * Apply a symbol command: "AAPL MSFT" replaces the watchlist,
+ * "+AAPL" adds to it, "-AAPL" removes from it and "?" prints the
+ * latest quotes
+ */
+static void ApplySymbolCommand(const WCHAR *cmd)
+{
+    SubscriptionTable *subs = &g_session.subs;
+    const WCHAR *p = cmd;
+    WCHAR symbol[64];
+    BOOL replaced = FALSE;
+
+    while (NextToken(&p, symbol, ARRAYSIZE(symbol))) {
+        if (wcscmp(symbol, L"?") == 0) {
+            PrintQuoteSnapshot(subs);
+            continue;
+        }
+        if (symbol[0] == L'+') {
+            if (symbol[1]) SubscribeSymbol(symbol + 1);
+        } else if (symbol[0] == L'-') {
+            if (symbol[1]) UnsubscribeSymbol(symbol + 1);
+        } else {
+            if (!replaced) {
+                UnsubscribeSymbol(NULL);
+                replaced = TRUE;
+            }
+            SubscribeSymbol(symbol);
+        }
+    }
+    wprintf(L"Active subscriptions: %ld\n\n", subs->count);
+}
+
+/**
+ * Journal and archive one decoded update and publish it to other processes
+ */
+static void PublishUpdate(RtdUpdate *u)
+{
+    if (g_journalOn) Journal_Append(&g_journal, u);
+    if (g_archiveOn) ArchiveWriter_Append(&g_archive, u);
+    if (g_shmOn) ShmWriter_Publish(&g_shm, u);
+    if (g_netOn) NetServer_Publish(&g_net, u);
+}
+
+/**
+ * Publish one decoded update and queue it for its worker
+ * (also an AnalyticsEmitFn)
+ */
+static void RouteUpdate(void *ctx, RtdUpdate *u)
+{
+    PublishUpdate(u);
+    UpdateRing_Push(&g_workers[u->topicID % g_workerCount].ring, u);
+}
+
+/**
+ * L1EmitFn: queue an event for the worker that owns its symbol
+ */
+static void RouteQuote(void *ctx, const L1Quote *q)
+{
+    L1Ring_Push(&g_workers[q->symbolID % g_workerCount].quotes, q);
+}
+
+/**
+ * BarEmitFn: journal a closed bar and queue it for the worker that owns
+ * its symbol (ctx is the subscription table)
+ */
+static void RouteBar(void *ctx, const Bar *bar)
+{
+    if (g_journalOn) {
+        const WCHAR *symbol = Interner_String(&((SubscriptionTable*)ctx)->symbols, bar->symbolID);
+        if (symbol) Journal_AppendBar(&g_journal, bar, symbol);
+    }
+    BarRing_Push(&g_workers[bar->symbolID % g_workerCount].bars, bar);
+}
+
+/**
+ * StaleEmitFn: print a topic going stale or updating again (ctx is the
+ * subscription table). Past STALE_PRINT_MAX in one pass, only counted.
+ */
+static void OnStale(void *ctx, const StaleEvent *ev)
+{
+    if (g_staleReported++ >= STALE_PRINT_MAX) return;
+    TopicSubscription *sub = SubTable_Get((SubscriptionTable*)ctx, ev->topicID);
+    if (!sub) return;
+    if (!ev->stale) {
+        wprintf(L"Recovered: %ls %ls after %.1f s without data\n", sub->symbol, sub->topic, ev->silentNs / 1e9);
+    } else if (!ev->lastNs) {
+        wprintf(L"Stale: %ls %ls, no data since subscribing %.1f s ago\n", sub->symbol, sub->topic,
+                ev->silentNs / 1e9);
+    } else {
+        wprintf(L"Stale: %ls %ls, quiet for %.1f s (threshold %.1f s)\n", sub->symbol, sub->topic,
+                ev->silentNs / 1e9, ev->thresholdNs / 1e9);
+    }
+}
+
+/**
+ * Summarize the staleness events OnStale did not print
+ */
+static void EndStaleReport(void)
+{
+    if (g_staleReported > STALE_PRINT_MAX) {
+        wprintf(L"... and %lu more stale or recovered topics (%ld stale now)\n",
+                g_staleReported - STALE_PRINT_MAX, g_stale.staleNow);
+    }
+    g_staleReported = 0;
+}
+
+/**
+ * Update the quote store and derived state for one row, then queue it
+ */
+static void ApplyUpdate(TopicSubscription *sub, RtdUpdate *u)
+{
+    QuoteStore_ApplyUpdate(&g_quotes, sub, u);
+    Analytics_Apply(&g_analytics, sub);
+    OptionChains_Apply(&g_chains, sub);
+    if (g_barsOn) BarBuilder_Apply(&g_bars, sub, u);
+    if (g_staleOn) StaleMonitor_Touch(&g_stale, sub->topicID, u->recvNs);
+    if (g_l1On && L1Assembler_Apply(&g_l1, sub)) {
+        // Printed as part of the symbol's L1 event at the end of the batch
+        PublishUpdate(u);
+        RtdUpdate_Clear(u);
+        return;
+    }
+    RouteUpdate(NULL, u);
+}
+
+/**
+ * Copy one decoded row into its worker's ring (BatchRowHandler).
+ * Apart from an optional journal record and shared-memory slot, this is
+ * all the RTD thread does per row.
+ */
+static void EnqueueUpdate(void *ctx, TopicSubscription *sub, const RtdBatch *batch, long row)
+{
+    RtdUpdate u;
+    if (!RtdBatch_Update(batch, row, &u, *(ULONGLONG*)ctx)) return;
+    ApplyUpdate(sub, &u);
+}
+
+/**
+ * RtdSessionBatchFn: route each decoded row to its subscription, then
+ * let the analytics, L1 and bar stages close the batch
+ */
+static void OnBatch(void *ctx, RtdSession *s, const RtdBatch *batch, ULONGLONG recvNs)
+{
+    METRIC_STAMP(dispatchNs);
+    METRIC_RECORD(&g_metrics, METRIC_BATCH_ROWS, batch->rows);
+    SubTable_DispatchBatch(&s->subs, batch, EnqueueUpdate, &recvNs);
+    Analytics_EndBatch(&g_analytics, recvNs, RouteUpdate, NULL);
+    if (g_l1On) L1Assembler_EndBatch(&g_l1, recvNs, RouteQuote, NULL);
+    if (g_barsOn) BarBuilder_EndBatch(&g_bars);
+    METRIC_RECORD(&g_metrics, METRIC_DISPATCH, RtdNowNs() - dispatchNs);
+}
+
+/**
+ * Format one update for its subscription, if it still has one
+ */
+static void EmitUpdate(OutputWorker *w, RtdUpdate *u)
+{
+    TopicSubscription *sub = SubTable_Get(w->subs, u->topicID);
+    if (sub) OutputWriter_Append(&w->writer, u, sub->symbol, sub->topic);
+    RtdUpdate_Clear(u);
+}
+
+/**
+ * Emit whatever the conflator has released since the last call
+ */
+static void DrainConflated(OutputWorker *w, RtdUpdate *scratch)
+{
+    ULONGLONG now = RtdNowNs();
+    ULONG n;
+    EnterCriticalSection(&symbolLock);
+    while ((n = Conflator_Drain(&w->conflator, now, scratch, WORKER_BATCH)) > 0) {
+        for (ULONG i = 0; i < n; i++) EmitUpdate(w, &scratch[i]);
+    }
+    LeaveCriticalSection(&symbolLock);
+}
+
+/**
+ * End a worker batch, timing the write and the oldest line's trip when
+ * the writer flushed
+ */
+static void EndWorkerBatch(OutputWorker *w, ULONGLONG nowNs)
+{
+#ifndef RTD_NO_METRICS
+    ULONGLONG oldestNs = w->writer.pendingRecvNs;
+    if (OutputWriter_EndBatch(&w->writer, nowNs)) {
+        ULONGLONG written = RtdNowNs();
+        METRIC_RECORD(&w->metrics, METRIC_WRITE, written - nowNs);
+        METRIC_RECORD(&w->metrics, METRIC_END_TO_END, written - oldestNs);
+    }
+#else
+    OutputWriter_EndBatch(&w->writer, nowNs);
+#endif
+}
+
+/**
+ * Output worker: drains one ring, formats and prints off the RTD thread
+ */
+static DWORD WINAPI OutputThreadProc(LPVOID lpParam)
+{
+    OutputWorker *w = (OutputWorker*)lpParam;
+    RtdUpdate batch[WORKER_BATCH];
+    L1Quote quotes[WORKER_BATCH];
+    Bar bars[WORKER_BATCH];
+    int idle = 0;
+
+    while (!shouldExit) {
+        ULONG n = UpdateRing_Pop(&w->ring, batch, WORKER_BATCH);
+        ULONG m = g_l1On ? L1Ring_Pop(&w->quotes, quotes, WORKER_BATCH) : 0;
+        ULONG k = g_barsOn ? BarRing_Pop(&w->bars, bars, WORKER_BATCH) : 0;
+        if (n == 0 && m == 0 && k == 0) {
+            // Let held values and time-based flushing catch up, then back off
+            if (g_conflateOn) DrainConflated(w, batch);
+            EndWorkerBatch(w, RtdNowNs());
+            if (++idle < 64) RtdYield(); else Sleep(1);
+            continue;
+        }
+        idle = 0;
+
+        // Format the whole batch under the lock, write after releasing it
+        ULONGLONG now = RtdNowNs();
+        METRIC_RECORD(&w->metrics, METRIC_RING_DEPTH, n + UpdateRing_Depth(&w->ring));
+        EnterCriticalSection(&symbolLock);
+        for (ULONG i = 0; i < n; i++) {
+            METRIC_RECORD(&w->metrics, METRIC_QUEUE, now - batch[i].recvNs);
+            if (g_conflateOn) {
+                TopicSubscription *sub = SubTable_Get(w->subs, batch[i].topicID);
+                ULONGLONG key = sub ? ((ULONGLONG)sub->symbolID << 32) | (ULONG)sub->fieldID : 0;
+                if (!Conflator_Offer(&w->conflator, &batch[i], key, now)) continue;
+            }
+            EmitUpdate(w, &batch[i]);
+        }
+        for (ULONG i = 0; i < m; i++) {
+            METRIC_RECORD(&w->metrics, METRIC_QUEUE, now - quotes[i].recvNs);
+            const WCHAR *symbol = Interner_String(&w->subs->symbols, quotes[i].symbolID);
+            if (symbol) OutputWriter_AppendQuote(&w->writer, &quotes[i], symbol);
+        }
+        for (ULONG i = 0; i < k; i++) {
+            const WCHAR *symbol = Interner_String(&w->subs->symbols, bars[i].symbolID);
+            if (symbol) OutputWriter_AppendBar(&w->writer, &bars[i], symbol);
+        }
+        LeaveCriticalSection(&symbolLock);
+        if (g_conflateOn) DrainConflated(w, batch);
+
+        ULONGLONG formatted = RtdNowNs();
+        METRIC_RECORD(&w->metrics, METRIC_FORMAT, formatted - now);
+        EndWorkerBatch(w, formatted);
+    }
+    OutputWriter_Flush(&w->writer);
+    return 0;
+}
+
 /**
  * Format variant value as string
  */
 void FormatVariantValue(VARIANT *value, WCHAR *buffer, size_t bufferSize) {
+    RtdUpdate u;
+    u.vt = value->vt;
     switch (value->vt) {
         case VT_BSTR:
-            swprintf(buffer, bufferSize, L"%ls", value->bstrVal);
+            u.bstrVal = value->bstrVal;     // Borrowed, never cleared
             break;
         case VT_R8:
-            swprintf(buffer, bufferSize, L"%.6f", value->dblVal);
+            u.dblVal = value->dblVal;
             break;
         case VT_I4:
-            swprintf(buffer, bufferSize, L"%ld", value->lVal);
+            u.llVal = value->lVal;
             break;
         default:
             swprintf(buffer, bufferSize, L"<unknown type %d>", value->vt);
+            return;
+    }
+    Format_UpdateValue(&u, FORMAT_DEFAULT_DECIMALS, buffer, bufferSize);
+}
+
+/**
+ * Subscribe a whole watchlist file in one batch and report the timing
+ */
+static void ConnectWatchlist(IRtdServer *pSrv, SubscriptionTable *subs, const Watchlist *wl)
+{
+    WatchConnectStats st;
+    Watchlist_Connect(wl, pSrv, subs, TrackSubscription, NULL, &st);
+    for (long id = 1; id < subs->highWater; id++) {
+        TopicSubscription *sub = SubTable_Get(subs, id);
+        if (sub && sub->local) SubscribeAnalyticsInputs(sub);
+    }
+    wprintf(L"Watchlist: %ld symbols, %ld pairs: %ld connected, %ld already connected, %ld failed\n",
+            wl->symbolCount, st.requested, st.connected, st.existing, st.failed);
+    long calls = st.connected + st.failed;
+    wprintf(L"  register %.2f ms, ConnectData %.2f ms (avg %.2f us, max %.2f us per call)\n",
+            st.registerNs / 1e6, st.connectNs / 1e6,
+            calls ? st.connectNs / 1e3 / calls : 0.0, st.maxCallNs / 1e3);
+}
+
+/**
+ * Expand an option chain into its contracts, subscribe them in one batch
+ * and report the timing
+ */
+static void ConnectChain(IRtdServer *pSrv, SubscriptionTable *subs, const ChainSpec *spec)
+{
+    ULONGLONG start = RtdNowNs();
+    long index = OptionChains_Add(&g_chains, spec, subs);
+    if (index < 0) {
+        wprintf(L"Failed to register option chain %ls\n", spec->underlying);
+        return;
+    }
+
+    // Everything registered but not yet connected belongs to this chain
+    long *ids = (long*)malloc((size_t)subs->highWater * sizeof *ids);
+    long count = 0;
+    if (!ids) return;
+    for (long id = 1; id < subs->highWater; id++) {
+        TopicSubscription *sub = SubTable_Get(subs, id);
+        if (sub && !sub->connected) ids[count++] = id;
+    }
+    WatchConnectStats st;
+    memset(&st, 0, sizeof st);
+    Watchlist_ConnectTopics(pSrv, subs, ids, count, TrackSubscription, NULL, &st);
+
+    // Contracts the server does not list drop out of the sums
+    for (long i = 0; i < count; i++) {
+        TopicSubscription *sub = SubTable_Get(subs, ids[i]);
+        if (!sub || sub->connected) continue;
+        OptionChains_Untrack(&g_chains, sub);
+        SubTable_Remove(subs, ids[i]);
+    }
+    free(ids);
+
+    const OptionChain *ch = &g_chains.chains[index];
+    wprintf(L"Chain %ls: %ld expiries x %ld strikes, %ld contracts: %ld topics connected, %ld failed in %.2f ms\n",
+            spec->underlying, spec->expiryCount, ch->strikeCount, ch->contractCount,
+            st.connected, st.failed, (RtdNowNs() - start) / 1e6);
+}
+
+/**
+ * LocalTopicFn: topics computed by the client rather than the server
+ */
+static BOOL IsLocalTopic(const WCHAR *topic)
+{
+    return AnalyticField_IsDerived(topic) || ChainField_FromName(topic) != CF_NONE;
+}
+
+/**
+ * Log supervisor incidents
+ */
+static void OnSupervisorEvent(void *ctx, const Supervisor *sv, SupervisorEvent ev)
+{
+    switch (ev) {
+        case SUPERVISOR_LOST:
+            wprintf(L"\nRTD server lost (%hs failed: 0x%08X), reconnecting\n", sv->cause, sv->reason);
+            break;
+        case SUPERVISOR_RETRY_FAILED:
+            wprintf(L"Reconnect attempt %u failed: 0x%08X, next in %.1f s\n",
+                    sv->attempts, sv->reason, (sv->nextAttemptNs - RtdNowNs()) / 1e9);
+            break;
+        case SUPERVISOR_RECOVERED:
+            wprintf(L"RTD server back after %.1f ms and %u attempt(s): %ld subscriptions restored, %ld failed\n",
+                    (sv->recoveredNs - sv->lostNs) / 1e6, sv->attempts, sv->replayed, sv->replayFailed);
+            break;
+        case SUPERVISOR_GAP_CLOSED:
+            wprintf(L"Data gap %.1f ms (last update before loss to first after recovery)\n", sv->gapNs / 1e6);
+            break;
+    }
+}
+
+#ifndef RTD_NO_METRICS
+/**
+ * Print latency histograms to stderr, so they stay out of piped output:
+ * the interval since the last dump, or the totals at exit
+ */
+static void DumpMetrics(BOOL final)
+{
+    static Metrics total, interval;
+    ULONGLONG now = RtdNowNs();
+
+    Metrics_Reset(&total);
+    Metrics_Merge(&total, &g_metrics);
+    for (int i = 0; i < g_workerCount; i++) Metrics_Merge(&total, &g_workers[i].metrics);
+
+    if (final) {
+        Metrics_Print(stderr, "total", &total, (now - g_statsStartNs) / 1e9);
+    } else {
+        Metrics_Diff(&interval, &total, &g_metricsLast);
+        Metrics_Print(stderr, "interval", &interval, (now - g_statsLastNs) / 1e9);
+        g_metricsLast = total;
+        g_statsLastNs = now;
     }
+    fflush(stderr);
+}
+#endif
+
+/**
+ * Print command line usage
+ */
+static void PrintUsage(void)
+{
+    wprintf(L"Usage: rtd_client [--poll] [--coalesce-us N] [--workers N] [--ring-size N]\n");
+    wprintf(L"                  [--overflow block|drop|conflate] [--journal PREFIX] [--journal-mb N]\n");
+    wprintf(L"                  [--archive FILE [--archive-journal PREFIX]]\n");
+    wprintf(L"                  [--decimals N] [--format line|csv|ndjson] [--out FILE] [--flush-ms N]\n");
+    wprintf(L"                  [--watchlist FILE] [--heartbeat-ms N]\n");
+    wprintf(L"                  [--min-interval-ms N] [--max-rate N] [--epsilon X]\n");
+    wprintf(L"                  [--shm NAME] [--shm-slots N]\n");
+    wprintf(L"                  [--net-port N] [--net-bind ADDR] [--net-clients N] [--net-buffer-kb N]\n");
+    wprintf(L"                  [--net-mcast GROUP:PORT]\n");
+    wprintf(L"                  [--vwap-window N] [--ema-fast N] [--ema-slow N] [--vol-window N]\n");
+    wprintf(L"                  [--chain SPEC ...] [--chain-ms N] [--l1 [--l1-stale-ms N]]\n");
+    wprintf(L"                  [--bars LIST [--bar-grace-ms N]] [--stale SPEC]\n");
+    wprintf(L"                  [--string-pool-mb N] [--shards N]\n");
+    wprintf(L"                  [--sim RATE | --replay PREFIX [--speed N] [--loop]]\n");
+    wprintf(L"                  [--sim-dropout SEC [--sim-downtime SEC]] [--sim-call-us N] [--sim-row-ns N]\n");
+#ifndef RTD_NO_METRICS
+    wprintf(L"                  [--stats-sec N]\n");
+#endif
+    wprintf(L"  --poll           Poll for updates every 100 ms instead of waking on UpdateNotify\n");
+    wprintf(L"  --coalesce-us N  After a notify, wait N microseconds before RefreshData\n");
+    wprintf(L"  --workers N      Output threads draining updates (default 1, max %d)\n", MAX_WORKERS);
+    wprintf(L"  --ring-size N    Queued updates per worker (default 65536)\n");
+    wprintf(L"  --overflow P     When a ring is full: block, drop oldest, or conflate per topic (default)\n");
+    wprintf(L"  --journal PREFIX Record every update to PREFIX-NNNNNN.rtj binary journal files\n");
+    wprintf(L"  --journal-mb N   Size of each preallocated journal file (default 256)\n");
+    wprintf(L"  --archive FILE   Record every update to a compressed columnar archive, indexed at exit\n");
+    wprintf(L"  --archive-journal PREFIX  Convert the journal PREFIX to the --archive FILE and exit\n");
+    wprintf(L"  --decimals N     Digits after the decimal point for prices (default 6)\n");
+    wprintf(L"  --format F       Output layout: line (default), csv or ndjson\n");
+    wprintf(L"  --out FILE       Write updates to FILE instead of stdout\n");
+    wprintf(L"  --flush-ms N     Buffer output for up to N ms (default 0: write once per batch)\n");
+    wprintf(L"  --watchlist FILE Subscribe every symbol x topic in FILE at startup, without prompting\n");
+    wprintf(L"  --heartbeat-ms N Check the server every N ms and reconnect if it is gone (default %d, 0 = off)\n",
+            SUPERVISOR_HEARTBEAT_MS);
+#ifndef RTD_NO_METRICS
+    wprintf(L"  --stats-sec N    Print latency histograms to stderr every N seconds (also on Ctrl+Break)\n");
+#endif
+    wprintf(L"  --min-interval-ms N  Print each topic at most once per N ms, always its latest value\n");
+    wprintf(L"  --max-rate N     Print at most N updates/s per worker, holding the latest per topic\n");
+    wprintf(L"  --epsilon X      Skip numeric updates within X of the last printed value\n");
+    wprintf(L"  --shm NAME       Publish latest values to shared memory segment NAME\n");
+    wprintf(L"  --shm-slots N    Topic slots in the segment (default 65536)\n");
+    wprintf(L"  --net-port N     Serve subscriptions to other processes over TCP on port N\n");
+    wprintf(L"  --net-bind ADDR  Address to listen on (default 127.0.0.1)\n");
+    wprintf(L"  --net-clients N  Most network clients at once (default %d)\n", NET_DEFAULT_CLIENTS);
+    wprintf(L"  --net-buffer-kb N  Send buffer per client; a full one conflates per topic (default %d)\n",
+            NET_DEFAULT_BUFFER / 1024);
+    wprintf(L"  --net-mcast GROUP:PORT  Also send every update to a UDP multicast group\n");
+    wprintf(L"  --sim RATE       Use a simulated server generating RATE updates/s (0 = max)\n");
+    wprintf(L"  --replay PREFIX  Use a simulated server replaying a journal\n");
+    wprintf(L"  --speed N        Replay at N x recorded pace (default 1, 0 = max)\n");
+    wprintf(L"  --loop           Restart the replay when it reaches the end\n");
+    wprintf(L"  --vwap-window N  Trades in the VWAP topic (default 0: the whole session)\n");
+    wprintf(L"  --ema-fast N, --ema-slow N  Periods of EMA_FAST and EMA_SLOW in trades (default %d, %d)\n",
+            ANALYTICS_DEFAULT_EMA_FAST, ANALYTICS_DEFAULT_EMA_SLOW);
+    wprintf(L"  --vol-window N   Price changes in the RVOL topic (default %d)\n", ANALYTICS_DEFAULT_VOL_WINDOW);
+    wprintf(L"  --chain SPEC     Sum GAMMA/DELTA x OPEN_INT over an option chain, e.g. SPY:250117,250221:480-520:5\n");
+    wprintf(L"                   (UNDERLYING:EXPIRIES:LOW-HIGH:STEP, up to %d chains)\n", MAX_CHAINS);
+    wprintf(L"  --chain-ms N     Publish chain NET_GAMMA/NET_DELTA every N ms (default %d)\n",
+            CHAIN_DEFAULT_PUBLISH_MS);
+    wprintf(L"  --string-pool-mb N  Share repeated string values from up to N MB (default %d, 0 = copy each)\n",
+            STRING_POOL_DEFAULT_BYTES >> 20);
+    wprintf(L"  --shards N       Run N server instances on their own threads, symbols split by hash (max %d)\n",
+            MAX_SHARDS);
+    wprintf(L"  --l1             Print BID/ASK/BID_SIZE/ASK_SIZE/LAST as one L1 event per symbol and batch\n");
+    wprintf(L"  --l1-stale-ms N  Flag an L1 event stale when its bid/ask is older than N ms (default %d, 0 = off)\n",
+            L1_DEFAULT_STALE_MS);
+    wprintf(L"  --bars LIST      Build OHLCV bars from LAST/VOLUME at each interval in LIST, e.g. 1s,1m,5m\n");
+    wprintf(L"                   (units ms, s, m, h; up to %d intervals of at most 4h)\n", BAR_MAX_INTERVALS);
+    wprintf(L"  --bar-grace-ms N Keep a bar open N ms past its end for late rows (default %d)\n",
+            BAR_DEFAULT_GRACE_MS);
+    wprintf(L"  --stale SPEC     Report topics quiet longer than their threshold, e.g. LAST=5s,BID=2s,*=1m\n");
+    wprintf(L"                   (topic=time, units ms, s, m, h; * for other topics; up to %d, at most 24h)\n",
+            STALE_MAX_CLASSES);
+    wprintf(L"  --sim-dropout SEC  Make the simulated server die every SEC seconds\n");
+    wprintf(L"  --sim-downtime SEC Keep it down that long before it can be recreated (default 1)\n");
+    wprintf(L"  --sim-call-us N  Make each simulated RefreshData/ConnectData call take N microseconds\n");
+    wprintf(L"  --sim-row-ns N   Plus N nanoseconds per row RefreshData returns\n");
 }
 
 /**
  * Main application entry point
  */
-int main(void)
+int main(int argc, char **argv)
 {
     HRESULT hr;
-    CLSID   clsid;
     IRtdServer      *pSrv = NULL;
-    IRTDUpdateEvent *pCB  = NULL;
-    SAFEARRAY       *pArgs = NULL;
-    SAFEARRAY       *pOutArr = NULL;
-    long            topicCount = 0;
-    long            topicID = 1;
-    BOOL            running = TRUE;
+    SubscriptionTable *subs = &g_session.subs;
+    RtdSessionConfig sessionConfig;
+    DWORD           coalesceUs = 0;
+    ULONG           ringSize = 65536;
+    RingPolicy      overflow = RING_CONFLATE;
+    const char     *journalPrefix = NULL;
+    ULONGLONG       journalMB = 256;
+    const char     *archivePath = NULL;
+    const char     *archiveJournal = NULL;
+    OutputLayout    outLayout = OUTPUT_LINE;
+    const char     *outPath = NULL;
+    DWORD           flushMs = 0;
+    const char     *shmName = NULL;
+    const char     *watchlistPath = NULL;
+    DWORD           heartbeatMs = SUPERVISOR_HEARTBEAT_MS;
+    Watchlist       watchlist;
+    ULONGLONG       shmSlots = 65536;
+    BOOL            useSim = FALSE;
+    SimConfig       simConfig;
+    AnalyticsConfig analyticsConfig;
+    ChainSpec       chainSpecs[MAX_CHAINS];
+    int             chainCount = 0;
+    DWORD           chainMs = CHAIN_DEFAULT_PUBLISH_MS;
+    NetConfig       netConfig;
+    DWORD           l1StaleMs = L1_DEFAULT_STALE_MS;
+    ULONG           barIntervals[BAR_MAX_INTERVALS];
+    int             barCount = 0;
+    DWORD           barGraceMs = BAR_DEFAULT_GRACE_MS;
+    StaleConfig     staleConfig;
+    size_t          stringPoolBytes = STRING_POOL_DEFAULT_BYTES;
+
+    memset(&simConfig, 0, sizeof simConfig);
+    memset(&analyticsConfig, 0, sizeof analyticsConfig);
+    memset(&netConfig, 0, sizeof netConfig);
+    simConfig.speed = 1.0;
+    simConfig.downtimeSec = 1.0;
+    simConfig.dropoutNotify = TRUE;
+
+    // Parse command line options
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--poll") == 0) {
+            g_pollMode = TRUE;
+        } else if (strcmp(argv[i], "--coalesce-us") == 0 && i + 1 < argc) {
+            coalesceUs = (DWORD)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            g_workerCount = atoi(argv[++i]);
+            if (g_workerCount < 1 || g_workerCount > MAX_WORKERS) {
+                PrintUsage();
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--ring-size") == 0 && i + 1 < argc) {
+            ringSize = (ULONG)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--journal") == 0 && i + 1 < argc) {
+            journalPrefix = argv[++i];
+        } else if (strcmp(argv[i], "--journal-mb") == 0 && i + 1 < argc) {
+            journalMB = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--archive") == 0 && i + 1 < argc) {
+            archivePath = argv[++i];
+        } else if (strcmp(argv[i], "--archive-journal") == 0 && i + 1 < argc) {
+            archiveJournal = argv[++i];
+        } else if (strcmp(argv[i], "--decimals") == 0 && i + 1 < argc) {
+            g_decimals = atoi(argv[++i]);
+            if (g_decimals < 0) g_decimals = 0;
+            if (g_decimals > FORMAT_MAX_DECIMALS) g_decimals = FORMAT_MAX_DECIMALS;
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            if (!OutputLayout_Parse(argv[++i], &outLayout)) {
+                PrintUsage();
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            outPath = argv[++i];
+        } else if (strcmp(argv[i], "--flush-ms") == 0 && i + 1 < argc) {
+            flushMs = (DWORD)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--watchlist") == 0 && i + 1 < argc) {
+            watchlistPath = argv[++i];
+        } else if (strcmp(argv[i], "--heartbeat-ms") == 0 && i + 1 < argc) {
+            heartbeatMs = (DWORD)strtoul(argv[++i], NULL, 10);
+#ifndef RTD_NO_METRICS
+        } else if (strcmp(argv[i], "--stats-sec") == 0 && i + 1 < argc) {
+            g_statsIntervalNs = (ULONGLONG)(atof(argv[++i]) * 1e9);
+#endif
+        } else if (strcmp(argv[i], "--min-interval-ms") == 0 && i + 1 < argc) {
+            g_conflate.topicIntervalNs = (ULONGLONG)(atof(argv[++i]) * 1e6);
+        } else if (strcmp(argv[i], "--max-rate") == 0 && i + 1 < argc) {
+            g_conflate.maxPerSec = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--epsilon") == 0 && i + 1 < argc) {
+            g_conflate.epsilon = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--vwap-window") == 0 && i + 1 < argc) {
+            analyticsConfig.vwapWindow = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--ema-fast") == 0 && i + 1 < argc) {
+            analyticsConfig.emaFast = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--ema-slow") == 0 && i + 1 < argc) {
+            analyticsConfig.emaSlow = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--vol-window") == 0 && i + 1 < argc) {
+            analyticsConfig.volWindow = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--chain") == 0 && i + 1 < argc) {
+            if (chainCount == MAX_CHAINS || !ChainSpec_Parse(&chainSpecs[chainCount++], argv[++i])) {
+                PrintUsage();
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--chain-ms") == 0 && i + 1 < argc) {
+            chainMs = (DWORD)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--shm") == 0 && i + 1 < argc) {
+            shmName = argv[++i];
+        } else if (strcmp(argv[i], "--shm-slots") == 0 && i + 1 < argc) {
+            shmSlots = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--string-pool-mb") == 0 && i + 1 < argc) {
+            stringPoolBytes = (size_t)strtoull(argv[++i], NULL, 10) << 20;
+        } else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc) {
+            g_shardCount = atoi(argv[++i]);
+            if (g_shardCount < 1 || g_shardCount > MAX_SHARDS) {
+                PrintUsage();
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--l1") == 0) {
+            g_l1On = TRUE;
+        } else if (strcmp(argv[i], "--l1-stale-ms") == 0 && i + 1 < argc) {
+            l1StaleMs = (DWORD)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--bars") == 0 && i + 1 < argc) {
+            if (!BarBuilder_ParseIntervals(argv[++i], barIntervals, &barCount)) {
+                PrintUsage();
+                return 1;
+            }
+            g_barsOn = TRUE;
+        } else if (strcmp(argv[i], "--bar-grace-ms") == 0 && i + 1 < argc) {
+            barGraceMs = (DWORD)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--stale") == 0 && i + 1 < argc) {
+            if (!StaleConfig_Parse(&staleConfig, argv[++i])) {
+                PrintUsage();
+                return 1;
+            }
+            g_staleOn = TRUE;
+        } else if (strcmp(argv[i], "--net-port") == 0 && i + 1 < argc) {
+            netConfig.port = (USHORT)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--net-bind") == 0 && i + 1 < argc) {
+            netConfig.bindAddr = argv[++i];
+        } else if (strcmp(argv[i], "--net-clients") == 0 && i + 1 < argc) {
+            netConfig.maxClients = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--net-buffer-kb") == 0 && i + 1 < argc) {
+            netConfig.bufferBytes = (ULONG)strtoul(argv[++i], NULL, 10) * 1024;
+        } else if (strcmp(argv[i], "--net-mcast") == 0 && i + 1 < argc) {
+            // GROUP:PORT; the group string stays in argv
+            char *colon = strrchr(argv[++i], ':');
+            if (!colon) {
+                PrintUsage();
+                return 1;
+            }
+            *colon = 0;
+            netConfig.mcastGroup = argv[i];
+            netConfig.mcastPort = (USHORT)atoi(colon + 1);
+        } else if (strcmp(argv[i], "--sim") == 0 && i + 1 < argc) {
+            useSim = TRUE;
+            simConfig.mode = SIM_SYNTHETIC;
+            simConfig.updatesPerSec = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            useSim = TRUE;
+            simConfig.mode = SIM_REPLAY;
+            simConfig.journalPrefix = argv[++i];
+        } else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            simConfig.speed = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--loop") == 0) {
+            simConfig.loop = TRUE;
+        } else if (strcmp(argv[i], "--sim-dropout") == 0 && i + 1 < argc) {
+            simConfig.dropoutAfterSec = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--sim-downtime") == 0 && i + 1 < argc) {
+            simConfig.downtimeSec = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--sim-call-us") == 0 && i + 1 < argc) {
+            simConfig.callLatencyUs = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--sim-row-ns") == 0 && i + 1 < argc) {
+            simConfig.rowLatencyNs = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--overflow") == 0 && i + 1 < argc) {
+            const char *p = argv[++i];
+            if (strcmp(p, "block") == 0) overflow = RING_BLOCK;
+            else if (strcmp(p, "drop") == 0) overflow = RING_DROP_OLDEST;
+            else if (strcmp(p, "conflate") == 0) overflow = RING_CONFLATE;
+            else {
+                PrintUsage();
+                return 1;
+            }
+        } else {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    if (archiveJournal) {
+        // Offline conversion; no server involved
+        if (!archivePath || !ArchiveWriter_Open(&g_archive, archivePath)) {
+            wprintf(L"Failed to open archive %hs\n", archivePath ? archivePath : "(--archive FILE missing)");
+            return 1;
+        }
+        BOOL converted = ArchiveWriter_AppendJournal(&g_archive, archiveJournal);
+        converted = ArchiveWriter_Close(&g_archive) && converted;
+        wprintf(L"Archive: %llu values in %ld series from journal %hs%ls\n", g_archive.values,
+                g_archive.streamCount, archiveJournal, converted ? L"" : L" (incomplete)");
+        return converted ? 0 : 1;
+    }
+
+    // The server itself is created by RtdSession_Start, after COM is up
+    memset(&sessionConfig, 0, sizeof sessionConfig);
+    sessionConfig.factoryCtx = useSim ? &simConfig : NULL;
+    sessionConfig.shards = g_shardCount;
+    sessionConfig.shardPools = stringPoolBytes > 0 ? g_shardStrings : NULL;
+    sessionConfig.heartbeatMs = heartbeatMs;
+    sessionConfig.coalesceUs = coalesceUs;
+    sessionConfig.pollMode = g_pollMode;
+    sessionConfig.onBatch = OnBatch;
+    sessionConfig.onEvent = OnSupervisorEvent;
+    if (!RtdSession_Init(&g_session, &sessionConfig)) {
+        wprintf(L"Failed to create the RTD session: %d\n", GetLastError());
+        return 1;
+    }
     
     // Set up Ctrl+C handler
     SetConsoleCtrlHandler(ConsoleHandler, TRUE);
@@ -349,27 +1114,126 @@ int main(void)
 
     // Initialize thread safety for symbol changes
     InitializeCriticalSection(&symbolLock);
-    
-    // Prompt for initial symbol
-    char symbolInput[64];
-    wprintf(L"Enter stock symbol: ");
-    if (fgets(symbolInput, sizeof(symbolInput), stdin) == NULL) {
-        wprintf(L"Error reading input. Exiting.\n");
+
+    if (!QuoteStore_Init(&g_quotes, 1024) || !Analytics_Init(&g_analytics, &analyticsConfig, &g_quotes) ||
+        !OptionChains_Init(&g_chains, &g_quotes, chainMs) || !L1Assembler_Init(&g_l1, &g_quotes, l1StaleMs) ||
+        (g_barsOn && !BarBuilder_Init(&g_bars, &g_quotes, barIntervals, barCount, barGraceMs, RtdNowNs(),
+                                      RouteBar, subs)) ||
+        (g_staleOn && !StaleMonitor_Init(&g_stale, &staleConfig, RtdNowNs(), OnStale, subs))) {
+        wprintf(L"Failed to allocate subscription table\n");
         return 1;
     }
-    symbolInput[strcspn(symbolInput, "\r\n")] = 0;  // Remove newline
-    MultiByteToWideChar(CP_UTF8, 0, symbolInput, -1, currentSymbol, sizeof(currentSymbol)/sizeof(WCHAR));
-    
-    // Prompt for initial topic
-    char topicInput[32];
-    wprintf(L"Enter data topic (LAST, BID, ASK, etc): ");
-    if (fgets(topicInput, sizeof(topicInput), stdin) == NULL) {
-        wprintf(L"Error reading input. Exiting.\n");
+    subs->isLocalTopic = IsLocalTopic;
+    if (stringPoolBytes > 0) {
+        if (!RtdStringPool_Init(&g_strings, stringPoolBytes)) {
+            wprintf(L"Failed to allocate string pool\n");
+            return 1;
+        }
+        g_session.batch.strings = &g_strings;
+        for (int i = 0; i < g_shardCount && g_shardCount > 1; i++) {
+            if (!RtdStringPool_Init(&g_shardStrings[i], stringPoolBytes / g_shardCount)) {
+                wprintf(L"Failed to allocate string pool\n");
+                return 1;
+            }
+        }
+    }
+    // Each simulated shard generates its share of the rate
+    if (g_shardCount > 1) simConfig.updatesPerSec /= g_shardCount;
+
+    if (!OutputSink_Open(&g_sink, outPath, outLayout)) {
+        wprintf(L"Failed to open output %hs\n", outPath ? outPath : "-");
         return 1;
     }
-    topicInput[strcspn(topicInput, "\r\n")] = 0;  // Remove newline
-    MultiByteToWideChar(CP_UTF8, 0, topicInput, -1, currentTopic, sizeof(currentTopic)/sizeof(WCHAR));
+
+    if (journalPrefix) {
+        if (!Journal_Open(&g_journal, journalPrefix, journalMB << 20)) {
+            wprintf(L"Failed to open journal %hs\n", journalPrefix);
+            return 1;
+        }
+        g_journalOn = TRUE;
+    }
+    if (archivePath) {
+        if (!ArchiveWriter_Open(&g_archive, archivePath)) {
+            wprintf(L"Failed to open archive %hs\n", archivePath);
+            return 1;
+        }
+        g_archiveOn = TRUE;
+    }
+
+    if (shmName) {
+        if (!ShmWriter_Create(&g_shm, shmName, shmSlots)) {
+            wprintf(L"Failed to create shared memory %hs\n", shmName);
+            return 1;
+        }
+        g_shmOn = TRUE;
+    }
+
+    if (netConfig.port) {
+        if (!NetServer_Start(&g_net, &netConfig, subs, ConnectForNet, ReleaseForNet, subs, WakeForNet, NULL)) {
+            wprintf(L"Failed to listen on %hs:%u\n", netConfig.bindAddr ? netConfig.bindAddr : "127.0.0.1",
+                    netConfig.port);
+            return 1;
+        }
+        g_netOn = TRUE;
+        wprintf(L"Serving network clients on port %u\n", g_net.port);
+    }
+
+    // Start the output workers, one ring each
+    g_conflateOn = ConflateConfig_Active(&g_conflate);
+    for (int i = 0; i < g_workerCount; i++) {
+        g_workers[i].subs = subs;
+        if (!UpdateRing_Init(&g_workers[i].ring, ringSize, overflow) ||
+            !OutputWriter_Init(&g_workers[i].writer, &g_sink, 256 * 1024, flushMs, g_decimals) ||
+            (g_conflateOn && !Conflator_Init(&g_workers[i].conflator, &g_conflate)) ||
+            (g_l1On && !L1Ring_Init(&g_workers[i].quotes, ringSize)) ||
+            (g_barsOn && !BarRing_Init(&g_workers[i].bars, ringSize))) {
+            wprintf(L"Failed to allocate update ring\n");
+            return 1;
+        }
+        g_workers[i].thread = CreateThread(NULL, 0, OutputThreadProc, &g_workers[i], 0, NULL);
+        if (!g_workers[i].thread) {
+            wprintf(L"Failed to create output thread: %d\n", GetLastError());
+            return 1;
+        }
+    }
     
+    memset(&watchlist, 0, sizeof watchlist);
+    if (watchlistPath) {
+        // Headless start: the file names the symbols, and +SYM later uses
+        // the topics of its first line
+        if (!Watchlist_Load(&watchlist, watchlistPath) || watchlist.count == 0) {
+            wprintf(L"Failed to load watchlist %hs\n", watchlistPath);
+            return 1;
+        }
+        for (long i = 0; i < watchlist.count && watchlist.pairs[i].symbol == watchlist.pairs[0].symbol; i++) {
+            if (i > 0) wcscat_s(currentTopics, ARRAYSIZE(currentTopics), L",");
+            wcscat_s(currentTopics, ARRAYSIZE(currentTopics), watchlist.pairs[i].topic);
+        }
+    } else if (chainCount > 0 || g_netOn) {
+        // Headless start with only chains or network clients; +SYM later subscribes LAST
+        wcscpy_s(currentTopics, ARRAYSIZE(currentTopics), WATCHLIST_DEFAULT_TOPIC);
+    } else {
+        // Prompt for initial symbols
+        char symbolInput[256];
+        wprintf(L"Enter stock symbol(s): ");
+        if (fgets(symbolInput, sizeof(symbolInput), stdin) == NULL) {
+            wprintf(L"Error reading input. Exiting.\n");
+            return 1;
+        }
+        symbolInput[strcspn(symbolInput, "\r\n")] = 0;  // Remove newline
+        MultiByteToWideChar(CP_UTF8, 0, symbolInput, -1, pendingSymbols, ARRAYSIZE(pendingSymbols));
+
+        // Prompt for initial topics
+        char topicInput[256];
+        wprintf(L"Enter data topic(s) (LAST, BID, ASK, etc): ");
+        if (fgets(topicInput, sizeof(topicInput), stdin) == NULL) {
+            wprintf(L"Error reading input. Exiting.\n");
+            return 1;
+        }
+        topicInput[strcspn(topicInput, "\r\n")] = 0;  // Remove newline
+        MultiByteToWideChar(CP_UTF8, 0, topicInput, -1, currentTopics, ARRAYSIZE(currentTopics));
+    }
+
     // Create and start the input thread for symbol changes
     HANDLE inputThread = CreateThread(NULL, 0, InputThreadProc, NULL, 0, NULL);
     if (!inputThread) {
@@ -377,145 +1241,238 @@ int main(void)
         return 1;
     }
     
-    // Get the COM class for the RTD server
-    hr = CLSIDFromProgID(L"Tos.RTD", &clsid);
+    // Start the server (simulated or ThinkOrSwim)
+    hr = RtdSession_Start(&g_session);
     if (FAILED(hr)) {
-        wprintf(L"Failed to get RTD server CLSID: 0x%08X\n", hr);
-        wprintf(L"Make sure ThinkOrSwim is running and the RTD server is available\n");
-        goto cleanup;
-    }
-
-    // Create an instance of the RTD server
-    hr = CoCreateInstance(&clsid, NULL, CLSCTX_INPROC_SERVER,
-                        &IID_IRtdServer, (void**)&pSrv);
-    if (FAILED(hr)) {
-        wprintf(L"Failed to create RTD server instance: 0x%08X\n", hr);
-        goto cleanup;
-    }
-
-    // Create our callback and start the server
-    pCB = (IRTDUpdateEvent*)CreateCallback();
-    hr = pSrv->lpVtbl->ServerStart(pSrv, pCB, &(long){1000});
-    if (FAILED(hr)) {
-        wprintf(L"RTD server failed to start: 0x%08X\n", hr);
+        if (useSim) {
+            wprintf(L"Failed to create simulated server\n");
+        } else {
+            wprintf(L"Failed to create and start the RTD server: 0x%08X\n", hr);
+            wprintf(L"Make sure ThinkOrSwim is running and the RTD server is available\n");
+        }
         goto cleanup;
     }
+    pSrv = RtdSession_Server(&g_session);
     
     wprintf(L"\nRTD server connection established successfully\n");
 
-    // Connect to initial symbol
-    if (!ConnectToSymbol(pSrv, currentSymbol, &pArgs, &topicID)) {
+    // Connect to initial symbols
+    if (watchlistPath) {
+        ConnectWatchlist(pSrv, subs, &watchlist);
+        Watchlist_Free(&watchlist);
+    } else {
+        ApplySymbolCommand(pendingSymbols);
+    }
+    for (int i = 0; i < chainCount; i++) ConnectChain(pSrv, subs, &chainSpecs[i]);
+    if (subs->count == 0 && !g_netOn) {
         wprintf(L"Initial connection failed\n");
         goto cleanup;
     }
-      // Main event loop
-    while (running && !shouldExit) {
-        MSG msg;
-        while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
-            if (msg.message == WM_QUIT) {
-                running = FALSE;
-                break;
-            }
-            TranslateMessage(&msg);
-            DispatchMessage(&msg);
+
+#ifndef RTD_NO_METRICS
+    g_statsStartNs = g_statsLastNs = RtdNowNs();
+#endif
+
+    // Main event loop
+    while (!shouldExit) {
+        // Block until UpdateNotify, a window message or an input command,
+        // and wake for the next bar close too, not only for the server
+        DWORD waitMs = 250;
+        ULONGLONG dueNs = g_barsOn ? BarBuilder_NextCloseNs(&g_bars) : ~0ULL;
+        if (g_staleOn && StaleMonitor_NextDueNs(&g_stale) < dueNs) dueNs = StaleMonitor_NextDueNs(&g_stale);
+        if (dueNs != ~0ULL) {
+            ULONGLONG nowNs = RtdNowNs();
+            if (dueNs <= nowNs) waitMs = 0;
+            else if (dueNs - nowNs < 250000000ULL) waitMs = (DWORD)((dueNs - nowNs + 999999) / 1000000);
         }
+        if (!RtdSession_Wait(&g_session, waitMs)) break;
 
-        // Check if we need to reconnect with a different symbol
-        EnterCriticalSection(&symbolLock);
+#ifndef RTD_NO_METRICS
+        if (InterlockedExchange(&g_statsRequested, 0) ||
+            (g_statsIntervalNs && RtdNowNs() - g_statsLastNs >= g_statsIntervalNs)) {
+            DumpMetrics(FALSE);
+        }
+#endif
+
+        // Heartbeat, or reconnect and resubscribe while the server is gone
+        RtdSession_Tick(&g_session, RtdNowNs());
+        pSrv = RtdSession_Server(&g_session);
+
+        // Bars close on time whether or not rows are arriving
+        if (g_barsOn) BarBuilder_Advance(&g_bars, RtdNowNs());
+        if (g_staleOn) {
+            StaleMonitor_Advance(&g_stale, RtdNowNs());
+            EndStaleReport();
+        }
+        if (!pSrv) continue;
+
+        // Check if the input thread changed the watchlist
         if (shouldReconnect) {
-            if (wcslen(currentSymbol) > 0) {
-                wprintf(L"\nReconnecting with new symbol: %ls\n", currentSymbol);
-                if (ConnectToSymbol(pSrv, currentSymbol, &pArgs, &topicID)) {
-                    wprintf(L"Connected to symbol: %ls\n", currentSymbol);
-                } else {
-                    wprintf(L"Failed to connect to symbol: %ls\n", currentSymbol);
-                }
+            EnterCriticalSection(&symbolLock);
+            if (wcslen(pendingSymbols) > 0) {
+                wprintf(L"\nUpdating symbols: %ls\n", pendingSymbols);
+                ApplySymbolCommand(pendingSymbols);
             }
             shouldReconnect = FALSE;
+            LeaveCriticalSection(&symbolLock);
         }
-        LeaveCriticalSection(&symbolLock);
+
+        // Connect and release pairs for network clients
+        if (g_netOn) NetServer_Poll(&g_net);
+
+        // Hand any conflated updates to workers that caught up
+        for (int i = 0; i < g_workerCount; i++) UpdateRing_Flush(&g_workers[i].ring);
 
         // Pause the stream if shouldPause is set
-        if (shouldPause) {
-            Sleep(100); // Wait until user enters a new symbol
-            continue;
-        }
+        if (shouldPause) continue;
 
-        // Process RTD updates
-        if (InterlockedCompareExchange(&g_update_flag, 0, 1)) {
-            topicCount = 0;
-            hr = pSrv->lpVtbl->RefreshData(pSrv, &topicCount, &pOutArr);
-            
-            if (SUCCEEDED(hr) && pOutArr && topicCount > 0) {
-                // Process the data
-                if (pOutArr->cDims == 2) {
-                    LONG rowCount = pOutArr->rgsabound[0].cElements;
-                    LONG colCount = pOutArr->rgsabound[1].cElements;
-                    
-                    VARIANT *pData = NULL;
-                    hr = SafeArrayAccessData(pOutArr, (void**)&pData);
-                    
-                    if (SUCCEEDED(hr)) {
-                        // Get current timestamp for display
-                        SYSTEMTIME st;
-                        GetLocalTime(&st);
-                        
-                        // Process all elements that were updated
-                        for (int i = 0; i < min(rowCount, topicCount); i++) {
-                            // Get the topic ID from the first column
-                            if (pData[i*colCount].vt == VT_I4) {
-                                long rcvTopicID = pData[i*colCount].lVal;
-                                
-                                // If this is our topic ID, print the value
-                                if (rcvTopicID == topicID) {
-                                    // Get the value from the second column
-                                    VARIANT *value = &pData[i*colCount + 1];
-                                    WCHAR valueStr[128] = L"";
-                                    
-                                    // Format the value
-                                    FormatVariantValue(value, valueStr, ARRAYSIZE(valueStr));
-                                    
-                                    // Print update with timestamp
-                                    wprintf(L"[%02d:%02d:%02d.%03d] %ls = %ls\n", 
-                                            st.wHour, st.wMinute, st.wSecond, st.wMilliseconds,
-                                            currentSymbol, valueStr);
-                                }
-                            }
-                        }
-                        
-                        SafeArrayUnaccessData(pOutArr);
-                    }
-                }
-                
-                SafeArrayDestroy(pOutArr);
-                pOutArr = NULL;
-            }
-        }
-        
-        Sleep(100);  // Small sleep to avoid excessive CPU usage
+        // Fetch and decode RTD updates; OnBatch routes the rows. New
+        // subscriptions' initial values come without a notify and are not
+        // a wake or a RefreshData to time.
+        BOOL notified = g_session.updatePending != 0;
+        long rows = RtdSession_Refresh(&g_session);
+        if (notified && rows >= 0 && !g_pollMode) METRIC_RECORD(&g_metrics, METRIC_WAKE, g_session.wakeup.lastLatencyNs);
+        if (notified && rows > 0 && g_shardCount == 1) METRIC_RECORD(&g_metrics, METRIC_REFRESH, g_session.lastRefreshNs);
+        if (g_staleOn) EndStaleReport();
+
+        // Chain aggregates go out on their own cadence, not per batch
+        OptionChains_Publish(&g_chains, subs, RtdNowNs(), RouteUpdate, NULL);
+        if (g_netOn) NetServer_EndBatch(&g_net);
     }
 
 cleanup:
+    pSrv = RtdSession_Server(&g_session);
     wprintf(L"Cleaning up and exiting\n");
+
+    // Stop the output workers and report ring overflow
+    shouldExit = TRUE;
+    for (int i = 0; i < g_workerCount; i++) {
+        OutputWorker *w = &g_workers[i];
+        if (w->thread) {
+            WaitForSingleObject(w->thread, INFINITE);
+            CloseHandle(w->thread);
+        }
+        if (w->ring.dropped || w->ring.conflated || w->ring.blockedSpins) {
+            wprintf(L"Worker %d: %llu queued, %llu dropped, %llu conflated, %llu blocked spins, max depth %lld\n",
+                    i, w->ring.pushed, w->ring.dropped, w->ring.conflated,
+                    w->ring.blockedSpins, w->ring.maxDepth);
+        }
+        if (g_conflateOn) {
+            Conflator *c = &w->conflator;
+            wprintf(L"Worker %d: %llu offered, %llu printed, %llu coalesced, %llu within epsilon, %ld held\n",
+                    i, c->offered, c->emitted, c->coalesced, c->absorbed, c->held);
+            Conflator_Free(c);
+        }
+        if (w->quotes.dropped) {
+            wprintf(L"Worker %d: %llu L1 events dropped while the worker was behind\n", i, w->quotes.dropped);
+        }
+        if (w->bars.dropped) {
+            wprintf(L"Worker %d: %llu bars dropped while the worker was behind\n", i, w->bars.dropped);
+        }
+        UpdateRing_Free(&w->ring);
+        L1Ring_Free(&w->quotes);
+        BarRing_Free(&w->bars);
+        OutputWriter_Free(&w->writer);
+    }
+    OutputSink_Close(&g_sink);
+#ifndef RTD_NO_METRICS
+    if (g_metrics.hist[METRIC_BATCH_ROWS].count > 0) DumpMetrics(TRUE);
+#endif
+
+    // Stop serving before the teardown below, so no pair is retained
+    if (g_netOn) {
+        NetServer_Stop(&g_net);
+        g_netOn = FALSE;
+        wprintf(L"Network: %llu clients, %llu pairs connected for them, %llu shared, %llu refused, %llu released\n",
+                g_net.accepted, g_net.connects, g_net.shared, g_net.refused, g_net.releases);
+        wprintf(L"  %llu frames, %.1f MB sent, %llu conflated for slow clients, %llu datagrams\n",
+                g_net.framesSent, g_net.bytesSent / 1e6, g_net.conflated, g_net.datagrams);
+    }
     
-    // Disconnect data if connected
-    if (pArgs) {
-        pSrv->lpVtbl->DisconnectData(pSrv, topicID);
-        SafeArrayDestroy(pArgs);
-        pArgs = NULL;
+    // Disconnect all subscriptions
+    if (pSrv) UnsubscribeSymbol(NULL);
+    wprintf(L"Allocations: %llu for ConnectData arguments", subs->argAllocs);
+    if (g_session.batch.strings) {
+        wprintf(L"; string values: %ld interned in %.1f KB, %llu shared, %llu copied",
+                g_strings.count, g_strings.arena.bytes / 1024.0, g_strings.hits, g_strings.copies);
+    }
+    wprintf(L"\n");
+    if (g_analytics.emitted > 0) {
+        wprintf(L"Analytics: %llu trades, %llu derived updates\n", g_analytics.trades, g_analytics.emitted);
+    }
+    Analytics_Free(&g_analytics);
+    if (g_chains.count > 0) {
+        wprintf(L"Chains: %llu contract updates, %llu aggregate updates published, %llu resums\n",
+                g_chains.applied, g_chains.published, g_chains.resums);
+    }
+    OptionChains_Free(&g_chains);
+    if (g_l1.events > 0) {
+        wprintf(L"L1: %llu rows in %llu events, %llu crossed, %llu locked, %llu stale\n",
+                g_l1.rows, g_l1.events, g_l1.crossed, g_l1.locked, g_l1.stale);
+    }
+    L1Assembler_Free(&g_l1);
+    if (g_barsOn) {
+        wprintf(L"Bars: %llu closed from %llu rows, %llu rows in grace, %llu too late, %llu closed early, "
+                L"%llu volume resets, worst close %.1f ms past grace\n", g_bars.bars, g_bars.rows, g_bars.late,
+                g_bars.dropped, g_bars.early, g_bars.volumeResets, g_bars.maxCloseLagNs / 1e6);
+        BarBuilder_Free(&g_bars);
+    }
+    if (g_staleOn) {
+        wprintf(L"Staleness: %ld topics watched, %llu went stale, %llu recovered (longest gap %.1f s), "
+                L"%ld stale now, %ld never updated\n", g_stale.tracked, g_stale.staleEvents, g_stale.recoveries,
+                g_stale.maxSilentNs / 1e9, g_stale.staleNow, StaleMonitor_NeverUpdated(&g_stale));
+        StaleMonitor_Free(&g_stale);
+    }
+    QuoteStore_Free(&g_quotes);
+    RtdStringPool_Free(&g_strings);   // Workers and the hub are stopped
+
+    if (g_journalOn) {
+        wprintf(L"Journal: %llu records in %u file(s)\n", g_journal.recordsWritten, g_journal.fileIndex);
+        Journal_Close(&g_journal);
+        g_journalOn = FALSE;
+    }
+    if (g_archiveOn) {
+        // Written only now: the index, and each series' last block
+        g_archiveOn = FALSE;
+        BOOL written = ArchiveWriter_Close(&g_archive);
+        wprintf(L"Archive: %llu values in %llu bytes%ls\n", g_archive.values, g_archive.offset,
+                written ? L"" : L" (write failed)");
+    }
+
+    if (g_shmOn) {
+        wprintf(L"Shared memory: %llu values published, %llu skipped\n", g_shm.published, g_shm.skipped);
+        ShmWriter_Destroy(&g_shm);
+        g_shmOn = FALSE;
     }
     
     // Terminate RTD server
-    if (pSrv) {
-        pSrv->lpVtbl->ServerTerminate(pSrv);
-        pSrv->lpVtbl->Release(pSrv);
+    if (g_session.supervisor.incidents > 0) {
+        wprintf(L"Server lost %u time(s), max data gap %.1f ms\n",
+                g_session.supervisor.incidents, g_session.supervisor.maxGapNs / 1e6);
     }
+    if (g_shardCount > 1 && pSrv) {
+        for (int i = 0; i < g_shardCount; i++) {
+            ShardStats st;
+            ShardServer_GetStats(pSrv, i, &st);
+            wprintf(L"Shard %d: %llu rows in %llu refreshes (max %llu), %llu connects (%llu failed), "
+                    L"%llu disconnects, %llu blocked spins\n", i, st.rows, st.refreshes, st.maxRows,
+                    st.connects, st.connectFailed, st.disconnects, st.blockedSpins);
+        }
+    }
+    RtdSession_Stop(&g_session);
+
+    // The shard threads are joined; their string values are no longer queued
+    for (int i = 0; i < g_shardCount && g_shardCount > 1; i++) RtdStringPool_Free(&g_shardStrings[i]);
     
-    // Release callback
-    if (pCB) pCB->lpVtbl->Release(pCB);
-    
+    if (!g_pollMode && g_session.wakeup.wakeCount > 0) {
+        wprintf(L"Notify-to-refresh latency: avg %.1f us, max %.1f us over %llu wakeups\n",
+                g_session.wakeup.totalLatencyNs / 1000.0 / g_session.wakeup.wakeCount,
+                g_session.wakeup.maxLatencyNs / 1000.0, g_session.wakeup.wakeCount);
+    }
+
     // Clean up thread resources
     DeleteCriticalSection(&symbolLock);
+    RtdSession_Free(&g_session);
     
     CoUninitialize();
     return 0;
@@ -4,8 +4,7 @@
 #ifndef __RTD_CLIENT_H__
 #define __RTD_CLIENT_H__
 
-#include <windows.h>
-#include <oaidl.h>  // For IDispatch, VARIANT, etc.
+#include "rtd_compat.h"  // windows.h/oaidl.h, or portable stand-ins
 
 // Forward declarations
 typedef struct IRtdServer IRtdServer;
@@ -18,23 +17,19 @@ extern const IID IID_IRtdServer;
 extern const IID IID_IRTDUpdateEvent;
 extern const IID LIBID_RTDServerLib;
 
-// Callback structure definition (forward declaration of vtable)
-typedef struct MyCallback {
-    IRTDUpdateEventVtbl *lpVtbl;
-    LONG                refCount;
-} MyCallback;
-
-// Topic subscription structure
+// Topic subscription structure (one per symbol x topic pair)
 typedef struct {
-    SAFEARRAY* pArgs;
-    long topicID;
-    WCHAR symbol[64];
-    WCHAR topic[32];
+    long topicID;       // ID passed to ConnectData, 0 when the slot is free
+    BOOL connected;     // ConnectData succeeded and not yet disconnected
+    BOOL local;         // Computed by the client (rtd_analytics), never sent to the server
+    const WCHAR *symbol;// Interned copies owned by the SubscriptionTable
+    const WCHAR *topic;
+    long symbolID;      // Interned symbol and topic IDs
+    long fieldID;
+    void *userData;     // Owner-defined per-subscription context
 } TopicSubscription;
 
 // Function declarations
-MyCallback* CreateCallback(void);
-BOOL ConnectToSymbol(IRtdServer *pSrv, WCHAR *symbol, SAFEARRAY **ppArgs, long *pTopicID);
 void FormatVariantValue(VARIANT *value, WCHAR *buffer, size_t bufferSize);
 
 // IRtdServer vtable definition
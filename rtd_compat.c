@@ -0,0 +1,415 @@
+/**
+ * rtd_compat.c - Portability layer for the RTD client core
+ *
+ * Minimal OLE automation stand-ins for non-Windows builds, plus clocks
+ * and small helpers shared by every platform.
+ */
+
+#include <stdlib.h>
+#include "rtd_compat.h"
+
+size_t RtdWideToUtf8(const WCHAR *src, size_t srcLen, char *dst, size_t dstCap)
+{
+    size_t out = 0;
+    for (size_t i = 0; i < srcLen; i++) {
+        uint32_t c = (uint32_t)src[i];
+
+        // Join UTF-16 surrogate pairs
+        if (c >= 0xD800 && c <= 0xDBFF && i + 1 < srcLen &&
+            (uint32_t)src[i + 1] >= 0xDC00 && (uint32_t)src[i + 1] <= 0xDFFF) {
+            c = 0x10000 + ((c - 0xD800) << 10) + ((uint32_t)src[i + 1] - 0xDC00);
+            i++;
+        }
+
+        if (c < 0x80) {
+            if (out + 1 > dstCap) break;
+            dst[out++] = (char)c;
+        } else if (c < 0x800) {
+            if (out + 2 > dstCap) break;
+            dst[out++] = (char)(0xC0 | (c >> 6));
+            dst[out++] = (char)(0x80 | (c & 0x3F));
+        } else if (c < 0x10000) {
+            if (out + 3 > dstCap) break;
+            dst[out++] = (char)(0xE0 | (c >> 12));
+            dst[out++] = (char)(0x80 | ((c >> 6) & 0x3F));
+            dst[out++] = (char)(0x80 | (c & 0x3F));
+        } else {
+            if (out + 4 > dstCap) break;
+            dst[out++] = (char)(0xF0 | (c >> 18));
+            dst[out++] = (char)(0x80 | ((c >> 12) & 0x3F));
+            dst[out++] = (char)(0x80 | ((c >> 6) & 0x3F));
+            dst[out++] = (char)(0x80 | (c & 0x3F));
+        }
+    }
+    return out;
+}
+
+size_t RtdUtf8ToWide(const char *src, size_t srcLen, WCHAR *dst, size_t dstCap)
+{
+    size_t out = 0;
+    const unsigned char *p = (const unsigned char*)src;
+    const unsigned char *end = p + srcLen;
+
+    while (p < end) {
+        uint32_t c = *p++;
+        int extra = 0;
+        if (c >= 0xF8)      { c = 0xFFFD; }
+        else if (c >= 0xF0) { c &= 0x07; extra = 3; }
+        else if (c >= 0xE0) { c &= 0x0F; extra = 2; }
+        else if (c >= 0xC0) { c &= 0x1F; extra = 1; }
+        else if (c >= 0x80) { c = 0xFFFD; }
+
+        for (; extra > 0; extra--) {
+            if (p >= end || (*p & 0xC0) != 0x80) {
+                c = 0xFFFD;
+                break;
+            }
+            c = (c << 6) | (*p++ & 0x3F);
+        }
+
+        if (c >= 0x10000 && sizeof(WCHAR) == 2) {
+            if (out + 2 > dstCap) break;
+            c -= 0x10000;
+            dst[out++] = (WCHAR)(0xD800 + (c >> 10));
+            dst[out++] = (WCHAR)(0xDC00 + (c & 0x3FF));
+        } else {
+            if (out + 1 > dstCap) break;
+            dst[out++] = (WCHAR)c;
+        }
+    }
+    return out;
+}
+
+#ifdef _WIN32
+
+typedef struct ThreadStart {
+    RtdThreadProc proc;
+    void         *arg;
+} ThreadStart;
+
+static DWORD WINAPI ThreadTrampoline(LPVOID lpParam)
+{
+    ThreadStart start = *(ThreadStart*)lpParam;
+    free(lpParam);
+    start.proc(start.arg);
+    return 0;
+}
+
+BOOL RtdThread_Start(RtdThread *t, RtdThreadProc proc, void *arg)
+{
+    ThreadStart *start = (ThreadStart*)malloc(sizeof *start);
+    if (!start) return FALSE;
+    start->proc = proc;
+    start->arg = arg;
+    *t = CreateThread(NULL, 0, ThreadTrampoline, start, 0, NULL);
+    if (!*t) {
+        free(start);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void RtdThread_Join(RtdThread *t)
+{
+    WaitForSingleObject(*t, INFINITE);
+    CloseHandle(*t);
+    *t = NULL;
+}
+
+void RtdMutex_Init(RtdMutex *m)   { InitializeCriticalSection(m); }
+void RtdMutex_Free(RtdMutex *m)   { DeleteCriticalSection(m); }
+void RtdMutex_Lock(RtdMutex *m)   { EnterCriticalSection(m); }
+void RtdMutex_Unlock(RtdMutex *m) { LeaveCriticalSection(m); }
+
+void RtdSleepMs(DWORD ms)
+{
+    Sleep(ms);
+}
+
+void RtdYield(void)
+{
+    SwitchToThread();
+}
+
+/**
+ * Monotonic clock in nanoseconds based on QueryPerformanceCounter
+ */
+ULONGLONG RtdNowNs(void)
+{
+    static LONGLONG freq = 0;
+    LARGE_INTEGER now;
+    if (freq == 0) {
+        LARGE_INTEGER f;
+        QueryPerformanceFrequency(&f);
+        freq = f.QuadPart;
+    }
+    QueryPerformanceCounter(&now);
+    // Split to avoid overflowing 64 bits on long uptimes
+    return (ULONGLONG)(now.QuadPart / freq) * 1000000000ULL +
+           (ULONGLONG)(now.QuadPart % freq) * 1000000000ULL / (ULONGLONG)freq;
+}
+
+ULONGLONG RtdWallNs(void)
+{
+    FILETIME ft;
+    ULARGE_INTEGER t;
+    GetSystemTimeAsFileTime(&ft);
+    t.LowPart  = ft.dwLowDateTime;
+    t.HighPart = ft.dwHighDateTime;
+    // FILETIME counts 100 ns ticks since 1601-01-01
+    return (t.QuadPart - 116444736000000000ULL) * 100ULL;
+}
+
+#else /* !_WIN32 */
+
+#include <sched.h>
+#include <time.h>
+
+const IID IID_IUnknown  = { 0x00000000, 0x0000, 0x0000, { 0xC0, 0, 0, 0, 0, 0, 0, 0x46 } };
+const IID IID_IDispatch = { 0x00020400, 0x0000, 0x0000, { 0xC0, 0, 0, 0, 0, 0, 0, 0x46 } };
+
+typedef struct ThreadStart {
+    RtdThreadProc proc;
+    void         *arg;
+} ThreadStart;
+
+static void* ThreadTrampoline(void *param)
+{
+    ThreadStart start = *(ThreadStart*)param;
+    free(param);
+    start.proc(start.arg);
+    return NULL;
+}
+
+BOOL RtdThread_Start(RtdThread *t, RtdThreadProc proc, void *arg)
+{
+    ThreadStart *start = (ThreadStart*)malloc(sizeof *start);
+    if (!start) return FALSE;
+    start->proc = proc;
+    start->arg = arg;
+    if (pthread_create(t, NULL, ThreadTrampoline, start) != 0) {
+        free(start);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void RtdThread_Join(RtdThread *t)
+{
+    pthread_join(*t, NULL);
+}
+
+void RtdMutex_Init(RtdMutex *m)   { pthread_mutex_init(m, NULL); }
+void RtdMutex_Free(RtdMutex *m)   { pthread_mutex_destroy(m); }
+void RtdMutex_Lock(RtdMutex *m)   { pthread_mutex_lock(m); }
+void RtdMutex_Unlock(RtdMutex *m) { pthread_mutex_unlock(m); }
+
+void RtdSleepMs(DWORD ms)
+{
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+}
+
+void RtdYield(void)
+{
+    sched_yield();
+}
+
+/**
+ * Monotonic clock in nanoseconds based on CLOCK_MONOTONIC
+ */
+ULONGLONG RtdNowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ULONGLONG)ts.tv_sec * 1000000000ULL + (ULONGLONG)ts.tv_nsec;
+}
+
+ULONGLONG RtdWallNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (ULONGLONG)ts.tv_sec * 1000000000ULL + (ULONGLONG)ts.tv_nsec;
+}
+
+static volatile LONGLONG g_oleAllocs;
+
+LONGLONG RtdOleAllocCount(void)
+{
+    return __atomic_load_n(&g_oleAllocs, __ATOMIC_RELAXED);
+}
+
+static inline void CountOleAlloc(LONGLONG n)
+{
+    __atomic_add_fetch(&g_oleAllocs, n, __ATOMIC_RELAXED);
+}
+
+/**
+ * BSTRs are length-prefixed: a 32-bit byte count sits just before the
+ * character data, which is also NUL terminated.
+ */
+BSTR SysAllocStringLen(const OLECHAR *pch, UINT len)
+{
+    size_t bytes = (size_t)len * sizeof(OLECHAR);
+    uint32_t *block = (uint32_t*)malloc(sizeof(uint32_t) + bytes + sizeof(OLECHAR));
+    if (!block) return NULL;
+    CountOleAlloc(1);
+    block[0] = (uint32_t)bytes;
+    BSTR str = (BSTR)(block + 1);
+    if (pch) memcpy(str, pch, bytes);
+    else memset(str, 0, bytes);
+    str[len] = 0;
+    return str;
+}
+
+BSTR SysAllocString(const OLECHAR *psz)
+{
+    if (!psz) return NULL;
+    return SysAllocStringLen(psz, (UINT)wcslen(psz));
+}
+
+void SysFreeString(BSTR bstr)
+{
+    if (bstr) free((uint32_t*)bstr - 1);
+}
+
+UINT SysStringLen(BSTR bstr)
+{
+    return bstr ? ((uint32_t*)bstr)[-1] / sizeof(OLECHAR) : 0;
+}
+
+void VariantInit(VARIANT *pvarg)
+{
+    memset(pvarg, 0, sizeof *pvarg);
+    pvarg->vt = VT_EMPTY;
+}
+
+HRESULT VariantClear(VARIANT *pvarg)
+{
+    if (pvarg->vt == VT_BSTR) SysFreeString(pvarg->bstrVal);
+    VariantInit(pvarg);
+    return S_OK;
+}
+
+HRESULT VariantCopy(VARIANT *pvargDest, const VARIANT *pvargSrc)
+{
+    if (pvargDest == pvargSrc) return S_OK;
+    VariantClear(pvargDest);
+    *pvargDest = *pvargSrc;
+    if (pvargSrc->vt == VT_BSTR && pvargSrc->bstrVal) {
+        pvargDest->bstrVal = SysAllocStringLen(pvargSrc->bstrVal, SysStringLen(pvargSrc->bstrVal));
+        if (!pvargDest->bstrVal) {
+            VariantInit(pvargDest);
+            return E_OUTOFMEMORY;
+        }
+    }
+    return S_OK;
+}
+
+/**
+ * Only VT_VARIANT arrays are supported, which is all RTD ever uses.
+ * rgsabound is passed left-most dimension first and stored reversed.
+ */
+SAFEARRAY *SafeArrayCreate(VARTYPE vt, UINT cDims, SAFEARRAYBOUND *rgsabound)
+{
+    if (vt != VT_VARIANT || cDims == 0) return NULL;
+
+    size_t count = 1;
+    for (UINT d = 0; d < cDims; d++) count *= rgsabound[d].cElements;
+
+    SAFEARRAY *psa = (SAFEARRAY*)calloc(1, sizeof(SAFEARRAY) + (cDims - 1) * sizeof(SAFEARRAYBOUND));
+    if (!psa) return NULL;
+    psa->cDims = (USHORT)cDims;
+    psa->cbElements = sizeof(VARIANT);
+    for (UINT d = 0; d < cDims; d++) psa->rgsabound[d] = rgsabound[cDims - 1 - d];
+
+    psa->pvData = calloc(count ? count : 1, sizeof(VARIANT));
+    if (!psa->pvData) {
+        free(psa);
+        return NULL;
+    }
+    CountOleAlloc(2);
+    return psa;
+}
+
+static size_t SafeArrayCount(const SAFEARRAY *psa)
+{
+    size_t count = 1;
+    for (USHORT d = 0; d < psa->cDims; d++) count *= psa->rgsabound[d].cElements;
+    return count;
+}
+
+HRESULT SafeArrayDestroy(SAFEARRAY *psa)
+{
+    if (!psa) return S_OK;
+    VARIANT *data = (VARIANT*)psa->pvData;
+    size_t count = SafeArrayCount(psa);
+    for (size_t i = 0; i < count; i++) VariantClear(&data[i]);
+    free(psa->pvData);
+    free(psa);
+    return S_OK;
+}
+
+/**
+ * Convert an index vector (left-most dimension first) to a flat offset
+ */
+static HRESULT SafeArrayOffset(const SAFEARRAY *psa, const LONG *rgIndices, size_t *pOffset)
+{
+    size_t offset = 0, stride = 1;
+    for (USHORT d = 0; d < psa->cDims; d++) {
+        const SAFEARRAYBOUND *b = &psa->rgsabound[psa->cDims - 1 - d];
+        LONG idx = rgIndices[d] - b->lLbound;
+        if (idx < 0 || (ULONG)idx >= b->cElements) return E_INVALIDARG;
+        offset += (size_t)idx * stride;
+        stride *= b->cElements;
+    }
+    *pOffset = offset;
+    return S_OK;
+}
+
+HRESULT SafeArrayPutElement(SAFEARRAY *psa, LONG *rgIndices, void *pv)
+{
+    size_t offset;
+    HRESULT hr = SafeArrayOffset(psa, rgIndices, &offset);
+    if (FAILED(hr)) return hr;
+    return VariantCopy(&((VARIANT*)psa->pvData)[offset], (const VARIANT*)pv);
+}
+
+HRESULT SafeArrayGetElement(SAFEARRAY *psa, LONG *rgIndices, void *pv)
+{
+    size_t offset;
+    HRESULT hr = SafeArrayOffset(psa, rgIndices, &offset);
+    if (FAILED(hr)) return hr;
+    VariantInit((VARIANT*)pv);
+    return VariantCopy((VARIANT*)pv, &((VARIANT*)psa->pvData)[offset]);
+}
+
+HRESULT SafeArrayAccessData(SAFEARRAY *psa, void **ppvData)
+{
+    if (!psa || !ppvData) return E_INVALIDARG;
+    psa->cLocks++;
+    *ppvData = psa->pvData;
+    return S_OK;
+}
+
+HRESULT SafeArrayUnaccessData(SAFEARRAY *psa)
+{
+    if (!psa || psa->cLocks == 0) return E_UNEXPECTED;
+    psa->cLocks--;
+    return S_OK;
+}
+
+void *CoTaskMemAlloc(size_t cb)
+{
+    CountOleAlloc(1);
+    return malloc(cb);
+}
+
+void CoTaskMemFree(void *pv)
+{
+    free(pv);
+}
+
+#endif /* _WIN32 */
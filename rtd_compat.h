@@ -0,0 +1,312 @@
+// rtd_compat.h - Portability layer for the RTD client core
+// On Windows this pulls in the real COM/OLE headers. Everywhere else it
+// provides plain-C stand-ins for the handful of OLE types and helpers the
+// portable modules use (VARIANT, SAFEARRAY, BSTR, ...) so the dispatch core
+// can be built and load-tested on Linux against a fake IRtdServer.
+
+#ifndef __RTD_COMPAT_H__
+#define __RTD_COMPAT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+
+#include <windows.h>
+#include <oaidl.h>
+#include <oleauto.h>
+
+#else /* !_WIN32 */
+
+#include <string.h>
+#include <wchar.h>
+
+// Basic Win32 types
+typedef int             BOOL;
+typedef uint8_t         BYTE;
+typedef uint16_t        WORD;
+typedef uint32_t        DWORD;
+typedef uint16_t        USHORT;
+typedef int32_t         LONG;
+typedef uint32_t        ULONG;
+typedef uint32_t        UINT;
+typedef long long       LONGLONG;
+typedef unsigned long long ULONGLONG;
+typedef int32_t         HRESULT;
+typedef void           *PVOID;
+typedef void           *HANDLE;
+typedef wchar_t         WCHAR;
+typedef WCHAR           OLECHAR;
+typedef OLECHAR        *LPOLESTR;
+typedef OLECHAR        *BSTR;
+typedef DWORD           LCID;
+typedef LONG            DISPID;
+typedef USHORT          VARTYPE;
+typedef short           VARIANT_BOOL;
+
+#ifndef TRUE
+#define TRUE  1
+#define FALSE 0
+#endif
+
+#define STDMETHODCALLTYPE
+#define WINAPI
+
+#define S_OK            ((HRESULT)0)
+#define S_FALSE         ((HRESULT)1)
+#define E_NOTIMPL       ((HRESULT)0x80004001)
+#define E_NOINTERFACE   ((HRESULT)0x80004002)
+#define E_POINTER       ((HRESULT)0x80004003)
+#define E_FAIL          ((HRESULT)0x80004005)
+#define E_UNEXPECTED    ((HRESULT)0x8000FFFF)
+#define E_OUTOFMEMORY   ((HRESULT)0x8007000E)
+#define E_INVALIDARG    ((HRESULT)0x80070057)
+#define RPC_E_DISCONNECTED ((HRESULT)0x80010108)
+#define SUCCEEDED(hr)   (((HRESULT)(hr)) >= 0)
+#define FAILED(hr)      (((HRESULT)(hr)) < 0)
+
+#define VARIANT_TRUE    ((VARIANT_BOOL)-1)
+#define VARIANT_FALSE   ((VARIANT_BOOL)0)
+
+#ifndef ARRAYSIZE
+#define ARRAYSIZE(a)    (sizeof(a) / sizeof((a)[0]))
+#endif
+
+// GUIDs
+typedef struct GUID {
+    uint32_t Data1;
+    uint16_t Data2;
+    uint16_t Data3;
+    uint8_t  Data4[8];
+} GUID;
+typedef GUID IID;
+typedef GUID CLSID;
+typedef const IID *REFIID;
+
+#define IsEqualIID(a, b) (memcmp((a), (b), sizeof(IID)) == 0)
+
+#ifdef INITGUID
+#define DEFINE_GUID(name, l, w1, w2, b1, b2, b3, b4, b5, b6, b7, b8) \
+    const GUID name = { l, w1, w2, { b1, b2, b3, b4, b5, b6, b7, b8 } }
+#else
+#define DEFINE_GUID(name, l, w1, w2, b1, b2, b3, b4, b5, b6, b7, b8) \
+    extern const GUID name
+#endif
+
+extern const IID IID_IUnknown;
+extern const IID IID_IDispatch;
+
+// Opaque IDispatch plumbing that the vtables only pass through
+typedef struct ITypeInfo  ITypeInfo;
+typedef struct DISPPARAMS DISPPARAMS;
+typedef struct EXCEPINFO  EXCEPINFO;
+
+// VARIANT subset used by RTD
+enum {
+    VT_EMPTY = 0,
+    VT_NULL  = 1,
+    VT_I2    = 2,
+    VT_I4    = 3,
+    VT_R4    = 4,
+    VT_R8    = 5,
+    VT_DATE  = 7,
+    VT_BSTR  = 8,
+    VT_ERROR = 10,
+    VT_BOOL  = 11,
+    VT_VARIANT = 12,
+    VT_I8    = 20
+};
+
+typedef struct VARIANT {
+    VARTYPE vt;
+    WORD    wReserved1;
+    WORD    wReserved2;
+    WORD    wReserved3;
+    union {
+        LONGLONG     llVal;
+        LONG         lVal;
+        short        iVal;
+        float        fltVal;
+        double       dblVal;
+        double       date;
+        VARIANT_BOOL boolVal;
+        HRESULT      scode;
+        BSTR         bstrVal;
+        void        *byref;
+    };
+} VARIANT;
+
+// SAFEARRAY. As on Windows, rgsabound[] is stored right-most dimension
+// first, so a 2 x N RefreshData result has rgsabound[0].cElements == N.
+typedef struct SAFEARRAYBOUND {
+    ULONG cElements;
+    LONG  lLbound;
+} SAFEARRAYBOUND;
+
+typedef struct SAFEARRAY {
+    USHORT         cDims;
+    USHORT         fFeatures;
+    ULONG          cbElements;
+    ULONG          cLocks;
+    PVOID          pvData;
+    SAFEARRAYBOUND rgsabound[1];
+} SAFEARRAY;
+
+// OLE automation stand-ins (rtd_compat.c)
+BSTR      SysAllocString(const OLECHAR *psz);
+BSTR      SysAllocStringLen(const OLECHAR *pch, UINT len);
+void      SysFreeString(BSTR bstr);
+UINT      SysStringLen(BSTR bstr);
+void      VariantInit(VARIANT *pvarg);
+HRESULT   VariantClear(VARIANT *pvarg);
+HRESULT   VariantCopy(VARIANT *pvargDest, const VARIANT *pvargSrc);
+SAFEARRAY *SafeArrayCreate(VARTYPE vt, UINT cDims, SAFEARRAYBOUND *rgsabound);
+HRESULT   SafeArrayDestroy(SAFEARRAY *psa);
+HRESULT   SafeArrayPutElement(SAFEARRAY *psa, LONG *rgIndices, void *pv);
+HRESULT   SafeArrayGetElement(SAFEARRAY *psa, LONG *rgIndices, void *pv);
+HRESULT   SafeArrayAccessData(SAFEARRAY *psa, void **ppvData);
+HRESULT   SafeArrayUnaccessData(SAFEARRAY *psa);
+void     *CoTaskMemAlloc(size_t cb);
+void      CoTaskMemFree(void *pv);
+
+// Heap allocations made by the stand-ins above since startup; rtd_bench
+// samples it around a stage to report allocations per batch
+LONGLONG  RtdOleAllocCount(void);
+
+// Interlocked helpers
+#define InterlockedIncrement(p)      __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement(p)      __atomic_sub_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedExchange(p, v)    __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedExchange64(p, v)  __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+static inline LONG InterlockedCompareExchange(volatile LONG *dest, LONG exchange, LONG comparand)
+{
+    __atomic_compare_exchange_n(dest, &comparand, exchange, 0,
+                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return comparand;
+}
+
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+
+#endif /* _WIN32 */
+
+// Mutex and thread wrappers for the portable modules
+#ifdef _WIN32
+typedef CRITICAL_SECTION RtdMutex;
+typedef HANDLE           RtdThread;
+#else
+#include <pthread.h>
+typedef pthread_mutex_t  RtdMutex;
+typedef pthread_t        RtdThread;
+#endif
+
+void RtdMutex_Init(RtdMutex *m);
+void RtdMutex_Free(RtdMutex *m);
+void RtdMutex_Lock(RtdMutex *m);
+void RtdMutex_Unlock(RtdMutex *m);
+
+typedef void (*RtdThreadProc)(void *arg);
+BOOL RtdThread_Start(RtdThread *t, RtdThreadProc proc, void *arg);
+void RtdThread_Join(RtdThread *t);
+
+/**
+ * Sleep for at least ms milliseconds
+ */
+void RtdSleepMs(DWORD ms);
+
+// Cache line size used to pad data shared between threads
+#define RTD_CACHE_LINE 64
+
+// 64-bit acquire/release atomics for the lock-free structures
+#ifdef _MSC_VER
+#include <intrin.h>
+// x86/x64 loads and stores are already acquire/release; only stop the compiler
+static __forceinline LONGLONG RtdLoadAcquire64(volatile LONGLONG *p)
+{
+    LONGLONG v = *p;
+    _ReadWriteBarrier();
+    return v;
+}
+static __forceinline void RtdStoreRelease64(volatile LONGLONG *p, LONGLONG v)
+{
+    _ReadWriteBarrier();
+    *p = v;
+}
+static __forceinline BOOL RtdCas64(volatile LONGLONG *p, LONGLONG expected, LONGLONG desired)
+{
+    return _InterlockedCompareExchange64(p, desired, expected) == expected;
+}
+// Standalone fences for seqlocks; x86 only reorders stores after loads
+#define RtdFenceAcquire() _ReadWriteBarrier()
+#define RtdFenceRelease() _ReadWriteBarrier()
+#else
+static inline LONGLONG RtdLoadAcquire64(volatile LONGLONG *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+static inline void RtdStoreRelease64(volatile LONGLONG *p, LONGLONG v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+static inline BOOL RtdCas64(volatile LONGLONG *p, LONGLONG expected, LONGLONG desired)
+{
+    return __atomic_compare_exchange_n(p, &expected, desired, 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+#define RtdFenceAcquire() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define RtdFenceRelease() __atomic_thread_fence(__ATOMIC_RELEASE)
+#endif
+
+// Index of the highest set bit; v must not be 0
+#ifdef _MSC_VER
+static __forceinline int RtdMsb64(ULONGLONG v)
+{
+    unsigned long index;
+    _BitScanReverse64(&index, v);
+    return (int)index;
+}
+#else
+static inline int RtdMsb64(ULONGLONG v)
+{
+    return 63 - __builtin_clzll(v);
+}
+#endif
+
+// Hint that *p will be read soon
+#ifdef _MSC_VER
+#define RtdPrefetch(p) _mm_prefetch((const char*)(p), _MM_HINT_T0)
+#else
+#define RtdPrefetch(p) __builtin_prefetch(p)
+#endif
+
+/**
+ * Give up the rest of the time slice (SwitchToThread / sched_yield)
+ */
+void RtdYield(void);
+
+/**
+ * Monotonic clock in nanoseconds (QueryPerformanceCounter / CLOCK_MONOTONIC)
+ */
+ULONGLONG RtdNowNs(void);
+
+/**
+ * Wall clock in nanoseconds since the Unix epoch (UTC)
+ */
+ULONGLONG RtdWallNs(void);
+
+/**
+ * Encode srcLen wide characters (UTF-16 or UTF-32) as UTF-8. Writes at most
+ * dstCap bytes, never splits a character, and returns the bytes written.
+ * Does not NUL terminate.
+ */
+size_t RtdWideToUtf8(const WCHAR *src, size_t srcLen, char *dst, size_t dstCap);
+
+/**
+ * Decode srcLen bytes of UTF-8 into wide characters (UTF-16 on Windows).
+ * Writes at most dstCap characters, returns the count written, does not
+ * NUL terminate. Malformed bytes decode as U+FFFD.
+ */
+size_t RtdUtf8ToWide(const char *src, size_t srcLen, WCHAR *dst, size_t dstCap);
+
+#endif /* __RTD_COMPAT_H__ */
@@ -0,0 +1,238 @@
+/**
+ * rtd_conflate.c - Per-topic conflation and rate limiting
+ *
+ * A topic is FREE (may emit at once), WAITING (emitted less than an
+ * interval ago, possibly holding a newer value) or READY (interval over,
+ * holding a value, no rate token yet). Topics are appended to the
+ * waiting list as they emit, so the list is ordered by deadline and
+ * Drain only ever looks at its head.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtd_conflate.h"
+
+BOOL Conflator_Init(Conflator *c, const ConflateConfig *cfg)
+{
+    memset(c, 0, sizeof *c);
+    c->cfg = *cfg;
+
+    // Allow a burst of 50 ms worth of emits, and always at least one
+    if (cfg->maxPerSec > 0) {
+        c->burst = cfg->maxPerSec * 0.05;
+        if (c->burst < 1) c->burst = 1;
+        c->tokens = c->burst;
+    }
+    c->capacity = 1024;
+    c->topics = (ConflateTopic*)calloc(c->capacity, sizeof *c->topics);
+    return c->topics != NULL;
+}
+
+void Conflator_Free(Conflator *c)
+{
+    for (long i = 0; i < c->capacity; i++) {
+        if (c->topics[i].hasPending) RtdUpdate_Clear(&c->topics[i].pending);
+    }
+    free(c->topics);
+    memset(c, 0, sizeof *c);
+}
+
+/**
+ * Grow the topic table to hold topicID
+ */
+static BOOL EnsureTopic(Conflator *c, long topicID)
+{
+    if (topicID < c->capacity) return TRUE;
+
+    long newCap = c->capacity;
+    while (newCap <= topicID) newCap *= 2;
+    ConflateTopic *topics = (ConflateTopic*)realloc(c->topics, newCap * sizeof *topics);
+    if (!topics) return FALSE;
+    memset(topics + c->capacity, 0, (newCap - c->capacity) * sizeof *topics);
+    c->topics = topics;
+    c->capacity = newCap;
+    return TRUE;
+}
+
+static void ListAppend(Conflator *c, ConflateList *list, long id)
+{
+    ConflateTopic *t = &c->topics[id];
+    t->prev = list->tail;
+    t->next = 0;
+    if (list->tail) c->topics[list->tail].next = id;
+    else list->head = id;
+    list->tail = id;
+}
+
+static void ListRemove(Conflator *c, ConflateList *list, long id)
+{
+    ConflateTopic *t = &c->topics[id];
+    if (t->prev) c->topics[t->prev].next = t->next;
+    else list->head = t->next;
+    if (t->next) c->topics[t->next].prev = t->prev;
+    else list->tail = t->prev;
+    t->prev = t->next = 0;
+}
+
+/**
+ * Take a topic off whichever list it is on
+ */
+static void MakeFree(Conflator *c, long id)
+{
+    ConflateTopic *t = &c->topics[id];
+    if (t->state == CONFLATE_WAITING) ListRemove(c, &c->waiting, id);
+    else if (t->state == CONFLATE_READY) ListRemove(c, &c->ready, id);
+    t->state = CONFLATE_FREE;
+}
+
+static void DropPending(Conflator *c, ConflateTopic *t)
+{
+    if (!t->hasPending) return;
+    RtdUpdate_Clear(&t->pending);
+    t->hasPending = FALSE;
+    c->held--;
+}
+
+static BOOL NumericValue(const RtdUpdate *u, double *value)
+{
+    switch (u->vt) {
+        case VT_R8: case VT_R4: case VT_DATE:
+            *value = u->dblVal;
+            return TRUE;
+        case VT_BSTR: case VT_EMPTY:
+            return FALSE;
+        default:
+            *value = (double)u->llVal;
+            return TRUE;
+    }
+}
+
+static void Refill(Conflator *c, ULONGLONG nowNs)
+{
+    if (c->cfg.maxPerSec <= 0) return;
+    if (nowNs > c->refillNs) {
+        c->tokens += (double)(nowNs - c->refillNs) * c->cfg.maxPerSec * 1e-9;
+        if (c->tokens > c->burst) c->tokens = c->burst;
+    }
+    c->refillNs = nowNs;
+}
+
+static BOOL TakeToken(Conflator *c)
+{
+    if (c->cfg.maxPerSec <= 0) return TRUE;
+    if (c->tokens < 1) return FALSE;
+    c->tokens -= 1;
+    return TRUE;
+}
+
+/**
+ * Record that u is going out now and start the topic's interval
+ */
+static void MarkEmitted(Conflator *c, long id, const RtdUpdate *u, ULONGLONG nowNs)
+{
+    ConflateTopic *t = &c->topics[id];
+    double value;
+    if (NumericValue(u, &value)) {
+        t->lastValue = value;
+        t->hasEmitted = TRUE;
+    }
+    t->lastEmitNs = nowNs;
+    if (c->cfg.topicIntervalNs > 0) {
+        t->state = CONFLATE_WAITING;
+        ListAppend(c, &c->waiting, id);
+    }
+    c->emitted++;
+}
+
+BOOL Conflator_Offer(Conflator *c, RtdUpdate *u, ULONGLONG key, ULONGLONG nowNs)
+{
+    long id = u->topicID;
+    c->offered++;
+    if (id <= 0 || !EnsureTopic(c, id)) {
+        c->emitted++;
+        return TRUE;
+    }
+
+    ConflateTopic *t = &c->topics[id];
+    if (t->key != key) {
+        MakeFree(c, id);
+        DropPending(c, t);
+        t->hasEmitted = FALSE;
+        t->key = key;
+    }
+
+    // Back within epsilon of what was last shown: anything held is stale too
+    double value;
+    if (c->cfg.epsilon > 0 && t->hasEmitted && NumericValue(u, &value) &&
+        fabs(value - t->lastValue) <= c->cfg.epsilon) {
+        if (t->hasPending) {
+            DropPending(c, t);
+            if (t->state == CONFLATE_READY) MakeFree(c, id);
+            c->coalesced++;
+        }
+        RtdUpdate_Clear(u);
+        c->absorbed++;
+        return FALSE;
+    }
+
+    Refill(c, nowNs);
+    if (t->state == CONFLATE_WAITING && nowNs - t->lastEmitNs >= c->cfg.topicIntervalNs) {
+        MakeFree(c, id);
+        if (t->hasPending) {
+            DropPending(c, t);
+            c->coalesced++;
+        }
+    }
+    if (t->state == CONFLATE_FREE && TakeToken(c)) {
+        MarkEmitted(c, id, u, nowNs);
+        return TRUE;
+    }
+
+    // Hold the latest value until the topic or the bucket allows it out
+    if (t->hasPending) {
+        RtdUpdate_Clear(&t->pending);
+        c->coalesced++;
+    } else {
+        t->hasPending = TRUE;
+        c->held++;
+    }
+    t->pending = *u;
+    if (t->state == CONFLATE_FREE) {
+        t->state = CONFLATE_READY;
+        ListAppend(c, &c->ready, id);
+    }
+    return FALSE;
+}
+
+ULONG Conflator_Drain(Conflator *c, ULONGLONG nowNs, RtdUpdate *out, ULONG max)
+{
+    Refill(c, nowNs);
+
+    // Intervals that have run out: topics holding a value queue for a token
+    while (c->waiting.head &&
+           nowNs - c->topics[c->waiting.head].lastEmitNs >= c->cfg.topicIntervalNs) {
+        long id = c->waiting.head;
+        ConflateTopic *t = &c->topics[id];
+        ListRemove(c, &c->waiting, id);
+        t->state = CONFLATE_FREE;
+        if (t->hasPending) {
+            t->state = CONFLATE_READY;
+            ListAppend(c, &c->ready, id);
+        }
+    }
+
+    ULONG n = 0;
+    while (n < max && c->ready.head && TakeToken(c)) {
+        long id = c->ready.head;
+        ConflateTopic *t = &c->topics[id];
+        ListRemove(c, &c->ready, id);
+        t->state = CONFLATE_FREE;
+        out[n] = t->pending;
+        t->hasPending = FALSE;
+        c->held--;
+        MarkEmitted(c, id, &out[n], nowNs);
+        n++;
+    }
+    return n;
+}
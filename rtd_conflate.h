@@ -0,0 +1,77 @@
+// rtd_conflate.h - Per-topic conflation and rate limiting
+// Sits between an output worker's ring and its writer. Each topic emits
+// at most once per interval; what arrives in between replaces the held
+// value, so the next emit is always the latest one. A token bucket caps
+// the total emit rate of the worker, and an optional epsilon drops
+// numeric changes too small to be worth printing. Topics are tracked in
+// arrays indexed by topic ID and threaded onto two intrusive lists, so
+// every operation is O(1) no matter how many topics are held.
+
+#ifndef __RTD_CONFLATE_H__
+#define __RTD_CONFLATE_H__
+
+#include "rtd_compat.h"
+#include "rtd_ring.h"
+
+typedef struct ConflateConfig {
+    ULONGLONG topicIntervalNs;  // Minimum time between emits of one topic (0 = none)
+    double    maxPerSec;        // Emits per second across the conflator (0 = unlimited)
+    double    epsilon;          // Absorb numeric changes no larger than this (0 = off)
+} ConflateConfig;
+
+enum { CONFLATE_FREE = 0, CONFLATE_WAITING, CONFLATE_READY };
+
+typedef struct ConflateTopic {
+    RtdUpdate  pending;         // Latest value not yet emitted
+    ULONGLONG  key;             // Subscription identity; a change resets the topic
+    ULONGLONG  lastEmitNs;
+    double     lastValue;       // Last emitted value, for the epsilon rule
+    long       prev;            // Links in the waiting or ready list (0 = none)
+    long       next;
+    BYTE       state;
+    BYTE       hasPending;
+    BYTE       hasEmitted;
+} ConflateTopic;
+
+typedef struct ConflateList {
+    long head;
+    long tail;
+} ConflateList;
+
+typedef struct Conflator {
+    ConflateConfig cfg;
+    ConflateTopic *topics;
+    long           capacity;
+    ConflateList   waiting;     // Emitted within the interval, oldest emit first
+    ConflateList   ready;       // Interval passed with a value held, waiting for a token
+    double         tokens;
+    double         burst;
+    ULONGLONG      refillNs;
+
+    ULONGLONG      offered;
+    ULONGLONG      emitted;
+    ULONGLONG      coalesced;   // Held values replaced by a newer one
+    ULONGLONG      absorbed;    // Updates within epsilon of the last emit
+    long           held;        // Topics currently holding a value
+} Conflator;
+
+BOOL Conflator_Init(Conflator *c, const ConflateConfig *cfg);
+void Conflator_Free(Conflator *c);
+
+// TRUE when any limit is configured
+static inline BOOL ConflateConfig_Active(const ConflateConfig *cfg)
+{
+    return cfg->topicIntervalNs > 0 || cfg->maxPerSec > 0 || cfg->epsilon > 0;
+}
+
+// Returns TRUE if u should be emitted now (the caller keeps ownership).
+// FALSE means the conflator took u over: it is held for a later Drain or
+// was dropped. key identifies the subscription behind u->topicID so a
+// reused topic ID starts fresh.
+BOOL Conflator_Offer(Conflator *c, RtdUpdate *u, ULONGLONG key, ULONGLONG nowNs);
+
+// Move up to max held updates that are now due into out; the caller emits
+// them and must RtdUpdate_Clear each. Call after every batch and when idle.
+ULONG Conflator_Drain(Conflator *c, ULONGLONG nowNs, RtdUpdate *out, ULONG max);
+
+#endif /* __RTD_CONFLATE_H__ */
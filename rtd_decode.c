@@ -0,0 +1,241 @@
+/**
+ * rtd_decode.c - Columnar decode of RefreshData batches
+ *
+ * The all-VT_R8 path works in blocks: it copies a block unconditionally
+ * while OR-ing together how far each row's types are from (VT_I4, VT_R8),
+ * and only checks the result once per block. The first block that is not
+ * clean is redone, with every row after it, by DecodeMixed. With SSE2 it
+ * takes two rows per step: four 16-byte loads (type and value of each
+ * VARIANT) and one store per column.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "rtd_decode.h"
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DECODE_SSE2
+#endif
+
+// Rows copied between type checks on the all-VT_R8 path
+#define DECODE_BLOCK 64
+
+BOOL RtdBatch_Init(RtdBatch *b, long capacity)
+{
+    memset(b, 0, sizeof *b);
+    if (capacity < DECODE_BLOCK) capacity = DECODE_BLOCK;
+    b->topicID = (LONG*)malloc(capacity * sizeof *b->topicID);
+    b->vt = (VARTYPE*)malloc(capacity * sizeof *b->vt);
+    // RtdBatch_Update reads both value columns for every row
+    b->dbl = (double*)calloc(capacity, sizeof *b->dbl);
+    b->i64 = (LONGLONG*)calloc(capacity, sizeof *b->i64);
+    b->str = (BSTR*)malloc(capacity * sizeof *b->str);
+    if (!b->topicID || !b->vt || !b->dbl || !b->i64 || !b->str) {
+        RtdBatch_Free(b);
+        return FALSE;
+    }
+    b->capacity = capacity;
+    return TRUE;
+}
+
+void RtdBatch_Free(RtdBatch *b)
+{
+    free(b->topicID);
+    free(b->vt);
+    free(b->dbl);
+    free(b->i64);
+    free(b->str);
+    memset(b, 0, sizeof *b);
+}
+
+/**
+ * Grow every column to hold at least rows entries, keeping the rows
+ * already filled (RtdBatch_Append grows a batch as it goes)
+ */
+static BOOL Reserve(RtdBatch *b, long rows)
+{
+    if (rows <= b->capacity) return TRUE;
+    long cap = b->capacity;
+    while (cap < rows) cap *= 2;
+
+    RtdBatch grown;
+    if (!RtdBatch_Init(&grown, cap)) return FALSE;
+    memcpy(grown.topicID, b->topicID, b->rows * sizeof *b->topicID);
+    memcpy(grown.vt, b->vt, b->rows * sizeof *b->vt);
+    memcpy(grown.dbl, b->dbl, b->rows * sizeof *b->dbl);
+    memcpy(grown.i64, b->i64, b->rows * sizeof *b->i64);
+    memcpy(grown.str, b->str, b->strCount * sizeof *b->str);
+    grown.rows = b->rows;
+    grown.strCount = b->strCount;
+    grown.allR8 = b->allR8;
+    grown.fastBatches = b->fastBatches;
+    grown.slowBatches = b->slowBatches;
+    grown.strings = b->strings;
+    RtdBatch_Free(b);
+    *b = grown;
+    return TRUE;
+}
+
+/**
+ * Copy leading rows whose ID is VT_I4 and value VT_R8. Returns how many
+ * rows were decoded, always a multiple of DECODE_BLOCK or rows itself.
+ */
+static long DecodeR8Prefix(RtdBatch *b, const VARIANT *data, long rows, long colCount)
+{
+    LONG *ids = b->topicID;
+    VARTYPE *vt = b->vt;
+    double *dbl = b->dbl;
+    long start = 0;
+#ifdef DECODE_SSE2
+    static const VARTYPE r8Pair[2] = { VT_R8, VT_R8 };
+    // The low dword of each VARIANT's first 8 bytes holds vt: the ID's in
+    // lane 0, the value's in lane 2
+    const __m128i want = _mm_set_epi32(0, VT_R8, 0, VT_I4);
+    const __m128i typeBits = _mm_set_epi32(0, 0xFFFF, 0, 0xFFFF);
+#endif
+
+    while (start < rows) {
+        long end = rows - start > DECODE_BLOCK ? start + DECODE_BLOCK : rows;
+        ULONG mismatch = 0;
+        long i = start;
+#ifdef DECODE_SSE2
+        __m128i diff = _mm_setzero_si128();
+        for (; i + 2 <= end; i += 2) {
+            const VARIANT *row = &data[i * colCount];
+            __m128i id0 = _mm_loadu_si128((const __m128i*)&row[0]);
+            __m128i val0 = _mm_loadu_si128((const __m128i*)&row[1]);
+            __m128i id1 = _mm_loadu_si128((const __m128i*)&row[colCount]);
+            __m128i val1 = _mm_loadu_si128((const __m128i*)&row[colCount + 1]);
+            diff = _mm_or_si128(diff, _mm_xor_si128(_mm_unpacklo_epi64(id0, val0), want));
+            diff = _mm_or_si128(diff, _mm_xor_si128(_mm_unpacklo_epi64(id1, val1), want));
+            _mm_storel_epi64((__m128i*)&ids[i], _mm_unpackhi_epi32(id0, id1));
+            _mm_storeu_si128((__m128i*)&dbl[i], _mm_unpackhi_epi64(val0, val1));
+            memcpy(&vt[i], r8Pair, sizeof r8Pair);
+        }
+        diff = _mm_and_si128(diff, typeBits);
+        mismatch = _mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xFFFF;
+#endif
+        for (; i < end; i++) {
+            const VARIANT *row = &data[i * colCount];
+            mismatch |= (ULONG)(row[0].vt ^ VT_I4) | (ULONG)(row[1].vt ^ VT_R8);
+            ids[i] = row[0].lVal;
+            vt[i] = VT_R8;
+            dbl[i] = row[1].dblVal;
+        }
+        if (mismatch) break;
+        start = end;
+    }
+    return start;
+}
+
+// Value types DecodeMixed stores without a fix-up
+#define DECODE_DIRECT ((1ULL << VT_R8) | (1ULL << VT_DATE) | (1ULL << VT_I4) | \
+                       (1ULL << VT_ERROR) | (1ULL << VT_I8) | (1ULL << VT_BSTR))
+
+/**
+ * Mixed batches, still without a branch per row: every row writes its raw
+ * 8 value bytes to both dbl and i64 (sign-extending 32-bit integers) and
+ * its BSTR pointer to the next str slot, which only advances for strings.
+ * Returns nonzero if a row has a type outside DECODE_DIRECT.
+ */
+static ULONG DecodeMixed(RtdBatch *b, const VARIANT *data, long first, long rows, long colCount)
+{
+    LONG *ids = b->topicID;
+    VARTYPE *vt = b->vt;
+    double *dbl = b->dbl;
+    LONGLONG *i64 = b->i64;
+    BSTR *str = b->str;
+    ULONG rare = 0;
+    LONGLONG strCount = b->strCount;
+    for (long i = first; i < rows; i++) {
+        const VARIANT *row = &data[i * colCount];
+        const VARIANT *v = &row[1];
+        VARTYPE t = v->vt;
+
+        // Selects are masks so the compiler cannot turn them back into branches
+        LONGLONG narrow = -(LONGLONG)((t == VT_I4) | (t == VT_ERROR));
+        LONGLONG n = ((LONGLONG)v->lVal & narrow) | (v->llVal & ~narrow);
+        LONGLONG isStr = -(LONGLONG)(t == VT_BSTR);
+        LONG idOk = -(LONG)(row[0].vt == VT_I4);
+
+        ids[i] = row[0].lVal & idOk;
+        vt[i] = t;
+        dbl[i] = v->dblVal;
+        str[strCount] = v->bstrVal;
+        i64[i] = (strCount & isStr) | (n & ~isStr);
+        strCount -= isStr;
+        rare |= (ULONG)(t >= 64) | (ULONG)(~(DECODE_DIRECT >> (t & 63)) & 1);
+    }
+    b->strCount = (long)strCount;
+    return rare;
+}
+
+/**
+ * Per-row switch for the types DecodeMixed leaves raw (VT_R4, VT_I2,
+ * VT_BOOL, anything unknown)
+ */
+static void FixRow(RtdBatch *b, long i, const VARIANT *v)
+{
+    switch (v->vt) {
+        case VT_R4:   b->dbl[i] = v->fltVal; break;
+        case VT_I2:   b->i64[i] = v->iVal; break;
+        case VT_BOOL: b->i64[i] = v->boolVal; break;
+        default:      b->i64[i] = 0; break;
+    }
+}
+
+/**
+ * Decode a RefreshData result (2 x N: topic ID, value) into b's columns
+ */
+long RtdBatch_Decode(RtdBatch *b, SAFEARRAY *pOutArr, long topicCount)
+{
+    b->rows = 0;
+    b->strCount = 0;
+    b->allR8 = FALSE;
+    if (!pOutArr || pOutArr->cDims != 2) return 0;
+
+    LONG rowCount = pOutArr->rgsabound[0].cElements;
+    LONG colCount = pOutArr->rgsabound[1].cElements;
+    if (colCount < 2) return 0;
+
+    long rows = min(rowCount, topicCount);
+    if (rows <= 0 || !Reserve(b, rows)) return 0;
+
+    VARIANT *pData = NULL;
+    if (FAILED(SafeArrayAccessData(pOutArr, (void**)&pData))) return 0;
+
+    // Constant stride for the usual two columns
+    long done = colCount == 2 ? DecodeR8Prefix(b, pData, rows, 2)
+                              : DecodeR8Prefix(b, pData, rows, colCount);
+    if (done < rows) {
+        ULONG rare = colCount == 2 ? DecodeMixed(b, pData, done, rows, 2)
+                                   : DecodeMixed(b, pData, done, rows, colCount);
+        for (long i = done; rare && i < rows; i++) {
+            VARTYPE t = b->vt[i];
+            if (t >= 64 || !((DECODE_DIRECT >> t) & 1)) FixRow(b, i, &pData[i * colCount + 1]);
+        }
+    }
+
+    SafeArrayUnaccessData(pOutArr);
+    b->allR8 = done == rows;
+    if (b->allR8) b->fastBatches++; else b->slowBatches++;
+    b->rows = rows;
+    return rows;
+}
+
+BOOL RtdBatch_Append(RtdBatch *b, const RtdUpdate *u)
+{
+    if (b->rows == b->capacity && !Reserve(b, b->rows + 1)) return FALSE;
+    long i = b->rows;
+    b->topicID[i] = u->topicID;
+    b->vt[i] = u->vt;
+    memcpy(&b->dbl[i], &u->llVal, sizeof b->dbl[i]);
+    b->i64[i] = u->llVal;
+    if (u->vt == VT_BSTR) {
+        b->str[b->strCount] = u->bstrVal;
+        b->i64[i] = b->strCount++;
+    }
+    b->rows++;
+    return TRUE;
+}
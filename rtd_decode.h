@@ -0,0 +1,96 @@
+// rtd_decode.h - Columnar decode of RefreshData batches
+// Converts a whole 2 x N RefreshData SAFEARRAY into typed columns in one
+// pass instead of switching on each VARIANT as it is routed:
+//
+//   topicID[i]  topic ID of row i, 0 when the ID was not VT_I4
+//   vt[i]       original VARIANT type, the tag for the columns below
+//   dbl[i]      VT_R8, VT_R4 and VT_DATE values
+//   i64[i]      VT_I4, VT_I2, VT_I8, VT_BOOL and VT_ERROR values, or for
+//               VT_BSTR the offset of the string in str[]
+//
+// A batch that is all VT_I4 IDs with VT_R8 values (the common case for
+// quote streams) is copied by a tight loop that checks types once per
+// block. Mixed batches are still decoded without a branch per row; only
+// the rare VT_R4/VT_I2/VT_BOOL values get a second look. Strings are not
+// copied: str[] borrows the BSTRs in the SAFEARRAY, so a batch is only
+// valid until the array is destroyed.
+
+#ifndef __RTD_DECODE_H__
+#define __RTD_DECODE_H__
+
+#include <string.h>
+#include "rtd_pool.h"
+#include "rtd_ring.h"
+
+typedef struct RtdBatch {
+    long      rows;         // Rows decoded by the last RtdBatch_Decode
+    long      capacity;     // Rows the columns can hold; grows as needed
+    BOOL      allR8;        // Last batch took the all-VT_R8 path
+    LONG     *topicID;
+    VARTYPE  *vt;
+    double   *dbl;
+    LONGLONG *i64;
+    BSTR     *str;          // Borrowed from the SAFEARRAY
+    long      strCount;
+    RtdStringPool *strings;  // Interns string values in RtdBatch_Update, may be NULL
+
+    ULONGLONG fastBatches;  // Batches decoded by the all-VT_R8 path
+    ULONGLONG slowBatches;  // Batches that needed the per-row switch
+} RtdBatch;
+
+BOOL RtdBatch_Init(RtdBatch *b, long capacity);
+void RtdBatch_Free(RtdBatch *b);
+
+// Decode up to topicCount rows of pOutArr; returns the rows decoded, 0 on
+// a malformed array or allocation failure
+long RtdBatch_Decode(RtdBatch *b, SAFEARRAY *pOutArr, long topicCount);
+
+// Build a batch from updates decoded elsewhere (the shard threads): empty
+// it, then add rows one at a time. A string row borrows u->bstrVal, which
+// must outlive the batch.
+static inline void RtdBatch_Reset(RtdBatch *b)
+{
+    b->rows = 0;
+    b->strCount = 0;
+    b->allR8 = FALSE;
+}
+
+BOOL RtdBatch_Append(RtdBatch *b, const RtdUpdate *u);
+
+/**
+ * Copy row i into an RtdUpdate, interning or duplicating a string value
+ * so the update can outlive the SAFEARRAY. FALSE if the copy could not be
+ * allocated.
+ */
+static inline BOOL RtdBatch_Update(const RtdBatch *b, long i, RtdUpdate *u, ULONGLONG recvNs)
+{
+    VARTYPE t = b->vt[i];
+    u->recvNs = recvNs;
+    u->topicID = b->topicID[i];
+    u->vt = t;
+    u->flags = 0;
+
+    // Pick the column with a mask; mixed batches mispredict a switch here
+    LONGLONG bits;
+    memcpy(&bits, &b->dbl[i], sizeof bits);
+    LONGLONG isDbl = -(LONGLONG)((t == VT_R8) | (t == VT_R4) | (t == VT_DATE));
+    u->llVal = (bits & isDbl) | (b->i64[i] & ~isDbl);
+
+    if (t == VT_BSTR) {
+        BSTR s = b->str[b->i64[i]];
+        if (b->strings) {
+            BOOL shared;
+            u->bstrVal = RtdStringPool_Intern(b->strings, s, SysStringLen(s), &shared);
+            if (shared) u->flags = RTD_UPDATE_SHARED;
+        } else {
+            u->bstrVal = SysAllocStringLen(s, SysStringLen(s));
+        }
+        if (!u->bstrVal) {
+            u->vt = VT_EMPTY;
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+#endif /* __RTD_DECODE_H__ */
@@ -0,0 +1,271 @@
+/**
+ * rtd_format.c - Text formatting of decoded RTD updates
+ *
+ * Format_Fixed splits the double into mantissa and exponent, multiplies
+ * the mantissa by 5^decimals in 128-bit integer arithmetic and shifts by
+ * the binary exponent, rounding half to even on the bits shifted out.
+ * That is exactly the decimal value printf would round, so the output
+ * matches "%.*f" byte for byte without touching floating point again.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+#include "rtd_format.h"
+
+static const char digitPairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const ULONGLONG pow10[] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL, 1000000000ULL
+};
+
+static const ULONGLONG pow5[] = {
+    1ULL, 5ULL, 25ULL, 125ULL, 625ULL, 3125ULL, 15625ULL,
+    78125ULL, 390625ULL, 1953125ULL
+};
+
+// Fast path limit on |v| so that v * 10^decimals stays below 1e18
+static const double fastLimit[] = {
+    1e18, 1e17, 1e16, 1e15, 1e14, 1e13, 1e12, 1e11, 1e10, 1e9
+};
+
+/**
+ * Write v in decimal, right-aligned so the last digit lands at end[-1];
+ * returns the first digit
+ */
+static char* WriteDigits(ULONGLONG v, char *end)
+{
+    while (v >= 100) {
+        unsigned pair = (unsigned)(v % 100);
+        v /= 100;
+        end -= 2;
+        memcpy(end, &digitPairs[pair * 2], 2);
+    }
+    if (v >= 10) {
+        end -= 2;
+        memcpy(end, &digitPairs[v * 2], 2);
+    } else {
+        *--end = (char)('0' + v);
+    }
+    return end;
+}
+
+/**
+ * Write exactly width digits of v (zero padded) at out
+ */
+static void WritePadded(ULONGLONG v, int width, char *out)
+{
+    char *p = out + width;
+    while (p - out >= 2) {
+        unsigned pair = (unsigned)(v % 100);
+        v /= 100;
+        p -= 2;
+        memcpy(p, &digitPairs[pair * 2], 2);
+    }
+    if (p > out) *--p = (char)('0' + v % 10);
+}
+
+/**
+ * Decimal digits in v, from how many powers of ten it reaches
+ */
+static int CountDigits(ULONGLONG v)
+{
+    int n = 1;
+    for (;;) {
+        if (v < 10) return n;
+        if (v < 100) return n + 1;
+        if (v < 1000) return n + 2;
+        if (v < 10000) return n + 3;
+        v /= 10000;
+        n += 4;
+    }
+}
+
+int Format_Int64(LONGLONG v, char *out)
+{
+    // Sized first, so the digits go straight to out with no copy
+    ULONGLONG mag = v < 0 ? 0 - (ULONGLONG)v : (ULONGLONG)v;
+    int len = (v < 0) + CountDigits(mag);
+    if (v < 0) out[0] = '-';
+    WriteDigits(mag, out + len);
+    out[len] = 0;
+    return len;
+}
+
+/**
+ * round-half-even(m * 5^d * 2^shift), with m < 2^53 and the result known
+ * to be below 1e18
+ */
+static ULONGLONG ScaleRound(ULONGLONG m, ULONGLONG mul, int shift)
+{
+    // 128-bit product of a 53-bit mantissa and a 21-bit power of five
+    ULONGLONG lo32 = (m & 0xFFFFFFFFULL) * mul;
+    ULONGLONG hi32 = (m >> 32) * mul;
+    ULONGLONG lo = lo32 + (hi32 << 32);
+    ULONGLONG hi = (hi32 >> 32) + (lo < lo32);
+
+    if (shift >= 0) return lo << shift;
+
+    int k = -shift;
+    ULONGLONG q, remHi, remLo, halfHi, halfLo;
+    if (k >= 128) {
+        return 0;   // Product is below 2^75, far under half of 2^k
+    } else if (k < 64) {
+        q = (lo >> k) | (hi << (63 - k) << 1);
+        remHi = 0;
+        remLo = lo & ((1ULL << k) - 1);
+        halfHi = 0;
+        halfLo = 1ULL << (k - 1);
+    } else if (k == 64) {
+        q = hi;
+        remHi = 0;
+        remLo = lo;
+        halfHi = 0;
+        halfLo = 1ULL << 63;
+    } else {
+        q = hi >> (k - 64);
+        remHi = hi & ((1ULL << (k - 64)) - 1);
+        remLo = lo;
+        halfHi = 1ULL << (k - 65);
+        halfLo = 0;
+    }
+
+    if (remHi > halfHi || (remHi == halfHi && remLo > halfLo)) return q + 1;
+    if (remHi == halfHi && remLo == halfLo) return q + (q & 1);
+    return q;
+}
+
+int Format_Fixed(double v, int decimals, char *out, size_t outSize)
+{
+    if (decimals < 0) decimals = 0;
+    if (decimals > FORMAT_MAX_DECIMALS) decimals = FORMAT_MAX_DECIMALS;
+
+    ULONGLONG bits;
+    memcpy(&bits, &v, sizeof bits);
+    BOOL negative = (bits >> 63) != 0;
+    double mag = negative ? -v : v;
+
+    // NaN, infinity and huge values keep the CRT's spelling
+    if (!(mag < fastLimit[decimals]) || outSize < FORMAT_NUMBER_MAX) {
+        int n = snprintf(out, outSize, "%.*f", decimals, v);
+        if (n < 0) n = 0;
+        if ((size_t)n >= outSize) n = outSize ? (int)outSize - 1 : 0;
+        return n;
+    }
+
+    int exp = (int)((bits >> 52) & 0x7FF);
+    ULONGLONG m = bits & ((1ULL << 52) - 1);
+    if (exp == 0) {
+        exp = 1;            // Subnormal: no implicit bit
+    } else {
+        m |= 1ULL << 52;
+    }
+    ULONGLONG scaled = ScaleRound(m, pow5[decimals], exp - 1075 + decimals);
+
+    int len = 0;
+    if (negative) out[len++] = '-';
+
+    // Constant divisors for the common precisions let the compiler
+    // replace the 64-bit division with a multiply
+    ULONGLONG whole, frac;
+    switch (decimals) {
+        case 2:  whole = scaled / 100;     frac = scaled % 100;     break;
+        case 4:  whole = scaled / 10000;   frac = scaled % 10000;   break;
+        case 6:  whole = scaled / 1000000; frac = scaled % 1000000; break;
+        default: whole = scaled / pow10[decimals]; frac = scaled % pow10[decimals]; break;
+    }
+
+    char tmp[FORMAT_NUMBER_MAX];
+    char *first = WriteDigits(whole, tmp + sizeof tmp);
+    size_t n = tmp + sizeof tmp - first;
+    memcpy(out + len, first, n);
+    len += (int)n;
+
+    if (decimals > 0) {
+        out[len++] = '.';
+        WritePadded(frac, decimals, out + len);
+        len += decimals;
+    }
+    out[len] = 0;
+    return len;
+}
+
+/**
+ * Text for the numeric (and unknown) value types; strings are handled by
+ * the callers because they need no conversion in one direction
+ */
+static int FormatNumber(const RtdUpdate *u, int decimals, char *out, size_t outSize)
+{
+    switch (u->vt) {
+        case VT_R8:
+        case VT_R4:
+        case VT_DATE:
+            return Format_Fixed(u->dblVal, decimals, out, outSize);
+        case VT_I4:
+        case VT_I2:
+        case VT_I8:
+        case VT_BOOL:
+        case VT_ERROR:
+            return Format_Int64(u->llVal, out);
+        default: {
+            static const char prefix[] = "<unknown type ";
+            int len = (int)sizeof prefix - 1;
+            memcpy(out, prefix, len);
+            len += Format_Int64(u->vt, out + len);
+            out[len++] = '>';
+            out[len] = 0;
+            return len;
+        }
+    }
+}
+
+int Format_UpdateValueUtf8(const RtdUpdate *u, int decimals, char *out, size_t outSize)
+{
+    if (outSize == 0) return 0;
+
+    if (u->vt == VT_BSTR) {
+        size_t n = u->bstrVal ? RtdWideToUtf8(u->bstrVal, SysStringLen(u->bstrVal), out, outSize - 1) : 0;
+        out[n] = 0;
+        return (int)n;
+    }
+    if (outSize >= FORMAT_NUMBER_MAX) return FormatNumber(u, decimals, out, outSize);
+
+    char tmp[FORMAT_NUMBER_MAX];
+    int n = FormatNumber(u, decimals, tmp, sizeof tmp);
+    if ((size_t)n >= outSize) n = (int)outSize - 1;
+    memcpy(out, tmp, n);
+    out[n] = 0;
+    return n;
+}
+
+int Format_UpdateValue(const RtdUpdate *u, int decimals, WCHAR *buffer, size_t bufferSize)
+{
+    if (bufferSize == 0) return 0;
+
+    if (u->vt == VT_BSTR) {
+        size_t n = u->bstrVal ? SysStringLen(u->bstrVal) : 0;
+        if (n >= bufferSize) n = bufferSize - 1;
+        if (n) wmemcpy(buffer, u->bstrVal, n);
+        buffer[n] = 0;
+        return (int)n;
+    }
+
+    // Number text is ASCII, so widening is a plain copy
+    char tmp[400];
+    int n = FormatNumber(u, decimals, tmp, sizeof tmp);
+    if ((size_t)n >= bufferSize) n = (int)bufferSize - 1;
+    for (int i = 0; i < n; i++) buffer[i] = (WCHAR)(unsigned char)tmp[i];
+    buffer[n] = 0;
+    return n;
+}
@@ -0,0 +1,37 @@
+// rtd_format.h - Text formatting of decoded RTD updates
+// Shared by the console output workers and rtd_bench so the formatting
+// cost measured on Linux is the cost paid by rtd_client.
+//
+// Numbers are formatted by hand rather than through printf: no locale
+// lookups, no heap, and output identical to "%.*f" / "%lld" in the C
+// locale, down to round-half-even on the exact binary value.
+
+#ifndef __RTD_FORMAT_H__
+#define __RTD_FORMAT_H__
+
+#include "rtd_compat.h"
+#include "rtd_ring.h"
+
+// Buffer size that always holds a formatted integer or fast-path double
+#define FORMAT_NUMBER_MAX   32
+
+// Fractional digits for floating point values unless told otherwise
+#define FORMAT_DEFAULT_DECIMALS 6
+#define FORMAT_MAX_DECIMALS     9
+
+// Narrow output; all return the length written and NUL terminate.
+// out must hold FORMAT_NUMBER_MAX bytes.
+int Format_Int64(LONGLONG v, char *out);
+
+// Same text as printf("%.*f", decimals, v). Values the fast path cannot
+// represent exactly (|v| >= 1e12, NaN, infinity) go through snprintf and
+// are truncated to outSize.
+int Format_Fixed(double v, int decimals, char *out, size_t outSize);
+
+// Value of u as UTF-8 text
+int Format_UpdateValueUtf8(const RtdUpdate *u, int decimals, char *out, size_t outSize);
+
+// Value of u as wide text
+int Format_UpdateValue(const RtdUpdate *u, int decimals, WCHAR *buffer, size_t bufferSize);
+
+#endif /* __RTD_FORMAT_H__ */
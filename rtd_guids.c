@@ -0,0 +1,29 @@
+/**
+ * rtd_guids.c - GUID definitions for the RTD interfaces
+ *
+ * Kept in their own translation unit so the portable modules (and the
+ * simulated server) can link without rtd_client.c.
+ */
+
+#ifdef _WIN32
+#include <windows.h>
+#include <initguid.h>
+#else
+#define INITGUID
+#endif
+#include "rtd_client.h"
+
+/**
+ * GUID Definitions
+ */
+// Define RTDServerLib GUID (used for type library)
+DEFINE_GUID(LIBID_RTDServerLib, 
+    0xBA792DC8, 0x807E, 0x43E3, 0xB4, 0x84, 0x47, 0x46, 0x5D, 0x82, 0xC4, 0xD1);
+
+// Define IRtdServer interface GUID
+DEFINE_GUID(IID_IRtdServer,
+    0xEC0E6191, 0xDB51, 0x11D3, 0x8F, 0x3E, 0x00, 0xC0, 0x4F, 0x36, 0x51, 0xB8);
+
+// Define IRTDUpdateEvent interface GUID
+DEFINE_GUID(IID_IRTDUpdateEvent,
+    0xA43788C1, 0xD91B, 0x11D3, 0x8F, 0x39, 0x00, 0xC0, 0x4F, 0x36, 0x51, 0xB8);
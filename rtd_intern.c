@@ -0,0 +1,108 @@
+/**
+ * rtd_intern.c - String interner for symbols and topics
+ *
+ * Strings are individually allocated so pointers handed out stay valid
+ * while the ID array grows. Interning only happens when subscribing, so
+ * nothing here is on the RefreshData path.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include "rtd_intern.h"
+
+/**
+ * FNV-1a over the characters of str
+ */
+static ULONG HashString(const WCHAR *str)
+{
+    uint32_t h = 2166136261u;
+    for (; *str; str++) { h ^= (uint32_t)*str; h *= 16777619u; }
+    return h;
+}
+
+static BOOL Rehash(StringInterner *in, ULONG size)
+{
+    long *index = (long*)calloc(size, sizeof *index);
+    if (!index) return FALSE;
+    for (long id = 1; id < in->count; id++) {
+        ULONG pos = in->hashes[id] & (size - 1);
+        while (index[pos]) pos = (pos + 1) & (size - 1);
+        index[pos] = id;
+    }
+    free(in->index);
+    in->index = index;
+    in->indexMask = size - 1;
+    return TRUE;
+}
+
+BOOL Interner_Init(StringInterner *in, long initialCapacity)
+{
+    memset(in, 0, sizeof *in);
+    in->count = 1;  // ID 0 means "none"
+    in->capacity = initialCapacity > 16 ? initialCapacity + 1 : 17;
+    in->strings = (WCHAR**)calloc(in->capacity, sizeof *in->strings);
+    in->hashes = (ULONG*)calloc(in->capacity, sizeof *in->hashes);
+
+    ULONG size = 64;
+    while (size < (ULONG)in->capacity * 2) size *= 2;
+    if (!in->strings || !in->hashes || !Rehash(in, size)) {
+        Interner_Free(in);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void Interner_Free(StringInterner *in)
+{
+    for (long id = 1; id < in->count; id++) free(in->strings[id]);
+    free(in->strings);
+    free(in->hashes);
+    free(in->index);
+    memset(in, 0, sizeof *in);
+}
+
+long Interner_Find(const StringInterner *in, const WCHAR *str)
+{
+    ULONG h = HashString(str);
+    ULONG pos = h & in->indexMask;
+    for (long id; (id = in->index[pos]) != 0; pos = (pos + 1) & in->indexMask) {
+        if (in->hashes[id] == h && wcscmp(in->strings[id], str) == 0) return id;
+    }
+    return 0;
+}
+
+long Interner_Add(StringInterner *in, const WCHAR *str)
+{
+    long id = Interner_Find(in, str);
+    if (id) return id;
+
+    if (in->count >= in->capacity) {
+        long newCap = in->capacity * 2;
+        WCHAR **strings = (WCHAR**)realloc(in->strings, newCap * sizeof *strings);
+        if (!strings) return 0;
+        in->strings = strings;
+        ULONG *hashes = (ULONG*)realloc(in->hashes, newCap * sizeof *hashes);
+        if (!hashes) return 0;
+        in->hashes = hashes;
+        in->capacity = newCap;
+    }
+    // Keep the index at most half full
+    if ((ULONG)(in->count + 1) * 2 > in->indexMask + 1 && !Rehash(in, (in->indexMask + 1) * 2)) {
+        return 0;
+    }
+
+    size_t len = wcslen(str);
+    WCHAR *copy = (WCHAR*)malloc((len + 1) * sizeof *copy);
+    if (!copy) return 0;
+    memcpy(copy, str, (len + 1) * sizeof *copy);
+
+    id = in->count++;
+    in->strings[id] = copy;
+    in->hashes[id] = HashString(str);
+
+    ULONG pos = in->hashes[id] & in->indexMask;
+    while (in->index[pos]) pos = (pos + 1) & in->indexMask;
+    in->index[pos] = id;
+    return id;
+}
@@ -0,0 +1,37 @@
+// rtd_intern.h - String interner for symbols and topics
+// Each distinct string gets a small, dense, never-reused ID starting at 1
+// and a single stable copy. Code that has an ID compares integers and
+// indexes arrays instead of comparing strings.
+
+#ifndef __RTD_INTERN_H__
+#define __RTD_INTERN_H__
+
+#include "rtd_compat.h"
+
+typedef struct StringInterner {
+    WCHAR **strings;        // Indexed by ID, slot 0 unused; never moved once stored
+    ULONG  *hashes;         // Hash of each string, for rehashing
+    long    count;          // Next ID to hand out
+    long    capacity;
+    long   *index;          // Open-addressed hash -> ID, 0 when empty
+    ULONG   indexMask;
+} StringInterner;
+
+BOOL Interner_Init(StringInterner *in, long initialCapacity);
+void Interner_Free(StringInterner *in);
+
+// ID of str, adding it if new; 0 on allocation failure
+long Interner_Add(StringInterner *in, const WCHAR *str);
+
+// ID of str, or 0 if it was never added
+long Interner_Find(const StringInterner *in, const WCHAR *str);
+
+/**
+ * String for an ID returned by Interner_Add
+ */
+static inline const WCHAR* Interner_String(const StringInterner *in, long id)
+{
+    return (id > 0 && id < in->count) ? in->strings[id] : NULL;
+}
+
+#endif /* __RTD_INTERN_H__ */
@@ -0,0 +1,458 @@
+/**
+ * rtd_journal.c - Append-only binary tick journal
+ *
+ * The writer stores records straight into a mapped, preallocated file, so
+ * an append is a 24-byte copy plus a header count update. Strings go
+ * through a buffered stdio stream; they are flushed on rotation and close,
+ * so a reader following a live journal may briefly see string offsets
+ * past the end of the side table.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "rtd_journal.h"
+#include "rtd_bars.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Map a file into memory. With create set, the file is created (or
+ * truncated) and preallocated to size bytes; otherwise it is opened
+ * read-only and mapped at its current size.
+ */
+BOOL MappedFile_Open(MappedFile *m, const char *path, size_t size, BOOL create)
+{
+    memset(m, 0, sizeof *m);
+#ifdef _WIN32
+    m->hFile = CreateFileA(path, create ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                           create ? CREATE_ALWAYS : OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m->hFile == INVALID_HANDLE_VALUE) return FALSE;
+
+    if (create) {
+        LARGE_INTEGER li;
+        li.QuadPart = (LONGLONG)size;
+        if (!SetFilePointerEx(m->hFile, li, NULL, FILE_BEGIN) || !SetEndOfFile(m->hFile)) {
+            CloseHandle(m->hFile);
+            return FALSE;
+        }
+    } else {
+        LARGE_INTEGER li;
+        if (!GetFileSizeEx(m->hFile, &li)) {
+            CloseHandle(m->hFile);
+            return FALSE;
+        }
+        size = (size_t)li.QuadPart;
+    }
+    m->size = size;
+    if (size == 0) return TRUE;
+
+    m->hMapping = CreateFileMappingA(m->hFile, NULL, create ? PAGE_READWRITE : PAGE_READONLY,
+                                     0, 0, NULL);
+    if (!m->hMapping) {
+        CloseHandle(m->hFile);
+        return FALSE;
+    }
+    m->base = MapViewOfFile(m->hMapping, create ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+    if (!m->base) {
+        CloseHandle(m->hMapping);
+        CloseHandle(m->hFile);
+        return FALSE;
+    }
+    return TRUE;
+#else
+    m->fd = open(path, create ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDONLY, 0644);
+    if (m->fd < 0) return FALSE;
+
+    if (create) {
+        // Reserve real blocks so appends never hit ENOSPC as a SIGBUS
+        if (posix_fallocate(m->fd, 0, (off_t)size) != 0 && ftruncate(m->fd, (off_t)size) != 0) {
+            close(m->fd);
+            return FALSE;
+        }
+    } else {
+        struct stat st;
+        if (fstat(m->fd, &st) != 0) {
+            close(m->fd);
+            return FALSE;
+        }
+        size = (size_t)st.st_size;
+    }
+    m->size = size;
+    if (size == 0) return TRUE;
+
+    m->base = mmap(NULL, size, create ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, m->fd, 0);
+    if (m->base == MAP_FAILED) {
+        m->base = NULL;
+        close(m->fd);
+        return FALSE;
+    }
+    if (!create) madvise(m->base, size, MADV_SEQUENTIAL);
+    return TRUE;
+#endif
+}
+
+void MappedFile_Close(MappedFile *m)
+{
+#ifdef _WIN32
+    if (m->base) UnmapViewOfFile(m->base);
+    if (m->hMapping) CloseHandle(m->hMapping);
+    if (m->hFile && m->hFile != INVALID_HANDLE_VALUE) CloseHandle(m->hFile);
+#else
+    if (m->base) munmap(m->base, m->size);
+    if (m->fd > 0) close(m->fd);
+#endif
+    memset(m, 0, sizeof *m);
+}
+
+void Journal_FilePath(char *out, size_t outSize, const char *prefix, uint32_t index, const char *ext)
+{
+    snprintf(out, outSize, "%s-%06u.%s", prefix, index, ext);
+}
+
+/**
+ * Append one string entry to the side table, returning its offset
+ */
+static uint64_t WriteString(Journal *j, const char *utf8, uint32_t len)
+{
+    static const char zeros[4] = { 0 };
+    uint64_t offset = j->stringsSize;
+    uint32_t padded = (len + 1 + 3) & ~3u;  // Keep entries 4-byte aligned
+
+    fwrite(&len, sizeof len, 1, j->strings);
+    fwrite(utf8, 1, len, j->strings);
+    fwrite(zeros, 1, padded - len, j->strings);
+    j->stringsSize += sizeof len + padded;
+    return offset;
+}
+
+static uint64_t WriteWideString(Journal *j, const WCHAR *str, size_t len)
+{
+    char stackBuf[512];
+    size_t cap = len * 4;
+    char *buf = cap <= sizeof stackBuf ? stackBuf : (char*)malloc(cap);
+    if (!buf) return WriteString(j, "", 0);
+
+    size_t n = RtdWideToUtf8(str, len, buf, cap);
+    uint64_t offset = WriteString(j, buf, (uint32_t)n);
+    if (buf != stackBuf) free(buf);
+    return offset;
+}
+
+/**
+ * Close the current file pair, recording the final count
+ */
+static void CloseFile(Journal *j)
+{
+    if (j->hdr) j->hdr->count = j->count;
+    MappedFile_Close(&j->map);
+    if (j->strings) fclose(j->strings);
+    j->strings = NULL;
+    j->hdr = NULL;
+    j->records = NULL;
+}
+
+/**
+ * Open the next file pair in the sequence
+ */
+static BOOL OpenNextFile(Journal *j)
+{
+    char path[300];
+
+    j->fileIndex++;
+    j->fileGen++;
+
+    Journal_FilePath(path, sizeof path, j->prefix, j->fileIndex, "rtj");
+    if (!MappedFile_Open(&j->map, path, (size_t)j->fileBytes, TRUE)) return FALSE;
+
+    Journal_FilePath(path, sizeof path, j->prefix, j->fileIndex, "rts");
+    j->strings = fopen(path, "wb");
+    if (!j->strings) {
+        MappedFile_Close(&j->map);
+        return FALSE;
+    }
+    setvbuf(j->strings, NULL, _IOFBF, 1 << 16);
+    j->stringsSize = 0;
+
+    j->hdr = (JournalHeader*)j->map.base;
+    j->records = (JournalRecord*)(j->hdr + 1);
+    j->capacity = (j->fileBytes - sizeof(JournalHeader)) / sizeof(JournalRecord);
+    j->count = 0;
+
+    memcpy(j->hdr->magic, JOURNAL_MAGIC, 8);
+    j->hdr->version = JOURNAL_VERSION;
+    j->hdr->recordSize = sizeof(JournalRecord);
+    j->hdr->capacity = j->capacity;
+    j->hdr->count = 0;
+    j->hdr->baseNs = RtdNowNs();
+    j->hdr->baseWallNs = RtdWallNs();
+    j->hdr->fileIndex = j->fileIndex;
+    return TRUE;
+}
+
+/**
+ * Start a journal; files are named <prefix>-NNNNNN.rtj/.rts
+ */
+BOOL Journal_Open(Journal *j, const char *prefix, uint64_t fileBytes)
+{
+    memset(j, 0, sizeof *j);
+    snprintf(j->prefix, sizeof j->prefix, "%s", prefix);
+    if (fileBytes < sizeof(JournalHeader) + 1024 * sizeof(JournalRecord)) {
+        fileBytes = sizeof(JournalHeader) + 1024 * sizeof(JournalRecord);
+    }
+    j->fileBytes = fileBytes;
+    return OpenNextFile(j);
+}
+
+void Journal_Close(Journal *j)
+{
+    CloseFile(j);
+    for (long i = 0; i < j->topicCap; i++) {
+        free(j->topics[i].symbol);
+        free(j->topics[i].topic);
+    }
+    free(j->topics);
+    j->topics = NULL;
+    j->topicCap = 0;
+}
+
+/**
+ * Reserve the next record slot, rotating files when full
+ */
+static JournalRecord* NextRecord(Journal *j)
+{
+    if (!j->records) return NULL;
+    if (j->count == j->capacity) {
+        CloseFile(j);
+        if (!OpenNextFile(j)) {
+            j->errors++;
+            return NULL;
+        }
+        j->filesRotated++;
+    }
+    return &j->records[j->count];
+}
+
+static void Commit(Journal *j)
+{
+    j->count++;
+    j->hdr->count = j->count;
+    j->recordsWritten++;
+}
+
+/**
+ * Emit a JOURNAL_DEFINE record for a known topic into the current file
+ */
+static BOOL EmitDefine(Journal *j, long topicID)
+{
+    JournalTopic *t = &j->topics[topicID];
+    JournalRecord *rec = NextRecord(j);
+    if (!rec) return FALSE;
+
+    // Rotation may have bumped the generation; names go in the new file
+    rec->tsNs = RtdNowNs();
+    rec->topicID = (uint32_t)topicID;
+    rec->vt = VT_BSTR;
+    rec->kind = JOURNAL_DEFINE;
+    rec->value.str = WriteString(j, t->symbol, (uint32_t)strlen(t->symbol));
+    WriteString(j, t->topic, (uint32_t)strlen(t->topic));
+    t->gen = j->fileGen;
+    Commit(j);
+    return TRUE;
+}
+
+static char* DupUtf8(const WCHAR *str)
+{
+    size_t len = wcslen(str);
+    char *out = (char*)malloc(len * 4 + 1);
+    if (!out) return NULL;
+    out[RtdWideToUtf8(str, len, out, len * 4)] = 0;
+    return out;
+}
+
+/**
+ * Name a topic ID. Call whenever a topic ID is (re)assigned.
+ */
+BOOL Journal_Define(Journal *j, long topicID, const WCHAR *symbol, const WCHAR *topic)
+{
+    if (topicID < 0) return FALSE;
+    if (topicID >= j->topicCap) {
+        long newCap = j->topicCap ? j->topicCap : 1024;
+        while (newCap <= topicID) newCap *= 2;
+        JournalTopic *topics = (JournalTopic*)realloc(j->topics, newCap * sizeof *topics);
+        if (!topics) return FALSE;
+        memset(topics + j->topicCap, 0, (newCap - j->topicCap) * sizeof *topics);
+        j->topics = topics;
+        j->topicCap = newCap;
+    }
+
+    JournalTopic *t = &j->topics[topicID];
+    free(t->symbol);
+    free(t->topic);
+    t->symbol = DupUtf8(symbol);
+    t->topic = DupUtf8(topic);
+    if (!t->symbol || !t->topic) return FALSE;
+    return EmitDefine(j, topicID);
+}
+
+/**
+ * Append one decoded update
+ */
+BOOL Journal_Append(Journal *j, const RtdUpdate *u)
+{
+    JournalRecord *rec = NextRecord(j);
+    if (!rec) return FALSE;
+
+    // First update of this topic in a rotated file: restate its names
+    if (u->topicID >= 0 && u->topicID < j->topicCap && j->topics[u->topicID].symbol &&
+        j->topics[u->topicID].gen != j->fileGen) {
+        if (!EmitDefine(j, u->topicID)) return FALSE;
+        rec = NextRecord(j);
+        if (!rec) return FALSE;
+    }
+
+    rec->tsNs = u->recvNs;
+    rec->topicID = (uint32_t)u->topicID;
+    rec->vt = u->vt;
+    rec->kind = JOURNAL_UPDATE;
+    if (u->vt == VT_BSTR) {
+        rec->value.str = WriteWideString(j, u->bstrVal, SysStringLen(u->bstrVal));
+    } else {
+        rec->value.i64 = u->llVal;  // Raw 8 bytes, double or integer
+    }
+    Commit(j);
+    return TRUE;
+}
+
+/**
+ * Append one closed bar, all of its records in the same file
+ */
+BOOL Journal_AppendBar(Journal *j, const Bar *bar, const WCHAR *symbol)
+{
+    if (!j->records) return FALSE;
+    if (j->capacity - j->count < JOURNAL_BAR_RECORDS) {
+        CloseFile(j);
+        if (!OpenNextFile(j)) {
+            j->errors++;
+            return FALSE;
+        }
+        j->filesRotated++;
+    }
+
+    JournalRecord *rec = &j->records[j->count];
+    const double prices[4] = { bar->open, bar->high, bar->low, bar->close };
+    for (int i = 0; i < JOURNAL_BAR_RECORDS; i++) {
+        rec[i].tsNs = bar->closeNs;
+        rec[i].topicID = bar->intervalMs;
+        rec[i].kind = JOURNAL_BAR;
+        rec[i].vt = VT_I8;
+    }
+    rec[0].vt = VT_BSTR;
+    rec[0].value.str = WriteWideString(j, symbol, wcslen(symbol));
+    rec[1].value.i64 = (int64_t)bar->startWallNs;
+    for (int i = 0; i < 4; i++) {
+        rec[2 + i].vt = VT_R8;
+        rec[2 + i].value.dbl = prices[i];
+    }
+    rec[6].value.i64 = bar->volume;
+    rec[7].value.i64 = (int64_t)bar->ticks | (int64_t)bar->flags << 32;
+
+    // Readers see the whole bar or none of it
+    j->count += JOURNAL_BAR_RECORDS;
+    j->hdr->count = j->count;
+    j->recordsWritten += JOURNAL_BAR_RECORDS;
+    return TRUE;
+}
+
+/**
+ * Map a journal file and its string side table for reading
+ */
+BOOL JournalReader_Open(JournalReader *r, const char *path)
+{
+    memset(r, 0, sizeof *r);
+    if (!MappedFile_Open(&r->recMap, path, 0, FALSE)) return FALSE;
+
+    r->hdr = (const JournalHeader*)r->recMap.base;
+    if (r->recMap.size < sizeof(JournalHeader) || memcmp(r->hdr->magic, JOURNAL_MAGIC, 8) != 0 ||
+        r->hdr->recordSize != sizeof(JournalRecord)) {
+        MappedFile_Close(&r->recMap);
+        return FALSE;
+    }
+    r->records = (const JournalRecord*)(r->hdr + 1);
+
+    // Trust the header count, then pick up records a crashed writer committed
+    uint64_t maxRecords = (r->recMap.size - sizeof(JournalHeader)) / sizeof(JournalRecord);
+    uint64_t count = r->hdr->count < maxRecords ? r->hdr->count : maxRecords;
+    while (count < maxRecords && r->records[count].tsNs != 0) count++;
+    r->count = count;
+
+    // Side table: same name with .rts instead of .rtj
+    char strPath[300];
+    size_t len = strlen(path);
+    snprintf(strPath, sizeof strPath, "%s", path);
+    if (len >= 3 && len < sizeof strPath) memcpy(strPath + len - 3, "rts", 3);
+    if (MappedFile_Open(&r->strMap, strPath, 0, FALSE)) {
+        r->strings = (const char*)r->strMap.base;
+        r->stringsSize = r->strMap.size;
+    }
+    return TRUE;
+}
+
+void JournalReader_Close(JournalReader *r)
+{
+    MappedFile_Close(&r->recMap);
+    MappedFile_Close(&r->strMap);
+    memset(r, 0, sizeof *r);
+}
+
+const char* JournalReader_String(const JournalReader *r, uint64_t offset, uint32_t *pLen)
+{
+    if (!r->strings || offset + sizeof(uint32_t) > r->stringsSize) return NULL;
+    uint32_t len;
+    memcpy(&len, r->strings + offset, sizeof len);
+    if (offset + sizeof len + len + 1 > r->stringsSize) return NULL;
+    if (pLen) *pLen = len;
+    return r->strings + offset + sizeof len;
+}
+
+BOOL JournalReader_Definition(const JournalReader *r, const JournalRecord *rec,
+                              const char **symbol, const char **topic)
+{
+    uint32_t len;
+    if (rec->kind != JOURNAL_DEFINE) return FALSE;
+    *symbol = JournalReader_String(r, rec->value.str, &len);
+    if (!*symbol) return FALSE;
+    uint64_t next = rec->value.str + sizeof len + ((len + 1 + 3) & ~3u);
+    *topic = JournalReader_String(r, next, NULL);
+    return *topic != NULL;
+}
+
+BOOL JournalReader_Bar(const JournalReader *r, uint64_t index, Bar *bar, const char **symbol)
+{
+    if (index + JOURNAL_BAR_RECORDS > r->count) return FALSE;
+    const JournalRecord *rec = &r->records[index];
+    for (int i = 0; i < JOURNAL_BAR_RECORDS; i++) {
+        if (rec[i].kind != JOURNAL_BAR) return FALSE;
+    }
+    *symbol = JournalReader_String(r, rec[0].value.str, NULL);
+    if (!*symbol) return FALSE;
+
+    memset(bar, 0, sizeof *bar);
+    bar->closeNs = rec[0].tsNs;
+    bar->intervalMs = rec[0].topicID;
+    bar->startWallNs = (ULONGLONG)rec[1].value.i64;
+    bar->open = rec[2].value.dbl;
+    bar->high = rec[3].value.dbl;
+    bar->low = rec[4].value.dbl;
+    bar->close = rec[5].value.dbl;
+    bar->volume = rec[6].value.i64;
+    bar->ticks = (ULONG)rec[7].value.i64;
+    bar->flags = (ULONG)(rec[7].value.i64 >> 32);
+    return TRUE;
+}
@@ -0,0 +1,145 @@
+// rtd_journal.h - Append-only binary tick journal
+// Every decoded RefreshData row becomes a fixed 24-byte record in a
+// preallocated, memory-mapped file. When a file fills up the writer
+// rotates to the next one. String values, and the symbol/topic names
+// behind each topic ID, live in a side table next to each journal file:
+//
+//   <prefix>-000001.rtj   header + JournalRecord[capacity]
+//   <prefix>-000001.rts   string entries: uint32 length, UTF-8 bytes, NUL
+//
+// Each file pair is self-contained: a JOURNAL_DEFINE record names a topic
+// ID before its first update in that file.
+//
+// A closed OHLCV bar (see rtd_bars.h) takes JOURNAL_BAR_RECORDS consecutive
+// JOURNAL_BAR records, all stamped with the close time and carrying the
+// interval in ms as topicID: the symbol (string), the UTC start (VT_I8),
+// open, high, low, close (VT_R8), volume (VT_I8), and ticks | flags << 32.
+
+#ifndef __RTD_JOURNAL_H__
+#define __RTD_JOURNAL_H__
+
+#include <stdio.h>
+#include "rtd_compat.h"
+#include "rtd_ring.h"
+
+#define JOURNAL_MAGIC    "RTDJRNL1"
+#define JOURNAL_VERSION  1
+
+// Record kinds
+#define JOURNAL_UPDATE   0   // value holds the update for topicID
+#define JOURNAL_DEFINE   1   // value.str -> symbol entry, followed by topic entry
+#define JOURNAL_BAR      2   // Part of a closed bar
+
+#define JOURNAL_BAR_RECORDS 8
+
+#pragma pack(push, 8)
+typedef struct JournalHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t capacity;      // Records the file was preallocated for
+    volatile uint64_t count;// Committed records
+    uint64_t baseNs;        // RtdNowNs() when the file was opened
+    uint64_t baseWallNs;    // RtdWallNs() at the same instant
+    uint32_t fileIndex;
+    uint32_t reserved[3];
+} JournalHeader;            // 64 bytes
+
+typedef struct JournalRecord {
+    uint64_t tsNs;          // Monotonic receive time (RtdNowNs)
+    uint32_t topicID;
+    uint16_t vt;            // VARTYPE of the value
+    uint16_t kind;          // JOURNAL_UPDATE or JOURNAL_DEFINE
+    union {
+        double   dbl;       // VT_R8, VT_R4, VT_DATE
+        int64_t  i64;       // Integer types
+        uint64_t str;       // VT_BSTR / JOURNAL_DEFINE: offset into the .rts file
+    } value;
+} JournalRecord;            // 24 bytes
+#pragma pack(pop)
+
+// Platform file mapping
+typedef struct MappedFile {
+#ifdef _WIN32
+    HANDLE hFile;
+    HANDLE hMapping;
+#else
+    int    fd;
+#endif
+    void  *base;
+    size_t size;
+} MappedFile;
+
+// Map path read-only at its size, or with create, create it preallocated
+// to size bytes and map it writable
+BOOL MappedFile_Open(MappedFile *m, const char *path, size_t size, BOOL create);
+void MappedFile_Close(MappedFile *m);
+
+// Per-topic names kept by the writer so rotated files can redefine them
+typedef struct JournalTopic {
+    uint32_t gen;           // fileGen the topic was last defined in
+    char    *symbol;        // UTF-8
+    char    *topic;
+} JournalTopic;
+
+typedef struct Journal {
+    char           prefix[260];
+    uint64_t       fileBytes;      // Preallocated size of each .rtj file
+    uint32_t       fileIndex;
+    uint32_t       fileGen;
+
+    MappedFile     map;
+    JournalHeader *hdr;
+    JournalRecord *records;
+    uint64_t       count;
+    uint64_t       capacity;
+
+    FILE          *strings;
+    uint64_t       stringsSize;
+
+    JournalTopic  *topics;         // Indexed by topic ID
+    long           topicCap;
+
+    ULONGLONG      recordsWritten;
+    ULONGLONG      filesRotated;
+    ULONGLONG      errors;
+} Journal;
+
+// Writer
+BOOL Journal_Open(Journal *j, const char *prefix, uint64_t fileBytes);
+void Journal_Close(Journal *j);
+BOOL Journal_Define(Journal *j, long topicID, const WCHAR *symbol, const WCHAR *topic);
+BOOL Journal_Append(Journal *j, const RtdUpdate *u);
+
+struct Bar;
+BOOL Journal_AppendBar(Journal *j, const struct Bar *bar, const WCHAR *symbol);
+
+// Zero-copy reader over one .rtj/.rts pair
+typedef struct JournalReader {
+    MappedFile           recMap;
+    MappedFile           strMap;
+    const JournalHeader *hdr;
+    const JournalRecord *records;
+    uint64_t             count;
+    const char          *strings;
+    uint64_t             stringsSize;
+} JournalReader;
+
+BOOL JournalReader_Open(JournalReader *r, const char *path);
+void JournalReader_Close(JournalReader *r);
+
+// UTF-8 string stored at offset, or NULL if out of range
+const char* JournalReader_String(const JournalReader *r, uint64_t offset, uint32_t *pLen);
+
+// Names for a JOURNAL_DEFINE record
+BOOL JournalReader_Definition(const JournalReader *r, const JournalRecord *rec,
+                              const char **symbol, const char **topic);
+
+// Read the bar whose first record is records[index]; symbol points into the
+// string table. seq is not journaled and reads as 0.
+BOOL JournalReader_Bar(const JournalReader *r, uint64_t index, struct Bar *bar, const char **symbol);
+
+// Build the path of file number index for a prefix
+void Journal_FilePath(char *out, size_t outSize, const char *prefix, uint32_t index, const char *ext);
+
+#endif /* __RTD_JOURNAL_H__ */
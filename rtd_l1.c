@@ -0,0 +1,139 @@
+/**
+ * rtd_l1.c - Coherent level-1 quote events
+ *
+ * Rows only set a bit and queue the symbol; the values are read once per
+ * symbol at the end of the batch, after every row has reached the
+ * QuoteStore, so an event never mixes fields from different batches.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "rtd_l1.h"
+
+// Dirty symbols whose quote columns are prefetched ahead of the one being read
+#define L1_PREFETCH 8
+
+BOOL L1Assembler_Init(L1Assembler *l1, const QuoteStore *quotes, DWORD staleMs)
+{
+    memset(l1, 0, sizeof *l1);
+    l1->quotes = quotes;
+    l1->staleNs = (ULONGLONG)staleMs * 1000000ULL;
+    return TRUE;
+}
+
+void L1Assembler_Free(L1Assembler *l1)
+{
+    free(l1->flags);
+    free(l1->changed);
+    free(l1->quoteNs);
+    free(l1->dirty);
+    memset(l1, 0, sizeof *l1);
+}
+
+static BOOL GrowSymbols(L1Assembler *l1, long minCap)
+{
+    long newCap = l1->symbolCap ? l1->symbolCap * 2 : 1024;
+    while (newCap < minCap) newCap *= 2;
+    long added = newCap - l1->symbolCap;
+
+    BYTE *flags = (BYTE*)realloc(l1->flags, newCap);
+    if (!flags) return FALSE;
+    memset(flags + l1->symbolCap, 0, added);
+    l1->flags = flags;
+
+    ULONG *changed = (ULONG*)realloc(l1->changed, newCap * sizeof *changed);
+    if (!changed) return FALSE;
+    memset(changed + l1->symbolCap, 0, added * sizeof *changed);
+    l1->changed = changed;
+
+    ULONGLONG *quoteNs = (ULONGLONG*)realloc(l1->quoteNs, newCap * sizeof *quoteNs);
+    if (!quoteNs) return FALSE;
+    memset(quoteNs + l1->symbolCap, 0, added * sizeof *quoteNs);
+    l1->quoteNs = quoteNs;
+
+    // Each symbol is queued at most once per batch
+    long *dirty = (long*)realloc(l1->dirty, newCap * sizeof *dirty);
+    if (!dirty) return FALSE;
+    l1->dirty = dirty;
+    l1->symbolCap = newCap;
+    return TRUE;
+}
+
+BOOL L1Assembler_Track(L1Assembler *l1, const TopicSubscription *sub)
+{
+    const QuoteStore *q = l1->quotes;
+    int col = sub->fieldID < q->fieldCap ? q->column[sub->fieldID] : QF_NONE;
+    if (col == QF_NONE || !((L1_FIELDS >> col) & 1)) return TRUE;
+    if (sub->symbolID >= l1->symbolCap && !GrowSymbols(l1, sub->symbolID + 1)) return FALSE;
+    if (!l1->flags[sub->symbolID]) l1->flags[sub->symbolID] = L1_TRACKED;
+    return TRUE;
+}
+
+void L1Assembler_ClearSymbol(L1Assembler *l1, long symbolID)
+{
+    if (symbolID <= 0 || symbolID >= l1->symbolCap) return;
+    l1->quoteNs[symbolID] = 0;
+}
+
+/**
+ * Read the top of book of one symbol and set its flags
+ */
+static void Assemble(L1Assembler *l1, long sym, ULONG changed, ULONGLONG recvNs, L1Quote *e)
+{
+    const QuoteStore *q = l1->quotes;
+    ULONG present = q->present[sym] & L1_FIELDS;
+
+    e->recvNs = recvNs;
+    e->symbolID = sym;
+    e->present = present;
+    e->changed = changed;
+    e->flags = 0;
+    e->bid = q->dbl[QF_BID][sym];
+    e->ask = q->dbl[QF_ASK][sym];
+    e->last = q->dbl[QF_LAST][sym];
+    e->bidSize = q->i64[QF_BID_SIZE - QUOTE_FIRST_INT][sym];
+    e->askSize = q->i64[QF_ASK_SIZE - QUOTE_FIRST_INT][sym];
+
+    if (changed & L1_QUOTE_FIELDS) l1->quoteNs[sym] = recvNs;
+    ULONG sides = (1u << QF_BID) | (1u << QF_ASK);
+    if ((present & sides) == sides) {
+        if (e->bid > e->ask) {
+            e->flags |= L1_CROSSED;
+            l1->crossed++;
+        } else if (e->bid == e->ask) {
+            e->flags |= L1_LOCKED;
+            l1->locked++;
+        }
+    }
+    if ((present & L1_QUOTE_FIELDS) && l1->staleNs && recvNs - l1->quoteNs[sym] > l1->staleNs) {
+        e->flags |= L1_STALE;
+        l1->stale++;
+    }
+}
+
+void L1Assembler_EndBatch(L1Assembler *l1, ULONGLONG recvNs, L1EmitFn emit, void *ctx)
+{
+    const QuoteStore *q = l1->quotes;
+    L1Quote e;
+    for (long i = 0; i < l1->dirtyCount; i++) {
+        if (i + L1_PREFETCH < l1->dirtyCount) {
+            long ahead = l1->dirty[i + L1_PREFETCH];
+            RtdPrefetch(&q->present[ahead]);
+            RtdPrefetch(&q->dbl[QF_BID][ahead]);
+            RtdPrefetch(&q->dbl[QF_ASK][ahead]);
+            RtdPrefetch(&q->dbl[QF_LAST][ahead]);
+        }
+        long sym = l1->dirty[i];
+        ULONG changed = l1->changed[sym];
+        l1->flags[sym] = L1_TRACKED;
+        l1->changed[sym] = 0;
+        // Cleared since the rows arrived
+        if (sym >= q->symbolCap || !(q->present[sym] & L1_FIELDS)) continue;
+
+        Assemble(l1, sym, changed, recvNs, &e);
+        e.seq = ++l1->seq;
+        l1->events++;
+        emit(ctx, &e);
+    }
+    l1->dirtyCount = 0;
+}
@@ -0,0 +1,136 @@
+// rtd_l1.h - Coherent level-1 quote events
+// BID, ASK, BID_SIZE, ASK_SIZE and LAST are separate RTD topics, so a quote
+// change normally reaches consumers as several unrelated updates and a
+// reader can catch the bid from one moment and the ask from the next. The
+// assembler notes which of those fields each RefreshData row touched and,
+// at the end of the batch, turns every symbol touched into one L1Quote
+// read from the QuoteStore: the whole top of book as of that batch, with
+// an assembler-wide sequence number and integrity flags.
+//
+// Events are built on the stack and handed to a callback; L1Ring carries
+// them to another thread in preallocated slots, so nothing is allocated
+// per event.
+
+#ifndef __RTD_L1_H__
+#define __RTD_L1_H__
+
+#include "rtd_quotes.h"
+#include "rtd_subs.h"
+
+// QuoteField bits an L1Quote is assembled from
+#define L1_FIELDS ((1u << QF_BID) | (1u << QF_ASK) | (1u << QF_BID_SIZE) | \
+                   (1u << QF_ASK_SIZE) | (1u << QF_LAST))
+#define L1_QUOTE_FIELDS (L1_FIELDS & ~(1u << QF_LAST))
+
+// L1Quote.flags
+#define L1_CROSSED  0x01    // bid > ask
+#define L1_LOCKED   0x02    // bid == ask
+#define L1_STALE    0x04    // Bid/ask unchanged for longer than staleNs
+
+#define L1_DEFAULT_STALE_MS 5000
+
+// Assembler.flags values, as in Analytics
+#define L1_TRACKED 1
+#define L1_QUEUED  2
+
+typedef struct L1Quote {
+    ULONGLONG seq;          // 1, 2, 3... across all symbols; a gap means events were lost
+    ULONGLONG recvNs;       // Batch the event was assembled from
+    long      symbolID;
+    ULONG     present;      // L1_FIELDS bits received so far for the symbol
+    ULONG     changed;      // L1_FIELDS bits that arrived in this batch
+    ULONG     flags;
+    double    bid;
+    double    ask;
+    double    last;
+    LONGLONG  bidSize;
+    LONGLONG  askSize;
+} L1Quote;
+
+typedef void (*L1EmitFn)(void *ctx, const L1Quote *q);
+
+typedef struct L1Assembler {
+    const QuoteStore *quotes;
+    ULONGLONG         staleNs;
+    BYTE             *flags;        // L1_TRACKED/QUEUED per symbol ID
+    ULONG            *changed;      // Fields touched in the current batch per symbol
+    ULONGLONG        *quoteNs;      // Last batch that touched the bid/ask side
+    long              symbolCap;
+    long             *dirty;        // Symbols touched in the current batch
+    long              dirtyCount;
+    ULONGLONG         seq;
+
+    ULONGLONG         rows;         // L1 rows folded into events
+    ULONGLONG         events;
+    ULONGLONG         crossed;
+    ULONGLONG         locked;
+    ULONGLONG         stale;
+} L1Assembler;
+
+BOOL L1Assembler_Init(L1Assembler *l1, const QuoteStore *quotes, DWORD staleMs);
+void L1Assembler_Free(L1Assembler *l1);
+
+// Assemble events for sub's symbol if sub is one of the L1 fields; call
+// after QuoteStore_Track
+BOOL L1Assembler_Track(L1Assembler *l1, const TopicSubscription *sub);
+
+// Forget a symbol's quote age once none of its pairs is subscribed
+void L1Assembler_ClearSymbol(L1Assembler *l1, long symbolID);
+
+/**
+ * TRUE if sub's rows go into L1 events
+ */
+static inline BOOL L1Assembler_Covers(const L1Assembler *l1, const TopicSubscription *sub)
+{
+    const QuoteStore *q = l1->quotes;
+    int col = sub->fieldID < q->fieldCap ? q->column[sub->fieldID] : QF_NONE;
+    return col != QF_NONE && ((L1_FIELDS >> col) & 1) &&
+           sub->symbolID < l1->symbolCap && l1->flags[sub->symbolID];
+}
+
+/**
+ * Note a row for sub; call after QuoteStore_Apply. Returns TRUE if the
+ * row went into the symbol's event.
+ */
+static inline BOOL L1Assembler_Apply(L1Assembler *l1, const TopicSubscription *sub)
+{
+    if (!L1Assembler_Covers(l1, sub)) return FALSE;
+    long sym = sub->symbolID;
+    l1->changed[sym] |= 1u << l1->quotes->column[sub->fieldID];
+    l1->rows++;
+    if (l1->flags[sym] == L1_TRACKED) {
+        l1->flags[sym] = L1_QUEUED;
+        l1->dirty[l1->dirtyCount++] = sym;
+    }
+    return TRUE;
+}
+
+// Emit one event per symbol touched since the last call
+void L1Assembler_EndBatch(L1Assembler *l1, ULONGLONG recvNs, L1EmitFn emit, void *ctx);
+
+// Events handed to an output worker (rtd_ring.h); a full ring drops the
+// new event and the consumer sees the gap in seq
+typedef RecordRing L1Ring;
+
+// capacity is rounded up to a power of two
+static inline BOOL L1Ring_Init(L1Ring *r, ULONG capacity)
+{
+    return RecordRing_Init(r, capacity, sizeof(L1Quote));
+}
+
+static inline void L1Ring_Free(L1Ring *r)
+{
+    RecordRing_Free(r);
+}
+
+static inline BOOL L1Ring_Push(L1Ring *r, const L1Quote *q)
+{
+    return RecordRing_Push(r, q);
+}
+
+static inline ULONG L1Ring_Pop(L1Ring *r, L1Quote *out, ULONG max)
+{
+    return RecordRing_Pop(r, out, max);
+}
+
+#endif /* __RTD_L1_H__ */
@@ -0,0 +1,119 @@
+/**
+ * rtd_metrics.c - Latency histograms for the update path
+ *
+ * Bucket i below HIST_SUB holds exactly the value i. Above that, each
+ * power of two [2^k, 2^(k+1)) is split into HIST_SUB equal buckets of
+ * width 2^(k - HIST_SUB_BITS).
+ */
+
+#include <string.h>
+#include "rtd_metrics.h"
+
+static const struct {
+    const char *name;
+    BOOL        isTime;     // Nanoseconds, printed as microseconds
+} kMetricInfo[METRIC_COUNT] = {
+    { "wake",        TRUE  },
+    { "refresh",     TRUE  },
+    { "dispatch",    TRUE  },
+    { "queue",       TRUE  },
+    { "format",      TRUE  },
+    { "write",       TRUE  },
+    { "end-to-end",  TRUE  },
+    { "rows/batch",  FALSE },
+    { "ring depth",  FALSE },
+};
+
+static ULONGLONG BucketLow(int index)
+{
+    if (index < HIST_SUB) return (ULONGLONG)index;
+    int shift = index / HIST_SUB - 1;
+    return (ULONGLONG)(HIST_SUB + index % HIST_SUB) << shift;
+}
+
+static ULONGLONG BucketWidth(int index)
+{
+    return index < HIST_SUB ? 1 : 1ULL << (index / HIST_SUB - 1);
+}
+
+ULONGLONG Histogram_Percentile(const Histogram *h, double p)
+{
+    if (h->count == 0) return 0;
+    ULONGLONG rank = (ULONGLONG)(p / 100.0 * (double)h->count + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > h->count) rank = h->count;
+
+    ULONGLONG seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            ULONGLONG v = BucketLow(i) + BucketWidth(i) / 2;
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+void Metrics_Reset(Metrics *m)
+{
+    memset(m, 0, sizeof *m);
+}
+
+void Metrics_Merge(Metrics *dst, const Metrics *src)
+{
+    for (int id = 0; id < METRIC_COUNT; id++) {
+        Histogram *d = &dst->hist[id];
+        const Histogram *s = &src->hist[id];
+        ULONGLONG count = s->count;
+        if (count == 0) continue;
+        if (s->max > d->max) d->max = s->max;
+        d->count += count;
+        d->sum += s->sum;
+        for (int i = 0; i < HIST_BUCKETS; i++) d->buckets[i] += s->buckets[i];
+    }
+}
+
+void Metrics_Diff(Metrics *dst, const Metrics *cur, const Metrics *prev)
+{
+    for (int id = 0; id < METRIC_COUNT; id++) {
+        Histogram *d = &dst->hist[id];
+        const Histogram *c = &cur->hist[id];
+        const Histogram *p = &prev->hist[id];
+        memset(d, 0, sizeof *d);
+        int last = -1;
+        for (int i = 0; i < HIST_BUCKETS; i++) {
+            d->buckets[i] = c->buckets[i] - p->buckets[i];
+            d->count += d->buckets[i];
+            if (d->buckets[i]) last = i;
+        }
+        if (last < 0) continue;
+        d->sum = c->sum - p->sum;
+        d->max = BucketLow(last) + BucketWidth(last) - 1;
+        if (d->max > c->max) d->max = c->max;
+    }
+}
+
+void Metrics_Print(FILE *f, const char *title, const Metrics *m, double seconds)
+{
+    static const double pct[] = { 50, 90, 99, 99.9 };
+
+    fprintf(f, "%-12s %10s %9s %9s %9s %9s %9s %9s\n",
+            title, "count", "p50", "p90", "p99", "p99.9", "max", "mean");
+    for (int id = 0; id < METRIC_COUNT; id++) {
+        const Histogram *h = &m->hist[id];
+        if (h->count == 0) continue;
+        double scale = kMetricInfo[id].isTime ? 1e-3 : 1.0;
+        fprintf(f, "%-12s %10llu", kMetricInfo[id].name, h->count);
+        for (size_t i = 0; i < ARRAYSIZE(pct); i++) {
+            fprintf(f, " %9.1f", Histogram_Percentile(h, pct[i]) * scale);
+        }
+        fprintf(f, " %9.1f %9.1f\n", h->max * scale, (double)h->sum / (double)h->count * scale);
+    }
+
+    // Every successful RefreshData with rows records one batch size
+    const Histogram *rows = &m->hist[METRIC_BATCH_ROWS];
+    if (seconds > 0) {
+        fprintf(f, "%llu batches (%.0f/s), %llu rows (%.0f/s), largest batch %llu, times in us\n",
+                rows->count, rows->count / seconds, rows->sum, rows->sum / seconds, rows->max);
+    }
+}
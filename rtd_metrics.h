@@ -0,0 +1,90 @@
+// rtd_metrics.h - Latency histograms for the update path
+// Each stage of an update's trip (UpdateNotify to wakeup, RefreshData,
+// dispatch, ring queueing, formatting, the sink write) is timed with
+// RtdNowNs() and recorded into a log-linear histogram: 32 buckets per
+// power of two, so any percentile is within about 3% of the true value,
+// from 1 ns up to 2^40 ns. Recording is a bit scan, three adds and a
+// compare.
+//
+// A Metrics block has a single writer thread. Other threads may read it
+// (Metrics_Merge) while it is being written; they see counts that are at
+// most a few records behind.
+//
+// Build with -DRTD_NO_METRICS to compile the METRIC_* hooks out entirely.
+
+#ifndef __RTD_METRICS_H__
+#define __RTD_METRICS_H__
+
+#include <stdio.h>
+#include "rtd_compat.h"
+
+#define HIST_SUB_BITS 5
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 40        // Larger values land in the top bucket
+#define HIST_BUCKETS  ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct Histogram {
+    ULONGLONG count;
+    ULONGLONG sum;
+    ULONGLONG max;          // Exact; the minimum only to bucket precision
+    ULONGLONG buckets[HIST_BUCKETS];
+} Histogram;
+
+static inline int Histogram_Bucket(ULONGLONG v)
+{
+    if (v < HIST_SUB) return (int)v;
+    int shift = RtdMsb64(v) - HIST_SUB_BITS;
+    int index = (shift + 1) * HIST_SUB + (int)((v >> shift) - HIST_SUB);
+    return index < HIST_BUCKETS ? index : HIST_BUCKETS - 1;
+}
+
+static inline void Histogram_Record(Histogram *h, ULONGLONG v)
+{
+    h->buckets[Histogram_Bucket(v)]++;
+    h->count++;
+    h->sum += v;
+    if (v > h->max) h->max = v;
+}
+
+// Value at percentile p (0-100), reported as the middle of its bucket
+ULONGLONG Histogram_Percentile(const Histogram *h, double p);
+
+typedef enum {
+    METRIC_WAKE = 0,    // UpdateNotify to the RTD thread waking (event mode)
+    METRIC_REFRESH,     // RefreshData calls that returned rows
+    METRIC_DISPATCH,    // Decoding and routing a batch into the rings
+    METRIC_QUEUE,       // Per update: RefreshData return to a worker popping it
+    METRIC_FORMAT,      // Formatting one popped batch
+    METRIC_WRITE,       // One write to the output sink
+    METRIC_END_TO_END,  // Oldest update in a write: RefreshData return to written
+    METRIC_BATCH_ROWS,  // Rows per RefreshData batch
+    METRIC_RING_DEPTH,  // Updates queued when a worker pops
+    METRIC_COUNT
+} MetricId;
+
+typedef struct Metrics {
+    Histogram hist[METRIC_COUNT];
+} Metrics;
+
+void Metrics_Reset(Metrics *m);
+
+// Add src into dst (src may be live on another thread)
+void Metrics_Merge(Metrics *dst, const Metrics *src);
+
+// dst = cur - prev, for reporting the interval between two snapshots.
+// The interval max comes from the buckets, so it is within 3%.
+void Metrics_Diff(Metrics *dst, const Metrics *cur, const Metrics *prev);
+
+// One line per non-empty stage (percentiles in microseconds) plus batch
+// and row rates over seconds
+void Metrics_Print(FILE *f, const char *title, const Metrics *m, double seconds);
+
+#ifndef RTD_NO_METRICS
+#define METRIC_STAMP(var)           ULONGLONG var = RtdNowNs()
+#define METRIC_RECORD(m, id, value) Histogram_Record(&(m)->hist[id], (value))
+#else
+#define METRIC_STAMP(var)
+#define METRIC_RECORD(m, id, value) ((void)0)
+#endif
+
+#endif /* __RTD_METRICS_H__ */
@@ -0,0 +1,1242 @@
+/**
+ * rtd_net.c - Local network fan-out of RTD updates
+ *
+ * The network thread keeps the latest value of every topic and, per topic,
+ * the clients subscribed to it. An update is encoded once and copied into
+ * each subscriber's send buffer. When a buffer has no room, the client's
+ * membership of that topic is marked dirty and the topic ID queued; later
+ * updates to a dirty topic only replace the cached value. As the socket
+ * drains, the dirty queue is replayed from the cache in FIFO order, so a
+ * slow client gets every topic's latest value and never more than one
+ * pending update per topic.
+ *
+ * A topic ID can be reused for another pair once the RTD thread removes a
+ * subscription. NetServer_Define stamps the new name with the time it was
+ * given; updates stamped earlier belong to the old pair and are dropped.
+ * The network thread pops a batch of updates before it reads the mailbox,
+ * so a definition always reaches it before any update that follows it.
+ */
+
+#ifdef _WIN32
+#include <winsock2.h>       // Before windows.h, which would pull in winsock 1
+#include <ws2tcpip.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtd_net.h"
+
+#ifdef _WIN32
+typedef SOCKET NetSock;
+typedef WSAPOLLFD NetPollFd;
+#define NET_INVALID         INVALID_SOCKET
+#define NetClose(s)         closesocket(s)
+#define NetPoll(fds, n, ms) WSAPoll((fds), (ULONG)(n), (ms))
+#define NetWouldBlock()     (WSAGetLastError() == WSAEWOULDBLOCK)
+#else
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int NetSock;
+typedef struct pollfd NetPollFd;
+#define NET_INVALID         (-1)
+#define NetClose(s)         close(s)
+#define NetPoll(fds, n, ms) poll((fds), (nfds_t)(n), (ms))
+#define NetWouldBlock()     (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define NET_BATCH           256                 // Updates popped per loop
+#define NET_IN_BUFFER       1024                // Bytes of requests buffered per client
+#define NET_CONTROL_RESERVE 4096                // Send buffer kept for control frames
+#define NET_MAX_FRAME       (NET_HEADER_SIZE + 5 + NET_MAX_TEXT)
+#define NET_DATAGRAM        1400
+#define NET_IDLE_MS         100
+#define NET_ANNOUNCE_NS     1000000000ULL       // Multicast DEFINE sweep period
+#define NET_ANNOUNCE_BATCH  64                  // DEFINE frames per loop while sweeping
+
+// Mailbox operations
+enum {
+    NET_MSG_SUBSCRIBE = 1,  // -> RTD: client wants symbol x topic
+    NET_MSG_RELEASE,        // -> RTD: one client reference to topicID is gone
+    NET_MSG_SUBSCRIBED,     // -> net: answer to NET_MSG_SUBSCRIBE
+    NET_MSG_DEFINE,         // -> net: topicID names symbol x topic since sinceNs
+    NET_MSG_CLEAR           // -> net: topicID names nothing
+};
+
+typedef struct NetMember {
+    long client;
+    BYTE dirty;             // Latest value is waiting in the client's dirty queue
+} NetMember;
+
+typedef struct NetTopic {
+    RtdUpdate  last;        // Latest value, VT_EMPTY if none
+    ULONGLONG  sinceNs;     // When the topic ID got its current name
+    BOOL       defined;
+    char       symbol[NET_SYMBOL_MAX];
+    char       topic[NET_TOPIC_MAX];
+    NetMember *members;
+    long       memberCount;
+    long       memberCap;
+} NetTopic;
+
+typedef struct NetClient {
+    NetSock    sock;        // NET_INVALID when the slot is free
+    ULONG      gen;         // Bumped whenever the slot is closed
+    BYTE      *out;         // bufferBytes + NET_CONTROL_RESERVE
+    ULONG      outHead;
+    ULONG      outLen;
+    BYTE       in[NET_IN_BUFFER];
+    ULONG      inLen;
+    BOOL       blocked;     // Last send would block; wait for POLLOUT
+    long      *dirty;       // Topic IDs waiting for buffer space, FIFO
+    long       dirtyHead;
+    long       dirtyCount;
+    long       dirtyCap;
+    long      *held;        // Topic IDs subscribed
+    long       heldCount;
+    long       heldCap;
+} NetClient;
+
+typedef struct NetIo {
+    NetSock            listenSock;
+    NetSock            wakeRecv;
+    NetSock            mcastSock;
+    struct sockaddr_in mcastAddr;
+    BYTE               datagram[NET_DATAGRAM];
+    ULONG              datagramLen;
+    long               announceNext;
+    ULONGLONG          announceNs;
+    NetTopic          *topics;
+    long               topicCap;
+    NetClient         *clients;
+    NetPollFd         *fds;
+    long              *fdClient;
+    BOOL               posted;      // Requests posted since the RTD thread was last woken
+    RtdUpdate          batch[NET_BATCH];
+} NetIo;
+
+// ---- wire helpers ----
+
+static void Put16(BYTE *p, ULONG v)
+{
+    p[0] = (BYTE)v;
+    p[1] = (BYTE)(v >> 8);
+}
+
+static void Put32(BYTE *p, ULONG v)
+{
+    for (int i = 0; i < 4; i++) p[i] = (BYTE)(v >> (8 * i));
+}
+
+static void Put64(BYTE *p, ULONGLONG v)
+{
+    for (int i = 0; i < 8; i++) p[i] = (BYTE)(v >> (8 * i));
+}
+
+static ULONG Get16(const BYTE *p)
+{
+    return (ULONG)p[0] | ((ULONG)p[1] << 8);
+}
+
+static ULONG Get32(const BYTE *p)
+{
+    return (ULONG)p[0] | ((ULONG)p[1] << 8) | ((ULONG)p[2] << 16) | ((ULONG)p[3] << 24);
+}
+
+static ULONGLONG Get64(const BYTE *p)
+{
+    ULONGLONG v = 0;
+    for (int i = 7; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+/**
+ * Write a frame with two length-prefixed names after a 4-byte field
+ * (NET_SUBSCRIBE, NET_DEFINE); returns its size
+ */
+static ULONG EncodeNamed(BYTE *p, BYTE type, ULONG field, const char *symbol, const char *topic)
+{
+    size_t n = strlen(symbol), m = strlen(topic);
+    ULONG size = (ULONG)(NET_HEADER_SIZE + 4 + 1 + n + 1 + m);
+    Put16(p, size);
+    p[2] = type;
+    Put32(p + 3, field);
+    p[7] = (BYTE)n;
+    memcpy(p + 8, symbol, n);
+    p[8 + n] = (BYTE)m;
+    memcpy(p + 9 + n, topic, m);
+    return size;
+}
+
+/**
+ * Write the NET_UPDATE frame for u; returns its size
+ */
+static ULONG EncodeUpdate(BYTE *p, const RtdUpdate *u)
+{
+    p[2] = NET_UPDATE;
+    p[3] = (BYTE)u->vt;
+    Put32(p + 4, (ULONG)u->topicID);
+    if (u->vt != VT_BSTR) {
+        Put16(p, NET_UPDATE_SIZE);
+        Put64(p + 8, (ULONGLONG)u->llVal);
+        return NET_UPDATE_SIZE;
+    }
+    size_t n = u->bstrVal ? RtdWideToUtf8(u->bstrVal, SysStringLen(u->bstrVal), (char*)p + 8, NET_MAX_TEXT) : 0;
+    Put16(p, (ULONG)(8 + n));
+    return (ULONG)(8 + n);
+}
+
+long NetFrame_Parse(const BYTE *p, size_t len, NetFrame *f)
+{
+    if (len < NET_HEADER_SIZE) return 0;
+    size_t size = Get16(p);
+    if (size < NET_HEADER_SIZE) return -1;
+    if (len < size) return 0;
+
+    memset(f, 0, sizeof *f);
+    f->type = p[2];
+    const BYTE *body = p + NET_HEADER_SIZE;
+    size_t bodyLen = size - NET_HEADER_SIZE;
+    switch (f->type) {
+        case NET_SUBSCRIBE:
+        case NET_DEFINE: {
+            if (bodyLen < 6) return -1;
+            ULONG field = Get32(body);
+            if (f->type == NET_SUBSCRIBE) f->requestID = field; else f->topicID = (long)field;
+            f->symbolLen = body[4];
+            if (bodyLen < 5 + f->symbolLen + 1) return -1;
+            f->symbol = (const char*)body + 5;
+            f->topicLen = body[5 + f->symbolLen];
+            if (bodyLen != 6 + f->symbolLen + f->topicLen) return -1;
+            f->topic = (const char*)body + 6 + f->symbolLen;
+            break;
+        }
+        case NET_UNSUBSCRIBE:
+        case NET_GONE:
+            if (bodyLen != 4) return -1;
+            f->topicID = (long)Get32(body);
+            break;
+        case NET_SUBSCRIBED:
+            if (bodyLen != 8) return -1;
+            f->requestID = Get32(body);
+            f->topicID = (long)Get32(body + 4);
+            break;
+        case NET_UPDATE:
+            if (bodyLen < 5) return -1;
+            f->vt = body[0];
+            f->topicID = (long)Get32(body + 1);
+            if (f->vt == VT_BSTR) {
+                f->text = (const char*)body + 5;
+                f->textLen = bodyLen - 5;
+            } else {
+                if (bodyLen != 13) return -1;
+                f->i64 = (LONGLONG)Get64(body + 5);
+            }
+            break;
+        default:
+            return -1;
+    }
+    return (long)size;
+}
+
+// ---- sockets ----
+
+static BOOL NetStartup(void)
+{
+#ifdef _WIN32
+    WSADATA wsa;
+    return WSAStartup(MAKEWORD(2, 2), &wsa) == 0;
+#else
+    return TRUE;
+#endif
+}
+
+static void NetCleanup(void)
+{
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+static BOOL SetNonBlocking(NetSock s)
+{
+#ifdef _WIN32
+    u_long on = 1;
+    return ioctlsocket(s, FIONBIO, &on) == 0;
+#else
+    int flags = fcntl(s, F_GETFL, 0);
+    return flags >= 0 && fcntl(s, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+static void SetNoDelay(NetSock s)
+{
+    int on = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&on, sizeof on);
+}
+
+static BOOL MakeAddr(struct sockaddr_in *addr, const char *host, USHORT port)
+{
+    memset(addr, 0, sizeof *addr);
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+    return inet_pton(AF_INET, host, &addr->sin_addr) == 1;
+}
+
+/**
+ * Send a whole buffer on a blocking socket
+ */
+static BOOL SendAll(NetSock s, const BYTE *p, size_t len)
+{
+    while (len > 0) {
+        int n = (int)send(s, (const char*)p, (int)len, MSG_NOSIGNAL);
+        if (n <= 0) return FALSE;
+        p += n;
+        len -= (size_t)n;
+    }
+    return TRUE;
+}
+
+/**
+ * End the network thread's poll, if it is in one (any thread)
+ */
+static void Kick(NetServer *ns)
+{
+    if (InterlockedCompareExchange(&ns->sleeping, 0, 1) == 1) {
+        send((NetSock)ns->wakeSock, "", 1, MSG_NOSIGNAL);
+    }
+}
+
+// ---- mailboxes ----
+
+static void Mailbox_Init(NetMailbox *mb)
+{
+    memset(mb, 0, sizeof *mb);
+    RtdMutex_Init(&mb->lock);
+}
+
+static void Mailbox_Free(NetMailbox *mb)
+{
+    free(mb->items);
+    free(mb->spare);
+    RtdMutex_Free(&mb->lock);
+    memset(mb, 0, sizeof *mb);
+}
+
+static BOOL Mailbox_Post(NetMailbox *mb, const NetMsg *m)
+{
+    BOOL ok = TRUE;
+    RtdMutex_Lock(&mb->lock);
+    if (mb->count == mb->capacity) {
+        long cap = mb->capacity ? mb->capacity * 2 : 256;
+        NetMsg *grown = (NetMsg*)realloc(mb->items, (size_t)cap * sizeof *grown);
+        if (grown) {
+            mb->items = grown;
+            mb->capacity = cap;
+        } else {
+            ok = FALSE;
+        }
+    }
+    if (ok) mb->items[mb->count++] = *m;
+    RtdMutex_Unlock(&mb->lock);
+    return ok;
+}
+
+/**
+ * Take every posted message; *out stays valid until the next Take
+ */
+static long Mailbox_Take(NetMailbox *mb, NetMsg **out)
+{
+    RtdMutex_Lock(&mb->lock);
+    NetMsg *items = mb->items;
+    long cap = mb->capacity;
+    long count = mb->count;
+    mb->items = mb->spare;
+    mb->capacity = mb->spareCapacity;
+    mb->count = 0;
+    mb->spare = items;
+    mb->spareCapacity = cap;
+    RtdMutex_Unlock(&mb->lock);
+    *out = items;
+    return count;
+}
+
+static BOOL Mailbox_Pending(NetMailbox *mb)
+{
+    RtdMutex_Lock(&mb->lock);
+    BOOL pending = mb->count > 0;
+    RtdMutex_Unlock(&mb->lock);
+    return pending;
+}
+
+static void CopyName(char *dst, size_t cap, const char *src, size_t len)
+{
+    if (len >= cap) len = cap - 1;
+    memcpy(dst, src, len);
+    dst[len] = 0;
+}
+
+// ---- network thread ----
+
+static NetTopic* EnsureTopic(NetIo *io, long topicID)
+{
+    if (topicID <= 0) return NULL;
+    if (topicID >= io->topicCap) {
+        long cap = io->topicCap ? io->topicCap : 1024;
+        while (cap <= topicID) cap *= 2;
+        NetTopic *grown = (NetTopic*)realloc(io->topics, (size_t)cap * sizeof *grown);
+        if (!grown) return NULL;
+        memset(grown + io->topicCap, 0, (size_t)(cap - io->topicCap) * sizeof *grown);
+        io->topics = grown;
+        io->topicCap = cap;
+    }
+    return &io->topics[topicID];
+}
+
+static NetTopic* GetTopic(NetIo *io, long topicID)
+{
+    return topicID > 0 && topicID < io->topicCap ? &io->topics[topicID] : NULL;
+}
+
+static NetMember* FindMember(NetTopic *t, long client)
+{
+    for (long i = 0; i < t->memberCount; i++) {
+        if (t->members[i].client == client) return &t->members[i];
+    }
+    return NULL;
+}
+
+static BOOL PushLong(long **arr, long *count, long *cap, long v)
+{
+    if (*count == *cap) {
+        long grown = *cap ? *cap * 2 : 16;
+        long *p = (long*)realloc(*arr, (size_t)grown * sizeof *p);
+        if (!p) return FALSE;
+        *arr = p;
+        *cap = grown;
+    }
+    (*arr)[(*count)++] = v;
+    return TRUE;
+}
+
+static BOOL AddMember(NetIo *io, NetTopic *t, long topicID, long client)
+{
+    NetClient *c = &io->clients[client];
+    if (t->memberCount == t->memberCap) {
+        long cap = t->memberCap ? t->memberCap * 2 : 4;
+        NetMember *grown = (NetMember*)realloc(t->members, (size_t)cap * sizeof *grown);
+        if (!grown) return FALSE;
+        t->members = grown;
+        t->memberCap = cap;
+    }
+    if (!PushLong(&c->held, &c->heldCount, &c->heldCap, topicID)) return FALSE;
+    t->members[t->memberCount].client = client;
+    t->members[t->memberCount].dirty = 0;
+    t->memberCount++;
+    return TRUE;
+}
+
+/**
+ * Drop client from topicID; FALSE if it was not subscribed. A queued
+ * dirty entry is skipped later because the membership is gone.
+ */
+static BOOL RemoveMember(NetIo *io, long topicID, long client)
+{
+    NetTopic *t = GetTopic(io, topicID);
+    NetMember *m = t ? FindMember(t, client) : NULL;
+    if (!m) return FALSE;
+    *m = t->members[--t->memberCount];
+
+    NetClient *c = &io->clients[client];
+    for (long i = 0; i < c->heldCount; i++) {
+        if (c->held[i] == topicID) {
+            c->held[i] = c->held[--c->heldCount];
+            break;
+        }
+    }
+    return TRUE;
+}
+
+static void PostRelease(NetServer *ns, long topicID)
+{
+    NetMsg m;
+    memset(&m, 0, sizeof m);
+    m.op = NET_MSG_RELEASE;
+    m.topicID = topicID;
+    Mailbox_Post(&ns->toRtd, &m);
+    ns->io->posted = TRUE;
+}
+
+/**
+ * Copy a frame into a client's send buffer. Updates may use bufferBytes;
+ * control frames may also use the reserve behind it.
+ */
+static BOOL Append(NetServer *ns, NetClient *c, const BYTE *frame, ULONG size, BOOL control)
+{
+    ULONG cap = ns->cfg.bufferBytes + (control ? NET_CONTROL_RESERVE : 0);
+    if (c->outLen + size > cap) {
+        if (c->outLen - c->outHead + size > cap) return FALSE;
+        memmove(c->out, c->out + c->outHead, c->outLen - c->outHead);
+        c->outLen -= c->outHead;
+        c->outHead = 0;
+    }
+    memcpy(c->out + c->outLen, frame, size);
+    c->outLen += size;
+    ns->framesSent++;
+    return TRUE;
+}
+
+static void CloseClient(NetServer *ns, long client)
+{
+    NetIo *io = ns->io;
+    NetClient *c = &io->clients[client];
+    if (c->sock == NET_INVALID) return;
+    while (c->heldCount > 0) {
+        long topicID = c->held[c->heldCount - 1];
+        RemoveMember(io, topicID, client);
+        PostRelease(ns, topicID);
+    }
+    NetClose(c->sock);
+    c->sock = NET_INVALID;
+    c->gen++;
+    c->outHead = c->outLen = 0;
+    c->inLen = 0;
+    c->dirtyHead = c->dirtyCount = 0;
+    c->blocked = FALSE;
+    ns->closed++;
+}
+
+/**
+ * Queue a control frame; a client too far behind to take one is closed
+ */
+static void SendControl(NetServer *ns, long client, const BYTE *frame, ULONG size)
+{
+    if (!Append(ns, &ns->io->clients[client], frame, size, TRUE)) CloseClient(ns, client);
+}
+
+static void FlushDatagram(NetServer *ns)
+{
+    NetIo *io = ns->io;
+    if (io->datagramLen == 0) return;
+    sendto(io->mcastSock, (const char*)io->datagram, (int)io->datagramLen, 0,
+           (const struct sockaddr*)&io->mcastAddr, sizeof io->mcastAddr);
+    io->datagramLen = 0;
+    ns->datagrams++;
+}
+
+static void AppendDatagram(NetServer *ns, const BYTE *frame, ULONG size)
+{
+    NetIo *io = ns->io;
+    if (io->datagramLen + size > NET_DATAGRAM) FlushDatagram(ns);
+    memcpy(io->datagram + io->datagramLen, frame, size);
+    io->datagramLen += size;
+}
+
+static void AnnounceTopic(NetServer *ns, long topicID, const NetTopic *t)
+{
+    BYTE frame[NET_HEADER_SIZE + 6 + NET_SYMBOL_MAX + NET_TOPIC_MAX];
+    AppendDatagram(ns, frame, EncodeNamed(frame, NET_DEFINE, (ULONG)topicID, t->symbol, t->topic));
+}
+
+/**
+ * Drop every client from a topic, telling them it is gone
+ */
+static void EvictMembers(NetServer *ns, long topicID, NetTopic *t)
+{
+    BYTE frame[NET_HEADER_SIZE + 4];
+    Put16(frame, sizeof frame);
+    frame[2] = NET_GONE;
+    Put32(frame + 3, (ULONG)topicID);
+    while (t->memberCount > 0) {
+        long client = t->members[t->memberCount - 1].client;
+        RemoveMember(ns->io, topicID, client);
+        SendControl(ns, client, frame, sizeof frame);
+    }
+}
+
+/**
+ * Fan one update out to the multicast group and every subscriber
+ */
+static void ApplyUpdate(NetServer *ns, RtdUpdate *u)
+{
+    NetIo *io = ns->io;
+    NetTopic *t = GetTopic(io, u->topicID);
+    if (!t || !t->defined || u->recvNs < t->sinceNs) {
+        ns->stale++;
+        RtdUpdate_Clear(u);
+        return;
+    }
+    RtdUpdate_Clear(&t->last);
+    t->last = *u;
+
+    BYTE frame[NET_MAX_FRAME];
+    ULONG size = EncodeUpdate(frame, &t->last);
+    if (io->mcastSock != NET_INVALID) AppendDatagram(ns, frame, size);
+
+    for (long i = 0; i < t->memberCount; i++) {
+        NetMember *m = &t->members[i];
+        NetClient *c = &io->clients[m->client];
+        if (m->dirty) {
+            ns->conflated++;
+            continue;
+        }
+        // Behind already: keep FIFO order by queueing behind the others
+        if (c->dirtyCount == 0 && Append(ns, c, frame, size, FALSE)) continue;
+        if (PushLong(&c->dirty, &c->dirtyCount, &c->dirtyCap, u->topicID)) m->dirty = 1;
+    }
+}
+
+/**
+ * Move dirty topics into the send buffer while it has room
+ */
+static void Refill(NetServer *ns, long client)
+{
+    NetIo *io = ns->io;
+    NetClient *c = &io->clients[client];
+    BYTE frame[NET_MAX_FRAME];
+    while (c->dirtyHead < c->dirtyCount) {
+        long topicID = c->dirty[c->dirtyHead];
+        NetTopic *t = GetTopic(io, topicID);
+        NetMember *m = t ? FindMember(t, client) : NULL;
+        if (m && m->dirty) {
+            if (t->last.vt != VT_EMPTY && !Append(ns, c, frame, EncodeUpdate(frame, &t->last), FALSE)) break;
+            m->dirty = 0;
+        }
+        c->dirtyHead++;
+    }
+    if (c->dirtyHead == c->dirtyCount) c->dirtyHead = c->dirtyCount = 0;
+}
+
+/**
+ * Write as much of a client's buffer as the socket takes
+ */
+static void Pump(NetServer *ns, long client)
+{
+    NetClient *c = &ns->io->clients[client];
+    for (;;) {
+        if (c->dirtyCount > 0) Refill(ns, client);
+        if (c->outHead == c->outLen) return;
+        int n = (int)send(c->sock, (const char*)c->out + c->outHead, (int)(c->outLen - c->outHead), MSG_NOSIGNAL);
+        if (n <= 0) {
+            if (n < 0 && NetWouldBlock()) c->blocked = TRUE;
+            else CloseClient(ns, client);
+            return;
+        }
+        ns->bytesSent += (ULONGLONG)n;
+        c->outHead += (ULONG)n;
+        if (c->outHead == c->outLen) c->outHead = c->outLen = 0;
+    }
+}
+
+static void HandleSubscribed(NetServer *ns, const NetMsg *msg)
+{
+    NetIo *io = ns->io;
+    NetClient *c = &io->clients[msg->client];
+    if (c->sock == NET_INVALID || c->gen != msg->clientGen) {
+        if (msg->topicID) PostRelease(ns, msg->topicID);
+        return;
+    }
+
+    BYTE frame[NET_MAX_FRAME];
+    Put16(frame, NET_HEADER_SIZE + 8);
+    frame[2] = NET_SUBSCRIBED;
+    Put32(frame + 3, msg->requestID);
+    Put32(frame + 7, (ULONG)msg->topicID);
+
+    NetTopic *t = msg->topicID ? EnsureTopic(io, msg->topicID) : NULL;
+    BOOL again = t && FindMember(t, msg->client);
+    if (msg->topicID && (again || !t || !AddMember(io, t, msg->topicID, msg->client))) {
+        // Already subscribed (or out of memory): the hub counted one reference too many
+        PostRelease(ns, msg->topicID);
+        if (!again) Put32(frame + 7, 0);
+        t = NULL;
+    }
+    SendControl(ns, msg->client, frame, NET_HEADER_SIZE + 8);
+
+    // Start the new subscriber off with the cached value
+    if (t && t->defined && t->last.vt != VT_EMPTY && c->sock != NET_INVALID) {
+        ULONG size = EncodeUpdate(frame, &t->last);
+        NetMember *m = FindMember(t, msg->client);
+        if (c->dirtyCount > 0 || !Append(ns, c, frame, size, FALSE)) {
+            if (PushLong(&c->dirty, &c->dirtyCount, &c->dirtyCap, msg->topicID)) m->dirty = 1;
+        }
+    }
+}
+
+/**
+ * Answers, definitions and removals from the RTD thread
+ */
+static void HandleMessages(NetServer *ns)
+{
+    NetIo *io = ns->io;
+    NetMsg *msgs;
+    long n = Mailbox_Take(&ns->toNet, &msgs);
+    for (long i = 0; i < n; i++) {
+        const NetMsg *msg = &msgs[i];
+        NetTopic *t;
+        switch (msg->op) {
+            case NET_MSG_SUBSCRIBED:
+                HandleSubscribed(ns, msg);
+                break;
+            case NET_MSG_DEFINE:
+                if (!(t = EnsureTopic(io, msg->topicID))) break;
+                // Reconnecting the same pair keeps its subscribers and value
+                if (t->defined && strcmp(t->symbol, msg->symbol) == 0 && strcmp(t->topic, msg->topic) == 0) break;
+                EvictMembers(ns, msg->topicID, t);
+                RtdUpdate_Clear(&t->last);
+                t->defined = TRUE;
+                t->sinceNs = msg->sinceNs;
+                memcpy(t->symbol, msg->symbol, sizeof t->symbol);
+                memcpy(t->topic, msg->topic, sizeof t->topic);
+                if (io->mcastSock != NET_INVALID) AnnounceTopic(ns, msg->topicID, t);
+                break;
+            case NET_MSG_CLEAR:
+                if (!(t = GetTopic(io, msg->topicID))) break;
+                EvictMembers(ns, msg->topicID, t);
+                RtdUpdate_Clear(&t->last);
+                t->defined = FALSE;
+                break;
+        }
+    }
+}
+
+/**
+ * Parse and act on the requests buffered for a client
+ */
+static void HandleRequests(NetServer *ns, long client)
+{
+    NetClient *c = &ns->io->clients[client];
+    ULONG pos = 0;
+    NetFrame f;
+    long size;
+    while ((size = NetFrame_Parse(c->in + pos, c->inLen - pos, &f)) > 0) {
+        pos += (ULONG)size;
+        if (f.type == NET_SUBSCRIBE) {
+            if (f.symbolLen == 0 || f.symbolLen >= NET_SYMBOL_MAX ||
+                f.topicLen == 0 || f.topicLen >= NET_TOPIC_MAX) {
+                BYTE frame[NET_HEADER_SIZE + 8];
+                Put16(frame, sizeof frame);
+                frame[2] = NET_SUBSCRIBED;
+                Put32(frame + 3, f.requestID);
+                Put32(frame + 7, 0);
+                SendControl(ns, client, frame, sizeof frame);
+                continue;
+            }
+            NetMsg m;
+            memset(&m, 0, sizeof m);
+            m.op = NET_MSG_SUBSCRIBE;
+            m.client = client;
+            m.clientGen = c->gen;
+            m.requestID = f.requestID;
+            CopyName(m.symbol, sizeof m.symbol, f.symbol, f.symbolLen);
+            CopyName(m.topic, sizeof m.topic, f.topic, f.topicLen);
+            Mailbox_Post(&ns->toRtd, &m);
+            ns->io->posted = TRUE;
+        } else if (f.type == NET_UNSUBSCRIBE) {
+            if (RemoveMember(ns->io, f.topicID, client)) PostRelease(ns, f.topicID);
+        } else {
+            size = -1;
+            break;
+        }
+        if (c->sock == NET_INVALID) return;
+    }
+    // A malformed frame, or one that can never fit the buffer, ends the session
+    if (size < 0 || (pos == 0 && c->inLen == sizeof c->in)) {
+        CloseClient(ns, client);
+        return;
+    }
+    memmove(c->in, c->in + pos, c->inLen - pos);
+    c->inLen -= pos;
+}
+
+static void ReadClient(NetServer *ns, long client)
+{
+    NetClient *c = &ns->io->clients[client];
+    int n = (int)recv(c->sock, (char*)c->in + c->inLen, (int)(sizeof c->in - c->inLen), 0);
+    if (n <= 0) {
+        if (n < 0 && NetWouldBlock()) return;
+        CloseClient(ns, client);
+        return;
+    }
+    c->inLen += (ULONG)n;
+    HandleRequests(ns, client);
+}
+
+static void AcceptClients(NetServer *ns)
+{
+    NetIo *io = ns->io;
+    for (;;) {
+        NetSock s = accept(io->listenSock, NULL, NULL);
+        if (s == NET_INVALID) return;
+
+        long slot = -1;
+        for (long i = 0; i < ns->cfg.maxClients; i++) {
+            if (io->clients[i].sock == NET_INVALID) {
+                slot = i;
+                break;
+            }
+        }
+        NetClient *c = slot >= 0 ? &io->clients[slot] : NULL;
+        if (c && !c->out) c->out = (BYTE*)malloc(ns->cfg.bufferBytes + NET_CONTROL_RESERVE);
+        if (!c || !c->out || !SetNonBlocking(s)) {
+            NetClose(s);
+            continue;
+        }
+        // Keep the kernel's unconflated queue no larger than ours
+        int sndbuf = (int)ns->cfg.bufferBytes;
+        setsockopt(s, SOL_SOCKET, SO_SNDBUF, (const char*)&sndbuf, sizeof sndbuf);
+        SetNoDelay(s);
+        c->sock = s;
+        ns->accepted++;
+    }
+}
+
+/**
+ * Send a sweep of DEFINE frames so late multicast listeners learn names
+ */
+static void Announce(NetServer *ns, ULONGLONG nowNs)
+{
+    NetIo *io = ns->io;
+    if (nowNs < io->announceNs) return;
+    for (int sent = 0; sent < NET_ANNOUNCE_BATCH && io->announceNext < io->topicCap; io->announceNext++) {
+        NetTopic *t = &io->topics[io->announceNext];
+        if (!t->defined) continue;
+        AnnounceTopic(ns, io->announceNext, t);
+        sent++;
+    }
+    if (io->announceNext >= io->topicCap) {
+        io->announceNext = 1;
+        io->announceNs = nowNs + NET_ANNOUNCE_NS;
+    }
+}
+
+/**
+ * Wait for socket events (or a Kick) and handle them
+ */
+static void PollSockets(NetServer *ns, int timeoutMs)
+{
+    NetIo *io = ns->io;
+    long n = 0;
+    io->fds[n].fd = io->listenSock;
+    io->fds[n].events = POLLIN;
+    io->fdClient[n++] = -1;
+    io->fds[n].fd = io->wakeRecv;
+    io->fds[n].events = POLLIN;
+    io->fdClient[n++] = -1;
+    for (long i = 0; i < ns->cfg.maxClients; i++) {
+        NetClient *c = &io->clients[i];
+        if (c->sock == NET_INVALID) continue;
+        io->fds[n].fd = c->sock;
+        io->fds[n].events = POLLIN | (c->outLen > c->outHead ? POLLOUT : 0);
+        io->fdClient[n++] = i;
+    }
+    for (long i = 0; i < n; i++) io->fds[i].revents = 0;
+
+    if (timeoutMs > 0) {
+        InterlockedExchange(&ns->sleeping, 1);
+        if (UpdateRing_Depth(&ns->ring) > 0 || Mailbox_Pending(&ns->toNet) || ns->stop) timeoutMs = 0;
+    }
+    int ready = NetPoll(io->fds, n, timeoutMs);
+    InterlockedExchange(&ns->sleeping, 0);
+    if (ready <= 0) return;
+
+    if (io->fds[1].revents) {
+        char drain[64];
+        while (recv(io->wakeRecv, drain, sizeof drain, 0) > 0) { }
+    }
+    for (long i = 2; i < n; i++) {
+        long client = io->fdClient[i];
+        short ev = io->fds[i].revents;
+        if (!ev || io->clients[client].sock != io->fds[i].fd) continue;
+        if (ev & (POLLIN | POLLHUP | POLLERR)) ReadClient(ns, client);
+        if ((ev & POLLOUT) && io->clients[client].sock != NET_INVALID) {
+            io->clients[client].blocked = FALSE;
+            Pump(ns, client);
+        }
+    }
+    if (io->fds[0].revents & POLLIN) AcceptClients(ns);
+}
+
+static void NetThreadProc(void *arg)
+{
+    NetServer *ns = (NetServer*)arg;
+    NetIo *io = ns->io;
+    while (!ns->stop) {
+        // Pop before reading the mailbox: see the comment at the top
+        ULONG n = UpdateRing_Pop(&ns->ring, io->batch, NET_BATCH);
+        HandleMessages(ns);
+        for (ULONG i = 0; i < n; i++) ApplyUpdate(ns, &io->batch[i]);
+
+        if (io->mcastSock != NET_INVALID) {
+            Announce(ns, RtdNowNs());
+            FlushDatagram(ns);
+        }
+        for (long i = 0; i < ns->cfg.maxClients; i++) {
+            NetClient *c = &io->clients[i];
+            if (c->sock != NET_INVALID && !c->blocked && (c->outLen > c->outHead || c->dirtyCount > 0)) Pump(ns, i);
+        }
+        if (io->posted) {
+            io->posted = FALSE;
+            if (ns->wake) ns->wake(ns->wakeCtx);
+        }
+        PollSockets(ns, n == NET_BATCH ? 0 : NET_IDLE_MS);
+    }
+}
+
+static void FreeIo(NetServer *ns)
+{
+    NetIo *io = ns->io;
+    if (!io) return;
+    if (io->listenSock != NET_INVALID) NetClose(io->listenSock);
+    if (io->wakeRecv != NET_INVALID) NetClose(io->wakeRecv);
+    if ((NetSock)ns->wakeSock != NET_INVALID) NetClose((NetSock)ns->wakeSock);
+    if (io->mcastSock != NET_INVALID) NetClose(io->mcastSock);
+    if (io->clients) {
+        for (long i = 0; i < ns->cfg.maxClients; i++) {
+            NetClient *c = &io->clients[i];
+            if (c->sock != NET_INVALID) NetClose(c->sock);
+            free(c->out);
+            free(c->dirty);
+            free(c->held);
+        }
+    }
+    for (long i = 0; i < io->topicCap; i++) {
+        RtdUpdate_Clear(&io->topics[i].last);
+        free(io->topics[i].members);
+    }
+    free(io->topics);
+    free(io->clients);
+    free(io->fds);
+    free(io->fdClient);
+    free(io);
+    ns->io = NULL;
+}
+
+/**
+ * Listening socket, the loopback UDP pair Kick uses, and the multicast
+ * sender
+ */
+static BOOL OpenSockets(NetServer *ns)
+{
+    NetIo *io = ns->io;
+    struct sockaddr_in addr;
+    socklen_t addrLen = sizeof addr;
+    int on = 1;
+
+    if (!MakeAddr(&addr, ns->cfg.bindAddr, ns->cfg.port)) return FALSE;
+    io->listenSock = socket(AF_INET, SOCK_STREAM, 0);
+    if (io->listenSock == NET_INVALID) return FALSE;
+    setsockopt(io->listenSock, SOL_SOCKET, SO_REUSEADDR, (const char*)&on, sizeof on);
+    if (bind(io->listenSock, (struct sockaddr*)&addr, sizeof addr) != 0 ||
+        listen(io->listenSock, SOMAXCONN) != 0 || !SetNonBlocking(io->listenSock) ||
+        getsockname(io->listenSock, (struct sockaddr*)&addr, &addrLen) != 0) {
+        return FALSE;
+    }
+    ns->port = ntohs(addr.sin_port);
+
+    MakeAddr(&addr, "127.0.0.1", 0);
+    addrLen = sizeof addr;
+    io->wakeRecv = socket(AF_INET, SOCK_DGRAM, 0);
+    NetSock wakeSend = socket(AF_INET, SOCK_DGRAM, 0);
+    ns->wakeSock = (uintptr_t)wakeSend;
+    if (io->wakeRecv == NET_INVALID || wakeSend == NET_INVALID ||
+        bind(io->wakeRecv, (struct sockaddr*)&addr, sizeof addr) != 0 ||
+        getsockname(io->wakeRecv, (struct sockaddr*)&addr, &addrLen) != 0 ||
+        connect(wakeSend, (struct sockaddr*)&addr, sizeof addr) != 0 ||
+        !SetNonBlocking(io->wakeRecv) || !SetNonBlocking(wakeSend)) {
+        return FALSE;
+    }
+
+    if (ns->cfg.mcastGroup) {
+        if (!MakeAddr(&io->mcastAddr, ns->cfg.mcastGroup, ns->cfg.mcastPort)) return FALSE;
+        io->mcastSock = socket(AF_INET, SOCK_DGRAM, 0);
+        if (io->mcastSock == NET_INVALID) return FALSE;
+        int ttl = ns->cfg.mcastTtl > 0 ? ns->cfg.mcastTtl : 1;
+        setsockopt(io->mcastSock, IPPROTO_IP, IP_MULTICAST_TTL, (const char*)&ttl, sizeof ttl);
+    }
+    return TRUE;
+}
+
+BOOL NetServer_Start(NetServer *ns, const NetConfig *cfg, SubscriptionTable *subs,
+                     NetConnectFn connect, NetReleaseFn release, void *hookCtx,
+                     NetWakeFn wake, void *wakeCtx)
+{
+    memset(ns, 0, sizeof *ns);
+    ns->cfg = *cfg;
+    if (!ns->cfg.bindAddr) ns->cfg.bindAddr = "127.0.0.1";
+    if (ns->cfg.maxClients <= 0) ns->cfg.maxClients = NET_DEFAULT_CLIENTS;
+    if (ns->cfg.bufferBytes < 4096) ns->cfg.bufferBytes = NET_DEFAULT_BUFFER;
+    if (ns->cfg.ringSize == 0) ns->cfg.ringSize = NET_DEFAULT_RING;
+    ns->subs = subs;
+    ns->connect = connect;
+    ns->release = release;
+    ns->hookCtx = hookCtx;
+    ns->wake = wake;
+    ns->wakeCtx = wakeCtx;
+    ns->wakeSock = (uintptr_t)NET_INVALID;
+    if (!NetStartup()) return FALSE;
+
+    Mailbox_Init(&ns->toRtd);
+    Mailbox_Init(&ns->toNet);
+    NetIo *io = (NetIo*)calloc(1, sizeof *io);
+    ns->io = io;
+    if (io) {
+        io->listenSock = io->wakeRecv = io->mcastSock = NET_INVALID;
+        io->announceNext = 1;
+        io->clients = (NetClient*)calloc((size_t)ns->cfg.maxClients, sizeof *io->clients);
+        io->fds = (NetPollFd*)calloc((size_t)ns->cfg.maxClients + 2, sizeof *io->fds);
+        io->fdClient = (long*)calloc((size_t)ns->cfg.maxClients + 2, sizeof *io->fdClient);
+        if (io->clients) {
+            for (long i = 0; i < ns->cfg.maxClients; i++) io->clients[i].sock = NET_INVALID;
+        }
+    }
+    if (!io || !io->clients || !io->fds || !io->fdClient ||
+        !UpdateRing_Init(&ns->ring, ns->cfg.ringSize, RING_CONFLATE) ||
+        !OpenSockets(ns) || !RtdThread_Start(&ns->thread, NetThreadProc, ns)) {
+        FreeIo(ns);
+        UpdateRing_Free(&ns->ring);
+        Mailbox_Free(&ns->toRtd);
+        Mailbox_Free(&ns->toNet);
+        NetCleanup();
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void NetServer_Stop(NetServer *ns)
+{
+    if (!ns->io) return;
+    InterlockedExchange(&ns->stop, 1);
+    send((NetSock)ns->wakeSock, "", 1, MSG_NOSIGNAL);
+    RtdThread_Join(&ns->thread);
+    FreeIo(ns);
+    UpdateRing_Free(&ns->ring);
+    Mailbox_Free(&ns->toRtd);
+    Mailbox_Free(&ns->toNet);
+    free(ns->refs);
+    free(ns->owned);
+    ns->refs = NULL;
+    ns->owned = NULL;
+    ns->refCap = 0;
+    NetCleanup();
+}
+
+// ---- RTD thread ----
+
+void NetServer_Publish(NetServer *ns, const RtdUpdate *u)
+{
+    RtdUpdate copy = *u;
+    if (u->vt == VT_BSTR && !(u->flags & RTD_UPDATE_SHARED)) {
+        copy.bstrVal = SysAllocStringLen(u->bstrVal, SysStringLen(u->bstrVal));
+        if (!copy.bstrVal) return;
+    }
+    UpdateRing_Push(&ns->ring, &copy);
+    ns->published++;
+}
+
+void NetServer_EndBatch(NetServer *ns)
+{
+    UpdateRing_Flush(&ns->ring);
+    Kick(ns);
+}
+
+void NetServer_Define(NetServer *ns, long topicID, const WCHAR *symbol, const WCHAR *topic)
+{
+    NetMsg m;
+    memset(&m, 0, sizeof m);
+    m.op = NET_MSG_DEFINE;
+    m.topicID = topicID;
+    m.sinceNs = RtdNowNs();
+    m.symbol[RtdWideToUtf8(symbol, wcslen(symbol), m.symbol, sizeof m.symbol - 1)] = 0;
+    m.topic[RtdWideToUtf8(topic, wcslen(topic), m.topic, sizeof m.topic - 1)] = 0;
+    Mailbox_Post(&ns->toNet, &m);
+    Kick(ns);
+}
+
+void NetServer_Clear(NetServer *ns, long topicID)
+{
+    NetMsg m;
+    memset(&m, 0, sizeof m);
+    m.op = NET_MSG_CLEAR;
+    m.topicID = topicID;
+    Mailbox_Post(&ns->toNet, &m);
+    Kick(ns);
+    if (topicID < ns->refCap) {
+        ns->refs[topicID] = 0;
+        ns->owned[topicID] = 0;
+    }
+}
+
+static BOOL EnsureRefs(NetServer *ns, long topicID)
+{
+    if (topicID < ns->refCap) return TRUE;
+    long cap = ns->refCap ? ns->refCap : 1024;
+    while (cap <= topicID) cap *= 2;
+    long *refs = (long*)realloc(ns->refs, (size_t)cap * sizeof *refs);
+    if (!refs) return FALSE;
+    ns->refs = refs;
+    BYTE *owned = (BYTE*)realloc(ns->owned, (size_t)cap);
+    if (!owned) return FALSE;
+    ns->owned = owned;
+    memset(refs + ns->refCap, 0, (size_t)(cap - ns->refCap) * sizeof *refs);
+    memset(owned + ns->refCap, 0, (size_t)(cap - ns->refCap));
+    ns->refCap = cap;
+    return TRUE;
+}
+
+/**
+ * Connect a pair for a client, counting one more reference to it
+ */
+static long Subscribe(NetServer *ns, const NetMsg *m)
+{
+    WCHAR symbol[NET_SYMBOL_MAX], topic[NET_TOPIC_MAX];
+    symbol[RtdUtf8ToWide(m->symbol, strlen(m->symbol), symbol, ARRAYSIZE(symbol) - 1)] = 0;
+    topic[RtdUtf8ToWide(m->topic, strlen(m->topic), topic, ARRAYSIZE(topic) - 1)] = 0;
+
+    TopicSubscription *existing = SubTable_Find(ns->subs, symbol, topic);
+    BOOL had = existing && existing->connected;
+    TopicSubscription *sub = ns->connect(ns->hookCtx, symbol, topic);
+    if (!sub || !EnsureRefs(ns, sub->topicID)) {
+        ns->refused++;
+        return 0;
+    }
+    if (ns->refs[sub->topicID]++ == 0) ns->owned[sub->topicID] = !had;
+    if (had) ns->shared++; else ns->connects++;
+    return sub->topicID;
+}
+
+static void Release(NetServer *ns, long topicID)
+{
+    if (topicID >= ns->refCap || ns->refs[topicID] <= 0 || --ns->refs[topicID] > 0) return;
+    if (!ns->owned[topicID]) return;
+    ns->owned[topicID] = 0;
+    TopicSubscription *sub = SubTable_Get(ns->subs, topicID);
+    if (sub) {
+        ns->release(ns->hookCtx, sub);
+        ns->releases++;
+    }
+}
+
+long NetServer_Poll(NetServer *ns)
+{
+    NetMsg *msgs;
+    long n = Mailbox_Take(&ns->toRtd, &msgs);
+    for (long i = 0; i < n; i++) {
+        NetMsg *m = &msgs[i];
+        if (m->op == NET_MSG_SUBSCRIBE) {
+            m->op = NET_MSG_SUBSCRIBED;
+            m->topicID = Subscribe(ns, m);
+            Mailbox_Post(&ns->toNet, m);
+        } else if (m->op == NET_MSG_RELEASE) {
+            Release(ns, m->topicID);
+        }
+    }
+    if (n > 0) Kick(ns);
+    return n;
+}
+
+BOOL NetServer_Retain(NetServer *ns, const TopicSubscription *sub)
+{
+    long id = sub->topicID;
+    if (id >= ns->refCap || ns->refs[id] == 0) return FALSE;
+    ns->owned[id] = 1;
+    return TRUE;
+}
+
+void NetServer_Disown(NetServer *ns, long topicID)
+{
+    if (topicID < ns->refCap) ns->owned[topicID] = 0;
+}
+
+// ---- subscriber ----
+
+BOOL NetSubscriber_Connect(NetSubscriber *s, const char *host, USHORT port)
+{
+    memset(s, 0, sizeof *s);
+    s->sock = (uintptr_t)NET_INVALID;
+    struct sockaddr_in addr;
+    if (!MakeAddr(&addr, host, port) || !NetStartup()) return FALSE;
+
+    NetSock sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == NET_INVALID) {
+        NetCleanup();
+        return FALSE;
+    }
+    s->capacity = 64 * 1024;
+    s->buf = (BYTE*)malloc(s->capacity);
+    if (!s->buf || connect(sock, (struct sockaddr*)&addr, sizeof addr) != 0) {
+        free(s->buf);
+        s->buf = NULL;
+        NetClose(sock);
+        NetCleanup();
+        return FALSE;
+    }
+    SetNoDelay(sock);
+    s->sock = (uintptr_t)sock;
+    return TRUE;
+}
+
+void NetSubscriber_Close(NetSubscriber *s)
+{
+    if ((NetSock)s->sock == NET_INVALID) return;
+    NetClose((NetSock)s->sock);
+    free(s->buf);
+    memset(s, 0, sizeof *s);
+    s->sock = (uintptr_t)NET_INVALID;
+    NetCleanup();
+}
+
+BOOL NetSubscriber_Subscribe(NetSubscriber *s, ULONG requestID, const char *symbol, const char *topic)
+{
+    if (strlen(symbol) >= NET_SYMBOL_MAX || strlen(topic) >= NET_TOPIC_MAX) return FALSE;
+    BYTE frame[NET_HEADER_SIZE + 6 + NET_SYMBOL_MAX + NET_TOPIC_MAX];
+    ULONG size = EncodeNamed(frame, NET_SUBSCRIBE, requestID, symbol, topic);
+    return SendAll((NetSock)s->sock, frame, size);
+}
+
+BOOL NetSubscriber_Unsubscribe(NetSubscriber *s, long topicID)
+{
+    BYTE frame[NET_HEADER_SIZE + 4];
+    Put16(frame, sizeof frame);
+    frame[2] = NET_UNSUBSCRIBE;
+    Put32(frame + 3, (ULONG)topicID);
+    return SendAll((NetSock)s->sock, frame, sizeof frame);
+}
+
+int NetSubscriber_Next(NetSubscriber *s, NetFrame *f, DWORD timeoutMs)
+{
+    for (;;) {
+        long size = NetFrame_Parse(s->buf + s->head, s->len - s->head, f);
+        if (size < 0) return -1;
+        if (size > 0) {
+            s->head += (size_t)size;
+            s->frames++;
+            return 1;
+        }
+
+        memmove(s->buf, s->buf + s->head, s->len - s->head);
+        s->len -= s->head;
+        s->head = 0;
+
+        NetPollFd pfd;
+        pfd.fd = (NetSock)s->sock;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int ready = NetPoll(&pfd, 1, (int)timeoutMs);
+        if (ready == 0) return 0;
+        if (ready < 0) return -1;
+        int n = (int)recv((NetSock)s->sock, (char*)s->buf + s->len, (int)(s->capacity - s->len), 0);
+        if (n <= 0) return -1;
+        s->len += (size_t)n;
+    }
+}
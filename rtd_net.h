@@ -0,0 +1,210 @@
+// rtd_net.h - Local network fan-out of RTD updates
+// Turns rtd_client into a distribution hub: other processes connect over
+// TCP, ask for symbol x topic pairs and receive compact binary frames.
+// The RTD thread connects each pair once however many clients want it and
+// keeps a reference count per topic ID; a pair the hub connected for its
+// clients is disconnected when the last of them lets go.
+//
+// All socket work happens on one network thread. The RTD thread only
+// pushes updates into a ring (NetServer_Publish) and answers subscription
+// requests between batches (NetServer_Poll), so no client can stall it.
+// Each client has a bounded send buffer; while it is full, updates for
+// that client are conflated per topic and the latest value goes out once
+// the buffer drains. Updates can also be sent to a UDP multicast group.
+//
+// Wire format, little-endian. Every frame starts with a 3-byte header:
+//
+//   uint16 length (whole frame), uint8 type
+//
+//   NET_SUBSCRIBE    c->s  uint32 requestID, uint8 n, symbol[n], uint8 m, topic[m] (UTF-8)
+//   NET_UNSUBSCRIBE  c->s  uint32 topicID
+//   NET_SUBSCRIBED   s->c  uint32 requestID, uint32 topicID (0 = refused)
+//   NET_UPDATE       s->c  uint8 vt, uint32 topicID, then 8 value bytes (double for
+//                          VT_R8/VT_R4/VT_DATE, int64 otherwise) or UTF-8 text for VT_BSTR
+//   NET_GONE         s->c  uint32 topicID; the hub no longer has the pair
+//   NET_DEFINE       mcast uint32 topicID, uint8 n, symbol[n], uint8 m, topic[m]
+
+#ifndef __RTD_NET_H__
+#define __RTD_NET_H__
+
+#include "rtd_compat.h"
+#include "rtd_ring.h"
+#include "rtd_subs.h"
+
+#define NET_DEFAULT_PORT        7878
+#define NET_DEFAULT_CLIENTS     256
+#define NET_DEFAULT_BUFFER      (256 * 1024)    // Send buffer bytes per client
+#define NET_DEFAULT_RING        65536
+
+#define NET_HEADER_SIZE         3
+#define NET_UPDATE_SIZE         16              // Numeric NET_UPDATE frame
+#define NET_MAX_TEXT            240             // UTF-8 bytes of a string value
+#define NET_SYMBOL_MAX          64              // Bytes including the NUL
+#define NET_TOPIC_MAX           32
+
+typedef enum {
+    NET_SUBSCRIBE   = 0x01,
+    NET_UNSUBSCRIBE = 0x02,
+    NET_SUBSCRIBED  = 0x81,
+    NET_UPDATE      = 0x82,
+    NET_GONE        = 0x83,
+    NET_DEFINE      = 0x84
+} NetFrameType;
+
+// One parsed frame; pointers refer into the buffer it was parsed from
+typedef struct NetFrame {
+    BYTE        type;
+    ULONG       requestID;      // NET_SUBSCRIBE, NET_SUBSCRIBED
+    long        topicID;
+    VARTYPE     vt;             // NET_UPDATE
+    union {
+        double   dbl;
+        LONGLONG i64;
+    };
+    const char *text;           // NET_UPDATE string value, not NUL terminated
+    size_t      textLen;
+    const char *symbol;         // NET_SUBSCRIBE, NET_DEFINE
+    size_t      symbolLen;
+    const char *topic;
+    size_t      topicLen;
+} NetFrame;
+
+/**
+ * Parse the frame at the start of p. Returns its length, 0 if more bytes
+ * are needed, or -1 if the bytes are not a valid frame.
+ */
+long NetFrame_Parse(const BYTE *p, size_t len, NetFrame *f);
+
+typedef struct NetConfig {
+    const char *bindAddr;       // Default 127.0.0.1
+    USHORT      port;           // 0 picks a free port (see NetServer.port)
+    long        maxClients;
+    ULONG       bufferBytes;    // Send buffer per client
+    ULONG       ringSize;       // RTD thread -> network thread
+    const char *mcastGroup;     // NULL: no multicast
+    USHORT      mcastPort;
+    int         mcastTtl;
+} NetConfig;
+
+// Connect symbol x topic, or return it if already connected; NULL if the
+// server refused it. Runs on the RTD thread, and must NetServer_Define a
+// pair it connects.
+typedef TopicSubscription* (*NetConnectFn)(void *ctx, const WCHAR *symbol, const WCHAR *topic);
+
+// Disconnect and remove a pair the hub connected and no client holds
+typedef void (*NetReleaseFn)(void *ctx, TopicSubscription *sub);
+
+// Lets the network thread wake the RTD thread when requests arrive
+typedef void (*NetWakeFn)(void *ctx);
+
+// Requests and answers passed between the two threads
+typedef struct NetMsg {
+    BYTE      op;
+    long      client;
+    ULONG     clientGen;
+    ULONG     requestID;
+    long      topicID;
+    ULONGLONG sinceNs;
+    char      symbol[NET_SYMBOL_MAX];
+    char      topic[NET_TOPIC_MAX];
+} NetMsg;
+
+typedef struct NetMailbox {
+    RtdMutex  lock;
+    NetMsg   *items;
+    long      count;
+    long      capacity;
+    NetMsg   *spare;            // Handed to the consumer by Mailbox_Take
+    long      spareCapacity;
+} NetMailbox;
+
+typedef struct NetServer {
+    NetConfig          cfg;
+    USHORT             port;        // Port actually bound
+    SubscriptionTable *subs;
+    NetConnectFn       connect;
+    NetReleaseFn       release;
+    void              *hookCtx;
+    NetWakeFn          wake;
+    void              *wakeCtx;
+
+    UpdateRing         ring;        // Updates, RTD thread -> network thread
+    NetMailbox         toRtd;       // Subscribe and release requests
+    NetMailbox         toNet;       // Answers, topic definitions and removals
+    RtdThread          thread;
+    volatile LONG      stop;
+    volatile LONG      sleeping;    // Network thread is blocked in poll
+    uintptr_t          wakeSock;    // Any thread writes a byte here to end that poll
+    struct NetIo      *io;          // Sockets and client state, network thread only
+
+    // RTD thread
+    long              *refs;        // Clients holding each topic ID
+    BYTE              *owned;       // The hub connected the pair and releases it
+    long               refCap;
+    ULONGLONG          published;
+    ULONGLONG          connects;    // Pairs connected on behalf of clients
+    ULONGLONG          shared;      // Client subscriptions served by an existing connection
+    ULONGLONG          refused;
+    ULONGLONG          releases;    // Pairs disconnected when their last client left
+
+    // Network thread; read them after NetServer_Stop
+    ULONGLONG          accepted;
+    ULONGLONG          closed;
+    ULONGLONG          framesSent;
+    ULONGLONG          bytesSent;
+    ULONGLONG          conflated;   // Updates replaced while a client's buffer was full
+    ULONGLONG          stale;       // Updates for a pair that had since been replaced
+    ULONGLONG          datagrams;
+} NetServer;
+
+// Bind, listen and start the network thread. The hooks run on the thread
+// that calls NetServer_Poll.
+BOOL NetServer_Start(NetServer *ns, const NetConfig *cfg, SubscriptionTable *subs,
+                     NetConnectFn connect, NetReleaseFn release, void *hookCtx,
+                     NetWakeFn wake, void *wakeCtx);
+void NetServer_Stop(NetServer *ns);
+
+// RTD thread: queue an update for the network thread (strings are copied)
+void NetServer_Publish(NetServer *ns, const RtdUpdate *u);
+
+// RTD thread: end of a batch; hands over conflated updates and wakes the
+// network thread if it is idle
+void NetServer_EndBatch(NetServer *ns);
+
+// RTD thread: a topic ID now names symbol x topic, or nothing. Updates
+// queued before the call are not delivered under the new name.
+void NetServer_Define(NetServer *ns, long topicID, const WCHAR *symbol, const WCHAR *topic);
+void NetServer_Clear(NetServer *ns, long topicID);
+
+// RTD thread: connect and release pairs for clients; returns requests handled
+long NetServer_Poll(NetServer *ns);
+
+// RTD thread: before removing a subscription for another reason. TRUE if
+// clients still hold it, in which case the hub keeps it and releases it
+// with the last client.
+BOOL NetServer_Retain(NetServer *ns, const TopicSubscription *sub);
+
+// RTD thread: someone else subscribed the pair too, so the hub must not
+// disconnect it when its clients leave
+void NetServer_Disown(NetServer *ns, long topicID);
+
+// Client side, for consumers of the hub and for rtd_bench
+typedef struct NetSubscriber {
+    uintptr_t  sock;
+    BYTE      *buf;
+    size_t     head;
+    size_t     len;
+    size_t     capacity;
+    ULONGLONG  frames;
+} NetSubscriber;
+
+BOOL NetSubscriber_Connect(NetSubscriber *s, const char *host, USHORT port);
+void NetSubscriber_Close(NetSubscriber *s);
+BOOL NetSubscriber_Subscribe(NetSubscriber *s, ULONG requestID, const char *symbol, const char *topic);
+BOOL NetSubscriber_Unsubscribe(NetSubscriber *s, long topicID);
+
+// Next frame, waiting up to timeoutMs for one. Returns 1 with *f filled
+// (valid until the next call), 0 on timeout, -1 when the hub closed.
+int NetSubscriber_Next(NetSubscriber *s, NetFrame *f, DWORD timeoutMs);
+
+#endif /* __RTD_NET_H__ */
@@ -0,0 +1,558 @@
+/**
+ * rtd_output.c - Batched, buffered output of decoded updates
+ *
+ * Writers format straight into a byte buffer with the rtd_format.c
+ * helpers; the only libc calls on the per-line path are memcpy. Local
+ * time is resolved once per second and cached as text.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "rtd_output.h"
+#include "rtd_format.h"
+#include "rtd_l1.h"
+#include "rtd_bars.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static const char csvHeader[] = "time,symbol,topic,value\n";
+
+BOOL OutputLayout_Parse(const char *name, OutputLayout *layout)
+{
+    if (strcmp(name, "line") == 0) *layout = OUTPUT_LINE;
+    else if (strcmp(name, "csv") == 0) *layout = OUTPUT_CSV;
+    else if (strcmp(name, "ndjson") == 0) *layout = OUTPUT_NDJSON;
+    else return FALSE;
+    return TRUE;
+}
+
+BOOL OutputSink_Open(OutputSink *s, const char *path, OutputLayout layout)
+{
+    memset(s, 0, sizeof *s);
+    s->layout = layout;
+    BOOL toStdout = !path || strcmp(path, "-") == 0;
+
+#ifdef _WIN32
+    if (toStdout) {
+        s->handle = GetStdHandle(STD_OUTPUT_HANDLE);
+        // Buffers are UTF-8; make the console agree
+        DWORD mode;
+        if (GetConsoleMode(s->handle, &mode)) SetConsoleOutputCP(CP_UTF8);
+    } else {
+        s->handle = CreateFileA(path, GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                                CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        s->ownsHandle = TRUE;
+    }
+    if (s->handle == INVALID_HANDLE_VALUE || s->handle == NULL) return FALSE;
+#else
+    if (toStdout) {
+        s->fd = STDOUT_FILENO;
+    } else {
+        s->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        s->ownsHandle = TRUE;
+    }
+    if (s->fd < 0) return FALSE;
+#endif
+
+    RtdMutex_Init(&s->lock);
+    if (layout == OUTPUT_CSV) OutputSink_Write(s, csvHeader, sizeof csvHeader - 1);
+    return TRUE;
+}
+
+void OutputSink_Close(OutputSink *s)
+{
+#ifdef _WIN32
+    if (s->ownsHandle && s->handle != INVALID_HANDLE_VALUE) CloseHandle(s->handle);
+    s->handle = INVALID_HANDLE_VALUE;
+#else
+    if (s->ownsHandle && s->fd >= 0) close(s->fd);
+    s->fd = -1;
+#endif
+    RtdMutex_Free(&s->lock);
+}
+
+void OutputSink_Write(OutputSink *s, const char *data, size_t len)
+{
+    RtdMutex_Lock(&s->lock);
+    s->writes++;
+    while (len > 0) {
+#ifdef _WIN32
+        DWORD written = 0;
+        if (!WriteFile(s->handle, data, (DWORD)min(len, 0x40000000), &written, NULL) || written == 0) {
+            s->errors++;
+            break;
+        }
+#else
+        ssize_t written = write(s->fd, data, len);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) {
+            s->errors++;
+            break;
+        }
+#endif
+        data += written;
+        len -= (size_t)written;
+        s->bytes += (ULONGLONG)written;
+    }
+    RtdMutex_Unlock(&s->lock);
+}
+
+BOOL OutputWriter_Init(OutputWriter *w, OutputSink *sink, size_t capacity,
+                       DWORD flushMs, int decimals)
+{
+    memset(w, 0, sizeof *w);
+    if (capacity < 4096) capacity = 4096;
+    w->buf = (char*)malloc(capacity);
+    if (!w->buf) return FALSE;
+    w->cap = capacity;
+    w->sink = sink;
+    w->flushIntervalNs = (ULONGLONG)flushMs * 1000000ULL;
+    w->decimals = decimals;
+    w->wallOffsetNs = (LONGLONG)RtdWallNs() - (LONGLONG)RtdNowNs();
+    w->cachedSecond = -1;
+    return TRUE;
+}
+
+void OutputWriter_Free(OutputWriter *w)
+{
+    OutputWriter_Flush(w);
+    free(w->buf);
+    w->buf = NULL;
+    w->cap = 0;
+}
+
+void OutputWriter_Flush(OutputWriter *w)
+{
+    if (w->len == 0) return;
+    OutputSink_Write(w->sink, w->buf, w->len);
+    w->len = 0;
+    w->flushes++;
+}
+
+BOOL OutputWriter_EndBatch(OutputWriter *w, ULONGLONG nowNs)
+{
+    if (w->len == 0) return FALSE;
+    if (w->flushIntervalNs == 0 || w->len >= w->cap / 2 ||
+        nowNs - w->pendingSinceNs >= w->flushIntervalNs) {
+        OutputWriter_Flush(w);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/**
+ * Write the low width decimal digits of v, zero padded
+ */
+static void PutDigits(char *p, unsigned v, int width)
+{
+    for (int i = width - 1; i >= 0; i--) {
+        p[i] = (char)('0' + v % 10);
+        v /= 10;
+    }
+}
+
+/**
+ * Local wall time of a RtdNowNs() stamp as YYYY-MM-DDTHH:MM:SS plus
+ * milliseconds
+ */
+static const char* LocalWallTime(OutputWriter *w, LONGLONG wall, unsigned *millis)
+{
+    LONGLONG second = wall / 1000000000LL;
+    *millis = (unsigned)(wall % 1000000000LL / 1000000LL);
+
+    if (second != w->cachedSecond) {
+        time_t t = (time_t)second;
+        struct tm tm;
+#ifdef _WIN32
+        localtime_s(&tm, &t);
+#else
+        localtime_r(&t, &tm);
+#endif
+        char *p = w->cachedTime;
+        PutDigits(p, tm.tm_year + 1900, 4);
+        p[4] = '-';
+        PutDigits(p + 5, tm.tm_mon + 1, 2);
+        p[7] = '-';
+        PutDigits(p + 8, tm.tm_mday, 2);
+        p[10] = 'T';
+        PutDigits(p + 11, tm.tm_hour, 2);
+        p[13] = ':';
+        PutDigits(p + 14, tm.tm_min, 2);
+        p[16] = ':';
+        PutDigits(p + 17, tm.tm_sec, 2);
+        p[19] = 0;
+        w->cachedSecond = second;
+    }
+    return w->cachedTime;
+}
+
+static const char* LocalTime(OutputWriter *w, ULONGLONG recvNs, unsigned *millis)
+{
+    return LocalWallTime(w, (LONGLONG)recvNs + w->wallOffsetNs, millis);
+}
+
+/**
+ * Append s as a CSV field, quoted only when it has to be
+ */
+static char* PutCsv(char *p, const char *s, size_t n)
+{
+    if (!memchr(s, ',', n) && !memchr(s, '"', n) && !memchr(s, '\n', n) && !memchr(s, '\r', n)) {
+        memcpy(p, s, n);
+        return p + n;
+    }
+    *p++ = '"';
+    for (size_t i = 0; i < n; i++) {
+        if (s[i] == '"') *p++ = '"';
+        *p++ = s[i];
+    }
+    *p++ = '"';
+    return p;
+}
+
+/**
+ * Append s as a JSON string literal
+ */
+static char* PutJson(char *p, const char *s, size_t n)
+{
+    static const char hex[] = "0123456789abcdef";
+    *p++ = '"';
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\') {
+            *p++ = '\\';
+            *p++ = (char)c;
+        } else if (c < 0x20) {
+            memcpy(p, "\\u00", 4);
+            p[4] = hex[c >> 4];
+            p[5] = hex[c & 15];
+            p += 6;
+        } else {
+            *p++ = (char)c;
+        }
+    }
+    *p++ = '"';
+    return p;
+}
+
+static char* PutText(char *p, const char *s, size_t n)
+{
+    memcpy(p, s, n);
+    return p + n;
+}
+
+/**
+ * Make room for a line of up to need bytes received at recvNs; FALSE if
+ * the buffer cannot grow that far
+ */
+static BOOL Reserve(OutputWriter *w, size_t need, ULONGLONG recvNs)
+{
+    if (w->len + need > w->cap) {
+        OutputWriter_Flush(w);
+        if (need > w->cap) {
+            char *grown = (char*)realloc(w->buf, need);
+            if (!grown) return FALSE;
+            w->buf = grown;
+            w->cap = need;
+        }
+    }
+    if (w->len == 0) {
+        w->pendingSinceNs = RtdNowNs();
+        w->pendingRecvNs = recvNs;
+    }
+    return TRUE;
+}
+
+void OutputWriter_Append(OutputWriter *w, const RtdUpdate *u,
+                         const WCHAR *symbol, const WCHAR *topic)
+{
+    char sym[256], top[128], val[1024];
+    size_t symLen = RtdWideToUtf8(symbol, wcslen(symbol), sym, sizeof sym);
+    size_t topLen = RtdWideToUtf8(topic, wcslen(topic), top, sizeof top);
+    size_t valLen = (size_t)Format_UpdateValueUtf8(u, w->decimals, val, sizeof val);
+
+    // Worst case: every byte escaped to \u00XX, plus time and punctuation
+    if (!Reserve(w, 96 + 6 * (symLen + topLen + valLen), u->recvNs)) return;
+
+    unsigned millis;
+    const char *when = LocalTime(w, u->recvNs, &millis);
+    char ms[3];
+    PutDigits(ms, millis, 3);
+
+    char *p = w->buf + w->len;
+    switch (w->sink->layout) {
+        case OUTPUT_LINE:
+            *p++ = '[';
+            p = PutText(p, when + 11, 8);
+            *p++ = '.';
+            p = PutText(p, ms, 3);
+            p = PutText(p, "] ", 2);
+            p = PutText(p, sym, symLen);
+            *p++ = ' ';
+            p = PutText(p, top, topLen);
+            p = PutText(p, " = ", 3);
+            p = PutText(p, val, valLen);
+            break;
+
+        case OUTPUT_CSV:
+            p = PutText(p, when, 19);
+            *p++ = '.';
+            p = PutText(p, ms, 3);
+            *p++ = ',';
+            p = PutCsv(p, sym, symLen);
+            *p++ = ',';
+            p = PutCsv(p, top, topLen);
+            *p++ = ',';
+            p = PutCsv(p, val, valLen);
+            break;
+
+        case OUTPUT_NDJSON: {
+            // Numbers stay numbers unless they have no JSON spelling (nan, inf)
+            BOOL numeric = u->vt != VT_BSTR && valLen > 0 &&
+                           (val[valLen - 1] >= '0' && val[valLen - 1] <= '9');
+            p = PutText(p, "{\"time\":\"", 9);
+            p = PutText(p, when, 19);
+            *p++ = '.';
+            p = PutText(p, ms, 3);
+            p = PutText(p, "\",\"symbol\":", 11);
+            p = PutJson(p, sym, symLen);
+            p = PutText(p, ",\"topic\":", 9);
+            p = PutJson(p, top, topLen);
+            p = PutText(p, ",\"value\":", 9);
+            p = numeric ? PutText(p, val, valLen) : PutJson(p, val, valLen);
+            *p++ = '}';
+            break;
+        }
+    }
+    *p++ = '\n';
+    w->len = (size_t)(p - w->buf);
+    w->lines++;
+}
+
+/**
+ * Append one L1 field: its number, or "-" (null in NDJSON) if it has not
+ * arrived yet
+ */
+static char* PutQuoteField(OutputWriter *w, char *p, const L1Quote *q, int field, double d, LONGLONG n)
+{
+    if (!(q->present & (1u << field))) {
+        return w->sink->layout == OUTPUT_NDJSON ? PutText(p, "null", 4) : PutText(p, "-", 1);
+    }
+    if (field < QUOTE_FIRST_INT) return p + Format_Fixed(d, w->decimals, p, FORMAT_NUMBER_MAX);
+    return p + Format_Int64(n, p);
+}
+
+static const struct {
+    ULONG       flag;
+    const char *name;
+} quoteFlags[] = {
+    { L1_CROSSED, "crossed" },
+    { L1_LOCKED,  "locked" },
+    { L1_STALE,   "stale" },
+};
+
+void OutputWriter_AppendQuote(OutputWriter *w, const L1Quote *q, const WCHAR *symbol)
+{
+    char sym[256], body[320];
+    size_t symLen = RtdWideToUtf8(symbol, wcslen(symbol), sym, sizeof sym);
+    if (!Reserve(w, 96 + 6 * symLen + 2 * sizeof body, q->recvNs)) return;
+
+    unsigned millis;
+    const char *when = LocalTime(w, q->recvNs, &millis);
+    char ms[3];
+    PutDigits(ms, millis, 3);
+
+    char *p = w->buf + w->len;
+    if (w->sink->layout == OUTPUT_NDJSON) {
+        p = PutText(p, "{\"time\":\"", 9);
+        p = PutText(p, when, 19);
+        *p++ = '.';
+        p = PutText(p, ms, 3);
+        p = PutText(p, "\",\"symbol\":", 11);
+        p = PutJson(p, sym, symLen);
+        p = PutText(p, ",\"topic\":\"L1\",\"seq\":", 20);
+        p += Format_Int64((LONGLONG)q->seq, p);
+        p = PutText(p, ",\"bid\":", 7);
+        p = PutQuoteField(w, p, q, QF_BID, q->bid, 0);
+        p = PutText(p, ",\"bid_size\":", 12);
+        p = PutQuoteField(w, p, q, QF_BID_SIZE, 0, q->bidSize);
+        p = PutText(p, ",\"ask\":", 7);
+        p = PutQuoteField(w, p, q, QF_ASK, q->ask, 0);
+        p = PutText(p, ",\"ask_size\":", 12);
+        p = PutQuoteField(w, p, q, QF_ASK_SIZE, 0, q->askSize);
+        p = PutText(p, ",\"last\":", 8);
+        p = PutQuoteField(w, p, q, QF_LAST, q->last, 0);
+        p = PutText(p, ",\"flags\":[", 10);
+        const char *sep = "";
+        for (size_t i = 0; i < ARRAYSIZE(quoteFlags); i++) {
+            if (!(q->flags & quoteFlags[i].flag)) continue;
+            p = PutText(p, sep, strlen(sep));
+            *p++ = '"';
+            p = PutText(p, quoteFlags[i].name, strlen(quoteFlags[i].name));
+            *p++ = '"';
+            sep = ",";
+        }
+        p = PutText(p, "]}\n", 3);
+        w->len = (size_t)(p - w->buf);
+        w->lines++;
+        return;
+    }
+
+    // #SEQ BID x BID_SIZE / ASK x ASK_SIZE last LAST [flags]
+    char *b = body;
+    *b++ = '#';
+    b += Format_Int64((LONGLONG)q->seq, b);
+    *b++ = ' ';
+    b = PutQuoteField(w, b, q, QF_BID, q->bid, 0);
+    b = PutText(b, " x ", 3);
+    b = PutQuoteField(w, b, q, QF_BID_SIZE, 0, q->bidSize);
+    b = PutText(b, " / ", 3);
+    b = PutQuoteField(w, b, q, QF_ASK, q->ask, 0);
+    b = PutText(b, " x ", 3);
+    b = PutQuoteField(w, b, q, QF_ASK_SIZE, 0, q->askSize);
+    b = PutText(b, " last ", 6);
+    b = PutQuoteField(w, b, q, QF_LAST, q->last, 0);
+    for (size_t i = 0; i < ARRAYSIZE(quoteFlags); i++) {
+        if (!(q->flags & quoteFlags[i].flag)) continue;
+        *b++ = ' ';
+        b = PutText(b, quoteFlags[i].name, strlen(quoteFlags[i].name));
+    }
+    size_t bodyLen = (size_t)(b - body);
+
+    if (w->sink->layout == OUTPUT_LINE) {
+        *p++ = '[';
+        p = PutText(p, when + 11, 8);
+        *p++ = '.';
+        p = PutText(p, ms, 3);
+        p = PutText(p, "] ", 2);
+        p = PutText(p, sym, symLen);
+        p = PutText(p, " L1 ", 4);
+    } else {
+        p = PutText(p, when, 19);
+        *p++ = '.';
+        p = PutText(p, ms, 3);
+        *p++ = ',';
+        p = PutCsv(p, sym, symLen);
+        p = PutText(p, ",L1,", 4);
+    }
+    p = PutText(p, body, bodyLen);
+    *p++ = '\n';
+    w->len = (size_t)(p - w->buf);
+    w->lines++;
+}
+
+static const struct {
+    ULONG       flag;
+    const char *name;
+} barFlags[] = {
+    { BAR_LATE,    "late" },
+    { BAR_EARLY,   "early" },
+    { BAR_CLEARED, "cleared" },
+};
+
+void OutputWriter_AppendBar(OutputWriter *w, const Bar *bar, const WCHAR *symbol)
+{
+    char sym[256], body[320], topic[24];
+    size_t symLen = RtdWideToUtf8(symbol, wcslen(symbol), sym, sizeof sym);
+    if (!Reserve(w, 96 + 6 * symLen + 2 * sizeof body, bar->closeNs)) return;
+
+    // Stamped with the bar's start
+    unsigned millis;
+    const char *when = LocalWallTime(w, (LONGLONG)bar->startWallNs, &millis);
+    char ms[3];
+    PutDigits(ms, millis, 3);
+    size_t topicLen = 4 + (size_t)BarInterval_Format(bar->intervalMs, topic + 4, sizeof topic - 4);
+    memcpy(topic, "BAR_", 4);
+
+    char *p = w->buf + w->len;
+    if (w->sink->layout == OUTPUT_NDJSON) {
+        p = PutText(p, "{\"time\":\"", 9);
+        p = PutText(p, when, 19);
+        *p++ = '.';
+        p = PutText(p, ms, 3);
+        p = PutText(p, "\",\"symbol\":", 11);
+        p = PutJson(p, sym, symLen);
+        p = PutText(p, ",\"topic\":", 9);
+        p = PutJson(p, topic, topicLen);
+        p = PutText(p, ",\"seq\":", 7);
+        p += Format_Int64((LONGLONG)bar->seq, p);
+        p = PutText(p, ",\"open\":", 8);
+        p += Format_Fixed(bar->open, w->decimals, p, FORMAT_NUMBER_MAX);
+        p = PutText(p, ",\"high\":", 8);
+        p += Format_Fixed(bar->high, w->decimals, p, FORMAT_NUMBER_MAX);
+        p = PutText(p, ",\"low\":", 7);
+        p += Format_Fixed(bar->low, w->decimals, p, FORMAT_NUMBER_MAX);
+        p = PutText(p, ",\"close\":", 9);
+        p += Format_Fixed(bar->close, w->decimals, p, FORMAT_NUMBER_MAX);
+        p = PutText(p, ",\"volume\":", 10);
+        p += Format_Int64(bar->volume, p);
+        p = PutText(p, ",\"ticks\":", 9);
+        p += Format_Int64(bar->ticks, p);
+        p = PutText(p, ",\"flags\":[", 10);
+        const char *sep = "";
+        for (size_t i = 0; i < ARRAYSIZE(barFlags); i++) {
+            if (!(bar->flags & barFlags[i].flag)) continue;
+            p = PutText(p, sep, strlen(sep));
+            *p++ = '"';
+            p = PutText(p, barFlags[i].name, strlen(barFlags[i].name));
+            *p++ = '"';
+            sep = ",";
+        }
+        p = PutText(p, "]}\n", 3);
+        w->len = (size_t)(p - w->buf);
+        w->lines++;
+        return;
+    }
+
+    // #SEQ O open H high L low C close V volume ticks N [flags]
+    char *b = body;
+    *b++ = '#';
+    b += Format_Int64((LONGLONG)bar->seq, b);
+    b = PutText(b, " O ", 3);
+    b += Format_Fixed(bar->open, w->decimals, b, FORMAT_NUMBER_MAX);
+    b = PutText(b, " H ", 3);
+    b += Format_Fixed(bar->high, w->decimals, b, FORMAT_NUMBER_MAX);
+    b = PutText(b, " L ", 3);
+    b += Format_Fixed(bar->low, w->decimals, b, FORMAT_NUMBER_MAX);
+    b = PutText(b, " C ", 3);
+    b += Format_Fixed(bar->close, w->decimals, b, FORMAT_NUMBER_MAX);
+    b = PutText(b, " V ", 3);
+    b += Format_Int64(bar->volume, b);
+    b = PutText(b, " ticks ", 7);
+    b += Format_Int64(bar->ticks, b);
+    for (size_t i = 0; i < ARRAYSIZE(barFlags); i++) {
+        if (!(bar->flags & barFlags[i].flag)) continue;
+        *b++ = ' ';
+        b = PutText(b, barFlags[i].name, strlen(barFlags[i].name));
+    }
+    size_t bodyLen = (size_t)(b - body);
+
+    if (w->sink->layout == OUTPUT_LINE) {
+        *p++ = '[';
+        p = PutText(p, when + 11, 8);
+        *p++ = '.';
+        p = PutText(p, ms, 3);
+        p = PutText(p, "] ", 2);
+        p = PutText(p, sym, symLen);
+        *p++ = ' ';
+        p = PutText(p, topic, topicLen);
+        *p++ = ' ';
+    } else {
+        p = PutText(p, when, 19);
+        *p++ = '.';
+        p = PutText(p, ms, 3);
+        *p++ = ',';
+        p = PutCsv(p, sym, symLen);
+        *p++ = ',';
+        p = PutText(p, topic, topicLen);
+        *p++ = ',';
+    }
+    p = PutText(p, body, bodyLen);
+    *p++ = '\n';
+    w->len = (size_t)(p - w->buf);
+    w->lines++;
+}
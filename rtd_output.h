@@ -0,0 +1,86 @@
+// rtd_output.h - Batched, buffered output of decoded updates
+// Each output worker owns an OutputWriter that formats a whole batch of
+// updates as UTF-8 into one reusable buffer. The buffer goes to the
+// shared OutputSink in a single write, either at the end of every batch
+// or once a size or age threshold is reached. The RTD thread never
+// touches the sink.
+
+#ifndef __RTD_OUTPUT_H__
+#define __RTD_OUTPUT_H__
+
+#include "rtd_compat.h"
+#include "rtd_ring.h"
+
+typedef enum {
+    OUTPUT_LINE = 0,    // [13:45:22.124] AAPL LAST = 167.280000
+    OUTPUT_CSV,         // time,symbol,topic,value with a header row
+    OUTPUT_NDJSON       // {"time":"...","symbol":"AAPL","topic":"LAST","value":167.28}
+} OutputLayout;
+
+// Destination shared by all writers; writes are serialized so lines from
+// different workers never interleave
+typedef struct OutputSink {
+#ifdef _WIN32
+    HANDLE       handle;
+#else
+    int          fd;
+#endif
+    BOOL         ownsHandle;
+    OutputLayout layout;
+    RtdMutex     lock;
+    ULONGLONG    writes;
+    ULONGLONG    bytes;
+    ULONGLONG    errors;
+} OutputSink;
+
+// path NULL or "-" means stdout. Writes the CSV header when needed.
+BOOL OutputSink_Open(OutputSink *s, const char *path, OutputLayout layout);
+void OutputSink_Close(OutputSink *s);
+void OutputSink_Write(OutputSink *s, const char *data, size_t len);
+
+// Parse "line", "csv" or "ndjson"
+BOOL OutputLayout_Parse(const char *name, OutputLayout *layout);
+
+typedef struct OutputWriter {
+    OutputSink *sink;
+    char       *buf;
+    size_t      len;
+    size_t      cap;
+    ULONGLONG   flushIntervalNs;    // 0 = flush at the end of every batch
+    ULONGLONG   pendingSinceNs;     // When the oldest buffered line was added
+    ULONGLONG   pendingRecvNs;      // recvNs of the update on that line
+    int         decimals;
+
+    // Monotonic to wall clock mapping and a per-second local time cache
+    LONGLONG    wallOffsetNs;
+    LONGLONG    cachedSecond;
+    char        cachedTime[20];     // YYYY-MM-DDTHH:MM:SS
+
+    ULONGLONG   lines;
+    ULONGLONG   flushes;
+} OutputWriter;
+
+BOOL OutputWriter_Init(OutputWriter *w, OutputSink *sink, size_t capacity,
+                       DWORD flushMs, int decimals);
+void OutputWriter_Free(OutputWriter *w);     // Flushes what is left
+
+// Format one update into the buffer (flushing first if it would not fit)
+void OutputWriter_Append(OutputWriter *w, const RtdUpdate *u,
+                         const WCHAR *symbol, const WCHAR *topic);
+
+// Format one L1 quote event (see rtd_l1.h) as a single line
+struct L1Quote;
+void OutputWriter_AppendQuote(OutputWriter *w, const struct L1Quote *q, const WCHAR *symbol);
+
+// Format one closed OHLCV bar (see rtd_bars.h), stamped with its start
+struct Bar;
+void OutputWriter_AppendBar(OutputWriter *w, const struct Bar *bar, const WCHAR *symbol);
+
+// Call after each batch and when idle: flushes when the batch is done
+// (flushMs 0), the buffer is half full, or the oldest line is too old.
+// Returns TRUE if it wrote.
+BOOL OutputWriter_EndBatch(OutputWriter *w, ULONGLONG nowNs);
+
+void OutputWriter_Flush(OutputWriter *w);
+
+#endif /* __RTD_OUTPUT_H__ */
@@ -0,0 +1,158 @@
+/**
+ * rtd_pool.c - Arena and interned string values
+ *
+ * Interned strings are written into the arena as a 4-byte byte count, the
+ * characters and a NUL, which is the BSTR layout; the BSTR points just
+ * past the count. The index stores those pointers and compares lengths
+ * before characters.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "rtd_pool.h"
+
+void RtdArena_Init(RtdArena *a, size_t chunkSize)
+{
+    memset(a, 0, sizeof *a);
+    a->chunkSize = chunkSize ? chunkSize : ARENA_DEFAULT_CHUNK;
+}
+
+static void FreeChunks(RtdArenaChunk *c)
+{
+    while (c) {
+        RtdArenaChunk *next = c->next;
+        free(c);
+        c = next;
+    }
+}
+
+void RtdArena_Free(RtdArena *a)
+{
+    FreeChunks(a->head);
+    FreeChunks(a->spare);
+    memset(a, 0, sizeof *a);
+}
+
+void* RtdArena_Alloc(RtdArena *a, size_t bytes)
+{
+    bytes = (bytes + 7) & ~(size_t)7;
+    RtdArenaChunk *c = a->head;
+    if (!c || c->size - c->used < bytes) {
+        // Reuse a spare chunk if it is big enough, else allocate one
+        if (a->spare && a->spare->size >= bytes) {
+            c = a->spare;
+            a->spare = c->next;
+        } else {
+            size_t size = bytes > a->chunkSize ? bytes : a->chunkSize;
+            c = (RtdArenaChunk*)malloc(sizeof *c + size);
+            if (!c) return NULL;
+            c->size = size;
+            a->reserved += size;
+            a->chunkAllocs++;
+        }
+        c->used = 0;
+        c->next = a->head;
+        a->head = c;
+    }
+    void *p = (char*)(c + 1) + c->used;
+    c->used += bytes;
+    a->bytes += bytes;
+    return p;
+}
+
+void RtdArena_Reset(RtdArena *a)
+{
+    while (a->head) {
+        RtdArenaChunk *c = a->head;
+        a->head = c->next;
+        c->next = a->spare;
+        a->spare = c;
+    }
+    a->bytes = 0;
+}
+
+BOOL RtdStringPool_Init(RtdStringPool *p, size_t maxBytes)
+{
+    memset(p, 0, sizeof *p);
+    RtdArena_Init(&p->arena, ARENA_DEFAULT_CHUNK);
+    p->maxBytes = maxBytes ? maxBytes : STRING_POOL_DEFAULT_BYTES;
+    p->index = (BSTR*)calloc(1024, sizeof *p->index);
+    if (!p->index) return FALSE;
+    p->indexMask = 1023;
+    return TRUE;
+}
+
+void RtdStringPool_Free(RtdStringPool *p)
+{
+    RtdArena_Free(&p->arena);
+    free(p->index);
+    memset(p, 0, sizeof *p);
+}
+
+/**
+ * FNV-1a over the UTF-16 code units
+ */
+static ULONG HashChars(const OLECHAR *s, UINT len)
+{
+    ULONG h = 2166136261u;
+    for (UINT i = 0; i < len; i++) {
+        h ^= (ULONG)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static BOOL GrowIndex(RtdStringPool *p)
+{
+    ULONG size = (p->indexMask + 1) * 2;
+    BSTR *index = (BSTR*)calloc(size, sizeof *index);
+    if (!index) return FALSE;
+    for (ULONG i = 0; i <= p->indexMask; i++) {
+        BSTR s = p->index[i];
+        if (!s) continue;
+        ULONG slot = HashChars(s, SysStringLen(s)) & (size - 1);
+        while (index[slot]) slot = (slot + 1) & (size - 1);
+        index[slot] = s;
+    }
+    free(p->index);
+    p->index = index;
+    p->indexMask = size - 1;
+    return TRUE;
+}
+
+BSTR RtdStringPool_Intern(RtdStringPool *p, const OLECHAR *s, UINT len, BOOL *shared)
+{
+    ULONG slot = HashChars(s, len) & p->indexMask;
+    for (BSTR t; (t = p->index[slot]) != NULL; slot = (slot + 1) & p->indexMask) {
+        if (SysStringLen(t) == len && memcmp(t, s, len * sizeof(OLECHAR)) == 0) {
+            p->hits++;
+            *shared = TRUE;
+            return t;
+        }
+    }
+
+    size_t bytes = sizeof(UINT) + ((size_t)len + 1) * sizeof(OLECHAR);
+    if (len <= STRING_POOL_MAX_LEN && p->arena.bytes + bytes <= p->maxBytes &&
+        ((ULONG)(p->count + 1) * 2 <= p->indexMask || GrowIndex(p))) {
+        UINT *block = (UINT*)RtdArena_Alloc(&p->arena, bytes);
+        if (block) {
+            block[0] = len * (UINT)sizeof(OLECHAR);
+            BSTR t = (BSTR)(block + 1);
+            memcpy(t, s, len * sizeof(OLECHAR));
+            t[len] = 0;
+
+            // GrowIndex may have moved the probe sequence
+            slot = HashChars(s, len) & p->indexMask;
+            while (p->index[slot]) slot = (slot + 1) & p->indexMask;
+            p->index[slot] = t;
+            p->count++;
+            p->misses++;
+            *shared = TRUE;
+            return t;
+        }
+    }
+
+    p->copies++;
+    *shared = FALSE;
+    return SysAllocStringLen(s, len);
+}
@@ -0,0 +1,67 @@
+// rtd_pool.h - Arena and interned string values
+// RtdArena hands out memory from large chunks with a pointer bump and
+// releases it all at once; Reset keeps the chunks for the next round.
+//
+// RtdStringPool interns string values (exchange codes, descriptions, ...)
+// in an arena, laid out as BSTRs so SysStringLen and the formatters read
+// them like any other. Repeated values share one copy, and an update that
+// carries one is marked RTD_UPDATE_SHARED so RtdUpdate_Clear leaves it
+// alone. Strings are immutable and live until RtdStringPool_Free, so any
+// thread may read them; only the RTD thread interns. Once the pool reaches
+// its byte limit, new values fall back to a private SysAllocString copy.
+
+#ifndef __RTD_POOL_H__
+#define __RTD_POOL_H__
+
+#include "rtd_compat.h"
+
+#define ARENA_DEFAULT_CHUNK         (64 * 1024)
+#define STRING_POOL_DEFAULT_BYTES   (16 * 1024 * 1024)
+#define STRING_POOL_MAX_LEN         1024        // Longer values are never interned
+
+typedef struct RtdArenaChunk {
+    struct RtdArenaChunk *next;
+    size_t                size;     // Bytes after the header
+    size_t                used;
+} RtdArenaChunk;
+
+typedef struct RtdArena {
+    RtdArenaChunk *head;            // Chunk being filled
+    RtdArenaChunk *spare;           // Chunks kept by Reset
+    size_t         chunkSize;
+    size_t         bytes;           // Handed out since the last Reset
+    size_t         reserved;        // Held in chunks
+    ULONGLONG      chunkAllocs;     // Heap allocations made, ever
+} RtdArena;
+
+void  RtdArena_Init(RtdArena *a, size_t chunkSize);
+void  RtdArena_Free(RtdArena *a);
+
+// 8-byte aligned; NULL only when the heap is exhausted
+void* RtdArena_Alloc(RtdArena *a, size_t bytes);
+
+// Forget every allocation but keep the chunks
+void  RtdArena_Reset(RtdArena *a);
+
+typedef struct RtdStringPool {
+    RtdArena   arena;
+    BSTR      *index;               // Open-addressed by content hash
+    ULONG      indexMask;
+    long       count;
+    size_t     maxBytes;
+
+    ULONGLONG  hits;                // Values that matched an interned copy
+    ULONGLONG  misses;              // Values interned
+    ULONGLONG  copies;              // Values copied privately (pool full or too long)
+} RtdStringPool;
+
+BOOL RtdStringPool_Init(RtdStringPool *p, size_t maxBytes);
+void RtdStringPool_Free(RtdStringPool *p);
+
+/**
+ * Shared copy of s[0..len); *shared is FALSE (and the result a private
+ * SysAllocStringLen copy the caller frees) when the pool could not take it
+ */
+BSTR RtdStringPool_Intern(RtdStringPool *p, const OLECHAR *s, UINT len, BOOL *shared);
+
+#endif /* __RTD_POOL_H__ */
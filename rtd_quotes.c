@@ -0,0 +1,124 @@
+/**
+ * rtd_quotes.c - Latest-value quote store
+ *
+ * Columns only grow when a new symbol is subscribed, which happens on the
+ * same thread as QuoteStore_Apply, so the store needs no locking.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include "rtd_quotes.h"
+
+#define QUOTE_NAME(name) #name,
+static const char *fieldNames[QUOTE_FIELD_COUNT] = {
+    QUOTE_DOUBLE_FIELDS(QUOTE_NAME)
+    QUOTE_INT_FIELDS(QUOTE_NAME)
+};
+#undef QUOTE_NAME
+
+/**
+ * Grow one column to newCap rows, zeroing the new rows
+ */
+static BOOL GrowColumn(void **column, size_t elemSize, long oldCap, long newCap)
+{
+    char *grown = (char*)realloc(*column, (size_t)newCap * elemSize);
+    if (!grown) return FALSE;
+    memset(grown + (size_t)oldCap * elemSize, 0, (size_t)(newCap - oldCap) * elemSize);
+    *column = grown;
+    return TRUE;
+}
+
+static BOOL GrowSymbols(QuoteStore *qs, long minCap)
+{
+    long newCap = qs->symbolCap * 2;
+    if (newCap < minCap) newCap = minCap;
+
+    for (int f = 0; f < QUOTE_DOUBLE_COUNT; f++) {
+        if (!GrowColumn((void**)&qs->dbl[f], sizeof(double), qs->symbolCap, newCap)) return FALSE;
+    }
+    for (int f = 0; f < QUOTE_INT_COUNT; f++) {
+        if (!GrowColumn((void**)&qs->i64[f], sizeof(LONGLONG), qs->symbolCap, newCap)) return FALSE;
+    }
+    if (!GrowColumn((void**)&qs->present, sizeof(ULONG), qs->symbolCap, newCap) ||
+        !GrowColumn((void**)&qs->updatedNs, sizeof(ULONGLONG), qs->symbolCap, newCap)) {
+        return FALSE;
+    }
+    qs->symbolCap = newCap;
+    return TRUE;
+}
+
+BOOL QuoteStore_Init(QuoteStore *qs, long symbolCapacity)
+{
+    memset(qs, 0, sizeof *qs);
+    if (!GrowSymbols(qs, symbolCapacity + 1)) {
+        QuoteStore_Free(qs);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void QuoteStore_Free(QuoteStore *qs)
+{
+    for (int f = 0; f < QUOTE_DOUBLE_COUNT; f++) free(qs->dbl[f]);
+    for (int f = 0; f < QUOTE_INT_COUNT; f++) free(qs->i64[f]);
+    free(qs->present);
+    free(qs->updatedNs);
+    free(qs->column);
+    memset(qs, 0, sizeof *qs);
+}
+
+int QuoteField_FromName(const WCHAR *topic)
+{
+    for (int f = 0; f < QUOTE_FIELD_COUNT; f++) {
+        const char *name = fieldNames[f];
+        const WCHAR *t = topic;
+        while (*name && (WCHAR)*name == *t) {
+            name++;
+            t++;
+        }
+        if (!*name && !*t) return f;
+    }
+    return QF_NONE;
+}
+
+const char* QuoteField_Name(int field)
+{
+    return field >= 0 && field < QUOTE_FIELD_COUNT ? fieldNames[field] : "?";
+}
+
+BOOL QuoteStore_Track(QuoteStore *qs, const TopicSubscription *sub)
+{
+    if (sub->symbolID >= qs->symbolCap && !GrowSymbols(qs, sub->symbolID + 1)) return FALSE;
+
+    if (sub->fieldID >= qs->fieldCap) {
+        long newCap = qs->fieldCap ? qs->fieldCap : 64;
+        while (newCap <= sub->fieldID) newCap *= 2;
+        signed char *column = (signed char*)realloc(qs->column, newCap);
+        if (!column) return FALSE;
+        memset(column + qs->fieldCap, QF_NONE, newCap - qs->fieldCap);
+        qs->column = column;
+        qs->fieldCap = newCap;
+    }
+    qs->column[sub->fieldID] = (signed char)QuoteField_FromName(sub->topic);
+    return TRUE;
+}
+
+void QuoteStore_ClearSymbol(QuoteStore *qs, long symbolID)
+{
+    if (symbolID > 0 && symbolID < qs->symbolCap) qs->present[symbolID] = 0;
+}
+
+void QuoteStore_ClearField(QuoteStore *qs, const TopicSubscription *sub)
+{
+    long sym = sub->symbolID;
+    int col = sub->fieldID < qs->fieldCap ? qs->column[sub->fieldID] : QF_NONE;
+    if (col != QF_NONE && sym > 0 && sym < qs->symbolCap) qs->present[sym] &= ~(1u << col);
+}
+
+size_t QuoteStore_Bytes(const QuoteStore *qs)
+{
+    size_t perSymbol = QUOTE_DOUBLE_COUNT * sizeof(double) + QUOTE_INT_COUNT * sizeof(LONGLONG) +
+                       sizeof(ULONG) + sizeof(ULONGLONG);
+    return (size_t)qs->symbolCap * perSymbol + (size_t)qs->fieldCap;
+}
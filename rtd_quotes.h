@@ -0,0 +1,141 @@
+// rtd_quotes.h - Latest-value quote store
+// Struct-of-arrays table of the most recent value of each well-known
+// field, one column per field, indexed by interned symbol ID. A full
+// watchlist snapshot is a linear walk over a few contiguous arrays; at
+// 5k symbols the whole store is about 820 KB and fits in a 1 MB L2.
+
+#ifndef __RTD_QUOTES_H__
+#define __RTD_QUOTES_H__
+
+#include "rtd_client.h"
+#include "rtd_ring.h"
+
+// Fields kept as doubles, then fields kept as 64-bit integers
+#define QUOTE_DOUBLE_FIELDS(X) \
+    X(LAST) X(BID) X(ASK) X(MARK) X(OPEN) X(HIGH) X(LOW) X(CLOSE) \
+    X(NET_CHANGE) X(DELTA) X(GAMMA) X(THETA) X(VEGA) X(IMPL_VOL)
+#define QUOTE_INT_FIELDS(X) \
+    X(VOLUME) X(LAST_SIZE) X(BID_SIZE) X(ASK_SIZE) X(OPEN_INT)
+
+#define QUOTE_ENUM(name) QF_##name,
+typedef enum {
+    QUOTE_DOUBLE_FIELDS(QUOTE_ENUM)
+    QUOTE_INT_FIELDS(QUOTE_ENUM)
+    QUOTE_FIELD_COUNT
+} QuoteField;
+#undef QUOTE_ENUM
+
+#define QUOTE_FIRST_INT   QF_VOLUME
+#define QUOTE_DOUBLE_COUNT QUOTE_FIRST_INT
+#define QUOTE_INT_COUNT   (QUOTE_FIELD_COUNT - QUOTE_FIRST_INT)
+#define QF_NONE           (-1)
+
+typedef struct QuoteStore {
+    long       symbolCap;               // Rows allocated in every column
+    double    *dbl[QUOTE_DOUBLE_COUNT]; // dbl[QF_LAST][symbolID]
+    LONGLONG  *i64[QUOTE_INT_COUNT];    // i64[QF_VOLUME - QUOTE_FIRST_INT][symbolID]
+    ULONG     *present;                 // Bit per QuoteField received for the symbol
+    ULONGLONG *updatedNs;               // Receive time of the symbol's latest value
+
+    signed char *column;                // QuoteField for each interned topic ID
+    long       fieldCap;
+
+    ULONGLONG  applied;                 // Values stored
+    ULONGLONG  ignored;                 // Values for untracked topics or of other types
+} QuoteStore;
+
+BOOL QuoteStore_Init(QuoteStore *qs, long symbolCapacity);
+void QuoteStore_Free(QuoteStore *qs);
+
+// QuoteField for a topic name, or QF_NONE
+int QuoteField_FromName(const WCHAR *topic);
+const char* QuoteField_Name(int field);
+
+// Size the columns for sub's symbol and map its topic; call when subscribing
+BOOL QuoteStore_Track(QuoteStore *qs, const TopicSubscription *sub);
+
+/**
+ * Store a value already converted both ways
+ */
+static inline void QuoteStore_Set(QuoteStore *qs, const TopicSubscription *sub,
+                                  double d, LONGLONG n, ULONGLONG recvNs)
+{
+    long sym = sub->symbolID;
+    int col = sub->fieldID < qs->fieldCap ? qs->column[sub->fieldID] : QF_NONE;
+    if (col == QF_NONE || sym >= qs->symbolCap) {
+        qs->ignored++;
+        return;
+    }
+    if (col < QUOTE_FIRST_INT) qs->dbl[col][sym] = d;
+    else qs->i64[col - QUOTE_FIRST_INT][sym] = n;
+    qs->present[sym] |= 1u << col;
+    qs->updatedNs[sym] = recvNs;
+    qs->applied++;
+}
+
+/**
+ * Store one RefreshData value (called on the RTD thread for every row)
+ */
+static inline void QuoteStore_Apply(QuoteStore *qs, const TopicSubscription *sub,
+                                    const VARIANT *value, ULONGLONG recvNs)
+{
+    double d;
+    LONGLONG n;
+    switch (value->vt) {
+        case VT_R8: d = value->dblVal; n = (LONGLONG)d; break;
+        case VT_R4: d = value->fltVal; n = (LONGLONG)d; break;
+        case VT_I4: n = value->lVal;  d = (double)n; break;
+        case VT_I8: n = value->llVal; d = (double)n; break;
+        case VT_I2: n = value->iVal;  d = (double)n; break;
+        default:
+            qs->ignored++;
+            return;
+    }
+    QuoteStore_Set(qs, sub, d, n, recvNs);
+}
+
+/**
+ * Store one decoded update; same types as QuoteStore_Apply
+ */
+static inline void QuoteStore_ApplyUpdate(QuoteStore *qs, const TopicSubscription *sub, const RtdUpdate *u)
+{
+    switch (u->vt) {
+        case VT_R8:
+        case VT_R4:
+            QuoteStore_Set(qs, sub, u->dblVal, (LONGLONG)u->dblVal, u->recvNs);
+            break;
+        case VT_I4:
+        case VT_I8:
+        case VT_I2:
+            QuoteStore_Set(qs, sub, (double)u->llVal, u->llVal, u->recvNs);
+            break;
+        default:
+            qs->ignored++;
+            break;
+    }
+}
+
+/**
+ * Latest value of a field as a double; FALSE if none has arrived yet
+ */
+static inline BOOL QuoteStore_Get(const QuoteStore *qs, long symbolID, int field, double *out)
+{
+    if (symbolID <= 0 || symbolID >= qs->symbolCap || !(qs->present[symbolID] & (1u << field))) {
+        return FALSE;
+    }
+    *out = field < QUOTE_FIRST_INT ? qs->dbl[field][symbolID]
+                                   : (double)qs->i64[field - QUOTE_FIRST_INT][symbolID];
+    return TRUE;
+}
+
+// Forget the values of a symbol that is no longer watched
+void QuoteStore_ClearSymbol(QuoteStore *qs, long symbolID);
+
+// Forget the value of one pair that is no longer watched; the symbol's
+// other fields stay
+void QuoteStore_ClearField(QuoteStore *qs, const TopicSubscription *sub);
+
+// Bytes held by the columns
+size_t QuoteStore_Bytes(const QuoteStore *qs);
+
+#endif /* __RTD_QUOTES_H__ */
@@ -0,0 +1,294 @@
+/**
+ * rtd_ring.c - Lock-free SPSC ring of decoded RTD updates
+ *
+ * head and tail are free-running 64-bit counters on separate cache lines;
+ * each side keeps a cached copy of the other's counter so the common case
+ * touches no shared line at all. Under RING_DROP_OLDEST the producer may
+ * advance head itself, so the consumer claims slots with a CAS and retries
+ * if the producer got there first.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "rtd_ring.h"
+
+BOOL UpdateRing_Init(UpdateRing *r, ULONG capacity, RingPolicy policy)
+{
+    ULONG size = 2;
+    while (size < capacity) size *= 2;
+
+    memset(r, 0, sizeof *r);
+    r->slots = (RtdUpdate*)calloc(size, sizeof *r->slots);
+    if (!r->slots) return FALSE;
+    r->mask = size - 1;
+    r->policy = policy;
+    return TRUE;
+}
+
+void UpdateRing_Free(UpdateRing *r)
+{
+    if (r->slots) {
+        for (LONGLONG i = r->head; i < r->tail; i++) RtdUpdate_Clear(&r->slots[i & r->mask]);
+    }
+    for (long i = 0; i < r->parkedCount; i++) {
+        RtdUpdate_Clear(&r->parked[r->parkedOrder[(r->parkedHead + i) % r->parkedCap]]);
+    }
+    free(r->slots);
+    free(r->parked);
+    free(r->parkedFlag);
+    free(r->parkedOrder);
+    memset(r, 0, sizeof *r);
+}
+
+LONGLONG UpdateRing_Depth(UpdateRing *r)
+{
+    return RtdLoadAcquire64(&r->tail) - RtdLoadAcquire64(&r->head);
+}
+
+/**
+ * Producer: is there room for one more slot? Refreshes the cached head.
+ */
+static BOOL HasRoom(UpdateRing *r, LONGLONG tail)
+{
+    if (tail - r->cachedHead <= r->mask) return TRUE;
+    r->cachedHead = RtdLoadAcquire64(&r->head);
+    return tail - r->cachedHead <= r->mask;
+}
+
+/**
+ * Producer: store an update in the next slot and publish it
+ */
+static void Publish(UpdateRing *r, LONGLONG tail, const RtdUpdate *u)
+{
+    r->slots[tail & r->mask] = *u;
+    RtdStoreRelease64(&r->tail, tail + 1);
+    r->pushed++;
+
+    LONGLONG depth = tail + 1 - r->cachedHead;
+    if (depth > r->maxDepth) r->maxDepth = depth;
+}
+
+/**
+ * Producer: discard the oldest queued update to make room
+ */
+static void DropOldest(UpdateRing *r)
+{
+    for (;;) {
+        LONGLONG head = RtdLoadAcquire64(&r->head);
+        if (r->tail - head <= r->mask) {
+            r->cachedHead = head;  // A consumer freed space meanwhile
+            return;
+        }
+        RtdUpdate victim = r->slots[head & r->mask];
+        if (RtdCas64(&r->head, head, head + 1)) {
+            RtdUpdate_Clear(&victim);
+            r->cachedHead = head + 1;
+            r->dropped++;
+            return;
+        }
+    }
+}
+
+/**
+ * Producer: grow the parking table to hold topicID
+ */
+static BOOL EnsureParked(UpdateRing *r, long topicID)
+{
+    if (topicID >= 0 && topicID < r->parkedCap) return TRUE;
+    if (topicID < 0) return FALSE;
+
+    long newCap = r->parkedCap ? r->parkedCap : 1024;
+    while (newCap <= topicID) newCap *= 2;
+
+    RtdUpdate *parked = (RtdUpdate*)realloc(r->parked, newCap * sizeof *parked);
+    if (!parked) return FALSE;
+    r->parked = parked;
+
+    BYTE *flag = (BYTE*)realloc(r->parkedFlag, newCap);
+    if (!flag) return FALSE;
+    memset(flag + r->parkedCap, 0, newCap - r->parkedCap);
+    r->parkedFlag = flag;
+
+    long *order = (long*)malloc(newCap * sizeof *order);
+    if (!order) return FALSE;
+    for (long i = 0; i < r->parkedCount; i++) {
+        order[i] = r->parkedOrder[(r->parkedHead + i) % r->parkedCap];
+    }
+    free(r->parkedOrder);
+    r->parkedOrder = order;
+    r->parkedHead = 0;
+    r->parkedCap = newCap;
+    return TRUE;
+}
+
+void UpdateRing_Flush(UpdateRing *r)
+{
+    while (r->parkedCount > 0 && HasRoom(r, r->tail)) {
+        long id = r->parkedOrder[r->parkedHead];
+        r->parkedHead = (r->parkedHead + 1) % r->parkedCap;
+        r->parkedCount--;
+        r->parkedFlag[id] = 0;
+        Publish(r, r->tail, &r->parked[id]);
+    }
+}
+
+void UpdateRing_Push(UpdateRing *r, RtdUpdate *u)
+{
+    if (r->policy == RING_CONFLATE && r->parkedCount > 0) {
+        UpdateRing_Flush(r);
+
+        // Keep per-topic order: a topic already parked stays parked
+        if (u->topicID >= 0 && u->topicID < r->parkedCap && r->parkedFlag[u->topicID]) {
+            RtdUpdate_Clear(&r->parked[u->topicID]);
+            r->parked[u->topicID] = *u;
+            r->conflated++;
+            return;
+        }
+    }
+
+    LONGLONG tail = r->tail;
+    if (!HasRoom(r, tail)) {
+        switch (r->policy) {
+        case RING_BLOCK:
+            while (!HasRoom(r, tail)) {
+                r->blockedSpins++;
+                RtdYield();
+            }
+            break;
+
+        case RING_DROP_OLDEST:
+            DropOldest(r);
+            break;
+
+        case RING_CONFLATE:
+            if (!EnsureParked(r, u->topicID)) {
+                // No table to park in; fall back to dropping this update
+                RtdUpdate_Clear(u);
+                r->dropped++;
+                return;
+            }
+            r->parked[u->topicID] = *u;
+            r->parkedFlag[u->topicID] = 1;
+            r->parkedOrder[(r->parkedHead + r->parkedCount) % r->parkedCap] = u->topicID;
+            r->parkedCount++;
+            return;
+        }
+    }
+
+    Publish(r, tail, u);
+}
+
+ULONG UpdateRing_Pop(UpdateRing *r, RtdUpdate *out, ULONG max)
+{
+    for (;;) {
+        LONGLONG head = RtdLoadAcquire64(&r->head);
+        if (r->cachedTail - head <= 0) {
+            r->cachedTail = RtdLoadAcquire64(&r->tail);
+            if (r->cachedTail - head <= 0) return 0;
+        }
+
+        LONGLONG avail = r->cachedTail - head;
+        if (avail > (LONGLONG)max) avail = max;
+        for (LONGLONG i = 0; i < avail; i++) out[i] = r->slots[(head + i) & r->mask];
+
+        if (r->policy != RING_DROP_OLDEST) {
+            RtdStoreRelease64(&r->head, head + avail);
+            return (ULONG)avail;
+        }
+        // The producer may have dropped some of these; the copies are then stale
+        if (RtdCas64(&r->head, head, head + avail)) return (ULONG)avail;
+    }
+}
+
+BOOL RtdUpdate_FromVariant(RtdUpdate *u, long topicID, const VARIANT *value, ULONGLONG recvNs)
+{
+    u->recvNs = recvNs;
+    u->topicID = topicID;
+    u->vt = value->vt;
+    u->flags = 0;
+    u->llVal = 0;
+
+    switch (value->vt) {
+        case VT_R8:   u->dblVal = value->dblVal; break;
+        case VT_R4:   u->dblVal = value->fltVal; break;
+        case VT_DATE: u->dblVal = value->date; break;
+        case VT_I4:   u->llVal = value->lVal; break;
+        case VT_I2:   u->llVal = value->iVal; break;
+        case VT_I8:   u->llVal = value->llVal; break;
+        case VT_BOOL: u->llVal = value->boolVal; break;
+        case VT_ERROR: u->llVal = value->scode; break;
+        case VT_BSTR:
+            u->bstrVal = SysAllocStringLen(value->bstrVal, SysStringLen(value->bstrVal));
+            if (!u->bstrVal) {
+                u->vt = VT_EMPTY;
+                return FALSE;
+            }
+            break;
+        default:
+            break;
+    }
+    return TRUE;
+}
+
+void RtdUpdate_Clear(RtdUpdate *u)
+{
+    if (u->vt == VT_BSTR && !(u->flags & RTD_UPDATE_SHARED)) SysFreeString(u->bstrVal);
+    u->vt = VT_EMPTY;
+    u->flags = 0;
+    u->llVal = 0;
+}
+
+BOOL RecordRing_Init(RecordRing *r, ULONG capacity, size_t recordSize)
+{
+    ULONG size = 2;
+    while (size < capacity) size *= 2;
+
+    memset(r, 0, sizeof *r);
+    r->slots = (BYTE*)calloc(size, recordSize);
+    if (!r->slots) return FALSE;
+    r->mask = size - 1;
+    r->recordSize = recordSize;
+    return TRUE;
+}
+
+void RecordRing_Free(RecordRing *r)
+{
+    free(r->slots);
+    memset(r, 0, sizeof *r);
+}
+
+BOOL RecordRing_Push(RecordRing *r, const void *record)
+{
+    LONGLONG tail = r->tail;
+    if (tail - r->cachedHead > r->mask) {
+        r->cachedHead = RtdLoadAcquire64(&r->head);
+        if (tail - r->cachedHead > r->mask) {
+            r->dropped++;
+            return FALSE;
+        }
+    }
+    memcpy(r->slots + (size_t)(tail & r->mask) * r->recordSize, record, r->recordSize);
+    RtdStoreRelease64(&r->tail, tail + 1);
+    r->pushed++;
+    return TRUE;
+}
+
+ULONG RecordRing_Pop(RecordRing *r, void *out, ULONG max)
+{
+    LONGLONG head = r->head;
+    if (r->cachedTail - head <= 0) {
+        r->cachedTail = RtdLoadAcquire64(&r->tail);
+        if (r->cachedTail - head <= 0) return 0;
+    }
+    LONGLONG avail = r->cachedTail - head;
+    if (avail > (LONGLONG)max) avail = max;
+
+    // At most two runs: up to the end of the slots, then from the start
+    size_t first = (size_t)(head & r->mask);
+    size_t run = (size_t)(r->mask + 1) - first;
+    if (run > (size_t)avail) run = (size_t)avail;
+    memcpy(out, r->slots + first * r->recordSize, run * r->recordSize);
+    memcpy((BYTE*)out + run * r->recordSize, r->slots, ((size_t)avail - run) * r->recordSize);
+    RtdStoreRelease64(&r->head, head + avail);
+    return (ULONG)avail;
+}
@@ -0,0 +1,121 @@
+// rtd_ring.h - Lock-free SPSC ring of decoded RTD updates
+// The RTD apartment thread is the single producer: it copies each
+// RefreshData row into the ring and goes straight back to pumping COM.
+// A single worker thread drains each ring; run one ring per worker to
+// fan out across several threads. RecordRing is the same ring for plain
+// records, without overflow policies.
+
+#ifndef __RTD_RING_H__
+#define __RTD_RING_H__
+
+#include "rtd_compat.h"
+
+// Decoded RefreshData row
+typedef struct RtdUpdate {
+    ULONGLONG recvNs;       // RtdNowNs() when the batch was received
+    long      topicID;
+    VARTYPE   vt;           // Original VARIANT type
+    WORD      flags;        // RTD_UPDATE_SHARED, RTD_UPDATE_INITIAL
+    union {
+        double    dblVal;   // VT_R8, VT_R4, VT_DATE
+        LONGLONG  llVal;    // VT_I4, VT_I2, VT_I8, VT_BOOL, VT_ERROR
+        BSTR      bstrVal;  // VT_BSTR, owned copy
+    };
+} RtdUpdate;
+
+// bstrVal belongs to an RtdStringPool: copies share it and nobody frees it
+#define RTD_UPDATE_SHARED 0x0001
+
+// The value ConnectData returned, not a RefreshData row
+#define RTD_UPDATE_INITIAL 0x0002
+
+// What Push does when the ring is full
+typedef enum {
+    RING_BLOCK = 0,         // Spin until a consumer frees a slot
+    RING_DROP_OLDEST,       // Discard the oldest queued update
+    RING_CONFLATE           // Park the update in a per-topic latest-value table
+} RingPolicy;
+
+typedef struct UpdateRing {
+    char              padHead[RTD_CACHE_LINE];
+
+    // Consumer-owned cache line
+    volatile LONGLONG head;         // Next slot to read
+    LONGLONG          cachedTail;
+    char              padConsumer[RTD_CACHE_LINE - 2 * sizeof(LONGLONG)];
+
+    // Producer-owned cache line
+    volatile LONGLONG tail;         // Next slot to write
+    LONGLONG          cachedHead;
+    char              padProducer[RTD_CACHE_LINE - 2 * sizeof(LONGLONG)];
+
+    // Read-mostly configuration
+    RtdUpdate        *slots;
+    LONGLONG          mask;
+    RingPolicy        policy;
+
+    // Producer-private conflation table, indexed by topic ID
+    RtdUpdate        *parked;
+    BYTE             *parkedFlag;
+    long             *parkedOrder;  // FIFO of parked topic IDs
+    long              parkedCap;
+    long              parkedHead;
+    long              parkedCount;
+
+    // Producer-side counters
+    ULONGLONG         pushed;       // Updates accepted by Push
+    ULONGLONG         dropped;      // Updates discarded by RING_DROP_OLDEST
+    ULONGLONG         conflated;    // Updates overwritten by RING_CONFLATE
+    ULONGLONG         blockedSpins; // Yields while waiting under RING_BLOCK
+    LONGLONG          maxDepth;     // High-water mark of queued updates
+
+    char              padTail[RTD_CACHE_LINE];
+} UpdateRing;
+
+// capacity is rounded up to a power of two
+BOOL UpdateRing_Init(UpdateRing *r, ULONG capacity, RingPolicy policy);
+void UpdateRing_Free(UpdateRing *r);
+
+// Producer: takes ownership of u->bstrVal
+void UpdateRing_Push(UpdateRing *r, RtdUpdate *u);
+
+// Producer: move parked (conflated) updates into free slots
+void UpdateRing_Flush(UpdateRing *r);
+
+// Consumer: copy up to max updates out; caller must RtdUpdate_Clear each
+ULONG UpdateRing_Pop(UpdateRing *r, RtdUpdate *out, ULONG max);
+
+// Current number of queued updates (approximate from any thread)
+LONGLONG UpdateRing_Depth(UpdateRing *r);
+
+// Bounded single-producer single-consumer ring of fixed-size records
+// that own nothing (L1 events, closed bars). When it is full the new
+// record is dropped and counted; the consumer sees the gap in its own
+// sequence numbers.
+typedef struct RecordRing {
+    char              padHead[RTD_CACHE_LINE];
+    volatile LONGLONG head;
+    LONGLONG          cachedTail;
+    char              padConsumer[RTD_CACHE_LINE - 2 * sizeof(LONGLONG)];
+    volatile LONGLONG tail;
+    LONGLONG          cachedHead;
+    char              padProducer[RTD_CACHE_LINE - 2 * sizeof(LONGLONG)];
+    BYTE             *slots;
+    LONGLONG          mask;
+    size_t            recordSize;
+    ULONGLONG         pushed;
+    ULONGLONG         dropped;
+    char              padTail[RTD_CACHE_LINE];
+} RecordRing;
+
+// capacity is rounded up to a power of two
+BOOL RecordRing_Init(RecordRing *r, ULONG capacity, size_t recordSize);
+void RecordRing_Free(RecordRing *r);
+BOOL RecordRing_Push(RecordRing *r, const void *record);
+ULONG RecordRing_Pop(RecordRing *r, void *out, ULONG max);
+
+// Copy a VARIANT into an update, duplicating strings
+BOOL RtdUpdate_FromVariant(RtdUpdate *u, long topicID, const VARIANT *value, ULONGLONG recvNs);
+void RtdUpdate_Clear(RtdUpdate *u);
+
+#endif /* __RTD_RING_H__ */
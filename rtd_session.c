@@ -0,0 +1,424 @@
+/**
+ * rtd_session.c - Headless RTD session (libtosrtd)
+ *
+ * The callback object, server creation and the refresh path that used to
+ * live in rtd_client.c, with the console left out. Only the session's
+ * thread touches the server; UpdateNotify and Disconnect may arrive on
+ * any thread (the shard threads in sharded mode) and only set flags and
+ * signal the wakeup.
+ *
+ * ConnectData's initial values are kept until the next Refresh, which
+ * hands them over ahead of anything RefreshData returns. In sharded mode
+ * the shards queue them with their other rows instead.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "rtd_session.h"
+#include "rtd_sim.h"
+
+// IRTDUpdateEvent handed to the server, refcounted so a server that
+// outlives the session never calls into freed memory
+typedef struct SessionCallback {
+    IRTDUpdateEvent iface;
+    LONG            refCount;
+    RtdSession     *session;    // NULL once the session is freed
+} SessionCallback;
+
+static HRESULT STDMETHODCALLTYPE SCB_QueryInterface(IRTDUpdateEvent *this, REFIID riid, void **ppv)
+{
+    if (IsEqualIID(riid, &IID_IUnknown) ||
+        IsEqualIID(riid, &IID_IDispatch) ||
+        IsEqualIID(riid, &IID_IRTDUpdateEvent))
+    {
+        *ppv = this;
+        this->lpVtbl->AddRef(this);
+        return S_OK;
+    }
+    *ppv = NULL;
+    return E_NOINTERFACE;
+}
+
+static ULONG STDMETHODCALLTYPE SCB_AddRef(IRTDUpdateEvent *this)
+{
+    return InterlockedIncrement(&((SessionCallback*)this)->refCount);
+}
+
+static ULONG STDMETHODCALLTYPE SCB_Release(IRTDUpdateEvent *this)
+{
+    SessionCallback *cb = (SessionCallback*)this;
+    LONG c = InterlockedDecrement(&cb->refCount);
+    if (c == 0) CoTaskMemFree(cb);
+    return c;
+}
+
+static HRESULT STDMETHODCALLTYPE SCB_UpdateNotify(IRTDUpdateEvent *this)
+{
+    RtdSession *s = ((SessionCallback*)this)->session;
+    if (!s) return S_OK;
+    InterlockedExchange(&s->updatePending, 1);
+    RtdSession_Wake(s);
+    return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE SCB_get_HeartbeatInterval(IRTDUpdateEvent *this, long *plRetVal)
+{
+    *plRetVal = 100;
+    return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE SCB_put_HeartbeatInterval(IRTDUpdateEvent *this, long plRetVal)
+{
+    return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE SCB_Disconnect(IRTDUpdateEvent *this)
+{
+    RtdSession *s = ((SessionCallback*)this)->session;
+    if (!s) return S_OK;
+    Supervisor_SignalDisconnect(&s->supervisor);
+    RtdSession_Wake(s);
+    return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE SCB_GetTypeInfoCount(IRTDUpdateEvent *this, UINT *pctinfo)
+{
+    *pctinfo = 0;
+    return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE SCB_GetTypeInfo(IRTDUpdateEvent *this, UINT iTInfo, LCID lcid, ITypeInfo **ppTInfo)
+{
+    *ppTInfo = NULL;
+    return E_NOTIMPL;
+}
+
+static HRESULT STDMETHODCALLTYPE SCB_GetIDsOfNames(IRTDUpdateEvent *this, REFIID riid, LPOLESTR *rgszNames,
+                                                   UINT cNames, LCID lcid, DISPID *rgDispId)
+{
+    return E_NOTIMPL;
+}
+
+static HRESULT STDMETHODCALLTYPE SCB_Invoke(IRTDUpdateEvent *this, DISPID dispIdMember, REFIID riid, LCID lcid,
+                                            WORD wFlags, DISPPARAMS *pDispParams, VARIANT *pvarResult,
+                                            EXCEPINFO *pExcepInfo, UINT *puArgErr)
+{
+    return E_NOTIMPL;
+}
+
+static IRTDUpdateEventVtbl scb_vtbl = {
+    SCB_QueryInterface,
+    SCB_AddRef,
+    SCB_Release,
+    SCB_GetTypeInfoCount,
+    SCB_GetTypeInfo,
+    SCB_GetIDsOfNames,
+    SCB_Invoke,
+    SCB_UpdateNotify,
+    SCB_get_HeartbeatInterval,
+    SCB_put_HeartbeatInterval,
+    SCB_Disconnect
+};
+
+/**
+ * ServerFactory: the simulated server when ctx is a SimConfig, otherwise
+ * a new ThinkOrSwim RTD server instance
+ */
+HRESULT RtdSession_CreateServer(void *ctx, IRtdServer **ppSrv)
+{
+    if (ctx) {
+        *ppSrv = SimServer_Create((const SimConfig*)ctx);
+        return *ppSrv ? S_OK : RPC_E_DISCONNECTED;
+    }
+
+#ifdef _WIN32
+    CLSID clsid;
+    HRESULT hr = CLSIDFromProgID(L"Tos.RTD", &clsid);
+    if (FAILED(hr)) return hr;
+    return CoCreateInstance(&clsid, NULL, CLSCTX_INPROC_SERVER, &IID_IRtdServer, (void**)ppSrv);
+#else
+    *ppSrv = NULL;
+    return E_NOTIMPL;
+#endif
+}
+
+/**
+ * ServerFactory: cfg.shards servers behind one ShardServer, each made by
+ * the configured factory on its own thread
+ */
+static HRESULT CreateShardedServer(void *ctx, IRtdServer **ppSrv)
+{
+    RtdSession *s = (RtdSession*)ctx;
+    *ppSrv = ShardServer_Create(s->cfg.factory, s->cfg.factoryCtx, &s->shard);
+    return *ppSrv ? S_OK : E_OUTOFMEMORY;
+}
+
+/**
+ * SubscriptionHandler for the table's ConnectData calls: keep the initial
+ * value for the next Refresh
+ */
+static void KeepInitial(void *ctx, TopicSubscription *sub, VARIANT *value)
+{
+    RtdSession *s = (RtdSession*)ctx;
+    if (s->initialCount == s->initialCap) {
+        long cap = s->initialCap ? s->initialCap * 2 : 256;
+        RtdUpdate *initial = (RtdUpdate*)realloc(s->initial, cap * sizeof *initial);
+        if (!initial) return;
+        s->initial = initial;
+        s->initialCap = cap;
+    }
+    RtdUpdate *u = &s->initial[s->initialCount];
+    if (!RtdUpdate_FromVariant(u, sub->topicID, value, RtdNowNs())) return;
+    u->flags |= RTD_UPDATE_INITIAL;
+    s->initialCount++;
+}
+
+BOOL RtdSession_Init(RtdSession *s, const RtdSessionConfig *cfg)
+{
+    memset(s, 0, sizeof *s);
+    s->cfg = *cfg;
+    if (!s->cfg.factory) s->cfg.factory = RtdSession_CreateServer;
+    if (s->cfg.shards < 1) s->cfg.shards = 1;
+    if (s->cfg.shards > MAX_SHARDS) s->cfg.shards = MAX_SHARDS;
+    s->shard.shards = s->cfg.shards;
+    s->shard.ringSize = s->cfg.shardRingSize ? s->cfg.shardRingSize : 65536;
+    s->shard.pools = s->cfg.shardPools;
+
+    if (!SubTable_Init(&s->subs, 1024)) return FALSE;
+    s->subs.onConnectValue = KeepInitial;
+    s->subs.connectValueCtx = s;
+    if (!RtdBatch_Init(&s->batch, 1024)) {
+        SubTable_Free(&s->subs);
+        return FALSE;
+    }
+    if (!Wakeup_Init(&s->wakeup, s->cfg.coalesceUs)) {
+        RtdBatch_Free(&s->batch);
+        SubTable_Free(&s->subs);
+        return FALSE;
+    }
+
+    SessionCallback *cb = (SessionCallback*)CoTaskMemAlloc(sizeof *cb);
+    if (!cb) {
+        Wakeup_Free(&s->wakeup);
+        RtdBatch_Free(&s->batch);
+        SubTable_Free(&s->subs);
+        return FALSE;
+    }
+    cb->iface.lpVtbl = &scb_vtbl;
+    cb->refCount = 1;
+    cb->session = s;
+    s->callback = &cb->iface;
+
+    if (s->cfg.shards > 1)
+        Supervisor_Init(&s->supervisor, CreateShardedServer, s, s->callback, &s->subs, s->cfg.heartbeatMs);
+    else
+        Supervisor_Init(&s->supervisor, s->cfg.factory, s->cfg.factoryCtx, s->callback, &s->subs, s->cfg.heartbeatMs);
+    s->supervisor.onEvent = s->cfg.onEvent;
+    s->supervisor.ctx = s->cfg.ctx;
+    return TRUE;
+}
+
+HRESULT RtdSession_Start(RtdSession *s)
+{
+    return Supervisor_Start(&s->supervisor);
+}
+
+void RtdSession_Stop(RtdSession *s)
+{
+    IRtdServer *srv = s->supervisor.server;
+    if (srv) {
+        for (long id = 1; id < s->subs.highWater; id++) {
+            TopicSubscription *sub = SubTable_Get(&s->subs, id);
+            if (sub && sub->connected) DisconnectSubscription(srv, sub);
+        }
+    }
+    Supervisor_Stop(&s->supervisor);
+}
+
+void RtdSession_Free(RtdSession *s)
+{
+    if (s->callback) {
+        ((SessionCallback*)s->callback)->session = NULL;
+        s->callback->lpVtbl->Release(s->callback);
+        s->callback = NULL;
+    }
+    for (long i = 0; i < s->heldCount; i++) RtdUpdate_Clear(&s->held[i]);
+    free(s->held);
+    s->held = NULL;
+    s->heldCount = s->heldCap = 0;
+    for (long i = 0; i < s->initialCount; i++) RtdUpdate_Clear(&s->initial[i]);
+    free(s->initial);
+    s->initial = NULL;
+    s->initialCount = s->initialCap = 0;
+    Wakeup_Free(&s->wakeup);
+    RtdBatch_Free(&s->batch);
+    SubTable_Free(&s->subs);
+}
+
+HRESULT RtdSession_Subscribe(RtdSession *s, const WCHAR *symbol, const WCHAR *topic, TopicSubscription **ppSub)
+{
+    if (ppSub) *ppSub = NULL;
+
+    BOOL existed = SubTable_Find(&s->subs, symbol, topic) != NULL;
+    TopicSubscription *sub = SubTable_Add(&s->subs, symbol, topic);
+    if (!sub) return E_OUTOFMEMORY;
+    if (sub->connected) {
+        if (ppSub) *ppSub = sub;
+        return S_FALSE;
+    }
+
+    IRtdServer *srv = s->supervisor.server;
+    HRESULT hr = srv ? SubTable_Connect(&s->subs, srv, sub) : RPC_E_DISCONNECTED;
+    if (FAILED(hr)) {
+        if (!existed) SubTable_Remove(&s->subs, sub->topicID);
+        return hr;
+    }
+    if (ppSub) *ppSub = sub;
+    return S_OK;
+}
+
+HRESULT RtdSession_Unsubscribe(RtdSession *s, long topicID)
+{
+    TopicSubscription *sub = SubTable_Get(&s->subs, topicID);
+    if (!sub) return S_FALSE;
+
+    IRtdServer *srv = s->supervisor.server;
+    HRESULT hr = srv ? DisconnectSubscription(srv, sub) : S_OK;
+    SubTable_Remove(&s->subs, topicID);
+
+    // The ID may be reused before the next Refresh
+    long kept = 0;
+    for (long i = 0; i < s->initialCount; i++) {
+        if (s->initial[i].topicID == topicID) RtdUpdate_Clear(&s->initial[i]);
+        else s->initial[kept++] = s->initial[i];
+    }
+    s->initialCount = kept;
+    return hr;
+}
+
+BOOL RtdSession_Wait(RtdSession *s, DWORD timeoutMs)
+{
+    if (s->cfg.pollMode) RtdSleepMs(RTD_SESSION_POLL_MS);
+    else Wakeup_Wait(&s->wakeup, timeoutMs);
+
+#ifdef _WIN32
+    // Apartment-threaded servers deliver UpdateNotify through the message queue
+    MSG msg;
+    while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+        if (msg.message == WM_QUIT) return FALSE;
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+    }
+#endif
+    return TRUE;
+}
+
+/**
+ * Hand the gathered rows to onBatch, then free the string values held
+ * for them
+ */
+static void Deliver(RtdSession *s, ULONGLONG recvNs)
+{
+    if (s->batch.rows > 0) {
+        s->batches++;
+        s->rows += s->batch.rows;
+        if (s->cfg.onBatch) s->cfg.onBatch(s->cfg.ctx, s, &s->batch, recvNs);
+    }
+    for (long i = 0; i < s->heldCount; i++) RtdUpdate_Clear(&s->held[i]);
+    s->heldCount = 0;
+    RtdBatch_Reset(&s->batch);
+}
+
+/**
+ * Add an update to the batch, which borrows a string value from held[]
+ * until Deliver
+ */
+static void Stage(RtdSession *s, RtdUpdate *u)
+{
+    if (u->vt == VT_BSTR) {
+        if (s->heldCount == s->heldCap) {
+            long cap = s->heldCap ? s->heldCap * 2 : 256;
+            RtdUpdate *held = (RtdUpdate*)realloc(s->held, cap * sizeof *held);
+            if (!held) {
+                RtdUpdate_Clear(u);
+                return;
+            }
+            s->held = held;
+            s->heldCap = cap;
+        }
+        s->held[s->heldCount++] = *u;
+    }
+
+    if (!RtdBatch_Append(&s->batch, u) && u->vt == VT_BSTR)
+        RtdUpdate_Clear(&s->held[--s->heldCount]);
+}
+
+/**
+ * ShardRowFn: rows arrive in receive-time order; each change of receive
+ * time closes a batch
+ */
+static void GatherMerged(void *ctx, RtdUpdate *u)
+{
+    RtdSession *s = (RtdSession*)ctx;
+    if (s->batch.rows > 0 && u->recvNs != s->mergedNs) Deliver(s, s->mergedNs);
+    s->mergedNs = u->recvNs;
+    Stage(s, u);
+}
+
+/**
+ * The kept ConnectData values as one batch, stamped with the latest
+ * ConnectData's time
+ */
+static void DeliverInitial(RtdSession *s)
+{
+    ULONGLONG recvNs = 0;
+    RtdBatch_Reset(&s->batch);
+    for (long i = 0; i < s->initialCount; i++) {
+        if (s->initial[i].recvNs > recvNs) recvNs = s->initial[i].recvNs;
+        Stage(s, &s->initial[i]);
+    }
+    s->initialCount = 0;
+    Deliver(s, recvNs);
+}
+
+long RtdSession_Refresh(RtdSession *s)
+{
+    ULONGLONG before = s->rows;
+    if (s->initialCount > 0) DeliverInitial(s);
+
+    IRtdServer *srv = s->supervisor.server;
+    if (!srv || !InterlockedCompareExchange(&s->updatePending, 0, 1))
+        return s->rows > before ? (long)(s->rows - before) : -1;
+    if (!s->cfg.pollMode) Wakeup_Consume(&s->wakeup);
+
+    ULONGLONG startNs = RtdNowNs();
+    if (s->cfg.shards > 1) {
+        RtdBatch_Reset(&s->batch);
+        long count = ShardServer_Drain(srv, GatherMerged, s);
+        s->lastRefreshNs = RtdNowNs() - startNs;
+        Deliver(s, s->mergedNs);
+        if (count > 0) s->refreshes++;
+        Supervisor_OnRefresh(&s->supervisor, S_OK, count, RtdNowNs());
+    } else {
+        long topicCount = 0;
+        SAFEARRAY *pOutArr = NULL;
+        HRESULT hr = srv->lpVtbl->RefreshData(srv, &topicCount, &pOutArr);
+        ULONGLONG recvNs = RtdNowNs();
+        s->lastRefreshNs = recvNs - startNs;
+
+        if (SUCCEEDED(hr) && pOutArr && topicCount > 0) {
+            s->refreshes++;
+            if (RtdBatch_Decode(&s->batch, pOutArr, topicCount) > 0) Deliver(s, recvNs);
+        }
+        if (pOutArr) SafeArrayDestroy(pOutArr);
+        Supervisor_OnRefresh(&s->supervisor, hr, SUCCEEDED(hr) ? topicCount : 0, RtdNowNs());
+    }
+    return (long)(s->rows - before);
+}
+
+long RtdSession_Poll(RtdSession *s, DWORD timeoutMs)
+{
+    if (!RtdSession_Wait(s, timeoutMs)) return -1;
+    RtdSession_Tick(s, RtdNowNs());
+    return RtdSession_Refresh(s);
+}
@@ -0,0 +1,142 @@
+// rtd_session.h - Headless RTD session (libtosrtd)
+// Everything between a process and the RTD server, without a console:
+// the IRTDUpdateEvent callback, the server and its supervisor (heartbeats,
+// reconnect, resubscribe), optional sharding, the subscription table,
+// and RefreshData decoding. An application embeds a session instead of
+// running rtd_client and reading its output.
+//
+// A session is driven from one thread, the one that initialized COM for
+// it: RtdSession_Poll waits for UpdateNotify, calls RefreshData, decodes
+// the result into typed columns (rtd_decode.h) and hands them to the
+// batch callback. Nothing is formatted or copied on the way: the columns
+// point into the server's SAFEARRAY and the batch buffers, so they are
+// valid only until the callback returns. Row i belongs to topic ID
+// batch->topicID[i]; SubTable_Get(&s->subs, id) finds its subscription.
+//
+// With shards > 1 each shard decodes on its own thread and the session
+// merges their rows in receive-time order, handing over one batch per
+// receive time. Those string values are owned by the session and freed
+// after the callback, so the same rule applies.
+//
+// The value ConnectData returns for a new subscription is delivered as an
+// ordinary row: the next Refresh hands over the values of every
+// subscription made since the last one as a batch of their own, before
+// any RefreshData rows. A topic's first row is therefore its value at
+// subscription time, not its first change.
+//
+// Built on Linux against the simulated server (rtd_sim.h), like the rest
+// of the portable core:
+//
+//   gcc -c rtd_session.c rtd_subs.c ... && ar rcs libtosrtd.a *.o
+
+#ifndef __RTD_SESSION_H__
+#define __RTD_SESSION_H__
+
+#include "rtd_decode.h"
+#include "rtd_shard.h"
+#include "rtd_subs.h"
+#include "rtd_supervisor.h"
+#include "rtd_wake.h"
+
+#define RTD_SESSION_POLL_MS 100     // RtdSession_Wait in poll mode
+
+struct RtdSession;
+
+// One decoded batch, all rows stamped recvNs (RtdNowNs clock)
+typedef void (*RtdSessionBatchFn)(void *ctx, struct RtdSession *s, const RtdBatch *batch, ULONGLONG recvNs);
+
+typedef struct RtdSessionConfig {
+    ServerFactory      factory;         // NULL = RtdSession_CreateServer
+    void              *factoryCtx;      // For RtdSession_CreateServer: SimConfig*, or NULL for ThinkOrSwim
+    int                shards;          // Servers on their own threads; 0 or 1 = one, called here
+    ULONG              shardRingSize;   // Decoded rows queued per shard (default 65536)
+    RtdStringPool     *shardPools;      // One per shard, may be NULL
+    DWORD              heartbeatMs;     // 0 = no heartbeats
+    DWORD              coalesceUs;      // Wait this long after a notify before RefreshData
+    BOOL               pollMode;        // Check for notifies every RTD_SESSION_POLL_MS instead of waking
+    RtdSessionBatchFn  onBatch;
+    SupervisorEventFn  onEvent;         // Server lost / recovered, may be NULL
+    void              *ctx;             // For onBatch and onEvent
+} RtdSessionConfig;
+
+typedef struct RtdSession {
+    RtdSessionConfig   cfg;
+    SubscriptionTable  subs;
+    RtdBatch           batch;           // Columns handed to onBatch
+    Supervisor         supervisor;      // Owns the server
+    RtdWakeup          wakeup;
+    IRTDUpdateEvent   *callback;        // Handed to ServerStart
+    volatile LONG      updatePending;   // Set by UpdateNotify
+    ShardConfig        shard;
+
+    // Sharded mode: rows of the receive time being gathered
+    ULONGLONG          mergedNs;
+    RtdUpdate         *held;            // String rows, freed after the callback
+    long               heldCount;
+    long               heldCap;
+
+    // ConnectData values not yet delivered (single server)
+    RtdUpdate         *initial;
+    long               initialCount;
+    long               initialCap;
+
+    ULONGLONG          lastRefreshNs;   // Time spent in the last RefreshData or merge
+    ULONGLONG          refreshes;       // RefreshData calls (or merges) that returned rows
+    ULONGLONG          batches;         // onBatch calls
+    ULONGLONG          rows;
+} RtdSession;
+
+// ServerFactory: the simulated server when ctx is a SimConfig, otherwise
+// a new ThinkOrSwim RTD server instance (Windows only)
+HRESULT RtdSession_CreateServer(void *ctx, IRtdServer **ppSrv);
+
+BOOL RtdSession_Init(RtdSession *s, const RtdSessionConfig *cfg);
+
+// Create and start the server; subscribe after this
+HRESULT RtdSession_Start(RtdSession *s);
+
+// Disconnect every subscription and terminate the server
+void RtdSession_Stop(RtdSession *s);
+void RtdSession_Free(RtdSession *s);
+
+static inline IRtdServer* RtdSession_Server(const RtdSession *s)
+{
+    return s->supervisor.server;
+}
+
+/**
+ * Subscribe a symbol x topic pair. S_OK when ConnectData succeeded,
+ * S_FALSE when the pair was already connected (*ppSub is the existing
+ * subscription), or the failure, after which a new pair is forgotten.
+ * ppSub may be NULL.
+ */
+HRESULT RtdSession_Subscribe(RtdSession *s, const WCHAR *symbol, const WCHAR *topic, TopicSubscription **ppSub);
+
+// DisconnectData and forget the subscription; its topic ID may be reused
+HRESULT RtdSession_Unsubscribe(RtdSession *s, long topicID);
+
+// Block until UpdateNotify, RtdSession_Wake or timeoutMs (RTD_SESSION_POLL_MS
+// in poll mode), pumping window messages on Windows. FALSE on WM_QUIT.
+BOOL RtdSession_Wait(RtdSession *s, DWORD timeoutMs);
+
+// Interrupt RtdSession_Wait from any thread
+static inline void RtdSession_Wake(RtdSession *s)
+{
+    if (!s->cfg.pollMode) Wakeup_Signal(&s->wakeup);
+}
+
+// Heartbeats, and reconnecting and resubscribing while the server is gone
+static inline void RtdSession_Tick(RtdSession *s, ULONGLONG nowNs)
+{
+    Supervisor_Tick(&s->supervisor, nowNs);
+}
+
+// Deliver any ConnectData values kept since the last call, then, if the
+// server has notified, fetch and decode its updates; onBatch sees each
+// batch. Returns the rows handed over, or -1 when there was nothing.
+long RtdSession_Refresh(RtdSession *s);
+
+// Wait, Tick and Refresh: the whole loop body for a simple embedder
+long RtdSession_Poll(RtdSession *s, DWORD timeoutMs);
+
+#endif /* __RTD_SESSION_H__ */
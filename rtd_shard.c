@@ -0,0 +1,916 @@
+/**
+ * rtd_shard.c - Several RTD servers on their own apartment threads
+ *
+ * Only a shard's own thread touches its server. The RTD thread talks to
+ * it through a mutex-protected command list (connect, disconnect,
+ * heartbeat) and hears back through the shard's update ring. When a topic
+ * is disconnected, the shard pushes a retire marker behind the rows it
+ * already queued, and Drain drops that shard's rows for the topic until
+ * the marker arrives, so a reused topic ID never receives its previous
+ * pair's values. A new pair on another shard is not held up.
+ * ConnectData's initial values go through the ring too, as one batch per
+ * command list.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "rtd_shard.h"
+#include "rtd_decode.h"
+#include "rtd_wake.h"
+
+#define SHARD_IDLE       ((LONGLONG)0x7FFFFFFFFFFFFFFFLL)  // busyNs between batches
+#define SHARD_MERGE_ROWS 256        // Rows Drain takes from a ring at a time
+#define SHARD_RETIRED    0x8000     // RtdUpdate.flags of a retire marker
+
+typedef enum {
+    SHARD_CONNECT = 0,
+    SHARD_DISCONNECT,
+    SHARD_HEARTBEAT
+} ShardOp;
+
+typedef struct ShardCommand {
+    ShardOp op;
+    long    topicID;
+    BSTR    topic;                  // SHARD_CONNECT only, owned by the command
+    BSTR    symbol;
+} ShardCommand;
+
+// Where a topic ID lives, kept by the RTD thread
+typedef struct ShardTopic {
+    BYTE   shard;
+    BYTE   connected;
+    USHORT retiring[MAX_SHARDS];    // Retire markers still on their way, per shard
+} ShardTopic;
+
+struct Shard;
+struct ShardServer;
+
+typedef struct ShardCallback {
+    IRTDUpdateEvent  iface;
+    struct Shard    *shard;
+} ShardCallback;
+
+typedef struct Shard {
+    struct ShardServer *owner;
+    int               index;
+    RtdThread         thread;
+    BOOL              threadStarted;
+    volatile LONG     exited;
+    volatile LONG     stop;
+    RtdWakeup         wakeup;
+    ShardCallback     callback;
+    HRESULT           startHr;
+
+    // Shard thread only
+    IRtdServer       *server;
+    RtdBatch          batch;
+    SAFEARRAY        *args;         // ConnectData arguments, refilled per call
+    RtdUpdate        *initial;      // ConnectData values of the running commands
+    long              initialCount;
+    long              initialCap;
+    volatile LONG     updatePending;
+    volatile LONG     lost;
+
+    // Commands queued by the RTD thread; the shard swaps the list out
+    RtdMutex          lock;
+    ShardCommand     *commands;
+    long              commandCount;
+    long              commandCap;
+    ShardCommand     *running;
+    long              runningCap;
+
+    UpdateRing        ring;
+    volatile LONGLONG busyNs;       // Receive time of the batch being pushed, SHARD_IDLE if none
+
+    // Drain's side of the ring
+    RtdUpdate        *merge;
+    ULONG             mergeHead;
+    ULONG             mergeCount;
+
+    ShardStats        stats;
+} Shard;
+
+typedef struct ShardServer {
+    IRtdServer        iface;
+    volatile LONG     refCount;
+    ServerFactory     factory;
+    void             *factoryCtx;
+    ShardConfig       cfg;
+    IRTDUpdateEvent  *callback;
+    BOOL              started;
+    volatile LONG     startedCount;
+    RtdWakeup         startWake;
+
+    ShardTopic       *topics;       // Indexed by topic ID
+    long              topicCap;
+
+    RtdUpdate        *staged;       // RefreshData's merged rows
+    long              stagedCount;
+    long              stagedCap;
+
+    Shard             shards[MAX_SHARDS];
+} ShardServer;
+
+static ShardServer* FromIface(IRtdServer *This)
+{
+    return (ShardServer*)This;
+}
+
+int ShardServer_ShardOf(const WCHAR *symbol, int shards)
+{
+    // FNV-1a, so a symbol lands on the same shard in every run
+    ULONG h = 2166136261u;
+    for (; *symbol; symbol++) {
+        h ^= (ULONG)*symbol;
+        h *= 16777619u;
+    }
+    return (int)(h % (ULONG)shards);
+}
+
+/**
+ * The shard's server is gone: say so once, through the client's Disconnect
+ */
+static void MarkLost(Shard *sh, HRESULT hr)
+{
+    if (InterlockedCompareExchange(&sh->lost, 1, 0) != 0) return;
+    sh->stats.lost = hr;
+    IRTDUpdateEvent *cb = sh->owner->callback;
+    if (cb) cb->lpVtbl->Disconnect(cb);
+}
+
+/**
+ * IRTDUpdateEvent handed to the shard's own server
+ */
+static HRESULT STDMETHODCALLTYPE ShardCB_QueryInterface(IRTDUpdateEvent *This, REFIID riid, void **ppv)
+{
+    if (IsEqualIID(riid, &IID_IUnknown) || IsEqualIID(riid, &IID_IDispatch) ||
+        IsEqualIID(riid, &IID_IRTDUpdateEvent)) {
+        *ppv = This;
+        return S_OK;
+    }
+    *ppv = NULL;
+    return E_NOINTERFACE;
+}
+
+// Embedded in the Shard, which outlives its server
+static ULONG STDMETHODCALLTYPE ShardCB_AddRef(IRTDUpdateEvent *This)  { return 1; }
+static ULONG STDMETHODCALLTYPE ShardCB_Release(IRTDUpdateEvent *This) { return 1; }
+
+static HRESULT STDMETHODCALLTYPE ShardCB_GetTypeInfoCount(IRTDUpdateEvent *This, UINT *pctinfo)
+{
+    *pctinfo = 0;
+    return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE ShardCB_GetTypeInfo(IRTDUpdateEvent *This, UINT iTInfo, LCID lcid, ITypeInfo **ppTInfo)
+{
+    return E_NOTIMPL;
+}
+
+static HRESULT STDMETHODCALLTYPE ShardCB_GetIDsOfNames(IRTDUpdateEvent *This, REFIID riid, LPOLESTR *rgszNames, UINT cNames, LCID lcid, DISPID *rgDispId)
+{
+    return E_NOTIMPL;
+}
+
+static HRESULT STDMETHODCALLTYPE ShardCB_Invoke(IRTDUpdateEvent *This, DISPID dispIdMember, REFIID riid, LCID lcid, WORD wFlags, DISPPARAMS *pDispParams, VARIANT *pVarResult, EXCEPINFO *pExcepInfo, UINT *puArgErr)
+{
+    return E_NOTIMPL;
+}
+
+static HRESULT STDMETHODCALLTYPE ShardCB_UpdateNotify(IRTDUpdateEvent *This)
+{
+    Shard *sh = ((ShardCallback*)This)->shard;
+    InterlockedExchange(&sh->updatePending, 1);
+    Wakeup_Signal(&sh->wakeup);
+    return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE ShardCB_GetHeartbeatInterval(IRTDUpdateEvent *This, long *plRetVal)
+{
+    IRTDUpdateEvent *cb = ((ShardCallback*)This)->shard->owner->callback;
+    if (cb) return cb->lpVtbl->get_HeartbeatInterval(cb, plRetVal);
+    *plRetVal = 100;
+    return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE ShardCB_PutHeartbeatInterval(IRTDUpdateEvent *This, long plRetVal)
+{
+    return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE ShardCB_Disconnect(IRTDUpdateEvent *This)
+{
+    Shard *sh = ((ShardCallback*)This)->shard;
+    MarkLost(sh, RPC_E_DISCONNECTED);
+    Wakeup_Signal(&sh->wakeup);
+    return S_OK;
+}
+
+static IRTDUpdateEventVtbl shardcb_vtbl = {
+    ShardCB_QueryInterface,
+    ShardCB_AddRef,
+    ShardCB_Release,
+    ShardCB_GetTypeInfoCount,
+    ShardCB_GetTypeInfo,
+    ShardCB_GetIDsOfNames,
+    ShardCB_Invoke,
+    ShardCB_UpdateNotify,
+    ShardCB_GetHeartbeatInterval,
+    ShardCB_PutHeartbeatInterval,
+    ShardCB_Disconnect
+};
+
+/**
+ * Queue a command for a shard's thread and wake it
+ */
+static HRESULT Post(Shard *sh, ShardOp op, long topicID, BSTR topic, BSTR symbol)
+{
+    RtdMutex_Lock(&sh->lock);
+    if (sh->commandCount == sh->commandCap) {
+        long newCap = sh->commandCap ? sh->commandCap * 2 : 256;
+        ShardCommand *grown = (ShardCommand*)realloc(sh->commands, newCap * sizeof *grown);
+        if (!grown) {
+            RtdMutex_Unlock(&sh->lock);
+            SysFreeString(topic);
+            SysFreeString(symbol);
+            return E_OUTOFMEMORY;
+        }
+        sh->commands = grown;
+        sh->commandCap = newCap;
+    }
+    ShardCommand *c = &sh->commands[sh->commandCount++];
+    c->op = op;
+    c->topicID = topicID;
+    c->topic = topic;
+    c->symbol = symbol;
+    RtdMutex_Unlock(&sh->lock);
+    Wakeup_Signal(&sh->wakeup);
+    return S_OK;
+}
+
+static void KeepInitial(Shard *sh, long topicID, const VARIANT *value)
+{
+    if (sh->initialCount == sh->initialCap) {
+        long newCap = sh->initialCap ? sh->initialCap * 2 : 64;
+        RtdUpdate *grown = (RtdUpdate*)realloc(sh->initial, newCap * sizeof *grown);
+        if (!grown) return;
+        sh->initial = grown;
+        sh->initialCap = newCap;
+    }
+    RtdUpdate *u = &sh->initial[sh->initialCount];
+    if (!RtdUpdate_FromVariant(u, topicID, value, 0)) return;
+    u->flags |= RTD_UPDATE_INITIAL;
+    sh->initialCount++;
+}
+
+/**
+ * Queue the kept ConnectData values as one batch, stamped like Refresh's
+ */
+static void PushInitial(Shard *sh)
+{
+    if (sh->initialCount == 0) return;
+    InterlockedExchange64(&sh->busyNs, (LONGLONG)RtdNowNs());
+    ULONGLONG recvNs = RtdNowNs();
+    RtdStoreRelease64(&sh->busyNs, (LONGLONG)recvNs);
+    for (long i = 0; i < sh->initialCount; i++) {
+        sh->initial[i].recvNs = recvNs;
+        UpdateRing_Push(&sh->ring, &sh->initial[i]);
+    }
+    RtdStoreRelease64(&sh->busyNs, SHARD_IDLE);
+
+    sh->stats.initialRows += sh->initialCount;
+    sh->initialCount = 0;
+    IRTDUpdateEvent *cb = sh->owner->callback;
+    if (cb) cb->lpVtbl->UpdateNotify(cb);
+}
+
+static void Connect(Shard *sh, ShardCommand *c)
+{
+    if (!sh->args) {
+        SAFEARRAYBOUND sab = { 2, 0 };
+        sh->args = SafeArrayCreate(VT_VARIANT, 1, &sab);
+        if (!sh->args) {
+            sh->stats.connectFailed++;
+            return;
+        }
+    }
+    VARIANT *argv;
+    SafeArrayAccessData(sh->args, (void**)&argv);
+    argv[0].vt = VT_BSTR;
+    argv[0].bstrVal = c->topic;
+    argv[1].vt = VT_BSTR;
+    argv[1].bstrVal = c->symbol;
+    SafeArrayUnaccessData(sh->args);
+
+    VARIANT initVal;
+    VariantInit(&initVal);
+    VARIANT_BOOL getNew = VARIANT_TRUE;
+    HRESULT hr = sh->server->lpVtbl->ConnectData(sh->server, c->topicID, &sh->args, &getNew, &initVal);
+    if (SUCCEEDED(hr) && initVal.vt != VT_EMPTY) KeepInitial(sh, c->topicID, &initVal);
+    VariantClear(&initVal);
+
+    // The strings stay the command's
+    SafeArrayAccessData(sh->args, (void**)&argv);
+    argv[0].vt = VT_EMPTY;
+    argv[1].vt = VT_EMPTY;
+    SafeArrayUnaccessData(sh->args);
+
+    sh->stats.connects++;
+    if (FAILED(hr)) {
+        sh->stats.connectFailed++;
+        if (hr == RPC_E_DISCONNECTED) MarkLost(sh, hr);
+    }
+}
+
+static void Disconnect(Shard *sh, long topicID)
+{
+    // A value kept for the topic goes ahead of its retire marker
+    PushInitial(sh);
+    HRESULT hr = sh->server->lpVtbl->DisconnectData(sh->server, topicID);
+    if (hr == RPC_E_DISCONNECTED) MarkLost(sh, hr);
+    sh->stats.disconnects++;
+
+    // Behind every row already queued for the topic
+    RtdUpdate marker;
+    memset(&marker, 0, sizeof marker);
+    marker.topicID = topicID;
+    marker.vt = VT_EMPTY;
+    marker.flags = SHARD_RETIRED;
+    UpdateRing_Push(&sh->ring, &marker);
+}
+
+static void RunCommands(Shard *sh)
+{
+    RtdMutex_Lock(&sh->lock);
+    ShardCommand *cmds = sh->commands;
+    long count = sh->commandCount, cap = sh->commandCap;
+    sh->commands = sh->running;
+    sh->commandCap = sh->runningCap;
+    sh->commandCount = 0;
+    sh->running = cmds;
+    sh->runningCap = cap;
+    RtdMutex_Unlock(&sh->lock);
+
+    for (long i = 0; i < count; i++) {
+        ShardCommand *c = &cmds[i];
+        switch (c->op) {
+            case SHARD_CONNECT:
+                Connect(sh, c);
+                break;
+            case SHARD_DISCONNECT:
+                Disconnect(sh, c->topicID);
+                break;
+            case SHARD_HEARTBEAT: {
+                long alive = 0;
+                HRESULT hr = sh->server->lpVtbl->Heartbeat(sh->server, &alive);
+                if (FAILED(hr)) MarkLost(sh, hr);
+                break;
+            }
+        }
+        SysFreeString(c->topic);
+        SysFreeString(c->symbol);
+    }
+    PushInitial(sh);
+}
+
+/**
+ * RefreshData, decode, and queue the rows for Drain
+ */
+static void Refresh(Shard *sh)
+{
+    long count = 0;
+    SAFEARRAY *arr = NULL;
+    HRESULT hr = sh->server->lpVtbl->RefreshData(sh->server, &count, &arr);
+    if (FAILED(hr)) {
+        MarkLost(sh, hr);
+    } else if (arr && count > 0) {
+        // Announce the batch before stamping it, so Drain never sees this
+        // shard idle while it holds rows older than Drain's clock reading
+        InterlockedExchange64(&sh->busyNs, (LONGLONG)RtdNowNs());
+        ULONGLONG recvNs = RtdNowNs();
+        RtdStoreRelease64(&sh->busyNs, (LONGLONG)recvNs);
+
+        long rows = RtdBatch_Decode(&sh->batch, arr, count);
+        for (long i = 0; i < rows; i++) {
+            RtdUpdate u;
+            if (sh->batch.topicID[i] == 0 || !RtdBatch_Update(&sh->batch, i, &u, recvNs)) continue;
+            UpdateRing_Push(&sh->ring, &u);
+        }
+        RtdStoreRelease64(&sh->busyNs, SHARD_IDLE);
+
+        sh->stats.refreshes++;
+        sh->stats.rows += rows;
+        if ((ULONGLONG)rows > sh->stats.maxRows) sh->stats.maxRows = rows;
+        IRTDUpdateEvent *cb = sh->owner->callback;
+        if (cb) cb->lpVtbl->UpdateNotify(cb);
+    }
+    if (arr) SafeArrayDestroy(arr);
+}
+
+static void ShardThreadProc(void *arg)
+{
+    Shard *sh = (Shard*)arg;
+    ShardServer *ss = sh->owner;
+
+#ifdef _WIN32
+    CoInitializeEx(NULL, COINIT_APARTMENTTHREADED);
+#endif
+    long res = 0;
+    HRESULT hr = ss->factory(ss->factoryCtx, &sh->server);
+    if (SUCCEEDED(hr)) {
+        hr = sh->server->lpVtbl->ServerStart(sh->server, &sh->callback.iface, &res);
+        if (FAILED(hr)) {
+            sh->server->lpVtbl->Release(sh->server);
+            sh->server = NULL;
+        }
+    }
+    sh->startHr = hr;
+    InterlockedIncrement(&ss->startedCount);
+    Wakeup_Signal(&ss->startWake);
+
+    while (sh->server && !sh->stop) {
+        Wakeup_Wait(&sh->wakeup, 250);
+        Wakeup_Consume(&sh->wakeup);
+#ifdef _WIN32
+        MSG msg;
+        while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+        }
+#endif
+        RunCommands(sh);
+        if (InterlockedExchange(&sh->updatePending, 0) && !sh->lost) Refresh(sh);
+    }
+
+    if (sh->server) {
+        sh->server->lpVtbl->ServerTerminate(sh->server);
+        sh->server->lpVtbl->Release(sh->server);
+        sh->server = NULL;
+    }
+    if (sh->args) {
+        SafeArrayDestroy(sh->args);
+        sh->args = NULL;
+    }
+#ifdef _WIN32
+    CoUninitialize();
+#endif
+    InterlockedExchange(&sh->exited, 1);
+}
+
+/**
+ * Clear queued rows nobody will drain
+ */
+static void DiscardRows(Shard *sh)
+{
+    for (; sh->mergeHead < sh->mergeCount; sh->mergeHead++) RtdUpdate_Clear(&sh->merge[sh->mergeHead]);
+    ULONG n;
+    while ((n = UpdateRing_Pop(&sh->ring, sh->merge, SHARD_MERGE_ROWS)) > 0) {
+        for (ULONG i = 0; i < n; i++) RtdUpdate_Clear(&sh->merge[i]);
+    }
+    sh->mergeHead = sh->mergeCount = 0;
+}
+
+/**
+ * Stop and join every shard thread; a shard blocked on a full ring is
+ * freed by discarding its rows
+ */
+static void StopShards(ShardServer *ss)
+{
+    for (int i = 0; i < ss->cfg.shards; i++) {
+        Shard *sh = &ss->shards[i];
+        if (!sh->threadStarted) continue;
+        InterlockedExchange(&sh->stop, 1);
+        Wakeup_Signal(&sh->wakeup);
+    }
+    for (int i = 0; i < ss->cfg.shards; i++) {
+        Shard *sh = &ss->shards[i];
+        if (!sh->threadStarted) continue;
+        while (!sh->exited) {
+            DiscardRows(sh);
+            RtdYield();
+        }
+        RtdThread_Join(&sh->thread);
+        sh->threadStarted = FALSE;
+        DiscardRows(sh);
+    }
+}
+
+static void FreeShard(Shard *sh)
+{
+    for (long i = 0; i < sh->commandCount; i++) {
+        SysFreeString(sh->commands[i].topic);
+        SysFreeString(sh->commands[i].symbol);
+    }
+    free(sh->commands);
+    free(sh->running);
+    free(sh->merge);
+    free(sh->initial);
+    UpdateRing_Free(&sh->ring);
+    RtdBatch_Free(&sh->batch);
+    RtdMutex_Free(&sh->lock);
+    Wakeup_Free(&sh->wakeup);
+}
+
+/**
+ * IUnknown / IDispatch
+ */
+static HRESULT STDMETHODCALLTYPE Shard_QueryInterface(IRtdServer *This, REFIID riid, void **ppv)
+{
+    if (IsEqualIID(riid, &IID_IUnknown) || IsEqualIID(riid, &IID_IDispatch) ||
+        IsEqualIID(riid, &IID_IRtdServer)) {
+        *ppv = This;
+        This->lpVtbl->AddRef(This);
+        return S_OK;
+    }
+    *ppv = NULL;
+    return E_NOINTERFACE;
+}
+
+static ULONG STDMETHODCALLTYPE Shard_AddRef(IRtdServer *This)
+{
+    return InterlockedIncrement(&FromIface(This)->refCount);
+}
+
+static ULONG STDMETHODCALLTYPE Shard_Release(IRtdServer *This)
+{
+    ShardServer *ss = FromIface(This);
+    LONG c = InterlockedDecrement(&ss->refCount);
+    if (c == 0) {
+        This->lpVtbl->ServerTerminate(This);
+        for (int i = 0; i < ss->cfg.shards; i++) FreeShard(&ss->shards[i]);
+        Wakeup_Free(&ss->startWake);
+        for (long i = 0; i < ss->stagedCount; i++) RtdUpdate_Clear(&ss->staged[i]);
+        free(ss->staged);
+        free(ss->topics);
+        free(ss);
+    }
+    return c;
+}
+
+static HRESULT STDMETHODCALLTYPE Shard_GetTypeInfoCount(IRtdServer *This, UINT *pctinfo)
+{
+    *pctinfo = 0;
+    return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE Shard_GetTypeInfo(IRtdServer *This, UINT iTInfo, LCID lcid, ITypeInfo **ppTInfo)
+{
+    return E_NOTIMPL;
+}
+
+static HRESULT STDMETHODCALLTYPE Shard_GetIDsOfNames(IRtdServer *This, REFIID riid, LPOLESTR *rgszNames, UINT cNames, LCID lcid, DISPID *rgDispId)
+{
+    return E_NOTIMPL;
+}
+
+static HRESULT STDMETHODCALLTYPE Shard_Invoke(IRtdServer *This, DISPID dispIdMember, REFIID riid, LCID lcid, WORD wFlags, DISPPARAMS *pDispParams, VARIANT *pVarResult, EXCEPINFO *pExcepInfo, UINT *puArgErr)
+{
+    return E_NOTIMPL;
+}
+
+/**
+ * IRtdServer
+ */
+static HRESULT STDMETHODCALLTYPE Shard_ServerStart(IRtdServer *This, IRTDUpdateEvent *CallbackObject, long *pfRes)
+{
+    ShardServer *ss = FromIface(This);
+    if (ss->started) return E_UNEXPECTED;
+
+    if (CallbackObject) CallbackObject->lpVtbl->AddRef(CallbackObject);
+    ss->callback = CallbackObject;
+    ss->startedCount = 0;
+    int launched = 0;
+    for (int i = 0; i < ss->cfg.shards; i++) {
+        Shard *sh = &ss->shards[i];
+        sh->stop = sh->exited = sh->lost = 0;
+        sh->threadStarted = RtdThread_Start(&sh->thread, ShardThreadProc, sh);
+        if (!sh->threadStarted) break;
+        launched++;
+    }
+
+    // Every shard has created and started its server, or failed to
+    while (ss->startedCount < launched) Wakeup_Wait(&ss->startWake, 100);
+    HRESULT hr = launched == ss->cfg.shards ? S_OK : E_FAIL;
+    for (int i = 0; i < launched && SUCCEEDED(hr); i++) hr = ss->shards[i].startHr;
+    if (FAILED(hr)) {
+        StopShards(ss);
+        if (ss->callback) ss->callback->lpVtbl->Release(ss->callback);
+        ss->callback = NULL;
+        *pfRes = 0;
+        return hr;
+    }
+    ss->started = TRUE;
+    *pfRes = 1;
+    return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE Shard_ConnectData(IRtdServer *This, long TopicID, SAFEARRAY **Strings,
+                                                   VARIANT_BOOL *GetNewValues, VARIANT *pvarOut)
+{
+    ShardServer *ss = FromIface(This);
+    VARIANT *args = NULL;
+    if (!ss->started) return E_UNEXPECTED;
+    if (TopicID <= 0 || !Strings || !*Strings || (*Strings)->rgsabound[0].cElements < 2) return E_INVALIDARG;
+    if (FAILED(SafeArrayAccessData(*Strings, (void**)&args))) return E_INVALIDARG;
+    if (args[0].vt != VT_BSTR || args[1].vt != VT_BSTR) {
+        SafeArrayUnaccessData(*Strings);
+        return E_INVALIDARG;
+    }
+    BSTR topic = SysAllocStringLen(args[0].bstrVal, SysStringLen(args[0].bstrVal));
+    BSTR symbol = SysAllocStringLen(args[1].bstrVal, SysStringLen(args[1].bstrVal));
+    SafeArrayUnaccessData(*Strings);
+    if (!topic || !symbol) {
+        SysFreeString(topic);
+        SysFreeString(symbol);
+        return E_OUTOFMEMORY;
+    }
+
+    if (TopicID >= ss->topicCap) {
+        long newCap = ss->topicCap ? ss->topicCap * 2 : 1024;
+        while (newCap <= TopicID) newCap *= 2;
+        ShardTopic *grown = (ShardTopic*)realloc(ss->topics, newCap * sizeof *grown);
+        if (!grown) {
+            SysFreeString(topic);
+            SysFreeString(symbol);
+            return E_OUTOFMEMORY;
+        }
+        memset(grown + ss->topicCap, 0, (newCap - ss->topicCap) * sizeof *grown);
+        ss->topics = grown;
+        ss->topicCap = newCap;
+    }
+
+    // Topic ID reused without a DisconnectData: retire it where it was
+    ShardTopic *t = &ss->topics[TopicID];
+    if (t->connected) This->lpVtbl->DisconnectData(This, TopicID);
+
+    int shard = ShardServer_ShardOf(symbol, ss->cfg.shards);
+    HRESULT hr = Post(&ss->shards[shard], SHARD_CONNECT, TopicID, topic, symbol);
+    if (FAILED(hr)) return hr;
+    t->shard = (BYTE)shard;
+    t->connected = TRUE;
+
+    // The shard makes the call later; its initial value comes as a row
+    if (pvarOut) VariantInit(pvarOut);
+    if (GetNewValues) *GetNewValues = VARIANT_TRUE;
+    return S_OK;
+}
+
+/**
+ * Take ownership of a merged row for RefreshData
+ */
+static void StageRow(void *ctx, RtdUpdate *u)
+{
+    ShardServer *ss = (ShardServer*)ctx;
+    if (ss->stagedCount == ss->stagedCap) {
+        long newCap = ss->stagedCap ? ss->stagedCap * 2 : 1024;
+        RtdUpdate *grown = (RtdUpdate*)realloc(ss->staged, newCap * sizeof *grown);
+        if (!grown) {
+            RtdUpdate_Clear(u);
+            return;
+        }
+        ss->staged = grown;
+        ss->stagedCap = newCap;
+    }
+    ss->staged[ss->stagedCount++] = *u;
+}
+
+/**
+ * The merged rows as a RefreshData result, for callers that want an
+ * ordinary IRtdServer; ShardServer_Drain skips the array and the copies
+ */
+static HRESULT STDMETHODCALLTYPE Shard_RefreshData(IRtdServer *This, long *TopicCount, SAFEARRAY **parrayOut)
+{
+    ShardServer *ss = FromIface(This);
+    *TopicCount = 0;
+    *parrayOut = NULL;
+    if (!ss->started) return E_UNEXPECTED;
+
+    ss->stagedCount = 0;
+    ShardServer_Drain(This, StageRow, ss);
+    if (ss->stagedCount == 0) return S_OK;
+
+    SAFEARRAYBOUND bounds[2] = { { 2, 0 }, { (ULONG)ss->stagedCount, 0 } };
+    SAFEARRAY *arr = SafeArrayCreate(VT_VARIANT, 2, bounds);
+    VARIANT *data = NULL;
+    if (arr) SafeArrayAccessData(arr, (void**)&data);
+    for (long i = 0; i < ss->stagedCount; i++) {
+        RtdUpdate *u = &ss->staged[i];
+        if (data) {
+            VARIANT *row = &data[i * 2];
+            row[0].vt = VT_I4;
+            row[0].lVal = u->topicID;
+            row[1].vt = u->vt;
+            switch (u->vt) {
+                case VT_R8:   row[1].dblVal = u->dblVal; break;
+                case VT_R4:   row[1].fltVal = (float)u->dblVal; break;
+                case VT_DATE: row[1].date = u->dblVal; break;
+                case VT_I4:   row[1].lVal = (LONG)u->llVal; break;
+                case VT_I2:   row[1].iVal = (short)u->llVal; break;
+                case VT_I8:   row[1].llVal = u->llVal; break;
+                case VT_BOOL: row[1].boolVal = (VARIANT_BOOL)u->llVal; break;
+                case VT_ERROR: row[1].scode = (LONG)u->llVal; break;
+                case VT_BSTR:
+                    // The array takes an owned string over; shared ones are copied
+                    if (u->flags & RTD_UPDATE_SHARED) {
+                        row[1].bstrVal = SysAllocStringLen(u->bstrVal, SysStringLen(u->bstrVal));
+                        if (!row[1].bstrVal) row[1].vt = VT_EMPTY;
+                    } else {
+                        row[1].bstrVal = u->bstrVal;
+                        u->vt = VT_EMPTY;
+                    }
+                    break;
+                default:
+                    row[1].vt = VT_EMPTY;
+                    break;
+            }
+        }
+        RtdUpdate_Clear(u);
+    }
+    if (!arr) {
+        ss->stagedCount = 0;
+        return E_OUTOFMEMORY;
+    }
+    SafeArrayUnaccessData(arr);
+    *TopicCount = ss->stagedCount;
+    *parrayOut = arr;
+    ss->stagedCount = 0;
+    return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE Shard_DisconnectData(IRtdServer *This, long TopicID)
+{
+    ShardServer *ss = FromIface(This);
+    if (!ss->started) return E_UNEXPECTED;
+    if (TopicID <= 0 || TopicID >= ss->topicCap || !ss->topics[TopicID].connected) return S_OK;
+
+    ShardTopic *t = &ss->topics[TopicID];
+    HRESULT hr = Post(&ss->shards[t->shard], SHARD_DISCONNECT, TopicID, NULL, NULL);
+    if (FAILED(hr)) return hr;
+    t->connected = FALSE;
+    t->retiring[t->shard]++;
+    return S_OK;
+}
+
+/**
+ * Reports a lost shard at once; live shards check their servers in the
+ * background and report through Disconnect
+ */
+static HRESULT STDMETHODCALLTYPE Shard_Heartbeat(IRtdServer *This, long *pfRes)
+{
+    ShardServer *ss = FromIface(This);
+    *pfRes = 0;
+    if (!ss->started) return E_UNEXPECTED;
+    for (int i = 0; i < ss->cfg.shards; i++) {
+        Shard *sh = &ss->shards[i];
+        if (sh->lost) return FAILED(sh->stats.lost) ? sh->stats.lost : RPC_E_DISCONNECTED;
+        Post(sh, SHARD_HEARTBEAT, 0, NULL, NULL);
+    }
+    *pfRes = 1;
+    return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE Shard_ServerTerminate(IRtdServer *This)
+{
+    ShardServer *ss = FromIface(This);
+    if (!ss->started) return S_OK;
+    StopShards(ss);
+    ss->started = FALSE;
+    if (ss->callback) {
+        ss->callback->lpVtbl->Release(ss->callback);
+        ss->callback = NULL;
+    }
+    return S_OK;
+}
+
+static const IRtdServerVtbl shard_vtbl = {
+    // IUnknown
+    Shard_QueryInterface,
+    Shard_AddRef,
+    Shard_Release,
+
+    // IDispatch
+    Shard_GetTypeInfoCount,
+    Shard_GetTypeInfo,
+    Shard_GetIDsOfNames,
+    Shard_Invoke,
+
+    // IRtdServer
+    Shard_ServerStart,
+    Shard_ConnectData,
+    Shard_RefreshData,
+    Shard_DisconnectData,
+    Shard_Heartbeat,
+    Shard_ServerTerminate
+};
+
+IRtdServer* ShardServer_Create(ServerFactory factory, void *factoryCtx, const ShardConfig *cfg)
+{
+    if (cfg->shards < 1 || cfg->shards > MAX_SHARDS) return NULL;
+    ShardServer *ss = (ShardServer*)calloc(1, sizeof *ss);
+    if (!ss) return NULL;
+
+    ss->iface.lpVtbl = &shard_vtbl;
+    ss->refCount = 1;
+    ss->factory = factory;
+    ss->factoryCtx = factoryCtx;
+    ss->cfg = *cfg;
+    if (!Wakeup_Init(&ss->startWake, 0)) {
+        free(ss);
+        return NULL;
+    }
+
+    int ready = 0;
+    BOOL ok = TRUE;
+    for (int i = 0; i < cfg->shards && ok; i++) {
+        Shard *sh = &ss->shards[i];
+        sh->owner = ss;
+        sh->index = i;
+        sh->callback.iface.lpVtbl = &shardcb_vtbl;
+        sh->callback.shard = sh;
+        sh->busyNs = SHARD_IDLE;
+        if (!Wakeup_Init(&sh->wakeup, 0)) break;
+        RtdMutex_Init(&sh->lock);
+        ready++;
+
+        sh->merge = (RtdUpdate*)malloc(SHARD_MERGE_ROWS * sizeof *sh->merge);
+        ok = sh->merge && UpdateRing_Init(&sh->ring, cfg->ringSize, RING_BLOCK) &&
+             RtdBatch_Init(&sh->batch, 1024);
+        sh->batch.strings = cfg->pools ? &cfg->pools[i] : NULL;
+    }
+    if (!ok || ready < cfg->shards) {
+        for (int i = 0; i < ready; i++) FreeShard(&ss->shards[i]);
+        Wakeup_Free(&ss->startWake);
+        free(ss);
+        return NULL;
+    }
+    return &ss->iface;
+}
+
+long ShardServer_Drain(IRtdServer *srv, ShardRowFn fn, void *ctx)
+{
+    ShardServer *ss = FromIface(srv);
+    int n = ss->cfg.shards;
+
+    // Read the clock before the shards' state: a shard idle now stamps its
+    // next batch after this, and a busy one has announced its batch time
+    LONGLONG mark = (LONGLONG)RtdNowNs();
+    for (int i = 0; i < n; i++) {
+        LONGLONG busy = RtdLoadAcquire64(&ss->shards[i].busyNs);
+        if (busy < mark) mark = busy;
+    }
+
+    long rows = 0;
+    for (;;) {
+        // The shard with the oldest head, and the next oldest head elsewhere
+        Shard *best = NULL;
+        LONGLONG bestNs = 0, nextNs = mark;
+        for (int i = 0; i < n; i++) {
+            Shard *sh = &ss->shards[i];
+            if (sh->mergeHead == sh->mergeCount) {
+                sh->mergeCount = UpdateRing_Pop(&sh->ring, sh->merge, SHARD_MERGE_ROWS);
+                sh->mergeHead = 0;
+                if (sh->mergeCount == 0) continue;
+            }
+            LONGLONG ns = (LONGLONG)sh->merge[sh->mergeHead].recvNs;
+            if (!best || ns < bestNs) {
+                if (best && bestNs < nextNs) nextNs = bestNs;
+                best = sh;
+                bestNs = ns;
+            } else if (ns < nextNs) {
+                nextNs = ns;
+            }
+        }
+        if (!best || bestNs > mark) break;
+
+        // Hand over best's rows up to the next shard's head in one run
+        while (best->mergeHead < best->mergeCount) {
+            RtdUpdate *u = &best->merge[best->mergeHead];
+            if ((LONGLONG)u->recvNs > nextNs) break;
+            best->mergeHead++;
+
+            ShardTopic *t = u->topicID > 0 && u->topicID < ss->topicCap ? &ss->topics[u->topicID] : NULL;
+            USHORT *retiring = t ? &t->retiring[best->index] : NULL;
+            if (u->flags & SHARD_RETIRED) {
+                if (retiring && *retiring) (*retiring)--;
+                continue;
+            }
+            if (retiring && *retiring) {
+                // Queued by this shard before the topic was disconnected.
+                // A reused ID's rows from any other shard are the new
+                // pair's, its ConnectData value among them, and go through.
+                RtdUpdate_Clear(u);
+                continue;
+            }
+            fn(ctx, u);
+            rows++;
+        }
+    }
+    return rows;
+}
+
+void ShardServer_GetStats(IRtdServer *srv, int shard, ShardStats *stats)
+{
+    Shard *sh = &FromIface(srv)->shards[shard];
+    *stats = sh->stats;
+    stats->blockedSpins = sh->ring.blockedSpins;
+}
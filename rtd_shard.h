@@ -0,0 +1,65 @@
+// rtd_shard.h - Several RTD servers on their own apartment threads
+// A ShardServer is an IRtdServer that fronts N server instances, each
+// created, started and called on its own single-threaded apartment with
+// its own callback object. ConnectData hashes the symbol to a shard and
+// queues the call for that shard's thread; every shard calls RefreshData
+// and decodes the result itself, so the calls and the decoding run in
+// parallel. Decoded rows wait in one SPSC ring per shard.
+//
+// The RTD thread takes them with ShardServer_Drain, which merges the rings
+// in receive-time order. Each shard publishes the receive time of the
+// batch it is pushing (or that it is idle), and rows are only released
+// once no shard can still produce an earlier one.
+//
+// UpdateNotify and Disconnect on the callback passed to ServerStart are
+// called from the shard threads; the client's implementation only sets
+// flags and signals its wakeup. ConnectData, DisconnectData and Heartbeat
+// return before the shard has made the call: failures are counted in
+// ShardStats, and a shard whose server is lost reports Disconnect and
+// fails every later Heartbeat, so the supervisor replaces the whole set.
+
+#ifndef __RTD_SHARD_H__
+#define __RTD_SHARD_H__
+
+#include "rtd_client.h"
+#include "rtd_pool.h"
+#include "rtd_ring.h"
+#include "rtd_supervisor.h"
+
+#define MAX_SHARDS 16
+
+typedef void (*ShardRowFn)(void *ctx, RtdUpdate *u);
+
+typedef struct ShardConfig {
+    int             shards;         // 1..MAX_SHARDS
+    ULONG           ringSize;       // Decoded rows queued per shard
+    RtdStringPool  *pools;          // One per shard, may be NULL; must outlive every update
+} ShardConfig;
+
+typedef struct ShardStats {
+    ULONGLONG refreshes;            // RefreshData calls that returned rows
+    ULONGLONG rows;
+    ULONGLONG maxRows;
+    ULONGLONG initialRows;          // ConnectData values queued as rows
+    ULONGLONG connects;
+    ULONGLONG connectFailed;
+    ULONGLONG disconnects;
+    ULONGLONG blockedSpins;         // Yields while the shard's ring was full
+    HRESULT   lost;                 // Why the shard's server was lost, S_OK if it was not
+} ShardStats;
+
+// Returns a server with one reference; the shard threads start with
+// ServerStart, each creating its server through factory(factoryCtx)
+IRtdServer* ShardServer_Create(ServerFactory factory, void *factoryCtx, const ShardConfig *cfg);
+
+// Shard a symbol belongs to
+int ShardServer_ShardOf(const WCHAR *symbol, int shards);
+
+// Hand every row that is ready to fn in receive-time order; fn owns each
+// update. Returns the rows handed over. Call from the thread that called
+// ServerStart.
+long ShardServer_Drain(IRtdServer *srv, ShardRowFn fn, void *ctx);
+
+void ShardServer_GetStats(IRtdServer *srv, int shard, ShardStats *stats);
+
+#endif /* __RTD_SHARD_H__ */
@@ -0,0 +1,244 @@
+/**
+ * rtd_shm.c - Shared-memory quote snapshot
+ *
+ * Seqlock protocol per slot: the writer makes seq odd, fences, writes the
+ * payload, then stores seq + 2 with release semantics. A reader takes seq
+ * with acquire, copies the payload, fences and compares seq again; if it
+ * changed or was odd the copy may be torn and is retried. The writer
+ * never blocks, so a stalled reader cannot slow down RefreshData.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtd_shm.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Create (writer) or open read-only (reader) the named segment
+ */
+static BOOL MapSegment(ShmSegment *seg, const char *name, size_t size, BOOL create)
+{
+    memset(seg, 0, sizeof *seg);
+    seg->owner = create;
+#ifdef _WIN32
+    char path[160];
+    snprintf(path, sizeof path, "Local\\%s", name);
+    if (create) {
+        seg->hMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                           (DWORD)((ULONGLONG)size >> 32), (DWORD)size, path);
+    } else {
+        seg->hMapping = OpenFileMappingA(FILE_MAP_READ, FALSE, path);
+    }
+    if (!seg->hMapping) return FALSE;
+    seg->hdr = (ShmHeader*)MapViewOfFile(seg->hMapping, create ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+    if (!seg->hdr) {
+        CloseHandle(seg->hMapping);
+        return FALSE;
+    }
+#else
+    snprintf(seg->name, sizeof seg->name, "/%s", name);
+    seg->fd = shm_open(seg->name, create ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDONLY, 0644);
+    if (seg->fd < 0) return FALSE;
+    if (create) {
+        if (ftruncate(seg->fd, (off_t)size) != 0) {
+            close(seg->fd);
+            shm_unlink(seg->name);
+            return FALSE;
+        }
+    } else {
+        struct stat st;
+        if (fstat(seg->fd, &st) != 0 || (size_t)st.st_size < sizeof(ShmHeader)) {
+            close(seg->fd);
+            return FALSE;
+        }
+        size = (size_t)st.st_size;
+    }
+    void *base = mmap(NULL, size, create ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, seg->fd, 0);
+    if (base == MAP_FAILED) {
+        close(seg->fd);
+        if (create) shm_unlink(seg->name);
+        return FALSE;
+    }
+    seg->hdr = (ShmHeader*)base;
+#endif
+    seg->size = size;
+    seg->slots = (ShmSlot*)(seg->hdr + 1);
+    return TRUE;
+}
+
+static void UnmapSegment(ShmSegment *seg)
+{
+#ifdef _WIN32
+    if (seg->hdr) UnmapViewOfFile(seg->hdr);
+    if (seg->hMapping) CloseHandle(seg->hMapping);
+#else
+    if (seg->hdr) munmap(seg->hdr, seg->size);
+    if (seg->fd > 0) close(seg->fd);
+    if (seg->owner && seg->name[0]) shm_unlink(seg->name);
+#endif
+    memset(seg, 0, sizeof *seg);
+}
+
+BOOL ShmWriter_Create(ShmWriter *w, const char *name, uint64_t capacity)
+{
+    memset(w, 0, sizeof *w);
+    if (capacity < 2) capacity = 2;
+    size_t size = sizeof(ShmHeader) + (size_t)capacity * sizeof(ShmSlot);
+    if (!MapSegment(&w->seg, name, size, TRUE)) return FALSE;
+
+    // Fresh mappings are zero filled: every slot starts unnamed with seq 0
+    ShmHeader *hdr = w->seg.hdr;
+    hdr->version = SHM_VERSION;
+    hdr->slotSize = sizeof(ShmSlot);
+    hdr->capacity = capacity;
+    hdr->highWater = 1;
+    hdr->startWallNs = RtdWallNs();
+#ifdef _WIN32
+    hdr->writerPid = GetCurrentProcessId();
+#else
+    hdr->writerPid = (uint32_t)getpid();
+#endif
+    w->wallOffsetNs = (LONGLONG)RtdWallNs() - (LONGLONG)RtdNowNs();
+
+    // Magic last, so a reader never sees a half-initialized header
+    RtdFenceRelease();
+    memcpy(hdr->magic, SHM_MAGIC, sizeof hdr->magic);
+    return TRUE;
+}
+
+void ShmWriter_Destroy(ShmWriter *w)
+{
+    UnmapSegment(&w->seg);
+}
+
+/**
+ * Enter / leave the write side of a slot's seqlock
+ */
+static inline LONGLONG BeginWrite(ShmSlot *slot)
+{
+    LONGLONG seq = slot->seq;
+    slot->seq = seq + 1;
+    RtdFenceRelease();
+    return seq;
+}
+
+static inline void EndWrite(ShmSlot *slot, LONGLONG seq)
+{
+    RtdStoreRelease64(&slot->seq, seq + 2);
+}
+
+BOOL ShmWriter_Define(ShmWriter *w, long topicID, const WCHAR *symbol, const WCHAR *topic)
+{
+    if (topicID <= 0 || (uint64_t)topicID >= w->seg.hdr->capacity) return FALSE;
+
+    // Encode with room for one more character than a slot holds: a name
+    // that fills the spare space did not fit (the encoder never splits one)
+    char sym[SHM_SYMBOL_MAX + 4], top[SHM_TOPIC_MAX + 4];
+    size_t symBytes = RtdWideToUtf8(symbol, wcslen(symbol), sym, sizeof sym);
+    size_t topBytes = RtdWideToUtf8(topic, wcslen(topic), top, sizeof top);
+    if (symBytes >= SHM_SYMBOL_MAX || topBytes >= SHM_TOPIC_MAX) return FALSE;
+
+    ShmSlot *slot = &w->seg.slots[topicID];
+    LONGLONG seq = BeginWrite(slot);
+    memset(slot->symbol, 0, sizeof slot->symbol);
+    memset(slot->topic, 0, sizeof slot->topic);
+    memcpy(slot->symbol, sym, symBytes);
+    memcpy(slot->topic, top, topBytes);
+    slot->vt = VT_EMPTY;
+    slot->updateNs = 0;
+    slot->value.i64 = 0;
+    EndWrite(slot, seq);
+
+    if (topicID >= w->seg.hdr->highWater) RtdStoreRelease64(&w->seg.hdr->highWater, topicID + 1);
+    RtdStoreRelease64(&w->seg.hdr->generation, w->seg.hdr->generation + 1);
+    return TRUE;
+}
+
+void ShmWriter_Clear(ShmWriter *w, long topicID)
+{
+    if (topicID <= 0 || (uint64_t)topicID >= w->seg.hdr->capacity) return;
+
+    ShmSlot *slot = &w->seg.slots[topicID];
+    LONGLONG seq = BeginWrite(slot);
+    memset(slot->symbol, 0, sizeof slot->symbol);
+    memset(slot->topic, 0, sizeof slot->topic);
+    slot->vt = VT_EMPTY;
+    slot->updateNs = 0;
+    slot->value.i64 = 0;
+    EndWrite(slot, seq);
+
+    RtdStoreRelease64(&w->seg.hdr->generation, w->seg.hdr->generation + 1);
+}
+
+void ShmWriter_Publish(ShmWriter *w, const RtdUpdate *u)
+{
+    if (u->topicID <= 0 || (uint64_t)u->topicID >= w->seg.hdr->capacity ||
+        u->vt == VT_BSTR || u->vt == VT_EMPTY) {
+        w->skipped++;
+        return;
+    }
+
+    ShmSlot *slot = &w->seg.slots[u->topicID];
+    LONGLONG seq = BeginWrite(slot);
+    slot->updateNs = (uint64_t)((LONGLONG)u->recvNs + w->wallOffsetNs);
+    slot->vt = u->vt;
+    slot->value.i64 = u->llVal;     // Same 8 bytes whether double or integer
+    EndWrite(slot, seq);
+    w->published++;
+}
+
+BOOL ShmReader_Open(ShmReader *r, const char *name)
+{
+    memset(r, 0, sizeof *r);
+    if (!MapSegment(&r->seg, name, 0, FALSE)) return FALSE;
+
+    const ShmHeader *hdr = r->seg.hdr;
+    if (memcmp(hdr->magic, SHM_MAGIC, sizeof hdr->magic) != 0 || hdr->version != SHM_VERSION ||
+        hdr->slotSize != sizeof(ShmSlot)) {
+        UnmapSegment(&r->seg);
+        return FALSE;
+    }
+#ifdef _WIN32
+    // The view of an existing mapping covers all of it; trust the header
+    r->seg.size = sizeof(ShmHeader) + (size_t)hdr->capacity * sizeof(ShmSlot);
+#else
+    if (r->seg.size < sizeof(ShmHeader) + (size_t)hdr->capacity * sizeof(ShmSlot)) {
+        UnmapSegment(&r->seg);
+        return FALSE;
+    }
+#endif
+    return TRUE;
+}
+
+void ShmReader_Close(ShmReader *r)
+{
+    UnmapSegment(&r->seg);
+}
+
+long ShmReader_Find(ShmReader *r, const char *symbol, const char *topic)
+{
+    LONGLONG highWater = RtdLoadAcquire64((volatile LONGLONG*)&r->seg.hdr->highWater);
+    for (long i = 1; i < highWater; i++) {
+        const ShmSlot *slot = &r->seg.slots[i];
+        char sym[SHM_SYMBOL_MAX], top[SHM_TOPIC_MAX];
+        LONGLONG seq;
+        do {
+            seq = RtdLoadAcquire64((volatile LONGLONG*)&slot->seq);
+            memcpy(sym, slot->symbol, sizeof sym);
+            memcpy(top, slot->topic, sizeof top);
+            RtdFenceAcquire();
+        } while ((seq & 1) || slot->seq != seq);
+
+        sym[sizeof sym - 1] = 0;
+        top[sizeof top - 1] = 0;
+        if (strcmp(sym, symbol) == 0 && strcmp(top, topic) == 0) return i;
+    }
+    return -1;
+}
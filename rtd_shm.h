@@ -0,0 +1,125 @@
+// rtd_shm.h - Shared-memory quote snapshot
+// The client publishes the latest value of every subscribed topic into a
+// named shared-memory segment (POSIX shm_open, or a pagefile-backed
+// mapping under Local\ on Windows). Slot i holds topic ID i and fills
+// exactly one cache line. Each slot is guarded by a seqlock, so any
+// number of local readers get consistent values with plain loads: no
+// syscalls, no locks, and nothing the writer ever waits on.
+//
+//   ShmHeader | ShmSlot[capacity]
+
+#ifndef __RTD_SHM_H__
+#define __RTD_SHM_H__
+
+#include "rtd_compat.h"
+#include "rtd_ring.h"
+
+#define SHM_MAGIC    "RTDSHM01"
+#define SHM_VERSION  1
+
+#define SHM_SYMBOL_MAX  22  // Bytes including the NUL
+#define SHM_TOPIC_MAX   16
+
+#pragma pack(push, 8)
+typedef struct ShmHeader {
+    char              magic[8];
+    uint32_t          version;
+    uint32_t          slotSize;
+    uint64_t          capacity;     // Slots in the segment
+    volatile LONGLONG highWater;    // Slots [1, highWater) have been used
+    volatile LONGLONG generation;   // Bumped whenever a slot is named or cleared
+    uint64_t          startWallNs;  // RtdWallNs() when the writer created the segment
+    uint32_t          writerPid;
+    char              reserved[RTD_CACHE_LINE - 52];
+} ShmHeader;                        // 64 bytes
+
+typedef struct ShmSlot {
+    volatile LONGLONG seq;          // Odd while the writer is changing the slot
+    uint64_t          updateNs;     // Wall clock ns of the value, 0 if none yet
+    union {
+        double        dbl;          // VT_R8, VT_R4, VT_DATE
+        LONGLONG      i64;          // Integer types
+    } value;
+    uint16_t          vt;           // VT_EMPTY for unnamed slots and string values
+    char              symbol[SHM_SYMBOL_MAX];   // UTF-8, empty when the slot is free
+    char              topic[SHM_TOPIC_MAX];
+} ShmSlot;                          // 64 bytes
+#pragma pack(pop)
+
+// Consistent copy of one slot
+typedef struct ShmQuote {
+    uint64_t  updateNs;
+    VARTYPE   vt;
+    union {
+        double   dbl;
+        LONGLONG i64;
+    };
+} ShmQuote;
+
+typedef struct ShmSegment {
+#ifdef _WIN32
+    HANDLE     hMapping;
+#else
+    int        fd;
+    char       name[128];
+#endif
+    size_t     size;
+    ShmHeader *hdr;
+    ShmSlot   *slots;
+    BOOL       owner;
+} ShmSegment;
+
+// Writer (one per segment, on the thread that sees RefreshData)
+typedef struct ShmWriter {
+    ShmSegment seg;
+    LONGLONG   wallOffsetNs;
+    ULONGLONG  published;
+    ULONGLONG  skipped;             // Topic ID beyond capacity, or a string value
+} ShmWriter;
+
+BOOL ShmWriter_Create(ShmWriter *w, const char *name, uint64_t capacity);
+void ShmWriter_Destroy(ShmWriter *w);   // Unlinks the segment
+
+// Name a slot when its topic is connected; names longer than a slot
+// allows are rejected so readers never match a truncated name
+BOOL ShmWriter_Define(ShmWriter *w, long topicID, const WCHAR *symbol, const WCHAR *topic);
+void ShmWriter_Clear(ShmWriter *w, long topicID);
+void ShmWriter_Publish(ShmWriter *w, const RtdUpdate *u);
+
+// Reader
+typedef struct ShmReader {
+    ShmSegment seg;
+    ULONGLONG  retries;             // Reads repeated because the writer was mid-update
+} ShmReader;
+
+BOOL ShmReader_Open(ShmReader *r, const char *name);
+void ShmReader_Close(ShmReader *r);
+
+// Slot index for a symbol x topic (UTF-8), or -1. Linear scan: call once
+// and keep the index, re-checking when hdr->generation changes.
+long ShmReader_Find(ShmReader *r, const char *symbol, const char *topic);
+
+/**
+ * Copy slot index out consistently. Returns FALSE if the slot holds no
+ * value yet (or is unnamed).
+ */
+static inline BOOL ShmReader_Read(ShmReader *r, long index, ShmQuote *out)
+{
+    const ShmSlot *slot = &r->seg.slots[index];
+    BOOL retried = FALSE;
+    for (;;) {
+        LONGLONG seq = RtdLoadAcquire64((volatile LONGLONG*)&slot->seq);
+        if (!(seq & 1)) {
+            out->updateNs = slot->updateNs;
+            out->vt = slot->vt;
+            out->i64 = slot->value.i64;
+            RtdFenceAcquire();
+            if (slot->seq == seq) break;
+        }
+        retried = TRUE;
+    }
+    r->retries += retried;
+    return out->vt != VT_EMPTY && out->updateNs != 0;
+}
+
+#endif /* __RTD_SHM_H__ */
@@ -0,0 +1,711 @@
+/**
+ * rtd_sim.c - Simulated IRtdServer for deterministic load testing
+ *
+ * Behaves like an RTD server as the client sees it: ConnectData returns an
+ * initial value, changes are conflated per topic until the next
+ * RefreshData, and UpdateNotify is sent once per RefreshData cycle. The tick
+ * source runs on its own thread and calls UpdateNotify directly, which
+ * stands in for the cross-apartment call a real out-of-process server makes.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "rtd_sim.h"
+#include "rtd_journal.h"
+
+#define SIM_CHUNK 4096  // Max values generated per lock hold
+
+typedef struct SimTopic {
+    BOOL      connected;
+    BOOL      dirty;
+    long      connPos;      // Index in connectedIDs
+    long      name;         // Index in the name table
+    VARIANT   value;
+    ULONGLONG dirtyNs;      // When the pending change was first made
+} SimTopic;
+
+// symbol x topic name, shared by client subscriptions and replayed topics
+typedef struct SimName {
+    char *key;              // UTF-8 "SYMBOL\tTOPIC"
+    long  clientID;         // Connected client topic ID, 0 if none
+} SimName;
+
+typedef struct SimServer {
+    IRtdServer       iface;
+    volatile LONG    refCount;
+    SimConfig        cfg;
+    char             prefix[260];
+    IRTDUpdateEvent *callback;
+
+    RtdMutex         lock;
+    RtdThread        thread;
+    BOOL             threadStarted;
+    volatile LONG    running;
+    BOOL             notified;      // UpdateNotify sent, RefreshData not yet called
+
+    SimTopic        *topics;        // Indexed by client topic ID
+    long             topicCap;
+    long            *connectedIDs;
+    long             connectedCount;
+    long            *dirtyIDs;
+    long             dirtyCount;
+
+    SimName         *names;
+    long             nameCount;
+    long             nameCap;
+    long            *nameIndex;     // Open-addressed into names
+    ULONG            nameMask;
+
+    uint64_t         rng;
+    SimStats         stats;
+
+    ULONGLONG        startedNs;     // ServerStart time, for dropoutAfterSec
+    volatile LONG    dead;
+} SimServer;
+
+// End of the current simulated outage; shared by every instance, like the
+// one ThinkOrSwim process they all stand in for
+static volatile LONGLONG g_downUntilNs = 0;
+
+static SimServer* FromIface(IRtdServer *This)
+{
+    return (SimServer*)This;
+}
+
+static uint64_t NextRandom(SimServer *s)
+{
+    // xorshift64*
+    s->rng ^= s->rng >> 12;
+    s->rng ^= s->rng << 25;
+    s->rng ^= s->rng >> 27;
+    return s->rng * 2685821657736338717ULL;
+}
+
+static uint32_t HashKey(const char *key)
+{
+    uint32_t h = 2166136261u;
+    for (; *key; key++) { h ^= (unsigned char)*key; h *= 16777619u; }
+    return h;
+}
+
+/**
+ * Find or add a name table entry; returns its index or -1
+ */
+static long InternName(SimServer *s, const char *key)
+{
+    if ((s->nameCount + 1) * 2 > (long)s->nameMask + 1) {
+        ULONG size = (s->nameMask + 1) * 2;
+        long *index = (long*)malloc(size * sizeof *index);
+        if (!index) return -1;
+        for (ULONG i = 0; i < size; i++) index[i] = -1;
+        for (long n = 0; n < s->nameCount; n++) {
+            ULONG pos = HashKey(s->names[n].key) & (size - 1);
+            while (index[pos] >= 0) pos = (pos + 1) & (size - 1);
+            index[pos] = n;
+        }
+        free(s->nameIndex);
+        s->nameIndex = index;
+        s->nameMask = size - 1;
+    }
+
+    ULONG pos = HashKey(key) & s->nameMask;
+    while (s->nameIndex[pos] >= 0) {
+        if (strcmp(s->names[s->nameIndex[pos]].key, key) == 0) return s->nameIndex[pos];
+        pos = (pos + 1) & s->nameMask;
+    }
+
+    if (s->nameCount == s->nameCap) {
+        long newCap = s->nameCap ? s->nameCap * 2 : 1024;
+        SimName *names = (SimName*)realloc(s->names, newCap * sizeof *names);
+        if (!names) return -1;
+        s->names = names;
+        s->nameCap = newCap;
+    }
+    size_t len = strlen(key);
+    char *copy = (char*)malloc(len + 1);
+    if (!copy) return -1;
+    memcpy(copy, key, len + 1);
+
+    long n = s->nameCount++;
+    s->names[n].key = copy;
+    s->names[n].clientID = 0;
+    s->nameIndex[pos] = n;
+    return n;
+}
+
+static BOOL EnsureTopic(SimServer *s, long topicID)
+{
+    if (topicID < s->topicCap) return TRUE;
+    long newCap = s->topicCap ? s->topicCap : 1024;
+    while (newCap <= topicID) newCap *= 2;
+
+    SimTopic *topics = (SimTopic*)realloc(s->topics, newCap * sizeof *topics);
+    if (!topics) return FALSE;
+    memset(topics + s->topicCap, 0, (newCap - s->topicCap) * sizeof *topics);
+    s->topics = topics;
+
+    long *conn = (long*)realloc(s->connectedIDs, newCap * sizeof *conn);
+    if (!conn) return FALSE;
+    s->connectedIDs = conn;
+
+    long *dirty = (long*)realloc(s->dirtyIDs, newCap * sizeof *dirty);
+    if (!dirty) return FALSE;
+    s->dirtyIDs = dirty;
+
+    s->topicCap = newCap;
+    return TRUE;
+}
+
+/**
+ * Record a change to a topic. Caller holds the lock.
+ * Returns TRUE when the caller must send UpdateNotify.
+ */
+static BOOL MarkDirty(SimServer *s, long topicID, ULONGLONG now)
+{
+    SimTopic *t = &s->topics[topicID];
+    s->stats.generated++;
+    if (t->dirty) {
+        s->stats.conflated++;
+    } else {
+        t->dirty = TRUE;
+        t->dirtyNs = now;
+        s->dirtyIDs[s->dirtyCount++] = topicID;
+    }
+    if (!s->notified) {
+        s->notified = TRUE;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/**
+ * Die: stop the tick source and start the outage
+ */
+static void Drop(SimServer *s)
+{
+    if (InterlockedExchange(&s->dead, 1)) return;
+    RtdStoreRelease64(&g_downUntilNs, (LONGLONG)(RtdNowNs() + (ULONGLONG)(s->cfg.downtimeSec * 1e9)));
+    InterlockedExchange(&s->running, 0);
+}
+
+/**
+ * Has the server died, on request or because dropoutAfterSec passed?
+ * Once dead, every call fails as a crashed out-of-process server's would.
+ */
+static BOOL IsDead(SimServer *s)
+{
+    if (s->dead) return TRUE;
+    if (s->cfg.dropoutAfterSec <= 0 || !s->startedNs) return FALSE;
+    if (RtdNowNs() - s->startedNs < (ULONGLONG)(s->cfg.dropoutAfterSec * 1e9)) return FALSE;
+    Drop(s);
+    return TRUE;
+}
+
+static void Notify(SimServer *s)
+{
+    s->stats.notifies++;
+    if (s->callback) s->callback->lpVtbl->UpdateNotify(s->callback);
+}
+
+/**
+ * Initial synthetic value, typed by topic name
+ */
+static void InitSyntheticValue(SimServer *s, SimTopic *t, const WCHAR *symbol, const WCHAR *topic)
+{
+    VariantInit(&t->value);
+    if (wcsstr(topic, L"DESCRIPTION") || wcsstr(topic, L"EXCHANGE") || wcsstr(topic, L"NAME")) {
+        WCHAR text[96];
+        swprintf(text, ARRAYSIZE(text), L"%ls simulated", symbol);
+        t->value.vt = VT_BSTR;
+        t->value.bstrVal = SysAllocString(text);
+    } else if (wcsstr(topic, L"VOLUME") || wcsstr(topic, L"SIZE") || wcsstr(topic, L"OPEN_INT")) {
+        t->value.vt = VT_I4;
+        t->value.lVal = (LONG)(NextRandom(s) % 1000) * 100;
+    } else {
+        t->value.vt = VT_R8;
+        t->value.dblVal = 10.0 + (double)(NextRandom(s) % 49000) / 100.0;
+    }
+}
+
+/**
+ * Advance a synthetic value one step
+ */
+static void StepSyntheticValue(SimServer *s, SimTopic *t)
+{
+    uint64_t r = NextRandom(s);
+    switch (t->value.vt) {
+        case VT_R8: {
+            // Move by -5..+5 cents, never below a penny
+            double next = t->value.dblVal + ((double)(r % 11) - 5.0) / 100.0;
+            t->value.dblVal = next < 0.01 ? 0.01 : next;
+            break;
+        }
+        case VT_I4:
+            t->value.lVal += (LONG)(r % 10 + 1) * 100;
+            break;
+        default:
+            break;  // Strings do not change
+    }
+}
+
+static void RunSynthetic(SimServer *s)
+{
+    ULONGLONG start = RtdNowNs();
+    ULONGLONG produced = 0;
+
+    while (s->running && !IsDead(s)) {
+        ULONGLONG due = SIM_CHUNK;
+        if (s->cfg.updatesPerSec > 0) {
+            double target = (double)(RtdNowNs() - start) * s->cfg.updatesPerSec / 1e9;
+            due = target > (double)produced ? (ULONGLONG)(target - (double)produced) : 0;
+            if (due > SIM_CHUNK) due = SIM_CHUNK;
+        }
+        if (due == 0 || s->connectedCount == 0) {
+            RtdSleepMs(1);
+            continue;
+        }
+
+        BOOL notify = FALSE;
+        ULONGLONG now = RtdNowNs();
+        RtdMutex_Lock(&s->lock);
+        for (ULONGLONG i = 0; i < due && s->connectedCount > 0; i++) {
+            long id = s->connectedIDs[NextRandom(s) % (uint64_t)s->connectedCount];
+            StepSyntheticValue(s, &s->topics[id]);
+            notify |= MarkDirty(s, id, now);
+        }
+        RtdMutex_Unlock(&s->lock);
+        produced += due;
+
+        if (notify) Notify(s);
+        if (s->cfg.updatesPerSec <= 0) RtdYield();
+    }
+}
+
+/**
+ * Sleep or spin until the monotonic clock reaches due
+ */
+static void WaitUntil(SimServer *s, ULONGLONG due)
+{
+    for (;;) {
+        ULONGLONG now = RtdNowNs();
+        if (now >= due || !s->running) return;
+        if (due - now > 2000000ULL) RtdSleepMs(1);
+        else RtdYield();
+    }
+}
+
+/**
+ * Replay one journal file. Returns FALSE if it could not be opened.
+ */
+static BOOL ReplayFile(SimServer *s, uint32_t index, ULONGLONG *pStartNs, uint64_t *pFirstTs)
+{
+    char path[300];
+    JournalReader r;
+    long *map = NULL;       // Journal topic ID -> name index
+    long mapCap = 0;
+
+    Journal_FilePath(path, sizeof path, s->prefix, index, "rtj");
+    if (!JournalReader_Open(&r, path)) return FALSE;
+
+    for (uint64_t i = 0; i < r.count && s->running; i++) {
+        const JournalRecord *rec = &r.records[i];
+
+        if (rec->kind == JOURNAL_DEFINE) {
+            const char *symbol, *topic;
+            char key[256];
+            if (!JournalReader_Definition(&r, rec, &symbol, &topic)) continue;
+            if ((long)rec->topicID >= mapCap) {
+                long newCap = mapCap ? mapCap : 1024;
+                while (newCap <= (long)rec->topicID) newCap *= 2;
+                long *grown = (long*)realloc(map, newCap * sizeof *grown);
+                if (!grown) break;
+                for (long k = mapCap; k < newCap; k++) grown[k] = -1;
+                map = grown;
+                mapCap = newCap;
+            }
+            snprintf(key, sizeof key, "%s\t%s", symbol, topic);
+            RtdMutex_Lock(&s->lock);
+            map[rec->topicID] = InternName(s, key);
+            RtdMutex_Unlock(&s->lock);
+            continue;
+        }
+
+        if (rec->kind != JOURNAL_UPDATE) continue;     // Bars the client built
+        if ((long)rec->topicID >= mapCap || map[rec->topicID] < 0) continue;
+
+        // Pace by recorded receive times
+        if (*pFirstTs == 0) {
+            *pFirstTs = rec->tsNs;
+            *pStartNs = RtdNowNs();
+        }
+        if (s->cfg.speed > 0) {
+            WaitUntil(s, *pStartNs + (ULONGLONG)((double)(rec->tsNs - *pFirstTs) / s->cfg.speed));
+        }
+
+        BOOL notify = FALSE;
+        RtdMutex_Lock(&s->lock);
+        long id = s->names[map[rec->topicID]].clientID;
+        if (id > 0) {
+            SimTopic *t = &s->topics[id];
+            VariantClear(&t->value);
+            switch (rec->vt) {
+                case VT_BSTR: {
+                    uint32_t len = 0;
+                    const char *str = JournalReader_String(&r, rec->value.str, &len);
+                    t->value.vt = VT_BSTR;
+                    t->value.bstrVal = SysAllocStringLen(NULL, len);
+                    if (t->value.bstrVal) {
+                        size_t n = str ? RtdUtf8ToWide(str, len, t->value.bstrVal, len) : 0;
+                        t->value.bstrVal[n] = 0;
+                    }
+                    break;
+                }
+                case VT_R8:
+                case VT_R4:
+                    t->value.vt = VT_R8;
+                    t->value.dblVal = rec->value.dbl;
+                    break;
+                case VT_DATE:
+                    t->value.vt = VT_DATE;
+                    t->value.date = rec->value.dbl;
+                    break;
+                default:
+                    t->value.vt = VT_I4;
+                    t->value.lVal = (LONG)rec->value.i64;
+                    break;
+            }
+            notify = MarkDirty(s, id, RtdNowNs());
+        }
+        RtdMutex_Unlock(&s->lock);
+        if (notify) Notify(s);
+    }
+
+    free(map);
+    JournalReader_Close(&r);
+    return TRUE;
+}
+
+static void RunReplay(SimServer *s)
+{
+    do {
+        ULONGLONG startNs = 0;
+        uint64_t firstTs = 0;
+        uint32_t index = 1;
+        while (s->running && ReplayFile(s, index, &startNs, &firstTs)) index++;
+    } while (s->running && s->cfg.loop);
+    s->stats.finished = TRUE;
+}
+
+static void SimThreadProc(void *arg)
+{
+    SimServer *s = (SimServer*)arg;
+    if (s->cfg.mode == SIM_REPLAY) RunReplay(s);
+    else RunSynthetic(s);
+
+    // A dying server may tell its client, as ThinkOrSwim does on a clean exit
+    if (s->dead && s->cfg.dropoutNotify && s->callback) s->callback->lpVtbl->Disconnect(s->callback);
+}
+
+static void StopThread(SimServer *s)
+{
+    if (!s->threadStarted) return;
+    InterlockedExchange(&s->running, 0);
+    RtdThread_Join(&s->thread);
+    s->threadStarted = FALSE;
+}
+
+/**
+ * IUnknown
+ */
+static HRESULT STDMETHODCALLTYPE Sim_QueryInterface(IRtdServer *This, REFIID riid, void **ppv)
+{
+    if (IsEqualIID(riid, &IID_IUnknown) ||
+        IsEqualIID(riid, &IID_IDispatch) ||
+        IsEqualIID(riid, &IID_IRtdServer))
+    {
+        *ppv = This;
+        This->lpVtbl->AddRef(This);
+        return S_OK;
+    }
+    *ppv = NULL;
+    return E_NOINTERFACE;
+}
+
+static ULONG STDMETHODCALLTYPE Sim_AddRef(IRtdServer *This)
+{
+    return InterlockedIncrement(&FromIface(This)->refCount);
+}
+
+static ULONG STDMETHODCALLTYPE Sim_Release(IRtdServer *This)
+{
+    SimServer *s = FromIface(This);
+    LONG c = InterlockedDecrement(&s->refCount);
+    if (c == 0) {
+        StopThread(s);
+        if (s->callback) s->callback->lpVtbl->Release(s->callback);
+        for (long i = 0; i < s->topicCap; i++) VariantClear(&s->topics[i].value);
+        for (long i = 0; i < s->nameCount; i++) free(s->names[i].key);
+        free(s->topics);
+        free(s->connectedIDs);
+        free(s->dirtyIDs);
+        free(s->names);
+        free(s->nameIndex);
+        RtdMutex_Free(&s->lock);
+        free(s);
+    }
+    return c;
+}
+
+/**
+ * IDispatch stubs
+ */
+static HRESULT STDMETHODCALLTYPE Sim_GetTypeInfoCount(IRtdServer *This, UINT *pctinfo)
+{
+    *pctinfo = 0;
+    return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE Sim_GetTypeInfo(IRtdServer *This, UINT iTInfo, LCID lcid, ITypeInfo **ppTInfo)
+{
+    *ppTInfo = NULL;
+    return E_NOTIMPL;
+}
+
+static HRESULT STDMETHODCALLTYPE Sim_GetIDsOfNames(IRtdServer *This, REFIID riid, LPOLESTR *rgszNames, UINT cNames, LCID lcid, DISPID *rgDispId)
+{
+    return E_NOTIMPL;
+}
+
+static HRESULT STDMETHODCALLTYPE Sim_Invoke(IRtdServer *This, DISPID dispIdMember, REFIID riid, LCID lcid, WORD wFlags, DISPPARAMS *pDispParams, VARIANT *pVarResult, EXCEPINFO *pExcepInfo, UINT *puArgErr)
+{
+    return E_NOTIMPL;
+}
+
+/**
+ * IRtdServer
+ */
+static HRESULT STDMETHODCALLTYPE Sim_ServerStart(IRtdServer *This, IRTDUpdateEvent *CallbackObject, long *pfRes)
+{
+    SimServer *s = FromIface(This);
+    if (s->threadStarted) return E_UNEXPECTED;
+
+    if (CallbackObject) CallbackObject->lpVtbl->AddRef(CallbackObject);
+    s->callback = CallbackObject;
+    s->running = 1;
+    s->startedNs = RtdNowNs();
+    s->threadStarted = RtdThread_Start(&s->thread, SimThreadProc, s);
+    *pfRes = s->threadStarted ? 1 : 0;
+    return s->threadStarted ? S_OK : E_FAIL;
+}
+
+static HRESULT STDMETHODCALLTYPE Sim_ConnectData(IRtdServer *This, long TopicID, SAFEARRAY **Strings,
+                                                 VARIANT_BOOL *GetNewValues, VARIANT *pvarOut)
+{
+    SimServer *s = FromIface(This);
+    VARIANT *args = NULL;
+    HRESULT hr = S_OK;
+
+    if (IsDead(s)) return RPC_E_DISCONNECTED;
+    if (TopicID <= 0 || !Strings || !*Strings || (*Strings)->rgsabound[0].cElements < 2) return E_INVALIDARG;
+    if (FAILED(SafeArrayAccessData(*Strings, (void**)&args))) return E_INVALIDARG;
+    if (args[0].vt != VT_BSTR || args[1].vt != VT_BSTR) {
+        SafeArrayUnaccessData(*Strings);
+        return E_INVALIDARG;
+    }
+
+    // Strings are { topic, symbol }
+    const WCHAR *topic = args[0].bstrVal ? args[0].bstrVal : L"";
+    const WCHAR *symbol = args[1].bstrVal ? args[1].bstrVal : L"";
+    char key[256];
+    size_t n = RtdWideToUtf8(symbol, wcslen(symbol), key, 120);
+    key[n++] = '\t';
+    key[n + RtdWideToUtf8(topic, wcslen(topic), key + n, 120)] = 0;
+
+    RtdMutex_Lock(&s->lock);
+    long name = EnsureTopic(s, TopicID) ? InternName(s, key) : -1;
+    if (name < 0) {
+        hr = E_OUTOFMEMORY;
+    } else {
+        SimTopic *t = &s->topics[TopicID];
+        if (t->connected && t->name != name && s->names[t->name].clientID == TopicID) {
+            s->names[t->name].clientID = 0;  // Topic ID reused for a new pair
+        }
+        if (!t->connected) {
+            t->connected = TRUE;
+            t->connPos = s->connectedCount;
+            s->connectedIDs[s->connectedCount++] = TopicID;
+        }
+        t->name = name;
+        s->names[name].clientID = TopicID;
+        VariantClear(&t->value);
+        if (s->cfg.mode == SIM_SYNTHETIC) InitSyntheticValue(s, t, symbol, topic);
+        if (pvarOut) hr = VariantCopy(pvarOut, &t->value);
+        s->stats.connected = s->connectedCount;
+    }
+    RtdMutex_Unlock(&s->lock);
+
+    SafeArrayUnaccessData(*Strings);
+    if (GetNewValues) *GetNewValues = VARIANT_TRUE;
+    if (s->cfg.callLatencyUs > 0) WaitUntil(s, RtdNowNs() + (ULONGLONG)(s->cfg.callLatencyUs * 1e3));
+    return hr;
+}
+
+static HRESULT STDMETHODCALLTYPE Sim_RefreshData(IRtdServer *This, long *TopicCount, SAFEARRAY **parrayOut)
+{
+    SimServer *s = FromIface(This);
+    if (IsDead(s)) return RPC_E_DISCONNECTED;
+
+    // Under the lock, so no row can have changed after now
+    RtdMutex_Lock(&s->lock);
+    ULONGLONG now = RtdNowNs();
+    long rows = 0;
+    for (long i = 0; i < s->dirtyCount; i++) {
+        if (s->topics[s->dirtyIDs[i]].connected) rows++;
+    }
+
+    SAFEARRAY *arr = NULL;
+    if (rows > 0) {
+        SAFEARRAYBOUND bounds[2];
+        bounds[0].cElements = 2;
+        bounds[0].lLbound = 0;
+        bounds[1].cElements = (ULONG)rows;
+        bounds[1].lLbound = 0;
+        arr = SafeArrayCreate(VT_VARIANT, 2, bounds);
+    }
+
+    VARIANT *data = NULL;
+    if (arr) SafeArrayAccessData(arr, (void**)&data);
+
+    long row = 0;
+    for (long i = 0; i < s->dirtyCount; i++) {
+        long id = s->dirtyIDs[i];
+        SimTopic *t = &s->topics[id];
+        t->dirty = FALSE;
+        if (!t->connected || !data) continue;
+
+        data[row * 2].vt = VT_I4;
+        data[row * 2].lVal = id;
+        VariantCopy(&data[row * 2 + 1], &t->value);
+        row++;
+
+        ULONGLONG age = now - t->dirtyNs;
+        s->stats.totalRowAgeNs += age;
+        if (age > s->stats.maxRowAgeNs) s->stats.maxRowAgeNs = age;
+    }
+    if (arr) SafeArrayUnaccessData(arr);
+
+    s->dirtyCount = 0;
+    s->notified = FALSE;
+    s->stats.refreshCalls++;
+    s->stats.rowsDelivered += row;
+    if ((ULONGLONG)row > s->stats.maxRows) s->stats.maxRows = row;
+    RtdMutex_Unlock(&s->lock);
+
+    *TopicCount = row;
+    *parrayOut = arr;
+    // Outside the lock, so the tick source keeps running meanwhile
+    double latencyNs = s->cfg.callLatencyUs * 1e3 + s->cfg.rowLatencyNs * row;
+    if (latencyNs > 0) WaitUntil(s, RtdNowNs() + (ULONGLONG)latencyNs);
+    return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE Sim_DisconnectData(IRtdServer *This, long TopicID)
+{
+    SimServer *s = FromIface(This);
+    if (IsDead(s)) return RPC_E_DISCONNECTED;
+
+    RtdMutex_Lock(&s->lock);
+    if (TopicID > 0 && TopicID < s->topicCap && s->topics[TopicID].connected) {
+        SimTopic *t = &s->topics[TopicID];
+        long last = s->connectedIDs[--s->connectedCount];
+        s->connectedIDs[t->connPos] = last;
+        s->topics[last].connPos = t->connPos;
+        t->connected = FALSE;
+        if (s->names[t->name].clientID == TopicID) s->names[t->name].clientID = 0;
+        VariantClear(&t->value);
+        s->stats.connected = s->connectedCount;
+    }
+    RtdMutex_Unlock(&s->lock);
+    return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE Sim_Heartbeat(IRtdServer *This, long *pfRes)
+{
+    if (IsDead(FromIface(This))) return RPC_E_DISCONNECTED;
+    *pfRes = 1;
+    return S_OK;
+}
+
+static HRESULT STDMETHODCALLTYPE Sim_ServerTerminate(IRtdServer *This)
+{
+    SimServer *s = FromIface(This);
+    StopThread(s);
+    if (s->callback) {
+        s->callback->lpVtbl->Release(s->callback);
+        s->callback = NULL;
+    }
+    return s->dead ? RPC_E_DISCONNECTED : S_OK;
+}
+
+static const IRtdServerVtbl sim_vtbl = {
+    // IUnknown
+    Sim_QueryInterface,
+    Sim_AddRef,
+    Sim_Release,
+
+    // IDispatch
+    Sim_GetTypeInfoCount,
+    Sim_GetTypeInfo,
+    Sim_GetIDsOfNames,
+    Sim_Invoke,
+
+    // IRtdServer
+    Sim_ServerStart,
+    Sim_ConnectData,
+    Sim_RefreshData,
+    Sim_DisconnectData,
+    Sim_Heartbeat,
+    Sim_ServerTerminate
+};
+
+/**
+ * Create a simulated server; the tick source starts with ServerStart
+ */
+IRtdServer* SimServer_Create(const SimConfig *cfg)
+{
+    if ((LONGLONG)RtdNowNs() < RtdLoadAcquire64(&g_downUntilNs)) return NULL;
+    SimServer *s = (SimServer*)calloc(1, sizeof *s);
+    if (!s) return NULL;
+
+    s->iface.lpVtbl = &sim_vtbl;
+    s->refCount = 1;
+    s->cfg = *cfg;
+    if (cfg->journalPrefix) snprintf(s->prefix, sizeof s->prefix, "%s", cfg->journalPrefix);
+    s->cfg.journalPrefix = s->prefix;
+    s->rng = cfg->seed ? cfg->seed : 0x9E3779B97F4A7C15ULL;
+
+    s->nameMask = 1023;
+    s->nameIndex = (long*)malloc((s->nameMask + 1) * sizeof *s->nameIndex);
+    if (!s->nameIndex) {
+        free(s);
+        return NULL;
+    }
+    for (ULONG i = 0; i <= s->nameMask; i++) s->nameIndex[i] = -1;
+
+    RtdMutex_Init(&s->lock);
+    return &s->iface;
+}
+
+void SimServer_GetStats(IRtdServer *srv, SimStats *stats)
+{
+    SimServer *s = FromIface(srv);
+    RtdMutex_Lock(&s->lock);
+    *stats = s->stats;
+    RtdMutex_Unlock(&s->lock);
+    stats->dead = s->dead;
+}
+
+void SimServer_Drop(IRtdServer *srv)
+{
+    Drop(FromIface(srv));
+}
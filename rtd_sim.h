@@ -0,0 +1,55 @@
+// rtd_sim.h - Simulated IRtdServer for deterministic load testing
+// Implements the IRtdServerVtbl layout from rtd_client.h in plain C. A tick
+// source thread either generates synthetic prices or replays a journal
+// written with --journal, conflates values per topic like the real server,
+// and calls UpdateNotify on the registered callback.
+
+#ifndef __RTD_SIM_H__
+#define __RTD_SIM_H__
+
+#include "rtd_client.h"
+
+typedef enum {
+    SIM_SYNTHETIC = 0,      // Random-walk values for every connected topic
+    SIM_REPLAY              // Values from a recorded tick journal
+} SimMode;
+
+typedef struct SimConfig {
+    SimMode     mode;
+    double      updatesPerSec;  // Synthetic: aggregate rate, 0 = as fast as possible
+    double      speed;          // Replay: 1 = recorded pace, N = N x faster, 0 = no pacing
+    const char *journalPrefix;  // Replay: PREFIX passed to --journal
+    BOOL        loop;           // Replay: start over at the end of the journal
+    unsigned    seed;           // Synthetic: random seed for reproducible runs
+    double      dropoutAfterSec;    // Die this long after ServerStart, 0 = never
+    double      downtimeSec;        // After dying, SimServer_Create fails this long
+    BOOL        dropoutNotify;      // Call IRTDUpdateEvent::Disconnect when dying
+    double      callLatencyUs;      // Every call waits this long before returning, and
+    double      rowLatencyNs;       // RefreshData this much more per row, standing in
+                                    // for marshalling to another process
+} SimConfig;
+
+typedef struct SimStats {
+    ULONGLONG generated;        // Values produced by the tick source
+    ULONGLONG conflated;        // Values overwritten before RefreshData took them
+    ULONGLONG notifies;         // UpdateNotify calls
+    ULONGLONG refreshCalls;
+    ULONGLONG rowsDelivered;
+    ULONGLONG maxRows;          // Largest RefreshData batch
+    ULONGLONG totalRowAgeNs;    // Sum over rows of (RefreshData time - first change)
+    ULONGLONG maxRowAgeNs;
+    long      connected;        // Currently connected topics
+    BOOL      finished;         // Replay reached the end with loop off
+    BOOL      dead;             // Dropped out; every call now fails
+} SimStats;
+
+// Returns a server with one reference, or NULL on failure (including
+// while a previous instance's downtime has not elapsed)
+IRtdServer* SimServer_Create(const SimConfig *cfg);
+void SimServer_GetStats(IRtdServer *srv, SimStats *stats);
+
+// Make the server die now, as if its process had exited: calls return
+// RPC_E_DISCONNECTED and no more updates are sent
+void SimServer_Drop(IRtdServer *srv);
+
+#endif /* __RTD_SIM_H__ */
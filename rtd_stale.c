@@ -0,0 +1,175 @@
+/**
+ * rtd_stale.c - Per-topic staleness detection on a timing wheel
+ *
+ * Runs on the RTD thread: Touch for every routed row, Advance from the
+ * main loop. Timer IDs are topic IDs.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "rtd_stale.h"
+
+BOOL StaleConfig_Parse(StaleConfig *cfg, const char *spec)
+{
+    memset(cfg, 0, sizeof *cfg);
+    const char *p = spec;
+    while (*p) {
+        const char *eq = strchr(p, '=');
+        size_t len = eq ? (size_t)(eq - p) : 0;
+        if (len == 0 || len >= ARRAYSIZE(cfg->classes[0].topic) || cfg->count == STALE_MAX_CLASSES) return FALSE;
+
+        char *end;
+        unsigned long n = strtoul(eq + 1, &end, 10);
+        ULONGLONG ms;
+        if (end == eq + 1 || n == 0) return FALSE;
+        if (strncmp(end, "ms", 2) == 0) { ms = n; end += 2; }
+        else if (*end == 's') { ms = n * 1000ULL; end++; }
+        else if (*end == 'm') { ms = n * 60000ULL; end++; }
+        else if (*end == 'h') { ms = n * 3600000ULL; end++; }
+        else return FALSE;
+        if (ms > STALE_MAX_MS || (*end && *end != ',')) return FALSE;
+
+        StaleClass *c = &cfg->classes[cfg->count++];
+        for (size_t i = 0; i < len; i++) c->topic[i] = (WCHAR)(unsigned char)p[i];
+        c->topic[len] = 0;
+        c->thresholdNs = ms * 1000000ULL;
+        p = *end ? end + 1 : end;
+    }
+    return cfg->count > 0;
+}
+
+ULONGLONG StaleConfig_Threshold(const StaleConfig *cfg, const WCHAR *topic)
+{
+    ULONGLONG other = 0;
+    for (int i = 0; i < cfg->count; i++) {
+        const StaleClass *c = &cfg->classes[i];
+        if (wcscmp(c->topic, topic) == 0) return c->thresholdNs;
+        if (c->topic[0] == L'*' && !c->topic[1]) other = c->thresholdNs;
+    }
+    return other;
+}
+
+BOOL StaleMonitor_Init(StaleMonitor *m, const StaleConfig *cfg, ULONGLONG nowNs, StaleEmitFn emit, void *ctx)
+{
+    memset(m, 0, sizeof *m);
+    m->cfg = *cfg;
+    m->emit = emit;
+    m->ctx = ctx;
+    m->nowNs = nowNs;
+    return TimerWheel_Init(&m->wheel, STALE_TICK_NS, nowNs);
+}
+
+void StaleMonitor_Free(StaleMonitor *m)
+{
+    free(m->topics);
+    TimerWheel_Free(&m->wheel);
+    memset(m, 0, sizeof *m);
+}
+
+static BOOL GrowTopics(StaleMonitor *m, long minCap)
+{
+    long newCap = m->topicCap ? m->topicCap * 2 : 1024;
+    while (newCap < minCap) newCap *= 2;
+    StaleTopic *topics = (StaleTopic*)realloc(m->topics, newCap * sizeof *topics);
+    if (!topics) return FALSE;
+    memset(topics + m->topicCap, 0, (newCap - m->topicCap) * sizeof *topics);
+    m->topics = topics;
+    m->topicCap = newCap;
+    return TRUE;
+}
+
+BOOL StaleMonitor_Track(StaleMonitor *m, const TopicSubscription *sub, ULONGLONG nowNs)
+{
+    // Derived topics are computed here and go quiet with their inputs
+    if (sub->local) return TRUE;
+    ULONGLONG thresholdNs = StaleConfig_Threshold(&m->cfg, sub->topic);
+    if (!thresholdNs) return TRUE;
+    long id = sub->topicID;
+    if (id >= m->topicCap && !GrowTopics(m, id + 1)) return FALSE;
+
+    StaleTopic *t = &m->topics[id];
+    if (t->thresholdNs) return TRUE;
+    memset(t, 0, sizeof *t);
+    if (!TimerWheel_Schedule(&m->wheel, (ULONG)id, nowNs + thresholdNs)) return FALSE;
+    t->thresholdNs = thresholdNs;
+    t->sinceNs = nowNs;
+    m->tracked++;
+    return TRUE;
+}
+
+void StaleMonitor_Untrack(StaleMonitor *m, long topicID)
+{
+    if (topicID <= 0 || topicID >= m->topicCap || !m->topics[topicID].thresholdNs) return;
+    TimerWheel_Cancel(&m->wheel, (ULONG)topicID);
+    if (m->topics[topicID].stale) m->staleNow--;
+    memset(&m->topics[topicID], 0, sizeof m->topics[topicID]);
+    m->tracked--;
+}
+
+void StaleMonitor_Recover(StaleMonitor *m, long topicID, ULONGLONG nowNs)
+{
+    StaleTopic *t = &m->topics[topicID];
+    StaleEvent ev;
+    ev.topicID = topicID;
+    ev.stale = FALSE;
+    ev.nowNs = nowNs;
+    ev.lastNs = t->lastNs;
+    ev.silentNs = nowNs - (t->lastNs ? t->lastNs : t->sinceNs);
+    ev.thresholdNs = t->thresholdNs;
+
+    t->stale = FALSE;
+    m->staleNow--;
+    m->recoveries++;
+    if (ev.silentNs > m->maxSilentNs) m->maxSilentNs = ev.silentNs;
+    TimerWheel_Schedule(&m->wheel, (ULONG)topicID, nowNs + t->thresholdNs);
+    if (m->emit) m->emit(m->ctx, &ev);
+}
+
+/**
+ * WheelFireFn: a topic's deadline came up. If it updated since the timer
+ * was set, push the deadline out instead of reporting it.
+ */
+static void Expire(void *ctx, ULONG id, ULONGLONG dueNs)
+{
+    StaleMonitor *m = (StaleMonitor*)ctx;
+    StaleTopic *t = &m->topics[id];
+    if (!t->thresholdNs || t->stale) return;
+
+    ULONGLONG fromNs = t->lastNs ? t->lastNs : t->sinceNs;
+    if (fromNs + t->thresholdNs > m->nowNs) {
+        TimerWheel_Schedule(&m->wheel, id, fromNs + t->thresholdNs);
+        m->rescheduled++;
+        return;
+    }
+
+    t->stale = TRUE;
+    m->staleNow++;
+    m->staleEvents++;
+    if (m->emit) {
+        StaleEvent ev;
+        ev.topicID = (long)id;
+        ev.stale = TRUE;
+        ev.nowNs = m->nowNs;
+        ev.lastNs = t->lastNs;
+        ev.silentNs = m->nowNs - fromNs;
+        ev.thresholdNs = t->thresholdNs;
+        m->emit(m->ctx, &ev);
+    }
+}
+
+ULONG StaleMonitor_Advance(StaleMonitor *m, ULONGLONG nowNs)
+{
+    ULONGLONG before = m->staleEvents;
+    m->nowNs = nowNs;
+    TimerWheel_Advance(&m->wheel, nowNs, Expire, m);
+    return (ULONG)(m->staleEvents - before);
+}
+
+long StaleMonitor_NeverUpdated(const StaleMonitor *m)
+{
+    long n = 0;
+    for (long id = 1; id < m->topicCap; id++) {
+        if (m->topics[id].thresholdNs && !m->topics[id].firstNs) n++;
+    }
+    return n;
+}
@@ -0,0 +1,117 @@
+// rtd_stale.h - Per-topic staleness detection
+// Each tracked subscription has a threshold picked by its topic name (its
+// class): "LAST=5s,BID=2s,ASK=2s,*=30s" gives quotes a tighter bound than
+// everything else, and a topic no class names is not watched. A topic
+// with no update for its threshold goes stale; its next update recovers
+// it. Both are reported through StaleEmitFn.
+//
+// The deadlines live on a timing wheel keyed by topic ID, but an update
+// does not move its timer: it only stamps lastNs. When a timer fires, a
+// topic that updated in the meantime is rescheduled for lastNs plus its
+// threshold and nothing is reported. A topic's timer therefore fires at
+// most once per threshold however fast it ticks, and an Advance costs the
+// timers that come due rather than a scan of every topic.
+//
+// ConnectData's initial value counts as the first update (the session
+// delivers it as an ordinary row), so a topic that never produced anything
+// can be told apart from one that went quiet.
+
+#ifndef __RTD_STALE_H__
+#define __RTD_STALE_H__
+
+#include "rtd_subs.h"
+#include "rtd_wheel.h"
+
+#define STALE_MAX_CLASSES 16
+#define STALE_MAX_MS      (24 * 3600 * 1000)
+#define STALE_TICK_NS     10000000      // Timing wheel resolution, 10 ms
+
+typedef struct StaleClass {
+    WCHAR     topic[32];    // Topic name, or "*" for every other topic
+    ULONGLONG thresholdNs;
+} StaleClass;
+
+typedef struct StaleConfig {
+    StaleClass classes[STALE_MAX_CLASSES];
+    int        count;
+} StaleConfig;
+
+typedef struct StaleEvent {
+    long      topicID;
+    BOOL      stale;        // TRUE: went stale; FALSE: updated again
+    ULONGLONG nowNs;
+    ULONGLONG lastNs;       // Its last update before the event, 0 = none since subscribing
+    ULONGLONG silentNs;     // Quiet this long: to the stale call, or the whole gap on recovery
+    ULONGLONG thresholdNs;
+} StaleEvent;
+
+typedef void (*StaleEmitFn)(void *ctx, const StaleEvent *ev);
+
+typedef struct StaleTopic {
+    ULONGLONG thresholdNs;  // 0 = not tracked
+    ULONGLONG sinceNs;      // Tracked since
+    ULONGLONG firstNs;      // First update (ConnectData's value, usually), 0 = none
+    ULONGLONG lastNs;
+    BOOL      stale;
+} StaleTopic;
+
+typedef struct StaleMonitor {
+    StaleConfig   cfg;
+    StaleTopic   *topics;           // Indexed by topic ID
+    long          topicCap;
+    TimerWheel    wheel;
+    StaleEmitFn   emit;
+    void         *ctx;
+    ULONGLONG     nowNs;            // Time of the Advance in progress
+
+    long          tracked;
+    long          staleNow;
+    ULONGLONG     staleEvents;
+    ULONGLONG     recoveries;
+    ULONGLONG     rescheduled;      // Timers that fired on a topic that had updated
+    ULONGLONG     maxSilentNs;      // Longest gap a recovery closed
+} StaleMonitor;
+
+// Parse "LAST=5s,BID=2000ms,*=1m" (units ms, s, m, h)
+BOOL StaleConfig_Parse(StaleConfig *cfg, const char *spec);
+
+// Threshold for a topic name, 0 if no class covers it
+ULONGLONG StaleConfig_Threshold(const StaleConfig *cfg, const WCHAR *topic);
+
+// nowNs starts the timing wheel
+BOOL StaleMonitor_Init(StaleMonitor *m, const StaleConfig *cfg, ULONGLONG nowNs, StaleEmitFn emit, void *ctx);
+void StaleMonitor_Free(StaleMonitor *m);
+
+// Start watching a subscription from nowNs if a class covers its topic;
+// FALSE only when out of memory
+BOOL StaleMonitor_Track(StaleMonitor *m, const TopicSubscription *sub, ULONGLONG nowNs);
+void StaleMonitor_Untrack(StaleMonitor *m, long topicID);
+
+// Called by Touch for a stale topic: report it recovered and rearm it
+void StaleMonitor_Recover(StaleMonitor *m, long topicID, ULONGLONG nowNs);
+
+/**
+ * Note an update for a topic; a couple of stores unless it was stale
+ */
+static inline void StaleMonitor_Touch(StaleMonitor *m, long topicID, ULONGLONG nowNs)
+{
+    if (topicID <= 0 || topicID >= m->topicCap) return;
+    StaleTopic *t = &m->topics[topicID];
+    if (!t->thresholdNs) return;
+    if (!t->firstNs) t->firstNs = nowNs;
+    if (t->stale) StaleMonitor_Recover(m, topicID, nowNs);
+    t->lastNs = nowNs;
+}
+
+// Report topics whose deadline passed by nowNs; returns the number that went stale
+ULONG StaleMonitor_Advance(StaleMonitor *m, ULONGLONG nowNs);
+
+static inline ULONGLONG StaleMonitor_NextDueNs(const StaleMonitor *m)
+{
+    return TimerWheel_NextDueNs(&m->wheel);
+}
+
+// Tracked topics with no update since they were subscribed
+long StaleMonitor_NeverUpdated(const StaleMonitor *m);
+
+#endif /* __RTD_STALE_H__ */
@@ -0,0 +1,438 @@
+/**
+ * rtd_subs.c - Subscription registry and RefreshData dispatch
+ *
+ * Topic IDs are handed out by the client, so they are kept dense and used
+ * directly as array indices. Released IDs are recycled oldest-first, which
+ * keeps rows still in flight for a disconnected topic from landing on a
+ * brand new subscription.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "rtd_subs.h"
+
+#define INDEX_EMPTY     (-1L)
+#define INDEX_TOMBSTONE (-2L)
+
+/**
+ * Mix the interned symbol and topic IDs into one hash
+ */
+static ULONG HashPair(long symbolID, long fieldID)
+{
+    uint64_t h = ((uint64_t)(uint32_t)symbolID << 32 | (uint32_t)fieldID) * 0x9E3779B97F4A7C15ULL;
+    return (ULONG)(h >> 32);
+}
+
+static BOOL GrowSlots(SubscriptionTable *tbl, long minCapacity)
+{
+    long newCap = tbl->capacity ? tbl->capacity : 64;
+    while (newCap < minCapacity) newCap *= 2;
+
+    TopicSubscription *slots = (TopicSubscription*)realloc(tbl->slots, newCap * sizeof *slots);
+    if (!slots) return FALSE;
+    memset(slots + tbl->capacity, 0, (newCap - tbl->capacity) * sizeof *slots);
+
+    // Unwrap the free-ID ring into the larger buffer
+    long *freeIDs = (long*)malloc(newCap * sizeof *freeIDs);
+    if (!freeIDs) {
+        tbl->slots = slots;
+        return FALSE;
+    }
+    for (long i = 0; i < tbl->freeCount; i++) {
+        freeIDs[i] = tbl->freeIDs[(tbl->freeHead + i) % tbl->capacity];
+    }
+    free(tbl->freeIDs);
+
+    tbl->slots = slots;
+    tbl->freeIDs = freeIDs;
+    tbl->freeHead = 0;
+    tbl->capacity = newCap;
+    return TRUE;
+}
+
+/**
+ * Rebuild the hash index with room for at least minEntries live entries
+ */
+static BOOL RehashIndex(SubscriptionTable *tbl, long minEntries)
+{
+    ULONG size = 64;
+    while (size < (ULONG)minEntries * 2) size *= 2;
+
+    long *index = (long*)malloc(size * sizeof *index);
+    if (!index) return FALSE;
+    for (ULONG i = 0; i < size; i++) index[i] = INDEX_EMPTY;
+
+    for (long id = 1; id < tbl->highWater; id++) {
+        TopicSubscription *sub = &tbl->slots[id];
+        if (!sub->topicID) continue;
+        ULONG pos = HashPair(sub->symbolID, sub->fieldID) & (size - 1);
+        while (index[pos] != INDEX_EMPTY) pos = (pos + 1) & (size - 1);
+        index[pos] = id;
+    }
+
+    free(tbl->index);
+    tbl->index = index;
+    tbl->indexMask = size - 1;
+    tbl->indexUsed = tbl->count;
+    return TRUE;
+}
+
+static BOOL GrowSymbolPairs(SubscriptionTable *tbl, long minCapacity)
+{
+    long newCap = tbl->symbolPairCap ? tbl->symbolPairCap : 64;
+    while (newCap < minCapacity) newCap *= 2;
+
+    long *pairs = (long*)realloc(tbl->symbolPairs, newCap * sizeof *pairs);
+    if (!pairs) return FALSE;
+    memset(pairs + tbl->symbolPairCap, 0, (newCap - tbl->symbolPairCap) * sizeof *pairs);
+    tbl->symbolPairs = pairs;
+    tbl->symbolPairCap = newCap;
+    return TRUE;
+}
+
+/**
+ * Initialize an empty table sized for initialCapacity subscriptions
+ */
+BOOL SubTable_Init(SubscriptionTable *tbl, long initialCapacity)
+{
+    memset(tbl, 0, sizeof *tbl);
+    tbl->highWater = 1;  // Topic ID 0 is reserved as "free"
+    if (!GrowSlots(tbl, initialCapacity + 1) || !RehashIndex(tbl, initialCapacity) ||
+        !Interner_Init(&tbl->symbols, initialCapacity) || !Interner_Init(&tbl->topics, 64)) {
+        SubTable_Free(tbl);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void SubTable_Free(SubscriptionTable *tbl)
+{
+    if (tbl->connectArgs) {
+        // The BSTRs belong to the name arrays, not the argument array
+        VARIANT *argv = (VARIANT*)tbl->connectArgs->pvData;
+        argv[0].vt = VT_EMPTY;
+        argv[1].vt = VT_EMPTY;
+        SafeArrayDestroy(tbl->connectArgs);
+    }
+    for (long i = 0; i < tbl->symbolArgCap; i++) SysFreeString(tbl->symbolArgs[i]);
+    for (long i = 0; i < tbl->topicArgCap; i++) SysFreeString(tbl->topicArgs[i]);
+    free(tbl->symbolArgs);
+    free(tbl->topicArgs);
+    free(tbl->slots);
+    free(tbl->freeIDs);
+    free(tbl->index);
+    free(tbl->symbolPairs);
+    Interner_Free(&tbl->symbols);
+    Interner_Free(&tbl->topics);
+    memset(tbl, 0, sizeof *tbl);
+}
+
+/**
+ * Locate the index bucket holding the pair, or NULL if absent
+ */
+static long* FindBucket(SubscriptionTable *tbl, long symbolID, long fieldID)
+{
+    ULONG pos = HashPair(symbolID, fieldID) & tbl->indexMask;
+    for (;;) {
+        long id = tbl->index[pos];
+        if (id == INDEX_EMPTY) return NULL;
+        if (id != INDEX_TOMBSTONE) {
+            TopicSubscription *sub = &tbl->slots[id];
+            if (sub->symbolID == symbolID && sub->fieldID == fieldID) {
+                return &tbl->index[pos];
+            }
+        }
+        pos = (pos + 1) & tbl->indexMask;
+    }
+}
+
+TopicSubscription* SubTable_Find(SubscriptionTable *tbl, const WCHAR *symbol, const WCHAR *topic)
+{
+    long symbolID = Interner_Find(&tbl->symbols, symbol);
+    long fieldID = Interner_Find(&tbl->topics, topic);
+    if (!symbolID || !fieldID) return NULL;
+
+    long *bucket = FindBucket(tbl, symbolID, fieldID);
+    return bucket ? &tbl->slots[*bucket] : NULL;
+}
+
+/**
+ * Register a symbol x topic pair and assign it a topic ID.
+ * Does not call ConnectData; see ConnectSubscription.
+ */
+TopicSubscription* SubTable_Add(SubscriptionTable *tbl, const WCHAR *symbol, const WCHAR *topic)
+{
+    long symbolID = Interner_Add(&tbl->symbols, symbol);
+    long fieldID = Interner_Add(&tbl->topics, topic);
+    if (!symbolID || !fieldID) return NULL;
+
+    long *bucket = FindBucket(tbl, symbolID, fieldID);
+    if (bucket) return &tbl->slots[*bucket];
+
+    // Keep the index at most half full, counting tombstones
+    if ((tbl->indexUsed + 1) * 2 > (long)tbl->indexMask + 1) {
+        if (!RehashIndex(tbl, tbl->count + 1)) return NULL;
+    }
+    if (symbolID >= tbl->symbolPairCap && !GrowSymbolPairs(tbl, symbolID + 1)) return NULL;
+
+    long id;
+    if (tbl->denseRemaining > 0) {
+        if (tbl->highWater >= tbl->capacity && !GrowSlots(tbl, tbl->highWater + 1)) return NULL;
+        id = tbl->highWater++;
+        tbl->denseRemaining--;
+    } else if (tbl->freeCount > 0) {
+        id = tbl->freeIDs[tbl->freeHead];
+        tbl->freeHead = (tbl->freeHead + 1) % tbl->capacity;
+        tbl->freeCount--;
+    } else {
+        if (tbl->highWater >= tbl->capacity && !GrowSlots(tbl, tbl->highWater + 1)) return NULL;
+        id = tbl->highWater++;
+    }
+
+    TopicSubscription *sub = &tbl->slots[id];
+    memset(sub, 0, sizeof *sub);
+    sub->topicID = id;
+    sub->symbolID = symbolID;
+    sub->fieldID = fieldID;
+    sub->symbol = Interner_String(&tbl->symbols, symbolID);
+    sub->topic = Interner_String(&tbl->topics, fieldID);
+    sub->local = tbl->isLocalTopic && tbl->isLocalTopic(sub->topic);
+
+    // Insert into the first empty or tombstone bucket
+    ULONG pos = HashPair(symbolID, fieldID) & tbl->indexMask;
+    while (tbl->index[pos] >= 0) pos = (pos + 1) & tbl->indexMask;
+    if (tbl->index[pos] == INDEX_EMPTY) tbl->indexUsed++;
+    tbl->index[pos] = id;
+
+    tbl->symbolPairs[symbolID]++;
+    tbl->count++;
+    return sub;
+}
+
+/**
+ * Make room for count more subscriptions up front and hand them
+ * consecutive topic IDs from the high-water mark, so a bulk load neither
+ * reallocates midway nor scatters into IDs freed earlier
+ */
+BOOL SubTable_Reserve(SubscriptionTable *tbl, long count)
+{
+    if (count <= 0) return TRUE;
+    if (tbl->highWater + count > tbl->capacity && !GrowSlots(tbl, tbl->highWater + count)) return FALSE;
+    if ((tbl->indexUsed + count) * 2 > (long)tbl->indexMask + 1 &&
+        !RehashIndex(tbl, tbl->count + count)) {
+        return FALSE;
+    }
+    tbl->denseRemaining = count;
+    return TRUE;
+}
+
+/**
+ * End a bulk load: IDs it reserved but did not use are dropped, so later
+ * adds go back to reusing freed IDs first
+ */
+void SubTable_EndReserve(SubscriptionTable *tbl)
+{
+    tbl->denseRemaining = 0;
+}
+
+/**
+ * Unregister a subscription and queue its topic ID for reuse.
+ * The caller is responsible for DisconnectData.
+ */
+BOOL SubTable_Remove(SubscriptionTable *tbl, long topicID)
+{
+    TopicSubscription *sub = SubTable_Get(tbl, topicID);
+    if (!sub) return FALSE;
+
+    long *bucket = FindBucket(tbl, sub->symbolID, sub->fieldID);
+    if (bucket) *bucket = INDEX_TOMBSTONE;
+
+    tbl->symbolPairs[sub->symbolID]--;
+    memset(sub, 0, sizeof *sub);
+    tbl->freeIDs[(tbl->freeHead + tbl->freeCount) % tbl->capacity] = topicID;
+    tbl->freeCount++;
+    tbl->count--;
+    return TRUE;
+}
+
+/**
+ * Walk a RefreshData result (2 x N: topic ID, value) and hand each row to
+ * handler. Returns the number of rows dispatched.
+ */
+long SubTable_Dispatch(SubscriptionTable *tbl, SAFEARRAY *pOutArr, long topicCount,
+                       SubscriptionHandler handler, void *ctx)
+{
+    if (!pOutArr || pOutArr->cDims != 2) return 0;
+
+    LONG rowCount = pOutArr->rgsabound[0].cElements;
+    LONG colCount = pOutArr->rgsabound[1].cElements;
+    if (colCount < 2) return 0;
+
+    VARIANT *pData = NULL;
+    if (FAILED(SafeArrayAccessData(pOutArr, (void**)&pData))) return 0;
+
+    long dispatched = 0;
+    long rows = min(rowCount, topicCount);
+    for (long i = 0; i < rows; i++) {
+        VARIANT *row = &pData[i * colCount];
+        if (row[0].vt != VT_I4) continue;
+
+        TopicSubscription *sub = SubTable_Get(tbl, row[0].lVal);
+        if (!sub) {
+            tbl->unknownRows++;
+            continue;
+        }
+        handler(ctx, sub, &row[1]);
+        dispatched++;
+    }
+
+    SafeArrayUnaccessData(pOutArr);
+    return dispatched;
+}
+
+/**
+ * Route each row of an already decoded batch to its subscription.
+ * Returns the number of rows dispatched.
+ */
+long SubTable_DispatchBatch(SubscriptionTable *tbl, const RtdBatch *batch,
+                            BatchRowHandler handler, void *ctx)
+{
+    long dispatched = 0;
+    for (long i = 0; i < batch->rows; i++) {
+        long id = batch->topicID[i];
+        if (id == 0) continue;          // ID was not VT_I4
+
+        TopicSubscription *sub = SubTable_Get(tbl, id);
+        if (!sub) {
+            tbl->unknownRows++;
+            continue;
+        }
+        handler(ctx, sub, batch, i);
+        dispatched++;
+    }
+    return dispatched;
+}
+
+/**
+ * Issue ConnectData for a registered subscription
+ */
+HRESULT ConnectSubscription(IRtdServer *pSrv, TopicSubscription *sub)
+{
+    if (sub->local) {
+        sub->connected = TRUE;
+        return S_OK;
+    }
+
+    VARIANT vType, vSym;
+    VariantInit(&vType);
+    vType.vt = VT_BSTR;
+    vType.bstrVal = SysAllocString(sub->topic);
+
+    VariantInit(&vSym);
+    vSym.vt = VT_BSTR;
+    vSym.bstrVal = SysAllocString(sub->symbol);
+
+    SAFEARRAYBOUND sab;
+    sab.cElements = 2;
+    sab.lLbound = 0;
+    SAFEARRAY *pArgs = SafeArrayCreate(VT_VARIANT, 1, &sab);
+    if (!pArgs) {
+        VariantClear(&vType);
+        VariantClear(&vSym);
+        return E_OUTOFMEMORY;
+    }
+    SafeArrayPutElement(pArgs, (LONG[]){0}, &vType);
+    SafeArrayPutElement(pArgs, (LONG[]){1}, &vSym);
+
+    VARIANT initVal;
+    VariantInit(&initVal);
+    VARIANT_BOOL getNew = VARIANT_TRUE;
+    HRESULT hr = pSrv->lpVtbl->ConnectData(pSrv, sub->topicID, &pArgs, &getNew, &initVal);
+
+    VariantClear(&initVal);
+    VariantClear(&vType);
+    VariantClear(&vSym);
+    SafeArrayDestroy(pArgs);
+
+    sub->connected = SUCCEEDED(hr);
+    return hr;
+}
+
+/**
+ * Cached BSTR for an interned name, created on first use
+ */
+static BSTR ArgString(SubscriptionTable *tbl, BSTR **cache, long *cap, long id, const WCHAR *name)
+{
+    if (id >= *cap) {
+        long newCap = *cap ? *cap * 2 : 256;
+        while (newCap <= id) newCap *= 2;
+        BSTR *grown = (BSTR*)realloc(*cache, newCap * sizeof *grown);
+        if (!grown) return NULL;
+        memset(grown + *cap, 0, (newCap - *cap) * sizeof *grown);
+        *cache = grown;
+        *cap = newCap;
+    }
+    if (!(*cache)[id]) {
+        (*cache)[id] = SysAllocString(name);
+        tbl->argAllocs++;
+    }
+    return (*cache)[id];
+}
+
+SAFEARRAY* SubTable_ConnectArgs(SubscriptionTable *tbl, const TopicSubscription *sub)
+{
+    BSTR topic = ArgString(tbl, &tbl->topicArgs, &tbl->topicArgCap, sub->fieldID, sub->topic);
+    BSTR symbol = ArgString(tbl, &tbl->symbolArgs, &tbl->symbolArgCap, sub->symbolID, sub->symbol);
+    if (!topic || !symbol) return NULL;
+    if (!tbl->connectArgs) {
+        SAFEARRAYBOUND sab = { 2, 0 };
+        tbl->connectArgs = SafeArrayCreate(VT_VARIANT, 1, &sab);
+        if (!tbl->connectArgs) return NULL;
+        tbl->argAllocs++;
+    }
+
+    VARIANT *argv;
+    if (FAILED(SafeArrayAccessData(tbl->connectArgs, (void**)&argv))) return NULL;
+    argv[0].vt = VT_BSTR;
+    argv[0].bstrVal = topic;
+    argv[1].vt = VT_BSTR;
+    argv[1].bstrVal = symbol;
+    SafeArrayUnaccessData(tbl->connectArgs);
+    return tbl->connectArgs;
+}
+
+/**
+ * ConnectData through the table's reused arguments
+ */
+HRESULT SubTable_Connect(SubscriptionTable *tbl, IRtdServer *pSrv, TopicSubscription *sub)
+{
+    if (sub->local) {
+        sub->connected = TRUE;
+        return S_OK;
+    }
+    SAFEARRAY *pArgs = SubTable_ConnectArgs(tbl, sub);
+    if (!pArgs) return E_OUTOFMEMORY;
+
+    VARIANT initVal;
+    VariantInit(&initVal);
+    VARIANT_BOOL getNew = VARIANT_TRUE;
+    HRESULT hr = pSrv->lpVtbl->ConnectData(pSrv, sub->topicID, &pArgs, &getNew, &initVal);
+    if (SUCCEEDED(hr) && initVal.vt != VT_EMPTY && tbl->onConnectValue) {
+        tbl->onConnectValue(tbl->connectValueCtx, sub, &initVal);
+    }
+    VariantClear(&initVal);
+
+    sub->connected = SUCCEEDED(hr);
+    return hr;
+}
+
+/**
+ * Issue DisconnectData for a connected subscription
+ */
+HRESULT DisconnectSubscription(IRtdServer *pSrv, TopicSubscription *sub)
+{
+    if (!sub->connected) return S_FALSE;
+    sub->connected = FALSE;
+    if (sub->local) return S_OK;
+    return pSrv->lpVtbl->DisconnectData(pSrv, sub->topicID);
+}
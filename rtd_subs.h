@@ -0,0 +1,106 @@
+// rtd_subs.h - Subscription registry and RefreshData dispatch
+// Subscriptions live in a dense array indexed by topic ID so each
+// RefreshData row reaches its subscription with a single array load.
+// Symbol and topic names are interned, and a hash index over the
+// (symbol ID, topic ID) pair prevents duplicate ConnectData calls.
+
+#ifndef __RTD_SUBS_H__
+#define __RTD_SUBS_H__
+
+#include "rtd_client.h"
+#include "rtd_decode.h"
+#include "rtd_intern.h"
+
+// Called once per RefreshData row whose topic ID is registered
+typedef void (*SubscriptionHandler)(void *ctx, TopicSubscription *sub, VARIANT *value);
+
+// Called once per decoded row whose topic ID is registered
+typedef void (*BatchRowHandler)(void *ctx, TopicSubscription *sub, const RtdBatch *batch, long row);
+
+// TRUE for topic names the client computes itself
+typedef BOOL (*LocalTopicFn)(const WCHAR *topic);
+
+typedef struct SubscriptionTable {
+    TopicSubscription *slots;   // Indexed by topic ID, slot 0 unused
+    long  capacity;             // Slots allocated
+    long  highWater;            // Next never-used topic ID
+    long  count;                // Live subscriptions
+    long *freeIDs;              // FIFO of released topic IDs
+    long  freeHead;
+    long  freeCount;
+    long  denseRemaining;       // Adds still owed consecutive IDs by SubTable_Reserve
+    StringInterner symbols;     // Symbol name <-> symbolID
+    StringInterner topics;      // Topic name <-> fieldID
+    long *symbolPairs;          // Live subscriptions per symbol ID
+    long  symbolPairCap;
+    long *index;                // Open-addressed (symbolID, fieldID) -> topic ID
+    ULONG indexMask;
+    long  indexUsed;            // Live entries plus tombstones
+    ULONGLONG unknownRows;      // Rows whose topic ID was not registered
+    LocalTopicFn isLocalTopic;  // Marks new subscriptions local, may be NULL
+    SubscriptionHandler onConnectValue; // ConnectData's initial value, may be NULL
+    void *connectValueCtx;
+
+    // ConnectData arguments kept for reuse: one BSTR per interned name and
+    // one argument array, so reconnects allocate nothing
+    BSTR *symbolArgs;
+    long  symbolArgCap;
+    BSTR *topicArgs;
+    long  topicArgCap;
+    SAFEARRAY *connectArgs;
+    ULONGLONG argAllocs;        // BSTRs and arrays created for ConnectData
+} SubscriptionTable;
+
+BOOL SubTable_Init(SubscriptionTable *tbl, long initialCapacity);
+void SubTable_Free(SubscriptionTable *tbl);
+
+// Returns the existing subscription when the pair is already registered
+TopicSubscription* SubTable_Add(SubscriptionTable *tbl, const WCHAR *symbol, const WCHAR *topic);
+TopicSubscription* SubTable_Find(SubscriptionTable *tbl, const WCHAR *symbol, const WCHAR *topic);
+BOOL SubTable_Remove(SubscriptionTable *tbl, long topicID);
+
+// Presize for count more adds and give them consecutive topic IDs, until
+// SubTable_EndReserve; call it after the bulk load, as adds of pairs
+// already registered use up none of the count
+BOOL SubTable_Reserve(SubscriptionTable *tbl, long count);
+void SubTable_EndReserve(SubscriptionTable *tbl);
+
+/**
+ * Live subscriptions of one symbol, 0 once its last pair is removed
+ */
+static inline long SubTable_SymbolPairs(const SubscriptionTable *tbl, long symbolID)
+{
+    return symbolID > 0 && symbolID < tbl->symbolPairCap ? tbl->symbolPairs[symbolID] : 0;
+}
+
+/**
+ * O(1) lookup of a live subscription by topic ID
+ */
+static inline TopicSubscription* SubTable_Get(SubscriptionTable *tbl, long topicID)
+{
+    if (topicID <= 0 || topicID >= tbl->highWater) return NULL;
+    TopicSubscription *sub = &tbl->slots[topicID];
+    return sub->topicID ? sub : NULL;
+}
+
+// Routes every row of a 2 x N RefreshData result to its subscription
+long SubTable_Dispatch(SubscriptionTable *tbl, SAFEARRAY *pOutArr, long topicCount,
+                       SubscriptionHandler handler, void *ctx);
+
+// Routes every row of a batch decoded by RtdBatch_Decode
+long SubTable_DispatchBatch(SubscriptionTable *tbl, const RtdBatch *batch,
+                            BatchRowHandler handler, void *ctx);
+
+// ConnectData / DisconnectData for one registered subscription (local
+// subscriptions only change state). ConnectSubscription builds its
+// arguments for the call; SubTable_Connect reuses the table's and hands
+// a non-empty initial value to onConnectValue.
+HRESULT ConnectSubscription(IRtdServer *pSrv, TopicSubscription *sub);
+HRESULT SubTable_Connect(SubscriptionTable *tbl, IRtdServer *pSrv, TopicSubscription *sub);
+
+// The table's { topic, symbol } argument array filled in for sub; NULL if
+// it could not be allocated. Valid until the next call.
+SAFEARRAY* SubTable_ConnectArgs(SubscriptionTable *tbl, const TopicSubscription *sub);
+HRESULT DisconnectSubscription(IRtdServer *pSrv, TopicSubscription *sub);
+
+#endif /* __RTD_SUBS_H__ */
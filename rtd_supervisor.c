@@ -0,0 +1,189 @@
+/**
+ * rtd_supervisor.c - Server health checks and automatic resubscription
+ *
+ * Everything runs on the RTD thread except SignalDisconnect, which only
+ * sets a flag for the next Tick. Subscriptions keep their topic IDs
+ * across a restart, so the rings, quote store, journal and shared memory
+ * need no changes when data starts flowing again.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "rtd_supervisor.h"
+
+void Supervisor_Init(Supervisor *sv, ServerFactory factory, void *factoryCtx,
+                     IRTDUpdateEvent *callback, SubscriptionTable *subs, DWORD heartbeatMs)
+{
+    memset(sv, 0, sizeof *sv);
+    sv->factory = factory;
+    sv->factoryCtx = factoryCtx;
+    sv->callback = callback;
+    sv->subs = subs;
+    sv->heartbeatNs = (ULONGLONG)heartbeatMs * 1000000ULL;
+    sv->backoffNs = (ULONGLONG)SUPERVISOR_BACKOFF_MIN_MS * 1000000ULL;
+}
+
+static void Emit(Supervisor *sv, SupervisorEvent ev)
+{
+    if (sv->onEvent) sv->onEvent(sv->ctx, sv, ev);
+}
+
+/**
+ * Create a server through the factory and start it
+ */
+static HRESULT StartServer(Supervisor *sv)
+{
+    IRtdServer *srv = NULL;
+    HRESULT hr = sv->factory(sv->factoryCtx, &srv);
+    if (FAILED(hr)) return hr;
+
+    // A late Disconnect from the previous instance must not count against this one
+    InterlockedExchange(&sv->disconnectSignaled, 0);
+    long res = 0;
+    hr = srv->lpVtbl->ServerStart(srv, sv->callback, &res);
+    if (FAILED(hr)) {
+        srv->lpVtbl->Release(srv);
+        return hr;
+    }
+    sv->server = srv;
+    return S_OK;
+}
+
+static void ReleaseServer(Supervisor *sv)
+{
+    if (!sv->server) return;
+    sv->server->lpVtbl->ServerTerminate(sv->server);    // Fails harmlessly once dead
+    sv->server->lpVtbl->Release(sv->server);
+    sv->server = NULL;
+}
+
+HRESULT Supervisor_Start(Supervisor *sv)
+{
+    HRESULT hr = StartServer(sv);
+    sv->nextHeartbeatNs = RtdNowNs() + sv->heartbeatNs;
+    return hr;
+}
+
+void Supervisor_Stop(Supervisor *sv)
+{
+    ReleaseServer(sv);
+}
+
+/**
+ * Drop the server and start an incident. Subscriptions stay registered but
+ * are marked disconnected, so nothing calls DisconnectData on a dead proxy.
+ */
+static void MarkLost(Supervisor *sv, HRESULT reason, const char *cause, ULONGLONG nowNs)
+{
+    if (!sv->server) return;
+    ReleaseServer(sv);
+    for (long id = 1; id < sv->subs->highWater; id++) {
+        TopicSubscription *sub = SubTable_Get(sv->subs, id);
+        if (sub) sub->connected = FALSE;
+    }
+
+    sv->incidents++;
+    sv->reason = reason;
+    sv->cause = cause;
+    sv->lostNs = nowNs;
+    sv->recoveredNs = 0;
+    sv->attempts = 0;
+    sv->replayed = 0;
+    sv->replayFailed = 0;
+    sv->replayNs = 0;
+    sv->awaitingUpdate = FALSE;
+    sv->gapNs = 0;
+    sv->backoffNs = (ULONGLONG)SUPERVISOR_BACKOFF_MIN_MS * 1000000ULL;
+    sv->nextAttemptNs = nowNs;      // First retry right away
+    Emit(sv, SUPERVISOR_LOST);
+}
+
+/**
+ * One reconnect attempt: new server, ServerStart, replay every
+ * registered subscription under its old topic ID
+ */
+static void TryReconnect(Supervisor *sv, ULONGLONG nowNs)
+{
+    sv->attempts++;
+    HRESULT hr = StartServer(sv);
+
+    long *ids = NULL;
+    long count = 0;
+    if (SUCCEEDED(hr)) {
+        ids = (long*)malloc(((size_t)sv->subs->highWater + 1) * sizeof *ids);
+        if (!ids) hr = E_OUTOFMEMORY;
+    }
+    if (SUCCEEDED(hr)) {
+        for (long id = 1; id < sv->subs->highWater; id++) {
+            if (SubTable_Get(sv->subs, id)) ids[count++] = id;
+        }
+        WatchConnectStats st;
+        memset(&st, 0, sizeof st);
+        Watchlist_ConnectTopics(sv->server, sv->subs, ids, count, sv->onResubscribed, sv->ctx, &st);
+        sv->replayed = st.connected;
+        sv->replayFailed = st.failed;
+        sv->replayNs = st.connectNs;
+
+        // A server that accepts none of a non-empty watchlist is not back
+        if (count > 0 && st.connected == 0) {
+            hr = RPC_E_DISCONNECTED;
+            ReleaseServer(sv);
+        }
+    }
+    free(ids);
+
+    if (FAILED(hr)) {
+        sv->reason = hr;
+        Emit(sv, SUPERVISOR_RETRY_FAILED);
+        sv->nextAttemptNs = nowNs + sv->backoffNs;
+        sv->backoffNs *= 2;
+        if (sv->backoffNs > (ULONGLONG)SUPERVISOR_BACKOFF_MAX_MS * 1000000ULL) {
+            sv->backoffNs = (ULONGLONG)SUPERVISOR_BACKOFF_MAX_MS * 1000000ULL;
+        }
+        return;
+    }
+
+    sv->recoveredNs = RtdNowNs();
+    sv->awaitingUpdate = TRUE;
+    sv->nextHeartbeatNs = sv->recoveredNs + sv->heartbeatNs;
+    Emit(sv, SUPERVISOR_RECOVERED);
+}
+
+void Supervisor_Tick(Supervisor *sv, ULONGLONG nowNs)
+{
+    if (!sv->server) {
+        if (nowNs >= sv->nextAttemptNs) TryReconnect(sv, nowNs);
+        return;
+    }
+
+    if (sv->disconnectSignaled) {
+        MarkLost(sv, RPC_E_DISCONNECTED, "Disconnect", nowNs);
+        return;
+    }
+
+    if (sv->heartbeatNs && nowNs >= sv->nextHeartbeatNs) {
+        sv->nextHeartbeatNs = nowNs + sv->heartbeatNs;
+        sv->heartbeats++;
+        long alive = 0;
+        HRESULT hr = sv->server->lpVtbl->Heartbeat(sv->server, &alive);
+        if (FAILED(hr) || alive != 1) MarkLost(sv, FAILED(hr) ? hr : E_FAIL, "heartbeat", nowNs);
+    }
+}
+
+void Supervisor_OnRefresh(Supervisor *sv, HRESULT hr, long rows, ULONGLONG nowNs)
+{
+    if (FAILED(hr)) {
+        MarkLost(sv, hr, "RefreshData", nowNs);
+        return;
+    }
+    if (rows <= 0) return;
+
+    if (sv->awaitingUpdate) {
+        sv->awaitingUpdate = FALSE;
+        sv->gapNs = nowNs - (sv->lastUpdateNs ? sv->lastUpdateNs : sv->lostNs);
+        sv->totalGapNs += sv->gapNs;
+        if (sv->gapNs > sv->maxGapNs) sv->maxGapNs = sv->gapNs;
+        Emit(sv, SUPERVISOR_GAP_CLOSED);
+    }
+    sv->lastUpdateNs = nowNs;
+}
@@ -0,0 +1,98 @@
+// rtd_supervisor.h - Server health checks and automatic resubscription
+// Owns the IRtdServer. It calls Heartbeat on a timer and watches
+// RefreshData results and IRTDUpdateEvent::Disconnect. When the server is
+// lost it recreates it through a factory (CoCreateInstance for
+// ThinkOrSwim, SimServer_Create for tests), calls ServerStart again and
+// replays every registered subscription under its existing topic ID,
+// retrying with exponential backoff. Each incident records the gap
+// between the last update before the loss and the first one after.
+
+#ifndef __RTD_SUPERVISOR_H__
+#define __RTD_SUPERVISOR_H__
+
+#include "rtd_subs.h"
+#include "rtd_watchlist.h"
+
+#define SUPERVISOR_HEARTBEAT_MS   2000
+#define SUPERVISOR_BACKOFF_MIN_MS 250
+#define SUPERVISOR_BACKOFF_MAX_MS 30000
+
+// Creates a fresh, not yet started server
+typedef HRESULT (*ServerFactory)(void *ctx, IRtdServer **ppSrv);
+
+typedef enum {
+    SUPERVISOR_LOST = 0,        // Server declared dead; reason holds why
+    SUPERVISOR_RETRY_FAILED,    // A reconnect attempt failed; reason holds the HRESULT
+    SUPERVISOR_RECOVERED,       // Server restarted and subscriptions replayed
+    SUPERVISOR_GAP_CLOSED       // First update after recovery arrived; gapNs is final
+} SupervisorEvent;
+
+struct Supervisor;
+typedef void (*SupervisorEventFn)(void *ctx, const struct Supervisor *sv, SupervisorEvent ev);
+
+typedef struct Supervisor {
+    ServerFactory      factory;
+    void              *factoryCtx;
+    IRTDUpdateEvent   *callback;
+    SubscriptionTable *subs;
+    WatchConnectedFn   onResubscribed;     // Per replayed subscription, may be NULL
+    SupervisorEventFn  onEvent;
+    void              *ctx;
+
+    IRtdServer        *server;             // NULL while down
+    volatile LONG      disconnectSignaled; // Set by IRTDUpdateEvent::Disconnect
+    ULONGLONG          heartbeatNs;        // 0 = no heartbeats
+    ULONGLONG          nextHeartbeatNs;
+    ULONGLONG          backoffNs;          // Wait before the next attempt
+    ULONGLONG          nextAttemptNs;
+
+    // Current or most recent incident
+    HRESULT            reason;
+    const char        *cause;              // "heartbeat", "RefreshData" or "Disconnect"
+    ULONGLONG          lastUpdateNs;       // Last RefreshData that returned rows
+    ULONGLONG          lostNs;
+    ULONGLONG          recoveredNs;
+    ULONG              attempts;           // Reconnect attempts in this incident
+    long               replayed;           // Subscriptions restored
+    long               replayFailed;
+    ULONGLONG          replayNs;           // ConnectData calls of the successful attempt
+    BOOL               awaitingUpdate;     // Recovered, first update not yet seen
+    ULONGLONG          gapNs;
+
+    // Totals
+    ULONG              incidents;
+    ULONGLONG          heartbeats;
+    ULONGLONG          maxGapNs;
+    ULONGLONG          totalGapNs;
+} Supervisor;
+
+void Supervisor_Init(Supervisor *sv, ServerFactory factory, void *factoryCtx,
+                     IRTDUpdateEvent *callback, SubscriptionTable *subs, DWORD heartbeatMs);
+
+// Create and start the first server. No retries: a failure here is
+// reported to the caller.
+HRESULT Supervisor_Start(Supervisor *sv);
+
+// Terminate and release the server (subscriptions stay registered)
+void Supervisor_Stop(Supervisor *sv);
+
+// Drive heartbeats and reconnect attempts; call from the RTD thread at
+// least every few hundred ms
+void Supervisor_Tick(Supervisor *sv, ULONGLONG nowNs);
+
+// Report a RefreshData outcome: a failed hr marks the server lost, rows
+// > 0 counts as a good update
+void Supervisor_OnRefresh(Supervisor *sv, HRESULT hr, long rows, ULONGLONG nowNs);
+
+// From IRTDUpdateEvent::Disconnect, on any thread
+static inline void Supervisor_SignalDisconnect(Supervisor *sv)
+{
+    InterlockedExchange(&sv->disconnectSignaled, 1);
+}
+
+static inline BOOL Supervisor_IsUp(const Supervisor *sv)
+{
+    return sv->server != NULL;
+}
+
+#endif /* __RTD_SUPERVISOR_H__ */
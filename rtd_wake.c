@@ -0,0 +1,138 @@
+/**
+ * rtd_wake.c - Event-driven wakeup for the RTD apartment thread
+ *
+ * Windows waits with MsgWaitForMultipleObjectsEx so the STA keeps pumping
+ * COM messages; other platforms use a mutex/condition variable pair, which
+ * is enough to drive a simulated server.
+ */
+
+#include <string.h>
+#include "rtd_wake.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <time.h>
+#endif
+
+/**
+ * Spin (yielding) until the coalescing window after the first notify closes
+ */
+static void CoalesceWindow(RtdWakeup *w)
+{
+    if (w->coalesceUs == 0) return;
+    ULONGLONG deadline = w->notifyNs + (ULONGLONG)w->coalesceUs * 1000ULL;
+    while (RtdNowNs() < deadline) RtdYield();
+}
+
+#ifdef _WIN32
+
+BOOL Wakeup_Init(RtdWakeup *w, DWORD coalesceUs)
+{
+    memset(w, 0, sizeof *w);
+    w->coalesceUs = coalesceUs;
+    w->hEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+    return w->hEvent != NULL;
+}
+
+void Wakeup_Free(RtdWakeup *w)
+{
+    if (w->hEvent) CloseHandle(w->hEvent);
+    w->hEvent = NULL;
+}
+
+void Wakeup_Signal(RtdWakeup *w)
+{
+    ULONGLONG now = RtdNowNs();
+    if (InterlockedCompareExchange(&w->pending, 1, 0) == 0) {
+        w->notifyNs = now;
+    }
+    SetEvent(w->hEvent);
+}
+
+WakeResult Wakeup_Wait(RtdWakeup *w, DWORD timeoutMs)
+{
+    DWORD r = MsgWaitForMultipleObjectsEx(1, &w->hEvent, timeoutMs,
+                                          QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+    if (r == WAIT_OBJECT_0) {
+        CoalesceWindow(w);
+        return WAKE_SIGNALED;
+    }
+    if (r == WAIT_OBJECT_0 + 1) return WAKE_MESSAGE;
+    return WAKE_TIMEOUT;
+}
+
+#else /* !_WIN32 */
+
+BOOL Wakeup_Init(RtdWakeup *w, DWORD coalesceUs)
+{
+    memset(w, 0, sizeof *w);
+    w->coalesceUs = coalesceUs;
+    if (pthread_mutex_init(&w->lock, NULL) != 0) return FALSE;
+
+    // Time out against CLOCK_MONOTONIC to match RtdNowNs
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    int rc = pthread_cond_init(&w->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    if (rc != 0) {
+        pthread_mutex_destroy(&w->lock);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void Wakeup_Free(RtdWakeup *w)
+{
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+}
+
+void Wakeup_Signal(RtdWakeup *w)
+{
+    ULONGLONG now = RtdNowNs();
+    pthread_mutex_lock(&w->lock);
+    if (InterlockedCompareExchange(&w->pending, 1, 0) == 0) {
+        w->notifyNs = now;
+    }
+    w->signaled = TRUE;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+WakeResult Wakeup_Wait(RtdWakeup *w, DWORD timeoutMs)
+{
+    ULONGLONG deadline = RtdNowNs() + (ULONGLONG)timeoutMs * 1000000ULL;
+    struct timespec ts;
+    ts.tv_sec = (time_t)(deadline / 1000000000ULL);
+    ts.tv_nsec = (long)(deadline % 1000000000ULL);
+
+    pthread_mutex_lock(&w->lock);
+    while (!w->signaled) {
+        if (pthread_cond_timedwait(&w->cond, &w->lock, &ts) == ETIMEDOUT) break;
+    }
+    BOOL signaled = w->signaled;
+    w->signaled = FALSE;
+    pthread_mutex_unlock(&w->lock);
+
+    if (!signaled) return WAKE_TIMEOUT;
+    CoalesceWindow(w);
+    return WAKE_SIGNALED;
+}
+
+#endif /* _WIN32 */
+
+ULONGLONG Wakeup_Consume(RtdWakeup *w)
+{
+    if (!w->pending) return 0;
+
+    ULONGLONG notified = w->notifyNs;
+    InterlockedExchange(&w->pending, 0);
+
+    ULONGLONG latency = RtdNowNs() - notified;
+    w->wakeCount++;
+    w->totalLatencyNs += latency;
+    w->lastLatencyNs = latency;
+    if (latency > w->maxLatencyNs) w->maxLatencyNs = latency;
+    return notified;
+}
@@ -0,0 +1,51 @@
+// rtd_wake.h - Event-driven wakeup for the RTD apartment thread
+// UpdateNotify signals a waitable object and the main loop blocks on it
+// (and, on Windows, on the thread's message queue) instead of polling.
+
+#ifndef __RTD_WAKE_H__
+#define __RTD_WAKE_H__
+
+#include "rtd_compat.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+typedef enum {
+    WAKE_TIMEOUT = 0,   // Nothing happened within the timeout
+    WAKE_SIGNALED,      // Wakeup_Signal was called
+    WAKE_MESSAGE        // Window messages are waiting to be pumped (Windows only)
+} WakeResult;
+
+typedef struct RtdWakeup {
+#ifdef _WIN32
+    HANDLE hEvent;              // Auto-reset event
+#else
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    BOOL            signaled;
+#endif
+    volatile LONG      pending;     // Set on first signal since last consume
+    volatile ULONGLONG notifyNs;    // RtdNowNs() of that first signal
+    DWORD     coalesceUs;           // Extra time to gather notifies before waking
+
+    // Notify-to-wake latency statistics
+    ULONGLONG wakeCount;
+    ULONGLONG totalLatencyNs;
+    ULONGLONG maxLatencyNs;
+    ULONGLONG lastLatencyNs;
+} RtdWakeup;
+
+BOOL Wakeup_Init(RtdWakeup *w, DWORD coalesceUs);
+void Wakeup_Free(RtdWakeup *w);
+
+// Safe to call from any thread, including the COM callback
+void Wakeup_Signal(RtdWakeup *w);
+
+// Block until signaled, a message arrives, or timeoutMs elapses
+WakeResult Wakeup_Wait(RtdWakeup *w, DWORD timeoutMs);
+
+// Clear the pending signal and update latency stats; returns the notify time
+ULONGLONG Wakeup_Consume(RtdWakeup *w);
+
+#endif /* __RTD_WAKE_H__ */
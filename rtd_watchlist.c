@@ -0,0 +1,203 @@
+/**
+ * rtd_watchlist.c - Watchlist files and bulk subscription
+ *
+ * The file is read in one go, converted to UTF-16 once and tokenized in
+ * place, so a watchlist costs two allocations plus the pair array no
+ * matter how many symbols it has.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtd_watchlist.h"
+
+static BOOL AddPair(Watchlist *wl, const WCHAR *symbol, const WCHAR *topic)
+{
+    if (wl->count == wl->capacity) {
+        long newCap = wl->capacity ? wl->capacity * 2 : 1024;
+        WatchPair *pairs = (WatchPair*)realloc(wl->pairs, newCap * sizeof *pairs);
+        if (!pairs) return FALSE;
+        wl->pairs = pairs;
+        wl->capacity = newCap;
+    }
+    wl->pairs[wl->count].symbol = symbol;
+    wl->pairs[wl->count].topic = topic;
+    wl->count++;
+    return TRUE;
+}
+
+static BOOL IsSeparator(WCHAR c)
+{
+    return c == L' ' || c == L'\t' || c == L',' || c == L'\r';
+}
+
+/**
+ * NUL-terminate the next token of *pp in place and return it
+ */
+static WCHAR* NextField(WCHAR **pp)
+{
+    WCHAR *p = *pp;
+    while (IsSeparator(*p)) p++;
+    if (!*p) return NULL;
+    WCHAR *start = p;
+    while (*p && !IsSeparator(*p)) p++;
+    if (*p) *p++ = 0;
+    *pp = p;
+    return start;
+}
+
+BOOL Watchlist_Load(Watchlist *wl, const char *path)
+{
+    memset(wl, 0, sizeof *wl);
+    FILE *f = fopen(path, "rb");
+    if (!f) return FALSE;
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *raw = (size >= 0) ? (char*)malloc((size_t)size + 1) : NULL;
+    BOOL ok = raw && fread(raw, 1, (size_t)size, f) == (size_t)size;
+    fclose(f);
+    if (!ok) {
+        free(raw);
+        return FALSE;
+    }
+
+    // Skip a UTF-8 byte order mark
+    const char *src = raw;
+    size_t srcLen = (size_t)size;
+    if (srcLen >= 3 && memcmp(src, "\xEF\xBB\xBF", 3) == 0) {
+        src += 3;
+        srcLen -= 3;
+    }
+    wl->text = (WCHAR*)malloc((srcLen + 1) * sizeof(WCHAR));
+    if (!wl->text) {
+        free(raw);
+        return FALSE;
+    }
+    wl->text[RtdUtf8ToWide(src, srcLen, wl->text, srcLen)] = 0;
+    free(raw);
+
+    // Lines without topics reuse those of the last line that had some
+    long topicsFrom = -1, topicCount = 0;
+    WCHAR *p = wl->text;
+    while (*p) {
+        WCHAR *line = p;
+        while (*p && *p != L'\n') p++;
+        if (*p) *p++ = 0;
+        WCHAR *comment = wcschr(line, L'#');
+        if (comment) *comment = 0;
+
+        const WCHAR *symbol = NextField(&line);
+        if (!symbol) continue;
+        wl->symbolCount++;
+
+        long first = wl->count;
+        const WCHAR *topic;
+        while ((topic = NextField(&line)) != NULL) {
+            if (!AddPair(wl, symbol, topic)) goto oom;
+        }
+        if (wl->count > first) {
+            topicsFrom = first;
+            topicCount = wl->count - first;
+        } else if (topicsFrom < 0) {
+            if (!AddPair(wl, symbol, WATCHLIST_DEFAULT_TOPIC)) goto oom;
+        } else {
+            for (long i = 0; i < topicCount; i++) {
+                if (!AddPair(wl, symbol, wl->pairs[topicsFrom + i].topic)) goto oom;
+            }
+        }
+    }
+    return TRUE;
+
+oom:
+    Watchlist_Free(wl);
+    return FALSE;
+}
+
+void Watchlist_Free(Watchlist *wl)
+{
+    free(wl->text);
+    free(wl->pairs);
+    memset(wl, 0, sizeof *wl);
+}
+
+/**
+ * ConnectData for registered subscriptions, back to back through the
+ * table's reused argument array
+ */
+long Watchlist_ConnectTopics(IRtdServer *pSrv, SubscriptionTable *subs, const long *ids, long count,
+                             WatchConnectedFn onConnected, void *ctx, WatchConnectStats *stats)
+{
+    ULONGLONG start = RtdNowNs();
+    long connected = 0;
+    for (long i = 0; i < count; i++) {
+        TopicSubscription *sub = SubTable_Get(subs, ids[i]);
+        if (!sub) continue;
+        if (sub->local) {
+            sub->connected = TRUE;
+            connected++;
+            if (onConnected) onConnected(ctx, sub);
+            continue;
+        }
+        SAFEARRAY *pArgs = SubTable_ConnectArgs(subs, sub);
+        if (!pArgs) {
+            stats->failed++;
+            continue;
+        }
+
+        VARIANT initVal;
+        VariantInit(&initVal);
+        VARIANT_BOOL getNew = VARIANT_TRUE;
+        ULONGLONG callStart = RtdNowNs();
+        HRESULT hr = pSrv->lpVtbl->ConnectData(pSrv, sub->topicID, &pArgs, &getNew, &initVal);
+        ULONGLONG callNs = RtdNowNs() - callStart;
+        if (callNs > stats->maxCallNs) stats->maxCallNs = callNs;
+        if (SUCCEEDED(hr) && initVal.vt != VT_EMPTY && subs->onConnectValue) {
+            subs->onConnectValue(subs->connectValueCtx, sub, &initVal);
+        }
+        VariantClear(&initVal);
+
+        sub->connected = SUCCEEDED(hr);
+        if (sub->connected) {
+            connected++;
+            if (onConnected) onConnected(ctx, sub);
+        } else {
+            stats->failed++;
+        }
+    }
+    stats->connected += connected;
+    stats->connectNs += RtdNowNs() - start;
+    return connected;
+}
+
+long Watchlist_Connect(const Watchlist *wl, IRtdServer *pSrv, SubscriptionTable *subs,
+                       WatchConnectedFn onConnected, void *ctx, WatchConnectStats *stats)
+{
+    memset(stats, 0, sizeof *stats);
+    stats->requested = wl->count;
+
+    // Intern names and hand out a dense block of topic IDs
+    ULONGLONG start = RtdNowNs();
+    long *ids = (long*)calloc((size_t)wl->count + 1, sizeof *ids);
+    if (!ids) return 0;
+    SubTable_Reserve(subs, wl->count);
+    long pending = 0;
+    for (long i = 0; i < wl->count; i++) {
+        TopicSubscription *sub = SubTable_Add(subs, wl->pairs[i].symbol, wl->pairs[i].topic);
+        if (!sub) stats->failed++;
+        else if (sub->connected) stats->existing++;
+        else ids[pending++] = sub->topicID;
+    }
+    SubTable_EndReserve(subs);  // Duplicates in the file leave some unused
+    stats->registerNs = RtdNowNs() - start;
+
+    // Forget the pairs the server rejected, as SubscribeSymbol does
+    Watchlist_ConnectTopics(pSrv, subs, ids, pending, onConnected, ctx, stats);
+    for (long i = 0; i < pending; i++) {
+        TopicSubscription *sub = SubTable_Get(subs, ids[i]);
+        if (sub && !sub->connected) SubTable_Remove(subs, ids[i]);
+    }
+    free(ids);
+    return stats->connected;
+}
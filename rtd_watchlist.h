@@ -0,0 +1,59 @@
+// rtd_watchlist.h - Watchlist files and bulk subscription
+// A watchlist file has one symbol per line followed by its topics:
+//
+//   # symbol  topics
+//   AAPL      LAST,BID,ASK,VOLUME
+//   MSFT                       (no topics: same as the line above)
+//
+// Watchlist_Connect registers every pair in one pass with dense topic
+// IDs, then issues the ConnectData calls back to back through a single
+// preallocated argument SAFEARRAY, with one BSTR per distinct symbol and
+// topic instead of two allocations per call.
+
+#ifndef __RTD_WATCHLIST_H__
+#define __RTD_WATCHLIST_H__
+
+#include "rtd_subs.h"
+
+#define WATCHLIST_DEFAULT_TOPIC L"LAST"
+
+typedef struct WatchPair {
+    const WCHAR *symbol;
+    const WCHAR *topic;
+} WatchPair;
+
+typedef struct Watchlist {
+    WCHAR     *text;            // Whole file, tokens NUL-terminated in place
+    WatchPair *pairs;
+    long       count;
+    long       capacity;
+    long       symbolCount;     // Lines that named a symbol
+} Watchlist;
+
+BOOL Watchlist_Load(Watchlist *wl, const char *path);
+void Watchlist_Free(Watchlist *wl);
+
+// Called for each pair ConnectData accepted
+typedef void (*WatchConnectedFn)(void *ctx, TopicSubscription *sub);
+
+typedef struct WatchConnectStats {
+    long      requested;
+    long      connected;
+    long      failed;
+    long      existing;         // Pairs that were already connected
+    ULONGLONG registerNs;       // Interning and topic ID assignment
+    ULONGLONG connectNs;        // All ConnectData calls
+    ULONGLONG maxCallNs;        // Slowest single ConnectData
+} WatchConnectStats;
+
+// Subscribe every pair; returns the number newly connected
+long Watchlist_Connect(const Watchlist *wl, IRtdServer *pSrv, SubscriptionTable *subs,
+                       WatchConnectedFn onConnected, void *ctx, WatchConnectStats *stats);
+
+// Connect already registered topic IDs the same way (adds to stats).
+// Rejected subscriptions stay registered but not connected. Returns the
+// number connected.
+long Watchlist_ConnectTopics(IRtdServer *pSrv, SubscriptionTable *subs, const long *ids, long count,
+                             WatchConnectedFn onConnected, void *ctx, WatchConnectStats *stats);
+
+#endif /* __RTD_WATCHLIST_H__ */
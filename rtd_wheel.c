@@ -0,0 +1,176 @@
+/**
+ * rtd_wheel.c - Hierarchical timing wheel
+ *
+ * Slot lists are doubly linked through the timer array by ID + 1, so a
+ * timer is moved or cancelled without searching its slot. The wheel is
+ * the classic cascading layout: a timer goes in the lowest level whose
+ * span covers its distance from the current tick, and each time level 0
+ * wraps, the next slot of the level above is emptied and its timers are
+ * placed again, now closer.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "rtd_wheel.h"
+
+// WheelTimer.level of a timer in the list being fired
+#define WHEEL_FIRING WHEEL_LEVELS
+
+BOOL TimerWheel_Init(TimerWheel *w, ULONGLONG tickNs, ULONGLONG startNs)
+{
+    memset(w, 0, sizeof *w);
+    w->tickNs = tickNs ? tickNs : 1000000;
+    w->tick = startNs / w->tickNs;
+    w->timerCap = 1024;
+    w->timers = (WheelTimer*)calloc(w->timerCap, sizeof *w->timers);
+    return w->timers != NULL;
+}
+
+void TimerWheel_Free(TimerWheel *w)
+{
+    free(w->timers);
+    memset(w, 0, sizeof *w);
+}
+
+static void Unlink(TimerWheel *w, ULONG id)
+{
+    WheelTimer *t = &w->timers[id];
+    if (t->prev) w->timers[t->prev - 1].next = t->next;
+    else if (t->level == WHEEL_FIRING) w->firing = t->next;
+    else w->heads[t->level][t->slot] = t->next;
+    if (t->next) w->timers[t->next - 1].prev = t->prev;
+    t->next = t->prev = 0;
+}
+
+static void Link(TimerWheel *w, ULONG id, ULONG *head)
+{
+    WheelTimer *t = &w->timers[id];
+    t->prev = 0;
+    t->next = *head;
+    if (*head) w->timers[*head - 1].prev = id + 1;
+    *head = id + 1;
+}
+
+/**
+ * Put a timer in the lowest level that reaches its due tick
+ */
+static void Place(TimerWheel *w, ULONG id)
+{
+    WheelTimer *t = &w->timers[id];
+    ULONGLONG due = t->dueTick < w->tick ? w->tick : t->dueTick;
+    ULONGLONG delta = due - w->tick;
+
+    // Beyond the wheel: park in the top level, as far out as it reaches
+    if (delta >= WHEEL_SPAN) due = w->tick + WHEEL_SPAN - 1;
+
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1ULL << ((level + 1) * WHEEL_BITS))) level++;
+    t->level = (BYTE)level;
+    t->slot = (BYTE)((due >> (level * WHEEL_BITS)) & (WHEEL_SLOTS - 1));
+    Link(w, id, &w->heads[level][t->slot]);
+}
+
+/**
+ * Empty the current slot of a level into the levels below; returns that
+ * slot's index, so the caller knows whether this level wrapped too
+ */
+static ULONG Cascade(TimerWheel *w, int level)
+{
+    ULONG slot = (ULONG)(w->tick >> (level * WHEEL_BITS)) & (WHEEL_SLOTS - 1);
+    ULONG head = w->heads[level][slot];
+    w->heads[level][slot] = 0;
+    while (head) {
+        ULONG id = head - 1;
+        head = w->timers[id].next;
+        Place(w, id);
+        w->cascaded++;
+    }
+    return slot;
+}
+
+static BOOL Reserve(TimerWheel *w, ULONG id)
+{
+    if (id < w->timerCap) return TRUE;
+    ULONG cap = w->timerCap;
+    while (cap <= id) cap *= 2;
+    WheelTimer *grown = (WheelTimer*)realloc(w->timers, cap * sizeof *grown);
+    if (!grown) return FALSE;
+    memset(grown + w->timerCap, 0, (cap - w->timerCap) * sizeof *grown);
+    w->timers = grown;
+    w->timerCap = cap;
+    return TRUE;
+}
+
+BOOL TimerWheel_Schedule(TimerWheel *w, ULONG id, ULONGLONG dueNs)
+{
+    if (!Reserve(w, id)) return FALSE;
+    WheelTimer *t = &w->timers[id];
+    if (t->pending) Unlink(w, id);
+    else w->pending++;
+    t->pending = 1;
+    t->dueTick = (dueNs + w->tickNs - 1) / w->tickNs;
+    Place(w, id);
+    return TRUE;
+}
+
+void TimerWheel_Cancel(TimerWheel *w, ULONG id)
+{
+    if (!TimerWheel_IsPending(w, id)) return;
+    Unlink(w, id);
+    w->timers[id].pending = 0;
+    w->pending--;
+}
+
+ULONGLONG TimerWheel_NextDueNs(const TimerWheel *w)
+{
+    if (w->pending == 0) return ~0ULL;
+    for (ULONG i = 0; i < WHEEL_SLOTS; i++) {
+        ULONGLONG tick = w->tick + i;
+        if (w->heads[0][tick & (WHEEL_SLOTS - 1)]) return tick * w->tickNs;
+    }
+    return ((w->tick | (WHEEL_SLOTS - 1)) + 1) * w->tickNs;
+}
+
+ULONG TimerWheel_Advance(TimerWheel *w, ULONGLONG nowNs, WheelFireFn fire, void *ctx)
+{
+    ULONGLONG target = nowNs / w->tickNs;
+    ULONG fired = 0;
+
+    while (w->tick <= target) {
+        if (w->pending == 0) {
+            // Nothing to visit; jump straight there
+            w->tick = target + 1;
+            break;
+        }
+
+        ULONGLONG tick = w->tick;
+        ULONG slot = (ULONG)tick & (WHEEL_SLOTS - 1);
+        if (slot == 0) {
+            for (int level = 1; level < WHEEL_LEVELS && Cascade(w, level) == 0; level++) {}
+        }
+
+        // Take the slot's list, then step the wheel so timers scheduled
+        // from the callback land in later slots
+        w->firing = w->heads[0][slot];
+        w->heads[0][slot] = 0;
+        for (ULONG h = w->firing; h; h = w->timers[h - 1].next) w->timers[h - 1].level = WHEEL_FIRING;
+        w->tick++;
+
+        while (w->firing) {
+            ULONG id = w->firing - 1;
+            WheelTimer *t = &w->timers[id];
+            Unlink(w, id);
+            if (t->dueTick > tick) {
+                // Parked beyond the wheel's span
+                Place(w, id);
+                continue;
+            }
+            t->pending = 0;
+            w->pending--;
+            w->fired++;
+            fired++;
+            fire(ctx, id, t->dueTick * w->tickNs);
+        }
+    }
+    return fired;
+}
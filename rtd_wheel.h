@@ -0,0 +1,70 @@
+// rtd_wheel.h - Hierarchical timing wheel
+// Timers keyed by a dense caller-chosen ID (symbol x interval, say) with
+// O(1) schedule, reschedule and cancel. Four levels of 64 slots: level 0
+// holds timers due within 64 ticks, one slot per tick; each level above
+// covers 64 times the span of the one below, and its slots are spread
+// into the lower levels as the wheel reaches them. With the 1 ms tick
+// the client uses, the wheel spans about 4.6 hours; timers further out
+// wait in the top level and are placed again as it turns.
+//
+// Advancing costs one slot visit per elapsed tick plus the timers that
+// are due, however many are pending, so thousands of timers expiring at
+// the same boundary cost nothing until that boundary.
+
+#ifndef __RTD_WHEEL_H__
+#define __RTD_WHEEL_H__
+
+#include "rtd_compat.h"
+
+#define WHEEL_LEVELS 4
+#define WHEEL_BITS   6
+#define WHEEL_SLOTS  (1 << WHEEL_BITS)
+#define WHEEL_SPAN   (1ULL << (WHEEL_LEVELS * WHEEL_BITS))     // Ticks the wheel covers
+
+typedef struct WheelTimer {
+    ULONGLONG dueTick;
+    ULONG     next;         // Timer ID + 1 in the same slot, 0 = end
+    ULONG     prev;
+    BYTE      level;
+    BYTE      slot;
+    BYTE      pending;
+} WheelTimer;
+
+// Called once per timer as it comes due; may schedule or cancel any timer
+typedef void (*WheelFireFn)(void *ctx, ULONG id, ULONGLONG dueNs);
+
+typedef struct TimerWheel {
+    ULONGLONG   tickNs;
+    ULONGLONG   tick;                               // Next tick to process
+    ULONG       heads[WHEEL_LEVELS][WHEEL_SLOTS];   // First timer ID + 1
+    ULONG       firing;                             // Slot list being fired
+    WheelTimer *timers;                             // Indexed by ID
+    ULONG       timerCap;
+    ULONG       pending;
+
+    ULONGLONG   fired;
+    ULONGLONG   cascaded;   // Timers moved down a level
+} TimerWheel;
+
+// Timers due at or before startNs fire on the first advance
+BOOL TimerWheel_Init(TimerWheel *w, ULONGLONG tickNs, ULONGLONG startNs);
+void TimerWheel_Free(TimerWheel *w);
+
+// (Re)arm timer id to fire at dueNs, rounded up to the next tick
+BOOL TimerWheel_Schedule(TimerWheel *w, ULONG id, ULONGLONG dueNs);
+void TimerWheel_Cancel(TimerWheel *w, ULONG id);
+
+static inline BOOL TimerWheel_IsPending(const TimerWheel *w, ULONG id)
+{
+    return id < w->timerCap && w->timers[id].pending;
+}
+
+// Earliest time the next Advance could fire a timer: exact within 64
+// ticks, otherwise the next level 0 wrap. ~0 when nothing is pending.
+ULONGLONG TimerWheel_NextDueNs(const TimerWheel *w);
+
+// Fire every timer due at or before nowNs, oldest tick first. Returns the
+// number fired.
+ULONG TimerWheel_Advance(TimerWheel *w, ULONGLONG nowNs, WheelFireFn fire, void *ctx);
+
+#endif /* __RTD_WHEEL_H__ */